@@ -48,6 +48,14 @@ public:
     Q_PROPERTY(double progress READ progress NOTIFY progressChanged)
     double progress();
 
+    // NB: units is bytes_per_second
+    Q_PROPERTY(quint64 speed READ speed NOTIFY speedChanged)
+    quint64 speed();
+
+    // NB: units is seconds; -1 means unknown
+    Q_PROPERTY(qint64 eta READ eta NOTIFY etaChanged)
+    qint64 eta();
+
     Q_PROPERTY(bool readyToBackup READ readyToBackup NOTIFY readyToBackupChanged)
     bool readyToBackup();
 
@@ -76,6 +84,8 @@ public:
 Q_SIGNALS:
     void statusChanged();
     void progressChanged();
+    void speedChanged();
+    void etaChanged();
     void readyToBackupChanged();
     void backupBusyChanged();
 
@@ -83,6 +93,10 @@ Q_SIGNALS:
     void finished();
 
 private Q_SLOTS:
+    void stateChanged(keeper::Items const & changes, QStringList const & removed);
+    void serviceOwnerChanged(QString const & service, QString const & oldOwner, QString const & newOwner);
+
+private:
     void stateUpdated();
 
 private:
@@ -22,6 +22,7 @@
 #include "client/keeper-errors.h"
 
 #include <QJsonObject>
+#include <QStringList>
 
 typedef QMap<QString, QVariantMap> QVariantDictMap;
 
@@ -50,6 +51,18 @@ public:
     static QString const ERROR_KEY;
     static QString const PERCENT_DONE_KEY;
     static QString const SPEED_KEY;
+    static QString const BYTES_DONE_KEY;
+    static QString const BYTES_REMAINING_KEY;
+    static QString const AVERAGE_SPEED_KEY;
+    static QString const SMOOTHED_SPEED_KEY;
+    static QString const STALLED_SECONDS_KEY;
+    static QString const ETA_SECONDS_KEY;
+    static QString const RETRIES_KEY;
+    static QString const RETRY_MSEC_KEY;
+    static QString const INCREMENTAL_KEY;
+    static QString const PARTS_KEY;
+    static QString const PART_SIZE_KEY;
+    static QString const ARCHIVE_SIZE_KEY;
 
     // values
     static QString const FOLDER_VALUE;
@@ -73,8 +86,20 @@ public:
     QString get_dir_name(bool *valid = nullptr) const;
     QString get_status(bool *valid = nullptr) const;
     double get_percent_done(bool *valid = nullptr) const;
+    quint64 get_bytes_done(bool *valid = nullptr) const;
+    quint64 get_bytes_remaining(bool *valid = nullptr) const;
+    quint64 get_smoothed_speed(bool *valid = nullptr) const;
+    qint64 get_eta_seconds(bool *valid = nullptr) const; // -1 if unknown
+    quint32 get_retries(bool *valid = nullptr) const;
+    quint64 get_retry_msec(bool *valid = nullptr) const;
     keeper::Error get_error(bool *valid = nullptr) const;
     QString get_file_name(bool *valid = nullptr) const;
+    bool is_incremental(bool *valid = nullptr) const;
+
+    // archives that were uploaded in parts: the parts' file names, in order
+    QStringList get_parts(bool *valid = nullptr) const;
+    quint64 get_part_size(bool *valid = nullptr) const;
+    quint64 get_archive_size(bool *valid = nullptr) const;
 
     // d-bus
     static void registerMetaType();
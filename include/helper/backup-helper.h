@@ -24,9 +24,11 @@
 #include "helper/helper.h" // parent class
 #include "helper/registry.h"
 
+#include <QByteArray>
 #include <QObject>
 #include <QScopedPointer>
 #include <QString>
+#include <QStringList>
 
 #include <memory>
 
@@ -47,13 +49,25 @@ public:
 
     static constexpr int MAX_INACTIVITY_TIME = 15000;
 
-    void set_uploader(std::shared_ptr<Uploader> const& uploader);
+    /**
+     * If `direct` is true, the helper writes to the uploader's socket itself
+     * instead of to get_helper_socket(). Since the data doesn't pass through
+     * here, the helper must report its progress and catalog.
+     */
+    void set_uploader(std::shared_ptr<Uploader> const& uploader, bool direct = false);
+    void set_direct_progress(qint64 n_bytes_total);
+    void set_direct_catalog(QByteArray const& catalog);
     void start(QStringList const& urls) override;
     void stop() override;
     int get_helper_socket() const;
     QString to_string(Helper::State state) const override;
     void set_state(State) override;
     QString get_uploader_committed_file_name() const;
+    // if the archive was uploaded in parts, the parts' names in order
+    QStringList get_uploader_committed_parts() const;
+    qint64 get_uploader_committed_part_size() const;
+    bool is_incremental() const;
+    QByteArray get_catalog() const;
 protected:
     void on_helper_finished() override;
 
@@ -21,6 +21,7 @@
 
 #include <client/keeper-errors.h>
 #include <util/attributes.h>
+#include <util/transfer-stats.h>
 
 #include <QObject>
 #include <QScopedPointer>
@@ -52,6 +53,14 @@ public:
     // NB: units is bytes_per_second
     int speed() const __pure;
 
+    // longer-term throughput, stall time, and ETA
+    TransferStats::Snapshot transfer_stats() const;
+
+    // NB: units is bytes_per_second; 0 means unlimited.
+    // Can be changed while the helper is running.
+    void set_rate_limit(quint64 bytes_per_second);
+    quint64 rate_limit() const __pure;
+
     qint64 expected_size() const __pure;
     void set_expected_size(qint64 n_bytes);
 
@@ -80,6 +89,13 @@ protected:
     bool is_helper_running() const;
     void record_data_transferred(qint64 n_bytes);
 
+    // the rate limit is enforced by subclasses as they relay data:
+    // send at most bandwidth_available() bytes, report them with
+    // use_bandwidth(), and if that's 0, try again after msec_until_bandwidth()
+    qint64 bandwidth_available();
+    void use_bandwidth(qint64 n_bytes);
+    int msec_until_bandwidth();
+
 private:
 
     QScopedPointer<HelperPrivate> const d_ptr;
@@ -23,6 +23,7 @@
 #include <QJsonObject>
 #include <QMap>
 #include <QString>
+#include <QStringList>
 
 /**
  * Information about a backup or restore item
@@ -36,4 +37,8 @@ public:
     Metadata(QString const& uuid, QString const& display_name);
 
     QJsonObject json() const;
+
+    // records the parts that an archive was uploaded in, or clears
+    // them if `parts` is empty
+    void set_parts(QStringList const & parts, qint64 part_size, qint64 archive_size);
 };
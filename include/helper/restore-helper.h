@@ -31,6 +31,7 @@
 #include <memory>
 
 class RestoreHelperPrivate;
+class TarFilter;
 class RestoreHelper final: public Helper
 {
     Q_OBJECT
@@ -46,14 +47,37 @@ public:
     Q_DISABLE_COPY(RestoreHelper)
 
     static constexpr int MAX_INACTIVITY_TIME = 15000;
+    static constexpr int DEFAULT_BUFFER_SIZE = 1024*1024;
+
+    /**
+     * How much downloaded data can wait for the helper to read it.
+     * By default this is tuned to the restore's throughput, up to
+     * DEFAULT_BUFFER_SIZE; setting it here pins it to `n_bytes`.
+     */
+    void set_buffer_size(int n_bytes);
 
     void set_downloader(std::shared_ptr<Downloader> const& downloader);
 
+    /**
+     * Restores several archives as one stream, eg a chain of incremental
+     * backups. The caller sets the stream's size with set_expected_size(),
+     * then adds the archives in order. Each time an archive has been read,
+     * downloader_needed() is emitted until the expected size is reached.
+     *
+     * If `filter` is set, only the members that it keeps are restored.
+     */
+    void add_downloader(std::shared_ptr<Downloader> const& downloader,
+                        std::shared_ptr<TarFilter> const& filter = nullptr);
+
     void start(QStringList const& urls) override;
     void stop() override;
     int get_helper_socket() const;
     QString to_string(Helper::State state) const override;
     void set_state(State) override;
+
+Q_SIGNALS:
+    void downloader_needed();
+
 protected:
     void on_helper_finished() override;
 
@@ -33,9 +33,10 @@ CommandLineClientView::CommandLineClientView(QObject * parent)
     std::cout << std::endl;
 }
 
-void CommandLineClientView::progress_changed(double percentage)
+void CommandLineClientView::progress_changed(double percentage, qint64 eta_seconds)
 {
     percentage_ = percentage * 100;
+    eta_seconds_ = eta_seconds;
 }
 
 void CommandLineClientView::status_changed(QString const & status)
@@ -101,7 +102,20 @@ void CommandLineClientView::show_info()
         std::cout << (*iter).toStdString() << std::setfill(' ') << std::endl;
     }
     std::cout << '\r' << std::fixed << std::setw(30) << status_.toStdString()  << std::setprecision(3)
-              << std::setfill(' ') << "  " << percentage_ << " %  " << get_next_spin_char() << "       " << std::flush;
+              << std::setfill(' ') << "  " << percentage_ << " %  " << get_next_spin_char() << "  " << get_eta_string(eta_seconds_).toStdString() << "       " << std::flush;
+}
+
+QString CommandLineClientView::get_eta_string(qint64 eta_seconds)
+{
+    if (eta_seconds < 0)
+        return QString();
+
+    auto const hours = eta_seconds / 3600;
+    auto const minutes = (eta_seconds / 60) % 60;
+    auto const seconds = eta_seconds % 60;
+    if (hours > 0)
+        return QStringLiteral("%1:%2:%3 left").arg(hours).arg(minutes, 2, 10, QLatin1Char('0')).arg(seconds, 2, 10, QLatin1Char('0'));
+    return QStringLiteral("%1:%2 left").arg(minutes).arg(seconds, 2, 10, QLatin1Char('0'));
 }
 
 char CommandLineClientView::get_next_spin_char()
@@ -33,7 +33,7 @@ public:
 
     Q_DISABLE_COPY(CommandLineClientView)
 
-    void progress_changed(double percentage);
+    void progress_changed(double percentage, qint64 eta_seconds = -1);
     void status_changed(QString const & status);
 
     void add_task(QString const & display_name, QString const & initial_status, double initial_percentage);
@@ -50,11 +50,13 @@ public Q_SLOTS:
 
 private:
     char get_next_spin_char();
+    static QString get_eta_string(qint64 eta_seconds);
     QString get_task_string(QString const & displayName, QString const & status, double percentage, keeper::Error error);
 
     QString status_;
     QTimer timer_status_;
     double percentage_ = 0.0;
+    qint64 eta_seconds_ = -1;
     int spin_value_ = 0;
     QMap<QString, QString> tasks_strings_;
 };
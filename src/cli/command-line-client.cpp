@@ -34,6 +34,7 @@ CommandLineClient::CommandLineClient(QObject * parent)
 {
     connect(keeper_client_.data(), &KeeperClient::statusChanged, this, &CommandLineClient::on_status_changed);
     connect(keeper_client_.data(), &KeeperClient::progressChanged, this, &CommandLineClient::on_progress_changed);
+    connect(keeper_client_.data(), &KeeperClient::etaChanged, this, &CommandLineClient::on_progress_changed);
     connect(keeper_client_.data(), &KeeperClient::finished, this, &CommandLineClient::on_keeper_client_finished);
     connect(keeper_client_.data(), &KeeperClient::taskStatusChanged, view_.data(), &CommandLineClientView::on_task_state_changed);
 }
@@ -213,7 +214,7 @@ void CommandLineClient::list_storage_accounts(QStringList const & accounts)
 
 void CommandLineClient::on_progress_changed()
 {
-    view_->progress_changed(keeper_client_->progress());
+    view_->progress_changed(keeper_client_->progress(), keeper_client_->eta());
 }
 
 void CommandLineClient::on_status_changed()
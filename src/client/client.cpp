@@ -17,12 +17,12 @@
  *     Marcus Tomlinson <marcus.tomlinson@canonical.com>
  */
 
+#include <QDBusServiceWatcher>
 #include <QTimer>
 
 #include <client/client.h>
 
 #include <qdbus-stubs/keeper_user_interface.h>
-#include <qdbus-stubs/DBusPropertiesInterface.h>
 #include <qdbus-stubs/dbus-types.h>
 
 struct KeeperClientPrivate final
@@ -37,11 +37,11 @@ struct KeeperClientPrivate final
                           DBusTypes::KEEPER_USER_PATH,
                           QDBusConnection::sessionBus()
                           ))
-        , propertiesIface(new DBusPropertiesInterface(
-                           DBusTypes::KEEPER_SERVICE,
-                           DBusTypes::KEEPER_USER_PATH,
-                           QDBusConnection::sessionBus()
-                         ))
+        , serviceWatcher(new QDBusServiceWatcher(
+                          DBusTypes::KEEPER_SERVICE,
+                          QDBusConnection::sessionBus(),
+                          QDBusServiceWatcher::WatchForOwnerChange
+                          ))
     {
     }
 
@@ -69,6 +69,42 @@ struct KeeperClientPrivate final
         return ret;
     }
 
+    // Estimates how long the whole run has left. Tasks whose size isn't
+    // known yet are assumed to be the size of an average known task.
+    static qint64 estimateSecondsLeft(keeper::Items const & state, quint64 speed)
+    {
+        quint64 n_remaining {};
+        quint64 n_known_total {};
+        int n_known {};
+        int n_unknown {};
+        for (auto const & item : state)
+        {
+            bool valid {};
+            auto const n_left = item.get_bytes_remaining(&valid);
+            auto const n_done = item.get_bytes_done();
+            if (valid)
+            {
+                n_remaining += n_left;
+                n_known_total += n_done + n_left;
+                ++n_known;
+            }
+            else if (!stateIsFinal(item.get_status()) && !n_done)
+            {
+                ++n_unknown;
+            }
+        }
+
+        if (n_known)
+            n_remaining += quint64(n_unknown) * (n_known_total / quint64(n_known));
+        else if (n_unknown)
+            return -1;
+
+        if (!n_remaining)
+            return 0;
+
+        return speed ? qint64((n_remaining + speed - 1) / speed) : -1;
+    }
+
     static keeper::Items getValue(QDBusMessage const & message, keeper::Error & error)
     {
         if (message.errorMessage().isEmpty())
@@ -108,10 +144,13 @@ struct KeeperClientPrivate final
     }
 
     QScopedPointer<DBusInterfaceKeeperUser> userIface;
-    QScopedPointer<DBusPropertiesInterface> propertiesIface;
+    QScopedPointer<QDBusServiceWatcher> serviceWatcher;
     QString status;
+    keeper::Items state;
     keeper::Items backups;
     double progress = 0;
+    quint64 speed = 0;
+    qint64 eta = -1;
     bool readyToBackup = false;
     bool backupBusy = false;
     QMap<QString, TaskStatus> taskStatus;
@@ -134,7 +173,12 @@ KeeperClient::KeeperClient(QObject* parent) :
         iter.value()["enabled"] = false;
     }
 
-    connect(d->propertiesIface.data(), &DBusPropertiesInterface::PropertiesChanged, this, &KeeperClient::stateUpdated);
+    // keep a local copy of the state, updated with just what changed
+    connect(d->userIface.data(), &DBusInterfaceKeeperUser::StateChanged, this, &KeeperClient::stateChanged);
+    d->state = getState();
+
+    // a restarted service doesn't know which deltas we missed, so start over
+    connect(d->serviceWatcher.data(), &QDBusServiceWatcher::serviceOwnerChanged, this, &KeeperClient::serviceOwnerChanged);
 }
 
 KeeperClient::~KeeperClient() = default;
@@ -163,6 +207,16 @@ double KeeperClient::progress()
     return d->progress;
 }
 
+quint64 KeeperClient::speed()
+{
+    return d->speed;
+}
+
+qint64 KeeperClient::eta()
+{
+    return d->eta;
+}
+
 bool KeeperClient::readyToBackup()
 {
     return d->readyToBackup;
@@ -312,9 +366,35 @@ QStringList KeeperClient::getStorageAccounts() const
      return accountsReply.value();
 }
 
+void KeeperClient::stateChanged(keeper::Items const & changes, QStringList const & removed)
+{
+    for (auto const & uuid : removed)
+        d->state.remove(uuid);
+
+    for (auto it = changes.cbegin(); it != changes.cend(); ++it)
+    {
+        auto& task_state = d->state[it.key()];
+        for (auto kit = it->cbegin(); kit != it->cend(); ++kit)
+            task_state.insert(kit.key(), kit.value());
+    }
+
+    stateUpdated();
+}
+
+void KeeperClient::serviceOwnerChanged(QString const & /*service*/, QString const & /*oldOwner*/, QString const & newOwner)
+{
+    // don't ask a service that just went away, it would only be started again
+    if (newOwner.isEmpty())
+        d->state.clear();
+    else
+        d->state = getState();
+
+    stateUpdated();
+}
+
 void KeeperClient::stateUpdated()
 {
-    auto states = getState();
+    auto const & states = d->state;
 
     if (!states.empty())
     {
@@ -349,6 +429,28 @@ void KeeperClient::stateUpdated()
         d->progress = totalProgress / states.count();
         Q_EMIT progressChanged();
 
+        // the run's speed is the sum of the smoothed speeds of the unfinished tasks,
+        // since several of them may be transferring at once
+        quint64 speed = 0;
+        for (auto const& state : states)
+        {
+            keeper::Item keeper_item(state);
+            if (!KeeperClientPrivate::stateIsFinal(keeper_item.get_status()))
+                speed += keeper_item.get_smoothed_speed();
+        }
+        if (d->speed != speed)
+        {
+            d->speed = speed;
+            Q_EMIT speedChanged();
+        }
+
+        auto const eta = KeeperClientPrivate::estimateSecondsLeft(states, speed);
+        if (d->eta != eta)
+        {
+            d->eta = eta;
+            Q_EMIT etaChanged();
+        }
+
         auto allTasksFinished = d->checkAllTasksFinished(states);
         // Update backup status
         QString statusString;
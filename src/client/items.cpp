@@ -42,6 +42,18 @@ const QString Item::STATUS_KEY = QStringLiteral("action");
 const QString Item::ERROR_KEY = QStringLiteral("error");
 const QString Item::PERCENT_DONE_KEY = QStringLiteral("percent-done");
 const QString Item::SPEED_KEY = QStringLiteral("speed");
+const QString Item::BYTES_DONE_KEY = QStringLiteral("bytes-done");
+const QString Item::BYTES_REMAINING_KEY = QStringLiteral("bytes-remaining");
+const QString Item::AVERAGE_SPEED_KEY = QStringLiteral("average-speed");
+const QString Item::SMOOTHED_SPEED_KEY = QStringLiteral("smoothed-speed");
+const QString Item::STALLED_SECONDS_KEY = QStringLiteral("stalled-seconds");
+const QString Item::ETA_SECONDS_KEY = QStringLiteral("eta-seconds");
+const QString Item::RETRIES_KEY = QStringLiteral("retries");
+const QString Item::RETRY_MSEC_KEY = QStringLiteral("retry-msec");
+const QString Item::INCREMENTAL_KEY = QStringLiteral("incremental");
+const QString Item::PARTS_KEY = QStringLiteral("parts");
+const QString Item::PART_SIZE_KEY = QStringLiteral("part-size");
+const QString Item::ARCHIVE_SIZE_KEY = QStringLiteral("archive-size");
 
 
 // values
@@ -139,6 +151,47 @@ double Item::get_percent_done(bool *valid) const
     return get_property<double>(PERCENT_DONE_KEY, valid);
 }
 
+quint64 Item::get_bytes_done(bool *valid) const
+{
+    return get_property<quint64>(BYTES_DONE_KEY, valid);
+}
+
+quint64 Item::get_bytes_remaining(bool *valid) const
+{
+    return get_property<quint64>(BYTES_REMAINING_KEY, valid);
+}
+
+quint64 Item::get_smoothed_speed(bool *valid) const
+{
+    return get_property<quint64>(SMOOTHED_SPEED_KEY, valid);
+}
+
+qint64 Item::get_eta_seconds(bool *valid) const
+{
+    auto it = this->find(ETA_SECONDS_KEY);
+
+    // no estimate means it's unknown
+    if (it == this->end())
+    {
+        if (valid != nullptr)
+            *valid = false;
+
+        return -1;
+    }
+
+    return get_property<qint64>(ETA_SECONDS_KEY, valid);
+}
+
+quint32 Item::get_retries(bool *valid) const
+{
+    return get_property<quint32>(RETRIES_KEY, valid);
+}
+
+quint64 Item::get_retry_msec(bool *valid) const
+{
+    return get_property<quint64>(RETRY_MSEC_KEY, valid);
+}
+
 keeper::Error Item::get_error(bool *valid) const
 {
     auto it = this->find(ERROR_KEY);
@@ -157,6 +210,27 @@ QString Item::get_file_name(bool *valid) const
     return get_property<QString>(FILE_NAME_KEY, valid);
 }
 
+bool Item::is_incremental(bool *valid) const
+{
+    return get_property<bool>(INCREMENTAL_KEY, valid);
+}
+
+QStringList Item::get_parts(bool *valid) const
+{
+    // one string, so that it survives the manifest's string-only properties
+    return get_property<QString>(PARTS_KEY, valid).split(QLatin1Char('/'), QString::SkipEmptyParts);
+}
+
+quint64 Item::get_part_size(bool *valid) const
+{
+    return get_property<quint64>(PART_SIZE_KEY, valid);
+}
+
+quint64 Item::get_archive_size(bool *valid) const
+{
+    return get_property<quint64>(ARCHIVE_SIZE_KEY, valid);
+}
+
 void Item::registerMetaType()
 {
     qRegisterMetaType<Item>("Item");
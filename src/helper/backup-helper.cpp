@@ -18,26 +18,59 @@
  *     Charles Kerr <charles.kerr@canonical.com>
  */
 
+#include "util/buffer-tuner.h"
 #include "util/connection-helper.h"
+#include "util/pipeline.h"
 #include "helper/backup-helper.h"
 #include "service/app-const.h" // HELPER_TYPE
+#include "tar/delta.h"
+#include "tar/tar-index.h"
 
 #include <QByteArray>
 #include <QDebug>
 #include <QLocalSocket>
 #include <QMap>
 #include <QObject>
+#include <QSocketNotifier>
 #include <QString>
+#include <QStringList>
 #include <QTimer>
 #include <QVector>
 
-#include <fcntl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <unistd.h> // close()
 
+#include <algorithm> // std::max()
 #include <functional> // std::bind()
+#include <memory>
+#include <sstream>
+#include <vector>
 
 
+namespace
+{
+
+// lets the indexer see the archive go by
+class IndexerTap final: public Pipeline::Tap
+{
+public:
+    explicit IndexerTap(TarIndexer& indexer)
+        : indexer_(indexer)
+    {
+    }
+
+    void observe(char const* data, size_t len) override
+    {
+        indexer_.feed(data, len);
+    }
+
+private:
+    TarIndexer& indexer_;
+};
+
+} // anonymous namespace
+
 class BackupHelperPrivate
 {
 public:
@@ -52,9 +85,10 @@ public:
             std::bind(&BackupHelperPrivate::on_inactivity_detected, this)
         );
 
-        // listen for data ready to read
-        QObject::connect(&read_socket_, &QLocalSocket::readyRead,
-            std::bind(&BackupHelperPrivate::on_ready_read, this)
+        // resume after waiting for the rate limit
+        throttle_timer_.setSingleShot(true);
+        QObject::connect(&throttle_timer_, &QTimer::timeout,
+            std::bind(&BackupHelperPrivate::process_more, this)
         );
 
         // fire up the sockets
@@ -70,10 +104,27 @@ public:
         // helper socket is for the client.
         helper_socket_.setSocketDescriptor(fds[1], QLocalSocket::ConnectedState, QIODevice::WriteOnly);
 
-        read_socket_.setSocketDescriptor(fds[0], QLocalSocket::ConnectedState, QIODevice::ReadOnly);
+        // our end is read by the pipeline, which splices the data straight
+        // to the uploader when it can instead of copying it through here
+        read_fd_ = fds[0];
+        read_notifier_.reset(new QSocketNotifier(read_fd_, QSocketNotifier::Read));
+        read_notifier_->setEnabled(false);
+        QObject::connect(read_notifier_.get(), &QSocketNotifier::activated,
+            std::bind(&BackupHelperPrivate::on_ready_read, this)
+        );
+        pipeline_.set_source(std::make_shared<FdSource>(read_fd_));
+        pipeline_.add_transform("index", std::make_shared<IndexerTap>(indexer_));
+
+        apply_buffer_size();
     }
 
-    ~BackupHelperPrivate() = default;
+    ~BackupHelperPrivate()
+    {
+        write_notifier_.reset();
+        read_notifier_.reset();
+        if (read_fd_ != -1)
+            ::close(read_fd_);
+    }
 
     Q_DISABLE_COPY(BackupHelperPrivate)
 
@@ -83,20 +134,32 @@ public:
         reset_inactivity_timer();
     }
 
-    void set_uploader(std::shared_ptr<Uploader> const& uploader)
+    void set_uploader(std::shared_ptr<Uploader> const& uploader, bool direct)
     {
+        direct_ = direct;
+        direct_catalog_.clear();
         n_read_ = 0;
         n_uploaded_ = 0;
         read_error_ = false;
         write_error_ = false;
         cancelled_ = false;
+        indexer_ = TarIndexer();
 
         uploader_ = uploader;
 
-        connections_.remember(QObject::connect(
-            uploader_->socket().get(), &QLocalSocket::bytesWritten,
-            std::bind(&BackupHelperPrivate::on_data_uploaded, this, std::placeholders::_1)
-        ));
+        if (!direct_ && (read_fd_ != -1))
+        {
+            auto const upload_fd = int(uploader_->socket()->socketDescriptor());
+            pipeline_.clear();
+            pipeline_.set_sink(std::make_shared<FdSink>(upload_fd));
+
+            write_notifier_.reset(new QSocketNotifier(upload_fd, QSocketNotifier::Write));
+            write_notifier_->setEnabled(false);
+            QObject::connect(write_notifier_.get(), &QSocketNotifier::activated,
+                std::bind(&BackupHelperPrivate::on_ready_write, this)
+            );
+            read_notifier_->setEnabled(true);
+        }
 
         // TODO xavi is going to remove this line
         q_ptr->Helper::on_helper_started();
@@ -128,12 +191,16 @@ public:
         {
             case Helper::State::CANCELLED:
             case Helper::State::FAILED:
+                log_buffer_metrics();
                 qDebug() << "cancelled/failed, calling uploader_.reset()";
+                disconnect_uploader();
                 uploader_.reset();
                 break;
 
             case Helper::State::DATA_COMPLETE: {
+                log_buffer_metrics();
                 qDebug() << "Backup helper finished, calling uploader_.commit()";
+                disconnect_uploader();
                 connections_.connect_oneshot(
                     uploader_.get(),
                     &Uploader::commit_finished,
@@ -145,7 +212,11 @@ public:
                             Q_EMIT(q_ptr->error(keeper::Error::COMMITTING_DATA));
                         }
                         else
+                        {
                             uploader_committed_file_name_ = uploader_->file_name();
+                            uploader_committed_parts_ = uploader_->part_names();
+                            uploader_committed_part_size_ = uploader_->part_size();
+                        }
                         uploader_.reset();
                         check_for_done();
                     }}
@@ -172,6 +243,69 @@ public:
         return uploader_committed_file_name_;
     }
 
+    QStringList get_uploader_committed_parts() const
+    {
+        return uploader_committed_parts_;
+    }
+
+    qint64 get_uploader_committed_part_size() const
+    {
+        return uploader_committed_part_size_;
+    }
+
+    void set_direct_progress(qint64 n_bytes_total)
+    {
+        if (!direct_ || !uploader_ || (n_bytes_total <= n_uploaded_))
+            return;
+
+        auto const n = n_bytes_total - n_uploaded_;
+        n_read_ += n;
+        n_uploaded_ += n;
+        q_ptr->record_data_transferred(n);
+        reset_inactivity_timer();
+        check_for_done();
+    }
+
+    void set_direct_catalog(QByteArray const& catalog)
+    {
+        if (direct_)
+            direct_catalog_ = catalog;
+    }
+
+    // true if the archive holds deltas against a previous backup
+    bool is_incremental() const
+    {
+        if (direct_)
+        {
+            std::istringstream in(direct_catalog_.toStdString());
+            std::vector<TarIndexer::Entry> entries;
+            TarIndexer::read_catalog(in, entries);
+            for (auto const& entry : entries)
+                if (Delta::is_delta_name(entry.path))
+                    return true;
+            return false;
+        }
+
+        for (auto const& entry : indexer_.entries())
+            if (Delta::is_delta_name(entry.path))
+                return true;
+        return false;
+    }
+
+    QByteArray get_catalog() const
+    {
+        if (direct_)
+            return direct_catalog_;
+
+        if (!indexer_.is_tar() || !indexer_.finished())
+            return QByteArray();
+
+        std::ostringstream out;
+        TarIndexer::write_catalog(out, indexer_.entries());
+        auto const str = out.str();
+        return QByteArray(str.data(), int(str.size()));
+    }
+
 private:
 
     void on_inactivity_detected()
@@ -187,57 +321,102 @@ private:
         process_more();
     }
 
-    void on_data_uploaded(qint64 n)
+    void on_ready_write()
     {
-        n_uploaded_ += n;
-        q_ptr->record_data_transferred(n);
         process_more();
-        check_for_done();
     }
 
     void process_more()
     {
-        if (!uploader_)
+        if (!uploader_ || direct_ || throttle_timer_.isActive())
             return;
 
-        char readbuf[UPLOAD_BUFFER_MAX_];
-        auto socket = uploader_->socket();
-        for(;;)
-        {
-            // try to fill the upload buf
-            int max_bytes = UPLOAD_BUFFER_MAX_ - upload_buffer_.size();
-            if (max_bytes > 0) {
-                const auto n = read_socket_.read(readbuf, max_bytes);
-                if (n > 0) {
-                    n_read_ += n;
-                    upload_buffer_.append(readbuf, int(n));
-                }
-                else if (n < 0) {
-                    read_error_ = true;
-                    Q_EMIT(q_ptr->error(keeper::Error::HELPER_READ));
-                    stop();
-                    return;
-                }
-            }
+        auto const result = pipeline_.pump(size_t(q_ptr->bandwidth_available()));
+        q_ptr->use_bandwidth(result.n_written);
+        n_read_ += result.n_read;
 
-            // try to empty the upload buf
-            const auto n = socket->write(upload_buffer_);
-            if (n > 0) {
-                upload_buffer_.remove(0, int(n));
-                continue;
-            }
-            else {
-                if (n < 0) {
-                    write_error_ = true;
-                    qWarning() << "Write error:" << socket->errorString();
-                    Q_EMIT(q_ptr->error(keeper::Error::HELPER_WRITE));
-                    stop();
-                }
-                break;
-            }
+        if (result.read_error)
+        {
+            qWarning() << "Read error:" << result.error.c_str();
+            read_error_ = true;
+            Q_EMIT(q_ptr->error(keeper::Error::HELPER_READ));
+            stop();
+            return;
         }
+        if (result.write_error)
+        {
+            qWarning() << "Write error:" << result.error.c_str();
+            write_error_ = true;
+            Q_EMIT(q_ptr->error(keeper::Error::HELPER_WRITE));
+            stop();
+            return;
+        }
+
+        if (tuner_.update(size_t(result.n_read), uint64_t(std::max(q_ptr->speed(), 0))))
+            apply_buffer_size();
+
+        // don't spin on a readable fd while waiting for the uploader to drain
+        read_notifier_->setEnabled(!result.want_write && !result.eof && !result.throttled);
+        if (write_notifier_)
+            write_notifier_->setEnabled(result.want_write);
+        if (result.throttled)
+            wait_for_bandwidth();
 
         reset_inactivity_timer();
+
+        if (result.n_written > 0)
+        {
+            n_uploaded_ += result.n_written;
+            q_ptr->record_data_transferred(result.n_written);
+            check_for_done();
+        }
+    }
+
+    // stop listening to the sockets until the rate limit lets us send more
+    void wait_for_bandwidth()
+    {
+        if (read_notifier_)
+            read_notifier_->setEnabled(false);
+        if (write_notifier_)
+            write_notifier_->setEnabled(false);
+        throttle_timer_.start(std::max(q_ptr->msec_until_bandwidth(), 1));
+    }
+
+    void disconnect_uploader()
+    {
+        throttle_timer_.stop();
+        write_notifier_.reset();
+        if (read_notifier_)
+            read_notifier_->setEnabled(false);
+        pipeline_.set_sink(nullptr);
+    }
+
+    // size the socketpair and the pipeline to what the tuner wants
+    void apply_buffer_size()
+    {
+        auto const n_bytes = tuner_.size();
+        auto const helper_size = BufferTuner::apply_to_socket(int(helper_socket_.socketDescriptor()), n_bytes);
+        auto const read_size = BufferTuner::apply_to_socket(read_fd_, n_bytes);
+        qDebug() << "backup buffer size" << n_bytes << "helper socket" << helper_size << "read socket" << read_size;
+        pipeline_.set_buffer_size(n_bytes);
+    }
+
+    void log_buffer_metrics() const
+    {
+        auto const& stats = tuner_.stats();
+        qDebug() << "backup buffer metrics:"
+                 << "size" << tuner_.size()
+                 << "largest" << stats.largest_size
+                 << "resizes" << stats.n_resizes
+                 << "wakeups" << stats.n_wakeups
+                 << "bytes" << stats.n_bytes
+                 << "bytes/wakeup" << (stats.n_wakeups ? stats.n_bytes / stats.n_wakeups : 0)
+                 << "max pending" << pipeline_.max_pending();
+        for (auto const& counters : pipeline_.counters())
+            qDebug() << "backup pipeline stage" << counters.name.c_str()
+                     << "calls" << counters.n_calls
+                     << "in" << counters.n_bytes_in
+                     << "out" << counters.n_bytes_out;
     }
 
     void reset_inactivity_timer()
@@ -289,14 +468,19 @@ private:
     ****
     ***/
 
-    static constexpr int UPLOAD_BUFFER_MAX_ {1024*16};
-
     BackupHelper * const q_ptr;
     QTimer timer_;
+    QTimer throttle_timer_;
     std::shared_ptr<Uploader> uploader_;
     QLocalSocket helper_socket_;
-    QLocalSocket read_socket_;
-    QByteArray upload_buffer_;
+    BufferTuner tuner_;
+    Pipeline pipeline_ {tuner_.size()};
+    int read_fd_ {-1};
+    std::unique_ptr<QSocketNotifier> read_notifier_;
+    std::unique_ptr<QSocketNotifier> write_notifier_;
+    bool direct_ = false;
+    QByteArray direct_catalog_;
+    TarIndexer indexer_;
     qint64 n_read_ = 0;
     qint64 n_uploaded_ = 0;
     bool read_error_ = false;
@@ -304,6 +488,8 @@ private:
     bool cancelled_ = false;
     ConnectionHelper connections_;
     QString uploader_committed_file_name_;
+    QStringList uploader_committed_parts_;
+    qint64 uploader_committed_part_size_ {};
 };
 
 /***
@@ -339,11 +525,27 @@ BackupHelper::stop()
 }
 
 void
-BackupHelper::set_uploader(std::shared_ptr<Uploader> const &uploader)
+BackupHelper::set_uploader(std::shared_ptr<Uploader> const &uploader, bool direct)
+{
+    Q_D(BackupHelper);
+
+    d->set_uploader(uploader, direct);
+}
+
+void
+BackupHelper::set_direct_progress(qint64 n_bytes_total)
 {
     Q_D(BackupHelper);
 
-    d->set_uploader(uploader);
+    d->set_direct_progress(n_bytes_total);
+}
+
+void
+BackupHelper::set_direct_catalog(QByteArray const& catalog)
+{
+    Q_D(BackupHelper);
+
+    d->set_direct_catalog(catalog);
 }
 
 int
@@ -385,3 +587,31 @@ QString BackupHelper::get_uploader_committed_file_name() const
 
     return d->get_uploader_committed_file_name();
 }
+
+QStringList BackupHelper::get_uploader_committed_parts() const
+{
+    Q_D(const BackupHelper);
+
+    return d->get_uploader_committed_parts();
+}
+
+qint64 BackupHelper::get_uploader_committed_part_size() const
+{
+    Q_D(const BackupHelper);
+
+    return d->get_uploader_committed_part_size();
+}
+
+QByteArray BackupHelper::get_catalog() const
+{
+    Q_D(const BackupHelper);
+
+    return d->get_catalog();
+}
+
+bool BackupHelper::is_incremental() const
+{
+    Q_D(const BackupHelper);
+
+    return d->is_incremental();
+}
@@ -18,6 +18,8 @@
  */
 
 #include <helper/helper.h>
+#include <util/token-bucket.h>
+#include <util/transfer-stats.h>
 
 #include <ubuntu-app-launch/registry.h>
 #include <service/app-const.h>
@@ -26,7 +28,10 @@
 #include <QDebug>
 #include <QTimer>
 
+#include <algorithm> // std::min(), std::max()
 #include <cmath> // std::fabs()
+#include <limits>
+#include <vector>
 #include <sys/time.h> // gettimeofday()
 
 
@@ -47,6 +52,7 @@ public:
     RateHistory()
         : newest{}
         , transfers{}
+        , first_date{}
         , cache_time{}
         , cache_val{}
     {
@@ -55,6 +61,9 @@ public:
     void
     add(uint64_t now, size_t size)
     {
+        if (!first_date)
+            first_date = now;
+
         // find the right bin and update its size
         if (transfers[newest].date + GRANULARITY_MSEC >= now)
         {
@@ -97,6 +106,10 @@ public:
                 }
             }
 
+            // don't dilute the speed with time from before the transfer began
+            if (first_date && (now > first_date))
+                interval_msec = unsigned(std::min(uint64_t(interval_msec), std::max(now - first_date, uint64_t(GRANULARITY_MSEC))));
+
             cache_val = uint32_t((bytes * 1000u) / interval_msec);
             cache_time = now;
         }
@@ -113,6 +126,7 @@ private:
 
     int newest;
     struct { uint64_t date, size; } transfers[HISTORY_SIZE];
+    uint64_t first_date;
 
     mutable uint64_t cache_time;
     mutable uint32_t cache_val;
@@ -146,6 +160,7 @@ public:
         , history_{}
         , registry_(new ubuntu::app_launch::Registry())
     {
+        stats_.reset(clock_(), 0);
         ual_init();
         QObject::connect(&timer_wait_ual_, &QTimer::timeout,
             std::bind(&HelperPrivate::on_max_time_waiting_for_ual_started, this)
@@ -183,6 +198,7 @@ public:
 
         size_ = 0;
         sized_ = 0.0;
+        stats_.reset(clock_(), uint64_t(std::max(expected_size, qint64(0))));
         update_percent_done();
     }
 
@@ -196,7 +212,9 @@ public:
         size_ += n_bytes;
         sized_ += double(n_bytes);
 
-        history_.add(clock_(), size_t(n_bytes));
+        auto const now = clock_();
+        history_.add(now, size_t(n_bytes));
+        stats_.add(now, uint64_t(n_bytes));
 
         update_percent_done();
     }
@@ -206,6 +224,43 @@ public:
         return history_.speed_bytes_per_second(clock_());
     }
 
+    TransferStats::Snapshot transfer_stats() const
+    {
+        return stats_.snapshot(clock_());
+    }
+
+    void set_rate_limit(quint64 bytes_per_second)
+    {
+        if (bucket_.rate() != bytes_per_second)
+        {
+            qDebug() << "helper" << static_cast<void*>(this) << "rate limit is now" << bytes_per_second << "bytes per second";
+            bucket_.set_rate(bytes_per_second, clock_());
+        }
+    }
+
+    quint64 rate_limit() const
+    {
+        return bucket_.rate();
+    }
+
+    qint64 bandwidth_available()
+    {
+        return qint64(std::min(bucket_.available(clock_()), uint64_t(std::numeric_limits<qint64>::max())));
+    }
+
+    void use_bandwidth(qint64 n_bytes)
+    {
+        if (n_bytes > 0)
+            bucket_.consume(uint64_t(n_bytes));
+    }
+
+    int msec_until_bandwidth()
+    {
+        // wait for enough to be worth a wakeup
+        static constexpr uint64_t MIN_SEND {TokenBucket::MIN_BURST};
+        return int(bucket_.msec_until_available(MIN_SEND, clock_()));
+    }
+
     float percent_done() const
     {
         return percent_done_;
@@ -279,24 +334,35 @@ private:
     {
         qDebug() << "Starting helper for app:" << appid_;
 
-        std::vector<ubuntu::app_launch::Helper::URL> urls;
+        // several helpers for the same app can run at once,
+        // so keep track of which instance is ours
+        std::vector<QByteArray> urls;
         for(const auto& url_string : url_strings) {
             qDebug() << "url" << url_string;
-            urls.push_back(ubuntu::app_launch::Helper::URL::from_raw(url_string.toStdString()));
+            urls.push_back(url_string.toUtf8());
         }
-
-        auto backupType = ubuntu::app_launch::Helper::Type::from_raw(HELPER_TYPE);
-
-        auto appid = ubuntu::app_launch::AppID::parse(appid_.toStdString());
-        auto helper = ubuntu::app_launch::Helper::create(backupType, appid, registry_);
+        std::vector<gchar const*> uris;
+        for (auto const& url : urls)
+            uris.push_back(url.constData());
+        uris.push_back(nullptr);
 
         reset_wait_for_ual_timer();
-        helper->launch(urls);
+        auto instance = ubuntu_app_launch_start_multiple_helper(HELPER_TYPE, appid_.toUtf8().constData(), uris.data());
+        instance_ = QString::fromUtf8(instance);
+        g_free(instance);
+        qDebug() << "helper instance:" << instance_;
     }
 
     void ual_stop()
     {
         qDebug() << "Stopping helper for app:" << appid_;
+
+        if (!instance_.isEmpty())
+        {
+            ubuntu_app_launch_stop_multiple_helper(HELPER_TYPE, appid_.toUtf8().constData(), instance_.toUtf8().constData());
+            return;
+        }
+
         auto backupType = ubuntu::app_launch::Helper::Type::from_raw(HELPER_TYPE);
 
         auto appid = ubuntu::app_launch::AppID::parse(appid_.toStdString());
@@ -311,17 +377,27 @@ private:
         }
     }
 
-    static void on_helper_started(const char* appid, const char* /*instance*/, const char* /*type*/, void* vself)
+    // ignore other helpers that are running at the same time
+    bool is_our_instance(const char* instance) const
+    {
+        return instance_.isEmpty() || !instance || !*instance || (instance_ == QString::fromUtf8(instance));
+    }
+
+    static void on_helper_started(const char* appid, const char* instance, const char* /*type*/, void* vself)
     {
-        qDebug() << "HELPER STARTED +++++++++++++++++++++++++++++++++++++" << appid;
         auto self = static_cast<HelperPrivate*>(vself);
+        if (!self->is_our_instance(instance))
+            return;
+        qDebug() << "HELPER STARTED +++++++++++++++++++++++++++++++++++++" << appid << instance;
         self->q_ptr->on_helper_started();
     }
 
-    static void on_helper_stopped(const char* appid, const char* /*instance*/, const char* /*type*/, void* vself)
+    static void on_helper_stopped(const char* appid, const char* instance, const char* /*type*/, void* vself)
     {
-        qDebug() << "HELPER STOPPED +++++++++++++++++++++++++++++++++++++" << appid;
         auto self = static_cast<HelperPrivate*>(vself);
+        if (!self->is_our_instance(instance))
+            return;
+        qDebug() << "HELPER STOPPED +++++++++++++++++++++++++++++++++++++" << appid << instance;
         self->q_ptr->on_helper_finished();
     }
 
@@ -367,9 +443,12 @@ private:
     double sized_ {};
     qint64 expected_size_ {};
     RateHistory history_;
+    TransferStats stats_;
+    TokenBucket bucket_;
     float percent_done_ {};
     float last_notified_percent_done_ {};
     std::shared_ptr<ubuntu::app_launch::Registry> registry_;
+    QString instance_;
     QTimer timer_wait_ual_;
     bool is_helper_running_ = false;
 };
@@ -410,6 +489,14 @@ Helper::speed() const
     return d->speed();
 }
 
+TransferStats::Snapshot
+Helper::transfer_stats() const
+{
+    Q_D(const Helper);
+
+    return d->transfer_stats();
+}
+
 float
 Helper::percent_done() const
 {
@@ -427,6 +514,46 @@ Helper::record_data_transferred(qint64 n_bytes)
 }
 
 
+void
+Helper::set_rate_limit(quint64 bytes_per_second)
+{
+    Q_D(Helper);
+
+    d->set_rate_limit(bytes_per_second);
+}
+
+quint64
+Helper::rate_limit() const
+{
+    Q_D(const Helper);
+
+    return d->rate_limit();
+}
+
+qint64
+Helper::bandwidth_available()
+{
+    Q_D(Helper);
+
+    return d->bandwidth_available();
+}
+
+void
+Helper::use_bandwidth(qint64 n_bytes)
+{
+    Q_D(Helper);
+
+    d->use_bandwidth(n_bytes);
+}
+
+int
+Helper::msec_until_bandwidth()
+{
+    Q_D(Helper);
+
+    return d->msec_until_bandwidth();
+}
+
 void
 Helper::set_state(State state)
 {
@@ -74,3 +74,20 @@ Metadata::json() const
 
     return ret;
 }
+
+void
+Metadata::set_parts(QStringList const & parts, qint64 part_size, qint64 archive_size)
+{
+    if (parts.isEmpty())
+    {
+        remove(keeper::Item::PARTS_KEY);
+        remove(keeper::Item::PART_SIZE_KEY);
+        remove(keeper::Item::ARCHIVE_SIZE_KEY);
+        return;
+    }
+
+    // file names can't hold a '/', so it's safe to join them with one
+    set_property_value(keeper::Item::PARTS_KEY, parts.join(QLatin1Char('/')));
+    set_property_value(keeper::Item::PART_SIZE_KEY, QString::number(part_size));
+    set_property_value(keeper::Item::ARCHIVE_SIZE_KEY, QString::number(archive_size));
+}
@@ -18,25 +18,53 @@
  *     Charles Kerr <charles.kerr@canonical.com>
  */
 
-#include "util/connection-helper.h"
+#include "util/buffer-tuner.h"
+#include "util/pipeline.h"
+#include "util/qiodevice-source.h"
 #include "helper/restore-helper.h"
 #include "service/app-const.h" // HELPER_TYPE
+#include "tar/tar-filter.h"
 
-#include <QByteArray>
 #include <QDebug>
 #include <QLocalSocket>
 #include <QMap>
 #include <QObject>
+#include <QSocketNotifier>
 #include <QString>
 #include <QTimer>
 #include <QVector>
 
-#include <fcntl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <unistd.h> // close()
 
+#include <algorithm> // std::max()
 #include <functional> // std::bind()
+#include <memory>
+#include <string>
 
+namespace
+{
+
+// drops the archive members that aren't being restored
+class FilterTransform final: public Pipeline::Transform
+{
+public:
+    explicit FilterTransform(std::shared_ptr<TarFilter> const& filter)
+        : filter_{filter}
+    {
+    }
+
+    void process(char const* data, size_t len, std::string& out) override
+    {
+        filter_->feed(data, len, out);
+    }
+
+private:
+    std::shared_ptr<TarFilter> filter_;
+};
+
+} // anonymous namespace
 
 class RestoreHelperPrivate
 {
@@ -52,6 +80,12 @@ public:
             std::bind(&RestoreHelperPrivate::on_inactivity_detected, this)
         );
 
+        // resume after waiting for the rate limit
+        throttle_timer_.setSingleShot(true);
+        QObject::connect(&throttle_timer_, &QTimer::timeout,
+            std::bind(&RestoreHelperPrivate::process_more, this)
+        );
+
         // fire up the sockets
         int fds[2];
         int rc = socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds);
@@ -66,10 +100,22 @@ public:
         // We don't use a QLocalSocket here as it buffers data and it makes the helper miss packets.
         helper_socket_ = fds[1];
 
-        write_socket_.setSocketDescriptor(fds[0], QLocalSocket::ConnectedState, QIODevice::WriteOnly);
+        // nor on our end, so that the pipeline writes straight to the socket
+        write_fd_ = fds[0];
+        write_notifier_.reset(new QSocketNotifier(write_fd_, QSocketNotifier::Write));
+        write_notifier_->setEnabled(false);
+        QObject::connect(write_notifier_.get(), &QSocketNotifier::activated,
+            std::bind(&RestoreHelperPrivate::on_ready_write, this)
+        );
+        pipeline_.set_sink(std::make_shared<FdSink>(write_fd_));
+
+        apply_buffer_size();
     }
 
-    ~RestoreHelperPrivate() = default;
+    ~RestoreHelperPrivate()
+    {
+        close_write_socket();
+    }
 
     Q_DISABLE_COPY(RestoreHelperPrivate)
 
@@ -79,32 +125,63 @@ public:
         reset_inactivity_timer();
     }
 
-    void set_downloader(std::shared_ptr<Downloader> const& downloader)
+    void set_buffer_size(size_t n_bytes)
     {
-        n_read_ = 0;
-        n_uploaded_ = 0;
-        read_error_ = false;
-        write_error_ = false;
-        cancelled_ = false;
+        // a fixed size turns off tuning
+        tuner_ = BufferTuner(n_bytes, n_bytes);
+        apply_buffer_size();
+    }
 
+    void set_downloader(std::shared_ptr<Downloader> const& downloader)
+    {
+        started_ = false;
         q_ptr->set_expected_size(downloader->file_size());
+        add_downloader(downloader, nullptr);
+    }
+
+    void add_downloader(std::shared_ptr<Downloader> const& downloader,
+                        std::shared_ptr<TarFilter> const& filter)
+    {
+        if (!started_)
+        {
+            started_ = true;
+            n_uploaded_ = 0;
+            read_error_ = false;
+            write_error_ = false;
+            cancelled_ = false;
+            pipeline_.clear();
+
+            // TODO investigate why UAL takes so long to call the helper started callback
+            // At this point we are sure that the helper started, as it is the helper
+            // the ones that asks for a downloader socket.
+            q_ptr->Helper::on_helper_started();
+        }
+        else if (downloader_)
+        {
+            // done with the previous archive
+            QObject::disconnect(ready_read_connection_);
+            downloader_->finish();
+        }
+
+        downloader_needed_ = false;
         downloader_ = downloader;
 
-        connections_.remember(QObject::connect(
-            &write_socket_, &QLocalSocket::bytesWritten,
-            std::bind(&RestoreHelperPrivate::on_data_uploaded, this, std::placeholders::_1)
-        ));
+        // what's already been filtered stays queued for the helper
+        source_ = std::make_shared<QIODeviceSource>(downloader_->socket().get(), downloader_->file_size());
+        pipeline_.set_source(source_);
+        pipeline_.clear_transforms();
+        if (filter)
+            pipeline_.add_transform("filter", std::make_shared<FilterTransform>(filter));
+
+        // bound what the socket reads ahead, so that a rate limit
+        // pushes back on the download instead of piling up here
+        downloader_->socket()->setReadBufferSize(RestoreHelper::DEFAULT_BUFFER_SIZE);
 
         // listen for data ready to read
-        QObject::connect(downloader_->socket().get(), &QLocalSocket::readyRead,
+        ready_read_connection_ = QObject::connect(downloader_->socket().get(), &QLocalSocket::readyRead,
             std::bind(&RestoreHelperPrivate::on_ready_read, this)
         );
 
-        // TODO investigate why UAL takes so long to call the helper started callback
-        // At this point we are sure that the helper started, as it is the helper
-        // the ones that asks for a downloader socket.
-        q_ptr->Helper::on_helper_started();
-
         // maybe there's data already to be read
         process_more();
 
@@ -113,7 +190,7 @@ public:
 
     void stop()
     {
-        write_socket_.disconnectFromServer();
+        close_write_socket();
         cancelled_ = true;
         q_ptr->Helper::stop();
     }
@@ -136,13 +213,17 @@ public:
         {
             case Helper::State::CANCELLED:
             case Helper::State::FAILED:
+                log_buffer_metrics();
+                throttle_timer_.stop();
                 qDebug() << "cancelled/failed, calling downloader_.reset()";
                 downloader_.reset();
                 break;
 
             case Helper::State::DATA_COMPLETE: {
+                log_buffer_metrics();
+                throttle_timer_.stop();
                 qDebug() << "Restore helper finished, calling downloader_.finish()";
-                write_socket_.disconnectFromServer();
+                close_write_socket();
                 downloader_->finish();
                 downloader_.reset();
                 break;
@@ -176,66 +257,104 @@ private:
         process_more();
     }
 
-    void on_data_uploaded(qint64 n)
+    void on_ready_write()
     {
-        n_uploaded_ += n;
-        q_ptr->record_data_transferred(n);
         process_more();
-        check_for_done();
     }
 
     void process_more()
     {
-        if (!downloader_)
+        if (!downloader_ || (write_fd_ == -1))
             return;
 
-        char readbuf[UPLOAD_BUFFER_MAX_];
-        auto socket = downloader_->socket();
-        while(socket->bytesAvailable() || upload_buffer_.size())
+        auto const result = pipeline_.pump(size_t(q_ptr->bandwidth_available()));
+        q_ptr->use_bandwidth(result.n_written);
+
+        if (result.read_error)
         {
-            if (socket->bytesAvailable())
-            {
-                // try to fill the upload buf
-                int max_bytes = UPLOAD_BUFFER_MAX_ - upload_buffer_.size();
-                if (max_bytes > 0) {
-                    const auto n = socket->read(readbuf, max_bytes);
-                    if (n > 0) {
-                        n_read_ += n;
-                        upload_buffer_.append(readbuf, int(n));
-                    }
-                    else if (n < 0) {
-                        read_error_ = true;
-                        qDebug() << "Read error in restore helper: " << socket->errorString();
-                        Q_EMIT(q_ptr->error(keeper::Error::HELPER_READ));
-                        stop();
-                        check_for_done();
-                        return;
-                    }
-                }
-            }
+            read_error_ = true;
+            qDebug() << "Read error in restore helper: " << result.error.c_str();
+            Q_EMIT(q_ptr->error(keeper::Error::HELPER_READ));
+            stop();
+            check_for_done();
+            return;
+        }
+        if (result.write_error)
+        {
+            write_error_ = true;
+            qWarning() << "Write error:" << result.error.c_str();
+            Q_EMIT(q_ptr->error(keeper::Error::HELPER_WRITE));
+            stop();
+            check_for_done();
+            return;
+        }
 
-            if (upload_buffer_.size())
-            {
-                // try to empty the upload buf
-                const auto n = write_socket_.write(upload_buffer_);
-                if (n > 0) {
-                    upload_buffer_.remove(0, int(n));
-                    continue;
-                }
-                else {
-                    if (n < 0) {
-                        write_error_ = true;
-                        qWarning() << "Write error:" << write_socket_.errorString();
-                        Q_EMIT(q_ptr->error(keeper::Error::HELPER_WRITE));
-                        stop();
-                        check_for_done();
-                    }
-                    break;
-                }
-            }
+        if (tuner_.update(size_t(result.n_written), uint64_t(std::max(q_ptr->speed(), 0))))
+            apply_buffer_size();
+
+        // wait for the helper to make room, or for the rate limit to allow more
+        write_notifier_->setEnabled(result.want_write);
+        if (result.throttled)
+            throttle_timer_.start(std::max(q_ptr->msec_until_bandwidth(), 1));
+
+        // if this archive is done but the stream isn't, ask for the next one
+        auto const n_queued = n_uploaded_ + result.n_written + qint64(pipeline_.n_pending());
+        if (!downloader_needed_ && source_->eof() && (n_queued < q_ptr->expected_size()))
+        {
+            downloader_needed_ = true;
+            Q_EMIT(q_ptr->downloader_needed());
         }
 
         reset_inactivity_timer();
+
+        if (result.n_written > 0)
+        {
+            n_uploaded_ += result.n_written;
+            q_ptr->record_data_transferred(result.n_written);
+            check_for_done();
+        }
+    }
+
+    // size the socketpair and the pipeline to what the tuner wants
+    void apply_buffer_size()
+    {
+        auto const n_bytes = tuner_.size();
+        if (write_fd_ != -1)
+        {
+            auto const helper_size = BufferTuner::apply_to_socket(helper_socket_, n_bytes);
+            auto const write_size = BufferTuner::apply_to_socket(write_fd_, n_bytes);
+            qDebug() << "restore buffer size" << n_bytes << "helper socket" << helper_size << "write socket" << write_size;
+        }
+        pipeline_.set_buffer_size(n_bytes);
+    }
+
+    void log_buffer_metrics() const
+    {
+        auto const& stats = tuner_.stats();
+        qDebug() << "restore buffer metrics:"
+                 << "size" << tuner_.size()
+                 << "largest" << stats.largest_size
+                 << "resizes" << stats.n_resizes
+                 << "wakeups" << stats.n_wakeups
+                 << "bytes" << stats.n_bytes
+                 << "bytes/wakeup" << (stats.n_wakeups ? stats.n_bytes / stats.n_wakeups : 0)
+                 << "max pending" << pipeline_.max_pending();
+        for (auto const& counters : pipeline_.counters())
+            qDebug() << "restore pipeline stage" << counters.name.c_str()
+                     << "calls" << counters.n_calls
+                     << "in" << counters.n_bytes_in
+                     << "out" << counters.n_bytes_out;
+    }
+
+    void close_write_socket()
+    {
+        write_notifier_.reset();
+        pipeline_.set_sink(nullptr);
+        if (write_fd_ != -1)
+        {
+            ::close(write_fd_);
+            write_fd_ = -1;
+        }
     }
 
     void reset_inactivity_timer()
@@ -287,20 +406,23 @@ private:
     ****
     ***/
 
-    static constexpr int UPLOAD_BUFFER_MAX_ {1024*16};
-
     RestoreHelper * const q_ptr;
     QTimer timer_;
+    QTimer throttle_timer_;
     std::shared_ptr<Downloader> downloader_;
     int helper_socket_ = -1;
-    QLocalSocket write_socket_;
-    QByteArray upload_buffer_;
-    qint64 n_read_ = 0;
+    int write_fd_ = -1;
+    std::unique_ptr<QSocketNotifier> write_notifier_;
+    BufferTuner tuner_ {BufferTuner::DEFAULT_MIN_SIZE, RestoreHelper::DEFAULT_BUFFER_SIZE};
+    Pipeline pipeline_ {tuner_.size()};
+    std::shared_ptr<QIODeviceSource> source_; // the current downloader
+    QMetaObject::Connection ready_read_connection_;
+    bool started_ = false;
+    bool downloader_needed_ = false;
     qint64 n_uploaded_ = 0;
     bool read_error_ = false;
     bool write_error_ = false;
     bool cancelled_ = false;
-    ConnectionHelper connections_;
 };
 
 /***
@@ -335,6 +457,14 @@ RestoreHelper::stop()
     d->stop();
 }
 
+void
+RestoreHelper::set_buffer_size(int n_bytes)
+{
+    Q_D(RestoreHelper);
+
+    d->set_buffer_size(size_t(std::max(n_bytes, 1)));
+}
+
 void
 RestoreHelper::set_downloader(std::shared_ptr<Downloader> const& downloader)
 {
@@ -343,6 +473,15 @@ RestoreHelper::set_downloader(std::shared_ptr<Downloader> const& downloader)
     d->set_downloader(downloader);
 }
 
+void
+RestoreHelper::add_downloader(std::shared_ptr<Downloader> const& downloader,
+                              std::shared_ptr<TarFilter> const& filter)
+{
+    Q_D(RestoreHelper);
+
+    d->add_downloader(downloader, filter);
+}
+
 int
 RestoreHelper::get_helper_socket() const
 {
@@ -54,6 +54,14 @@ namespace DBusTypes
 
     constexpr const char KEEPER_HELPER_PATH[] = "/com/canonical/keeper/helper";
 
+    // each running task's helper calls in on a path of its own
+    constexpr int KEEPER_HELPER_MAX_TASKS = 8;
+
+    inline QString keeperHelperTaskPath(int slot)
+    {
+        return QStringLiteral("%1/task%2").arg(QLatin1String(KEEPER_HELPER_PATH)).arg(slot);
+    }
+
     constexpr const char KEEPER_USER_INTERFACE[] = "com.canonical.keeper.User";
 
     constexpr const char KEEPER_USER_PATH[]      = "/com/canonical/keeper/user";
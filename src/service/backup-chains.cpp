@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "service/backup-chains.h"
+
+#include <algorithm> // std::stable_sort()
+
+BackupChains::BackupChains(QVector<Metadata> const& entries)
+{
+    for (auto const& entry : entries)
+        chains_[chain_key(entry)].push_back(entry);
+
+    // backup dir names are timestamps, so they sort chronologically
+    for (auto& chain : chains_)
+    {
+        std::stable_sort(chain.begin(), chain.end(), [](Metadata const& a, Metadata const& b){
+            return a.get_dir_name() < b.get_dir_name();
+        });
+    }
+}
+
+QString
+BackupChains::chain_key(Metadata const& entry)
+{
+    auto const type = entry.get_type();
+
+    QString id;
+    if (type == Metadata::FOLDER_VALUE)
+        id = entry.get_property_value(Metadata::SUBTYPE_KEY).toString();
+    else if (type == Metadata::APPLICATION_VALUE)
+        id = entry.get_property_value(Metadata::PACKAGE_KEY).toString();
+    if (id.isEmpty())
+        id = entry.get_display_name();
+
+    return QStringLiteral("%1:%2").arg(type).arg(id);
+}
+
+QStringList
+BackupChains::keys() const
+{
+    return chains_.keys();
+}
+
+QVector<Metadata>
+BackupChains::chain(QString const& key) const
+{
+    return chains_.value(key);
+}
+
+QVector<Metadata>
+BackupChains::restore_chain(Metadata const& entry) const
+{
+    auto const chain = chains_.value(chain_key(entry));
+
+    // find the entry
+    int end = -1;
+    for (int i=0, n=chain.size(); i<n; ++i)
+    {
+        if (chain[i].get_dir_name() == entry.get_dir_name())
+        {
+            end = i;
+            break;
+        }
+    }
+    if (end < 0)
+        return QVector<Metadata>{entry};
+
+    // walk back to the newest full backup
+    int begin = end;
+    while ((begin > 0) && chain[begin].is_incremental())
+        --begin;
+
+    return chain.mid(begin, end-begin+1);
+}
+
+int
+BackupChains::incrementals_since_full(QString const& key) const
+{
+    auto const chain = chains_.value(key);
+
+    int n {};
+    for (int i=chain.size()-1; (i >= 0) && chain[i].is_incremental(); --i)
+        ++n;
+    return n;
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#pragma once
+
+#include "helper/metadata.h"
+
+#include <QMap>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+/**
+ * Groups the manifest entries of every backup run into per-item chains.
+ *
+ * Each backup of an item is either full or incremental, where an
+ * incremental backup holds deltas against the item's previous backup.
+ * A chain is all the backups of one item, oldest first.
+ */
+class BackupChains
+{
+public:
+    explicit BackupChains(QVector<Metadata> const& entries);
+
+    // identifies the item that an entry is a backup of
+    static QString chain_key(Metadata const& entry);
+
+    QStringList keys() const;
+
+    // all the backups of an item, oldest first
+    QVector<Metadata> chain(QString const& key) const;
+
+    // the backups needed to restore `entry`:
+    // the newest full backup at or before it, then the incrementals up to it
+    QVector<Metadata> restore_chain(Metadata const& entry) const;
+
+    // how many incrementals the item's newest backup depends on
+    int incrementals_since_full(QString const& key) const;
+
+private:
+    QMap<QString,QVector<Metadata>> chains_;
+};
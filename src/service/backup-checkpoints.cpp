@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+
+#include "service/backup-checkpoints.h"
+#include "service/backup-chains.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+// JSON Keys
+namespace
+{
+    constexpr const char DIR_NAME_KEY[] = "dir-name";
+    constexpr const char SIZE_KEY[] = "size";
+    constexpr const char PART_SIZE_KEY[] = "part-size";
+    constexpr const char PARTS_KEY[] = "parts";
+    constexpr const char INDEX_KEY[] = "index";
+    constexpr const char NAME_KEY[] = "name";
+    constexpr const char DIGEST_KEY[] = "digest";
+}
+
+/***
+****
+***/
+
+bool
+BackupCheckpoints::Checkpoint::matches(qint64 n_bytes_in, qint64 part_size_in) const
+{
+    return !parts.isEmpty() && (n_bytes == n_bytes_in) && (part_size == part_size_in);
+}
+
+PartedUploader::Resume
+BackupCheckpoints::Checkpoint::resume() const
+{
+    PartedUploader::Resume ret;
+    ret.part_size = part_size;
+    for (int i=0; parts.contains(i); ++i)
+    {
+        ret.parts << parts[i].name;
+        ret.digests << parts[i].digest;
+    }
+    return ret;
+}
+
+/***
+****
+***/
+
+BackupCheckpoints::BackupCheckpoints(QString const & path)
+    : path_(path)
+{
+    load();
+}
+
+QString
+BackupCheckpoints::default_path()
+{
+    // losing these only costs a re-upload, so they're cache
+    auto const dir = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation);
+    return QDir(dir).filePath(QStringLiteral("keeper/checkpoints.json"));
+}
+
+QString
+BackupCheckpoints::key(QString const & storage, Metadata const & entry)
+{
+    return storage + QLatin1Char('|') + BackupChains::chain_key(entry);
+}
+
+BackupCheckpoints::Checkpoint
+BackupCheckpoints::get(QString const & key) const
+{
+    return checkpoints_.value(key);
+}
+
+void
+BackupCheckpoints::set(QString const & key, Checkpoint const & checkpoint)
+{
+    checkpoints_[key] = checkpoint;
+    save();
+}
+
+void
+BackupCheckpoints::remove(QString const & key)
+{
+    if (checkpoints_.remove(key))
+        save();
+}
+
+/***
+****
+***/
+
+void
+BackupCheckpoints::load()
+{
+    QFile file(path_);
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+
+    auto const root = QJsonDocument::fromJson(file.readAll()).object();
+    for (auto it=root.begin(), end=root.end(); it!=end; ++it)
+    {
+        auto const obj = it.value().toObject();
+
+        Checkpoint checkpoint;
+        checkpoint.dir_name = obj[DIR_NAME_KEY].toString();
+        checkpoint.n_bytes = obj[SIZE_KEY].toString().toLongLong();
+        checkpoint.part_size = obj[PART_SIZE_KEY].toString().toLongLong();
+        for (auto const& val : obj[PARTS_KEY].toArray())
+        {
+            auto const part_obj = val.toObject();
+            Part part;
+            part.name = part_obj[NAME_KEY].toString();
+            part.digest = QByteArray::fromHex(part_obj[DIGEST_KEY].toString().toLatin1());
+            checkpoint.parts[part_obj[INDEX_KEY].toInt()] = part;
+        }
+
+        if (!checkpoint.dir_name.isEmpty() && !checkpoint.parts.isEmpty())
+            checkpoints_[it.key()] = checkpoint;
+    }
+}
+
+void
+BackupCheckpoints::save() const
+{
+    // sizes are stored as strings, like in the manifest, so they don't lose precision
+    QJsonObject root;
+    for (auto it=checkpoints_.cbegin(), end=checkpoints_.cend(); it!=end; ++it)
+    {
+        auto const& checkpoint = it.value();
+
+        QJsonArray parts;
+        for (auto pit=checkpoint.parts.cbegin(), pend=checkpoint.parts.cend(); pit!=pend; ++pit)
+        {
+            QJsonObject part;
+            part[INDEX_KEY] = pit.key();
+            part[NAME_KEY] = pit.value().name;
+            part[DIGEST_KEY] = QString::fromLatin1(pit.value().digest.toHex());
+            parts.append(part);
+        }
+
+        QJsonObject obj;
+        obj[DIR_NAME_KEY] = checkpoint.dir_name;
+        obj[SIZE_KEY] = QString::number(checkpoint.n_bytes);
+        obj[PART_SIZE_KEY] = QString::number(checkpoint.part_size);
+        obj[PARTS_KEY] = parts;
+        root[it.key()] = obj;
+    }
+
+    QDir().mkpath(QFileInfo(path_).path());
+    QSaveFile file(path_);
+    if (!file.open(QIODevice::WriteOnly) ||
+        (file.write(QJsonDocument(root).toJson(QJsonDocument::Compact)) == -1) ||
+        !file.commit())
+    {
+        qWarning() << "unable to save backup checkpoints to" << path_ << ":" << file.errorString();
+    }
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+
+#pragma once
+
+#include "helper/metadata.h"
+#include "storage-framework/parted-uploader.h"
+
+#include <QByteArray>
+#include <QMap>
+#include <QString>
+
+/**
+ * Remembers which parts of each backup archive have been committed,
+ * so that if a backup is interrupted, the next backup of the same item
+ * can pick up where it left off instead of uploading everything again.
+ *
+ * Checkpoints are kept per storage and per item (see BackupChains::chain_key),
+ * and are written to disk whenever they change.
+ */
+class BackupCheckpoints
+{
+public:
+
+    struct Part
+    {
+        QString name;      // its committed name
+        QByteArray digest; // see PartedUploader::part_committed()
+    };
+
+    struct Checkpoint
+    {
+        QString dir_name;
+        qint64 n_bytes {};
+        qint64 part_size {};
+        QMap<int,Part> parts; // they can be committed out of order
+
+        // whether the upload it describes is the one being asked about
+        bool matches(qint64 n_bytes, qint64 part_size) const;
+
+        // the parts that the archive starts with, up to the first gap
+        PartedUploader::Resume resume() const;
+    };
+
+    explicit BackupCheckpoints(QString const & path = default_path());
+
+    static QString default_path();
+    static QString key(QString const & storage, Metadata const & entry);
+
+    // returns an empty Checkpoint if there isn't one for `key`
+    Checkpoint get(QString const & key) const;
+
+    void set(QString const & key, Checkpoint const & checkpoint);
+    void remove(QString const & key);
+
+private:
+
+    void load();
+    void save() const;
+
+    QString const path_;
+    QMap<QString,Checkpoint> checkpoints_;
+};
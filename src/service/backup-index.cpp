@@ -0,0 +1,309 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+
+#include "service/backup-index.h"
+
+#include "service/manifest.h"
+#include "storage-framework/download-reader.h"
+#include "storage-framework/storage_framework_client.h"
+#include "util/connection-helper.h"
+
+#include <QDebug>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSet>
+
+#include <algorithm>
+#include <functional>
+
+// JSON Keys
+namespace
+{
+    constexpr const char BACKUPS_KEY[] = "backups";
+}
+
+QString const BackupIndex::FILE_NAME = QStringLiteral("index.json");
+
+constexpr int BackupIndex::MAX_CANDIDATES;
+
+/***
+****
+***/
+
+class BackupIndexPrivate
+{
+public:
+    BackupIndexPrivate(QSharedPointer<StorageFrameworkClient> const & storage, BackupIndex * index)
+        : q_ptr{index}
+        , storage_{storage}
+    {
+    }
+
+    ~BackupIndexPrivate() = default;
+
+    Q_DISABLE_COPY(BackupIndexPrivate)
+
+    void read(QVector<QString> const & dirs)
+    {
+        dirs_ = dirs;
+        candidates_ = BackupIndex::candidates(dirs);
+        read_next_candidate([this](bool found){
+            Q_EMIT(q_ptr->finished(found));
+        });
+    }
+
+    void update(QVector<QString> const & dirs, QString const & dir_name, QVector<Metadata> const & entries)
+    {
+        // this run's own dir has no index yet
+        dirs_.clear();
+        for (auto const& dir : dirs)
+            if (dir != dir_name)
+                dirs_ << dir;
+        candidates_ = BackupIndex::candidates(dirs_);
+
+        read_next_candidate([this, dir_name, entries](bool found){
+            if (!found)
+                qDebug() << "no backup index found; building one from the manifests";
+
+            // fill in whatever the old index doesn't cover
+            missing_.clear();
+            for (auto const& dir : dirs_)
+                if (!backups_.contains(dir))
+                    missing_ << dir;
+            backups_[dir_name] = entries;
+            read_next_missing(dir_name);
+        });
+    }
+
+    BackupIndex::Backups backups() const
+    {
+        return backups_;
+    }
+
+private:
+
+    void read_next_candidate(std::function<void(bool)> const & on_done)
+    {
+        if (candidates_.isEmpty())
+        {
+            backups_.clear();
+            on_done(false);
+            return;
+        }
+
+        auto const dir = candidates_.takeFirst();
+        download(dir, BackupIndex::FILE_NAME, [this, dir, on_done](QByteArray const & bytes){
+            BackupIndex::Backups backups;
+            if (bytes.isEmpty() || !BackupIndex::from_json(bytes, backups))
+            {
+                qDebug() << "no usable backup index in" << dir;
+                read_next_candidate(on_done);
+                return;
+            }
+
+            // forget the backups that have been deleted since
+            QSet<QString> const keep = QSet<QString>::fromList(dirs_.toList());
+            backups_.clear();
+            for (auto it=backups.cbegin(), end=backups.cend(); it!=end; ++it)
+                if (keep.contains(it.key()))
+                    backups_.insert(it.key(), it.value());
+            qDebug() << "backup index in" << dir << "covers" << backups_.size() << "of" << dirs_.size() << "backups";
+            on_done(true);
+        });
+    }
+
+    void read_next_missing(QString const & dir_name)
+    {
+        if (missing_.isEmpty())
+        {
+            store(dir_name);
+            return;
+        }
+
+        auto const dir = missing_.takeFirst();
+        QSharedPointer<Manifest> manifest(new Manifest(storage_, dir), [](Manifest *m){m->deleteLater();});
+        connections_.connect_oneshot(
+            manifest.data(),
+            &Manifest::finished,
+            std::function<void(bool)>{[this, dir_name, dir, manifest](bool success){
+                // leave out the ones that can't be read, so readers try them on their own
+                if (success)
+                    backups_[dir] = manifest->get_entries();
+                read_next_missing(dir_name);
+            }}
+        );
+        manifest->read();
+    }
+
+    void store(QString const & dir_name)
+    {
+        auto const data = BackupIndex::to_json(backups_);
+
+        connections_.connect_future(
+            storage_->get_new_uploader(data.size(), dir_name, BackupIndex::FILE_NAME),
+            std::function<void(std::shared_ptr<Uploader> const&)>{
+                [this, data](std::shared_ptr<Uploader> const& uploader){
+                    if (!uploader)
+                    {
+                        qWarning() << "Error retrieving uploader for the backup index from storage-framework";
+                        Q_EMIT(q_ptr->finished(false));
+                        return;
+                    }
+                    uploader->socket()->write(data);
+                    connections_.connect_oneshot(
+                        uploader.get(),
+                        &Uploader::commit_finished,
+                        std::function<void(bool)>{[this, uploader](bool success){
+                            Q_EMIT(q_ptr->finished(success));
+                        }}
+                    );
+                    uploader->commit();
+                }
+            }
+        );
+    }
+
+    // passes an empty array if the file can't be read
+    void download(QString const & dir_name, QString const & file_name, std::function<void(QByteArray const &)> const & on_done)
+    {
+        connections_.connect_future(
+            storage_->get_new_downloader(dir_name, file_name),
+            std::function<void(std::shared_ptr<Downloader> const&)>{
+                [this, on_done](std::shared_ptr<Downloader> const& downloader){
+                    if (!downloader)
+                    {
+                        on_done(QByteArray());
+                        return;
+                    }
+
+                    QSharedPointer<DownloadReader> reader(new DownloadReader(downloader), [](DownloadReader *r){r->deleteLater();});
+                    connections_.connect_oneshot(
+                        reader.data(),
+                        &DownloadReader::finished,
+                        std::function<void(bool)>{[downloader, reader, on_done](bool success){
+                            downloader->finish();
+                            on_done(success ? reader->bytes() : QByteArray());
+                        }}
+                    );
+                    reader->start();
+                }
+            }
+        );
+    }
+
+    BackupIndex * const q_ptr;
+    QSharedPointer<StorageFrameworkClient> storage_;
+
+    QVector<QString> dirs_;       // the backups that are in storage
+    QVector<QString> candidates_; // the dirs still to look for an index in
+    QVector<QString> missing_;    // the backups whose manifests still need reading
+    BackupIndex::Backups backups_;
+
+    ConnectionHelper connections_;
+};
+
+/***
+****
+***/
+
+BackupIndex::BackupIndex(QSharedPointer<StorageFrameworkClient> const & storage, QObject * parent)
+    : QObject(parent)
+    , d_ptr{new BackupIndexPrivate{storage, this}}
+{
+}
+
+BackupIndex::~BackupIndex() = default;
+
+void
+BackupIndex::read(QVector<QString> const & dirs)
+{
+    Q_D(BackupIndex);
+
+    d->read(dirs);
+}
+
+void
+BackupIndex::update(QVector<QString> const & dirs, QString const & dir_name, QVector<Metadata> const & entries)
+{
+    Q_D(BackupIndex);
+
+    d->update(dirs, dir_name, entries);
+}
+
+BackupIndex::Backups
+BackupIndex::backups() const
+{
+    Q_D(const BackupIndex);
+
+    return d->backups();
+}
+
+QVector<QString>
+BackupIndex::candidates(QVector<QString> const & dirs)
+{
+    // backup dirs are named by their start time, so they sort by age
+    auto sorted = dirs;
+    std::sort(sorted.begin(), sorted.end(), std::greater<QString>());
+    if (sorted.size() > MAX_CANDIDATES)
+        sorted.resize(MAX_CANDIDATES);
+    return sorted;
+}
+
+QByteArray
+BackupIndex::to_json(Backups const & backups)
+{
+    QJsonObject dirs;
+    for (auto it=backups.cbegin(), end=backups.cend(); it!=end; ++it)
+    {
+        QJsonArray entries;
+        for (auto const& entry : it.value())
+            entries.append(entry.json());
+        dirs[it.key()] = entries;
+    }
+
+    QJsonObject root;
+    root[BACKUPS_KEY] = dirs;
+    return QJsonDocument(root).toJson(QJsonDocument::Compact);
+}
+
+bool
+BackupIndex::from_json(QByteArray const & json, Backups & backups)
+{
+    auto const doc = QJsonDocument::fromJson(json);
+    if (!doc.isObject())
+        return false;
+
+    auto const root = doc.object();
+    auto const dirs = root[BACKUPS_KEY];
+    if (!dirs.isObject())
+        return false;
+
+    backups.clear();
+    auto const obj = dirs.toObject();
+    for (auto it=obj.begin(), end=obj.end(); it!=end; ++it)
+    {
+        QVector<Metadata> entries;
+        for (auto const& val : it.value().toArray())
+            entries.push_back(Metadata(val.toObject()));
+        backups.insert(it.key(), entries);
+    }
+    return true;
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+
+#pragma once
+
+#include "helper/metadata.h"
+
+#include <QMap>
+#include <QObject>
+#include <QSharedPointer>
+#include <QString>
+#include <QVector>
+
+class BackupIndexPrivate;
+class StorageFrameworkClient;
+
+/**
+ * A summary of every backup's manifest, so that a device with nothing
+ * cached can list the restore choices without reading one manifest
+ * per backup.
+ *
+ * Each backup run stores an index next to its manifest that covers its
+ * own entries and those of every older backup. Since manifests are never
+ * changed once written, the newest index is valid for every backup that
+ * it covers and that is still in storage. Readers only need to read the
+ * manifests of backups that it doesn't cover, eg ones made by a run that
+ * was interrupted before it could store its index.
+ */
+class BackupIndex : public QObject
+{
+    Q_OBJECT
+    Q_DECLARE_PRIVATE(BackupIndex)
+public:
+    // backup dir -> the entries of its manifest
+    using Backups = QMap<QString,QVector<Metadata>>;
+
+    explicit BackupIndex(QSharedPointer<StorageFrameworkClient> const & storage, QObject * parent = nullptr);
+    virtual ~BackupIndex();
+    Q_DISABLE_COPY(BackupIndex)
+
+    // reads the newest index that can be found among the backups in `dirs`
+    void read(QVector<QString> const & dirs);
+
+    // stores an index in `dir_name` that covers its manifest's `entries`
+    // as well as every other backup in `dirs`
+    void update(QVector<QString> const & dirs, QString const & dir_name, QVector<Metadata> const & entries);
+
+    // what the index says about the backups in `dirs`
+    Backups backups() const;
+
+    static QString const FILE_NAME;
+
+    // the newest index is in the newest backup, unless that one didn't
+    // finish. Returns which dirs to look in, in the order to try them
+    static QVector<QString> candidates(QVector<QString> const & dirs);
+    static constexpr int MAX_CANDIDATES {3};
+
+    static QByteArray to_json(Backups const & backups);
+    static bool from_json(QByteArray const & json, Backups & backups);
+
+Q_SIGNALS:
+    void finished(bool success);
+
+private:
+    QScopedPointer<BackupIndexPrivate> const d_ptr;
+};
@@ -0,0 +1,276 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "service/bandwidth-schedule.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+#include <algorithm> // std::max(), std::min()
+
+namespace
+{
+
+constexpr int MSEC_PER_DAY {24*60*60*1000};
+
+QString const TIME_FORMAT {QStringLiteral("HH:mm")};
+QString const NAME_KEY {QStringLiteral("name")};
+QString const DEFAULT_KEY {QStringLiteral("default")};
+QString const PROFILES_KEY {QStringLiteral("profiles")};
+
+bool contains(BandwidthSchedule::Profile const& profile, QTime const& time)
+{
+    if (profile.start <= profile.end)
+        return (profile.start <= time) && (time < profile.end);
+
+    // wraps past midnight
+    return (profile.start <= time) || (time < profile.end);
+}
+
+int msec_until(QTime const& from, QTime const& to)
+{
+    auto const msec = from.msecsTo(to);
+    return msec > 0 ? msec : msec + MSEC_PER_DAY;
+}
+
+QJsonObject limits_to_json(BandwidthSchedule::Limits const& limits)
+{
+    QJsonObject json;
+    json[BandwidthSchedule::UPLOAD_LIMIT_KEY] = double(limits.upload);
+    json[BandwidthSchedule::DOWNLOAD_LIMIT_KEY] = double(limits.download);
+    return json;
+}
+
+BandwidthSchedule::Limits limits_from_json(QJsonObject const& json)
+{
+    BandwidthSchedule::Limits limits;
+    limits.upload = quint64(std::max(json[BandwidthSchedule::UPLOAD_LIMIT_KEY].toDouble(), 0.0));
+    limits.download = quint64(std::max(json[BandwidthSchedule::DOWNLOAD_LIMIT_KEY].toDouble(), 0.0));
+    return limits;
+}
+
+} // anonymous namespace
+
+QString const BandwidthSchedule::START_KEY {QStringLiteral("start")};
+QString const BandwidthSchedule::END_KEY {QStringLiteral("end")};
+QString const BandwidthSchedule::UPLOAD_LIMIT_KEY {QStringLiteral("upload-limit")};
+QString const BandwidthSchedule::DOWNLOAD_LIMIT_KEY {QStringLiteral("download-limit")};
+
+bool
+BandwidthSchedule::Limits::operator==(Limits const& that) const
+{
+    return (upload == that.upload) && (download == that.download);
+}
+
+bool
+BandwidthSchedule::Limits::operator!=(Limits const& that) const
+{
+    return !(*this == that);
+}
+
+void
+BandwidthSchedule::set_default_limits(Limits const& limits)
+{
+    default_limits_ = limits;
+}
+
+BandwidthSchedule::Limits
+BandwidthSchedule::default_limits() const
+{
+    return default_limits_;
+}
+
+void
+BandwidthSchedule::set_profiles(QVector<Profile> const& profiles)
+{
+    profiles_ = profiles;
+}
+
+QVector<BandwidthSchedule::Profile>
+BandwidthSchedule::profiles() const
+{
+    return profiles_;
+}
+
+BandwidthSchedule::Limits
+BandwidthSchedule::limits_at(QTime const& time) const
+{
+    for (auto const& profile : profiles_)
+        if (contains(profile, time))
+            return profile.limits;
+
+    return default_limits_;
+}
+
+int
+BandwidthSchedule::msec_until_change(QTime const& time) const
+{
+    int ret {-1};
+
+    for (auto const& profile : profiles_)
+    {
+        for (auto const& boundary : { profile.start, profile.end })
+        {
+            auto const msec = msec_until(time, boundary);
+            ret = ret == -1 ? msec : std::min(ret, msec);
+        }
+    }
+
+    return ret;
+}
+
+bool
+BandwidthSchedule::limits_uploads() const
+{
+    if (default_limits_.upload)
+        return true;
+
+    for (auto const& profile : profiles_)
+        if (profile.limits.upload)
+            return true;
+
+    return false;
+}
+
+bool
+BandwidthSchedule::parse_profiles(QVariantDictMap const& map, QVector<Profile>& setme, QString& setme_error)
+{
+    QVector<Profile> profiles;
+
+    for (auto it=map.begin(), end=map.end(); it!=end; ++it)
+    {
+        auto const& props = it.value();
+
+        Profile profile;
+        profile.name = it.key();
+        profile.start = QTime::fromString(props.value(START_KEY).toString(), TIME_FORMAT);
+        profile.end = QTime::fromString(props.value(END_KEY).toString(), TIME_FORMAT);
+        if (!profile.start.isValid() || !profile.end.isValid() || (profile.start == profile.end))
+        {
+            setme_error = QStringLiteral("profile '%1' needs distinct '%2' and '%3' times formatted as %4")
+                .arg(profile.name).arg(START_KEY).arg(END_KEY).arg(TIME_FORMAT);
+            return false;
+        }
+
+        bool upload_ok {true};
+        if (props.contains(UPLOAD_LIMIT_KEY))
+            profile.limits.upload = props.value(UPLOAD_LIMIT_KEY).toULongLong(&upload_ok);
+        bool download_ok {true};
+        if (props.contains(DOWNLOAD_LIMIT_KEY))
+            profile.limits.download = props.value(DOWNLOAD_LIMIT_KEY).toULongLong(&download_ok);
+        if (!upload_ok || !download_ok)
+        {
+            setme_error = QStringLiteral("profile '%1' has an invalid '%2'")
+                .arg(profile.name).arg(upload_ok ? DOWNLOAD_LIMIT_KEY : UPLOAD_LIMIT_KEY);
+            return false;
+        }
+
+        profiles << profile;
+    }
+
+    // QMap is sorted by name, which gives overlapping profiles a predictable order
+    setme = profiles;
+    return true;
+}
+
+QJsonObject
+BandwidthSchedule::to_json() const
+{
+    QJsonArray profiles;
+    for (auto const& profile : profiles_)
+    {
+        auto json = limits_to_json(profile.limits);
+        json[NAME_KEY] = profile.name;
+        json[START_KEY] = profile.start.toString(TIME_FORMAT);
+        json[END_KEY] = profile.end.toString(TIME_FORMAT);
+        profiles.append(json);
+    }
+
+    QJsonObject json;
+    json[DEFAULT_KEY] = limits_to_json(default_limits_);
+    json[PROFILES_KEY] = profiles;
+    return json;
+}
+
+BandwidthSchedule
+BandwidthSchedule::from_json(QJsonObject const& json)
+{
+    BandwidthSchedule schedule;
+    schedule.default_limits_ = limits_from_json(json[DEFAULT_KEY].toObject());
+
+    for (auto const& value : json[PROFILES_KEY].toArray())
+    {
+        auto const obj = value.toObject();
+        Profile profile;
+        profile.name = obj[NAME_KEY].toString();
+        profile.start = QTime::fromString(obj[START_KEY].toString(), TIME_FORMAT);
+        profile.end = QTime::fromString(obj[END_KEY].toString(), TIME_FORMAT);
+        profile.limits = limits_from_json(obj);
+        if (profile.start.isValid() && profile.end.isValid())
+            schedule.profiles_ << profile;
+    }
+
+    return schedule;
+}
+
+QString
+BandwidthSchedule::default_path()
+{
+    return QDir(QStandardPaths::writableLocation(QStandardPaths::GenericConfigLocation))
+        .filePath(QStringLiteral("keeper/bandwidth.json"));
+}
+
+bool
+BandwidthSchedule::save(QString const& path) const
+{
+    QDir().mkpath(QFileInfo(path).absolutePath());
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        qWarning() << "Unable to save bandwidth schedule to" << path << ':' << file.errorString();
+        return false;
+    }
+    file.write(QJsonDocument(to_json()).toJson());
+    return file.commit();
+}
+
+BandwidthSchedule
+BandwidthSchedule::load(QString const& path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return BandwidthSchedule();
+
+    QJsonParseError error;
+    auto const doc = QJsonDocument::fromJson(file.readAll(), &error);
+    if (error.error != QJsonParseError::NoError)
+    {
+        qWarning() << "Ignoring unreadable bandwidth schedule" << path << ':' << error.errorString();
+        return BandwidthSchedule();
+    }
+
+    return from_json(doc.object());
+}
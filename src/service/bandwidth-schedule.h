@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#pragma once
+
+#include "qdbus-stubs/dbus-types.h" // QVariantDictMap
+
+#include <QJsonObject>
+#include <QString>
+#include <QTime>
+#include <QVector>
+
+/**
+ * Upload and download rate limits, optionally varying by time of day.
+ *
+ * Each profile covers [start, end) in local time, wrapping past midnight
+ * if end is before start. Where profiles overlap, the first one wins;
+ * outside of them all, the default limits apply.
+ *
+ * Limits are in bytes per second, and 0 means unlimited.
+ */
+class BandwidthSchedule
+{
+public:
+    struct Limits
+    {
+        quint64 upload {};
+        quint64 download {};
+
+        bool operator==(Limits const& that) const;
+        bool operator!=(Limits const& that) const;
+    };
+
+    struct Profile
+    {
+        QString name;
+        QTime start;
+        QTime end;
+        Limits limits;
+    };
+
+    void set_default_limits(Limits const& limits);
+    Limits default_limits() const;
+
+    void set_profiles(QVector<Profile> const& profiles);
+    QVector<Profile> profiles() const;
+
+    // the limits in effect at `time`
+    Limits limits_at(QTime const& time) const;
+
+    // msec from `time` until a profile starts or ends, or -1 if none ever will
+    int msec_until_change(QTime const& time) const;
+
+    // true if uploads are limited at any time of day
+    bool limits_uploads() const;
+
+    // D-Bus: profile names mapped to their 'start' and 'end' ("HH:mm")
+    // and 'upload-limit' and 'download-limit' (uint64) properties
+    static bool parse_profiles(QVariantDictMap const& map, QVector<Profile>& setme, QString& setme_error);
+
+    QJsonObject to_json() const;
+    static BandwidthSchedule from_json(QJsonObject const& json);
+
+    // where the user's schedule is kept between runs
+    static QString default_path();
+    bool save(QString const& path) const;
+    static BandwidthSchedule load(QString const& path);
+
+    static QString const START_KEY;
+    static QString const END_KEY;
+    static QString const UPLOAD_LIMIT_KEY;
+    static QString const DOWNLOAD_LIMIT_KEY;
+
+private:
+    Limits default_limits_;
+    QVector<Profile> profiles_;
+};
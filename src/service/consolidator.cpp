@@ -0,0 +1,642 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "service/consolidator.h"
+
+#include "service/backup-chains.h"
+#include "service/backup-index.h"
+#include "service/manifest.h"
+#include "storage-framework/storage_framework_client.h"
+#include "tar/delta.h"
+#include "tar/tar-creator.h"
+#include "tar/tar-index.h"
+#include "tar/untar-thread.h"
+#include "util/connection-helper.h"
+
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QStorageInfo>
+#include <QTemporaryDir>
+#include <QTimer>
+#include <QUuid>
+
+#include <algorithm> // std::max_element()
+#include <functional> // std::bind()
+#include <memory>
+#include <sstream>
+#include <unordered_set>
+#include <vector>
+
+namespace
+{
+    constexpr char const DIR_NAME_FORMAT[] = "yyyy-MM-ddTHH-mm-ss";
+
+    // how much to keep queued in the upload socket
+    constexpr qint64 UPLOAD_BUFFER_MAX_SIZE {1024*1024};
+
+    // how much to read from the download socket at a time
+    constexpr qint64 DOWNLOAD_READ_SIZE {64*1024};
+
+    // free space to leave alone when staging a chain
+    constexpr qint64 STAGING_RESERVE {256*1024*1024};
+}
+
+class ConsolidatorPrivate
+{
+public:
+    ConsolidatorPrivate(QSharedPointer<StorageFrameworkClient> const & storage, Consolidator * consolidator)
+        : q_ptr{consolidator}
+        , storage_{storage}
+    {
+    }
+
+    ~ConsolidatorPrivate() = default;
+
+    Q_DISABLE_COPY(ConsolidatorPrivate)
+
+    void start(int max_incrementals)
+    {
+        if (active_)
+        {
+            qDebug() << "consolidation already in progress";
+            return;
+        }
+
+        active_ = true;
+        cancelled_ = false;
+        max_incrementals_ = max_incrementals;
+        entries_.clear();
+        queue_.clear();
+        n_consolidated_ = 0;
+
+        connections_.connect_future(
+            storage_->get_keeper_dirs(),
+            std::function<void(QVector<QString> const&)>{
+                [this](QVector<QString> const& dirs){
+                    if (dirs.isEmpty())
+                        finish(true);
+                    else
+                        read_manifests(dirs);
+                }
+            }
+        );
+    }
+
+    void cancel()
+    {
+        if (!active_)
+            return;
+
+        cancelled_ = true;
+
+        // the current chain is abandoned; finish() cleans up
+        if (downloader_ || uploader_)
+            finish(false);
+    }
+
+    bool is_active() const
+    {
+        return active_;
+    }
+
+private:
+
+    /***
+    ****  Planning
+    ***/
+
+    void read_manifests(QVector<QString> const& dirs)
+    {
+        dir_name_ = choose_dir_name(dirs);
+
+        manifests_to_read_ = dirs.size();
+        for (auto const& dir : dirs)
+        {
+            QSharedPointer<Manifest> manifest(new Manifest(storage_, dir), [](Manifest *m){m->deleteLater();});
+            connections_.connect_oneshot(
+                manifest.data(),
+                &Manifest::finished,
+                std::function<void(bool)>{[this, manifest](bool success){
+                    if (success)
+                        entries_ += manifest->get_entries();
+                    if (!--manifests_to_read_)
+                        plan();
+                }}
+            );
+            manifest->read();
+        }
+    }
+
+    // the synthetic full must sort after every backup that it consolidates
+    static QString choose_dir_name(QVector<QString> const& dirs)
+    {
+        auto dir_name = QDateTime::currentDateTime().toString(DIR_NAME_FORMAT);
+
+        auto const newest = *std::max_element(dirs.begin(), dirs.end());
+        if (dir_name <= newest)
+        {
+            auto const when = QDateTime::fromString(newest, DIR_NAME_FORMAT);
+            if (when.isValid())
+                dir_name = when.addSecs(1).toString(DIR_NAME_FORMAT);
+        }
+
+        return dir_name;
+    }
+
+    void plan()
+    {
+        if (cancelled_)
+        {
+            finish(false);
+            return;
+        }
+
+        BackupChains chains(entries_);
+        for (auto const& key : chains.keys())
+        {
+            auto const n = chains.incrementals_since_full(key);
+            if (n > max_incrementals_)
+            {
+                qDebug() << "consolidating" << key << "which has" << n << "incrementals";
+                queue_ << chains.restore_chain(chains.chain(key).last());
+            }
+        }
+
+        if (queue_.isEmpty())
+        {
+            finish(true);
+            return;
+        }
+
+        manifest_.reset(new Manifest(storage_, dir_name_), [](Manifest *m){m->deleteLater();});
+        next_chain();
+    }
+
+    /***
+    ****  Replaying a chain into the staging directory
+    ***/
+
+    void next_chain()
+    {
+        if (cancelled_)
+        {
+            finish(false);
+            return;
+        }
+
+        if (queue_.isEmpty())
+        {
+            store_manifest();
+            return;
+        }
+
+        chain_ = queue_.takeFirst();
+        chain_pos_ = 0;
+        staging_.reset(new QTemporaryDir(QDir(QDir::tempPath()).filePath(QStringLiteral("keeper-consolidate-XXXXXX"))));
+        if (!staging_->isValid())
+        {
+            qWarning() << "unable to create a staging directory for consolidation";
+            finish(false);
+            return;
+        }
+
+        download_next();
+    }
+
+    void download_next()
+    {
+        if (chain_pos_ >= chain_.size())
+        {
+            upload();
+            return;
+        }
+
+        auto const& entry = chain_[chain_pos_];
+        qDebug() << "consolidation is downloading" << entry.get_dir_name() << entry.get_file_name();
+
+        connections_.connect_future(
+            Manifest::open_archive(storage_, entry),
+            std::function<void(std::shared_ptr<Downloader> const&)>{
+                [this](std::shared_ptr<Downloader> const& downloader){
+                    if (cancelled_)
+                    {
+                        finish(false);
+                    }
+                    else if (!downloader)
+                    {
+                        chain_failed(QStringLiteral("unable to get a downloader"));
+                    }
+                    else if (!has_room_for(downloader->file_size()))
+                    {
+                        downloader->finish();
+                        chain_failed(QStringLiteral("not enough free space to stage it"));
+                    }
+                    else
+                    {
+                        downloader_ = downloader;
+                        n_read_ = 0;
+                        untar_.reset(new UntarThread(staging_->path().toStdString()));
+                        QObject::connect(untar_.get(), &UntarThread::ready_for_more, q_ptr,
+                                         std::bind(&ConsolidatorPrivate::on_ready_read, this));
+                        QObject::connect(untar_.get(), &UntarThread::finished, q_ptr,
+                                         std::bind(&ConsolidatorPrivate::on_extracted, this, std::placeholders::_1));
+                        if (chain_pos_ == chain_.size()-1)
+                            newest_indexer_ = TarIndexer{};
+                        downloader_->socket()->setReadBufferSize(DOWNLOAD_READ_SIZE);
+                        socket_connection_ = QObject::connect(
+                            downloader_->socket().get(), &QLocalSocket::readyRead,
+                            std::bind(&ConsolidatorPrivate::on_ready_read, this)
+                        );
+                        on_ready_read();
+                    }
+                }
+            }
+        );
+    }
+
+    // Extracting takes about as much room as the archive, and applying
+    // a delta briefly needs a second copy of the file that it patches
+    bool has_room_for(qint64 archive_size) const
+    {
+        QStorageInfo const info(staging_->path());
+        if (!info.isValid())
+            return true;
+
+        auto const available = info.bytesAvailable();
+        if (available >= 2*archive_size + STAGING_RESERVE)
+            return true;
+
+        qWarning() << "consolidation needs about" << 2*archive_size << "bytes in" << staging_->path() << "but only" << available << "are free";
+        return false;
+    }
+
+    // the extraction runs in its own thread; this only hands it the bytes
+    void on_ready_read()
+    {
+        if (!downloader_ || !untar_)
+            return;
+
+        auto socket = downloader_->socket();
+
+        bool room = true;
+        while (room && socket->bytesAvailable() > 0)
+        {
+            auto const buf = socket->read(DOWNLOAD_READ_SIZE);
+            n_read_ += buf.size();
+            if (chain_pos_ == chain_.size()-1)
+                newest_indexer_.feed(buf.constData(), size_t(buf.size()));
+            room = untar_->step(buf);
+        }
+
+        if (n_read_ < downloader_->file_size())
+            return;
+
+        QObject::disconnect(socket_connection_);
+        untar_->finish();
+    }
+
+    void on_extracted(bool ok)
+    {
+        // the extraction can fail before the whole archive was read
+        QObject::disconnect(socket_connection_);
+        if (!downloader_)
+            return;
+        downloader_->finish();
+
+        // don't destroy the socket or the thread from inside their own signals
+        auto downloader = downloader_;
+        downloader_.reset();
+        QTimer::singleShot(0, q_ptr, [this, downloader, ok](){
+            untar_.reset();
+            if (cancelled_)
+                finish(false);
+            else if (!ok)
+                chain_failed(QStringLiteral("unable to extract the archive"));
+            else {
+                ++chain_pos_;
+                download_next();
+            }
+        });
+    }
+
+    /***
+    ****  Uploading the staging directory as a full backup
+    ***/
+
+    // Files that were deleted partway along the chain are still in the
+    // staging dir. Only the ones in the newest backup belong in the
+    // synthetic full, just as RestorePlanner only restores those.
+    bool prune_staging()
+    {
+        if (!newest_indexer_.is_tar() || !newest_indexer_.finished())
+            return false;
+
+        std::unordered_set<std::string> live;
+        for (auto const& entry : newest_indexer_.entries())
+            live.insert(QDir::cleanPath(QString::fromStdString(Delta::target_name(entry.path))).toStdString());
+
+        QDir const base(staging_->path());
+        QDirIterator it(base.path(), QDir::Files|QDir::Hidden|QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+        while (it.hasNext())
+        {
+            auto const path = it.next();
+            if (!live.count(QDir::cleanPath(base.relativeFilePath(path)).toStdString()))
+            {
+                qDebug() << "consolidation is dropping" << path << "; it's not in the newest backup";
+                QFile::remove(path);
+            }
+        }
+        return true;
+    }
+
+    void upload()
+    {
+        if (!prune_staging())
+        {
+            chain_failed(QStringLiteral("unable to tell which files are in the newest backup"));
+            return;
+        }
+
+        QStringList files;
+        QDir const base(staging_->path());
+        QDirIterator it(base.path(), QDir::Files|QDir::Hidden|QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+        while (it.hasNext())
+            files << QStringLiteral("./") + base.relativeFilePath(it.next());
+        files.sort();
+
+        indexer_ = TarIndexer{};
+        tar_creator_.reset(new TarCreator(files, false));
+        tar_creator_->set_base_dir(base.path());
+        auto const n_bytes = tar_creator_->calculate_size();
+        if (n_bytes < 0)
+        {
+            chain_failed(QStringLiteral("unable to calculate the archive size"));
+            return;
+        }
+
+        auto const file_name = QStringLiteral("%1.keeper").arg(chain_.last().get_display_name());
+        connections_.connect_future(
+            storage_->get_new_archive_uploader(n_bytes, dir_name_, file_name),
+            std::function<void(std::shared_ptr<Uploader> const&)>{
+                [this, n_bytes](std::shared_ptr<Uploader> const& uploader){
+                    if (cancelled_)
+                    {
+                        finish(false);
+                    }
+                    else if (!uploader)
+                    {
+                        chain_failed(QStringLiteral("unable to get an uploader"));
+                    }
+                    else
+                    {
+                        uploader_ = uploader;
+                        upload_size_ = n_bytes;
+                        socket_connection_ = QObject::connect(
+                            uploader_->socket().get(), &QLocalSocket::bytesWritten,
+                            std::bind(&ConsolidatorPrivate::write_more, this)
+                        );
+                        write_more();
+                    }
+                }
+            }
+        );
+    }
+
+    void write_more()
+    {
+        auto socket = uploader_->socket();
+
+        while (socket->bytesToWrite() < UPLOAD_BUFFER_MAX_SIZE)
+        {
+            if (!tar_creator_->step(upload_buf_))
+            {
+                QObject::disconnect(socket_connection_);
+                commit();
+                return;
+            }
+            indexer_.feed(upload_buf_.data(), upload_buf_.size());
+            if (!upload_buf_.empty() && (socket->write(upload_buf_.data(), qint64(upload_buf_.size())) < 0))
+            {
+                QObject::disconnect(socket_connection_);
+                chain_failed(socket->errorString());
+                return;
+            }
+        }
+    }
+
+    void commit()
+    {
+        connections_.connect_oneshot(
+            uploader_.get(),
+            &Uploader::commit_finished,
+            std::function<void(bool)>{[this](bool success){
+                QTimer::singleShot(0, q_ptr, [this, success](){
+                    if (!uploader_) // cancelled
+                        return;
+
+                    if (!success)
+                    {
+                        chain_failed(QStringLiteral("unable to commit the archive"));
+                        return;
+                    }
+
+                    // the synthetic full describes the same item as the chain's newest backup
+                    auto entry = chain_.last();
+                    entry.set_property_value(keeper::Item::UUID_KEY, QUuid::createUuid().toString());
+                    entry.set_property_value(keeper::Item::DIR_NAME_KEY, dir_name_);
+                    entry.set_property_value(keeper::Item::FILE_NAME_KEY, uploader_->file_name());
+                    entry.set_property_value(keeper::Item::INCREMENTAL_KEY, false);
+                    entry.set_parts(uploader_->part_names(), uploader_->part_size(), upload_size_);
+                    manifest_->add_entry(entry);
+                    if (indexer_.finished())
+                    {
+                        std::ostringstream catalog;
+                        TarIndexer::write_catalog(catalog, indexer_.entries());
+                        manifest_->add_catalog(uploader_->file_name(), QByteArray::fromStdString(catalog.str()));
+                    }
+                    ++n_consolidated_;
+
+                    release_chain();
+                    next_chain();
+                });
+            }}
+        );
+        uploader_->commit();
+    }
+
+    void chain_failed(QString const& why)
+    {
+        qWarning() << "unable to consolidate" << chain_.last().get_display_name() << ':' << why;
+        release_chain();
+        next_chain();
+    }
+
+    void release_chain()
+    {
+        QObject::disconnect(socket_connection_);
+        tar_creator_.reset();
+        untar_.reset();
+        downloader_.reset();
+        uploader_.reset();
+        staging_.reset();
+        chain_.clear();
+        upload_buf_.clear();
+    }
+
+    /***
+    ****
+    ***/
+
+    void store_manifest()
+    {
+        if (!n_consolidated_)
+        {
+            finish(false);
+            return;
+        }
+
+        connections_.connect_oneshot(
+            manifest_.data(),
+            &Manifest::finished,
+            std::function<void(bool)>{[this](bool success){
+                if (!success)
+                {
+                    qWarning() << "unable to store the consolidation manifest:" << manifest_->error();
+                    finish(false);
+                    return;
+                }
+                store_index(manifest_->get_entries());
+            }}
+        );
+        manifest_->store();
+    }
+
+    // the consolidated dir is the newest backup now,
+    // so its index is the one that restore choices read
+    void store_index(QVector<Metadata> const& entries)
+    {
+        connections_.connect_future(
+            storage_->get_keeper_dirs(),
+            std::function<void(QVector<QString> const&)>{
+                [this, entries](QVector<QString> const& dirs){
+                    if (dirs.isEmpty())
+                    {
+                        qWarning() << "unable to list the backups; not updating the backup index";
+                        finish(true);
+                        return;
+                    }
+                    QSharedPointer<BackupIndex> index(new BackupIndex(storage_), [](BackupIndex *i){i->deleteLater();});
+                    connections_.connect_oneshot(
+                        index.data(),
+                        &BackupIndex::finished,
+                        std::function<void(bool)>{[this, index](bool success){
+                            if (!success)
+                                qWarning() << "unable to store the backup index; restore choices will read the manifests instead";
+                            finish(true);
+                        }}
+                    );
+                    index->update(dirs, dir_name_, entries);
+                }
+            }
+        );
+    }
+
+    void finish(bool success)
+    {
+        qDebug() << "consolidation finished; success =" << success << "consolidated =" << n_consolidated_;
+
+        release_chain();
+        queue_.clear();
+        entries_.clear();
+        manifest_.reset();
+        active_ = false;
+
+        Q_EMIT(q_ptr->finished(success));
+    }
+
+    Consolidator * const q_ptr;
+    QSharedPointer<StorageFrameworkClient> storage_;
+
+    bool active_ {};
+    bool cancelled_ {};
+    int max_incrementals_ {Consolidator::MAX_INCREMENTALS};
+    int manifests_to_read_ {};
+    int n_consolidated_ {};
+
+    QString dir_name_;
+    QVector<Metadata> entries_;
+    QVector<QVector<Metadata>> queue_;
+    QSharedPointer<Manifest> manifest_;
+
+    // the chain being consolidated
+    QVector<Metadata> chain_;
+    int chain_pos_ {};
+    QScopedPointer<QTemporaryDir> staging_;
+    std::shared_ptr<Downloader> downloader_;
+    std::unique_ptr<UntarThread> untar_;
+    qint64 n_read_ {};
+    std::shared_ptr<Uploader> uploader_;
+    qint64 upload_size_ {};
+    std::unique_ptr<TarCreator> tar_creator_;
+    std::vector<char> upload_buf_;
+    TarIndexer indexer_;
+    TarIndexer newest_indexer_; // the chain's newest archive, to find the live files
+    QMetaObject::Connection socket_connection_;
+
+    ConnectionHelper connections_;
+};
+
+/***
+****
+***/
+
+Consolidator::Consolidator(QSharedPointer<StorageFrameworkClient> const & storage, QObject * parent)
+    : QObject(parent)
+    , d_ptr(new ConsolidatorPrivate(storage, this))
+{
+}
+
+Consolidator::~Consolidator() = default;
+
+void
+Consolidator::start(int max_incrementals)
+{
+    Q_D(Consolidator);
+
+    d->start(max_incrementals);
+}
+
+void
+Consolidator::cancel()
+{
+    Q_D(Consolidator);
+
+    d->cancel();
+}
+
+bool
+Consolidator::is_active() const
+{
+    Q_D(const Consolidator);
+
+    return d->is_active();
+}
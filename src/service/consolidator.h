@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#pragma once
+
+#include <QObject>
+#include <QScopedPointer>
+#include <QSharedPointer>
+
+class ConsolidatorPrivate;
+class StorageFrameworkClient;
+
+/**
+ * Background job that bounds how long incremental chains can get.
+ *
+ * For every item whose newest backup depends on more than `max_incrementals`
+ * incremental backups, this downloads the chain, replays it into a staging
+ * directory, drops the files that the newest backup no longer has, and
+ * uploads the result as a new synthetic full backup in a
+ * new backup directory with its own manifest and backup index.
+ *
+ * Items that don't need consolidating are left where they are, so the
+ * new manifest only references the archives that were rebuilt.
+ */
+class Consolidator : public QObject
+{
+    Q_OBJECT
+    Q_DECLARE_PRIVATE(Consolidator)
+public:
+    Consolidator(QSharedPointer<StorageFrameworkClient> const & storage, QObject * parent = nullptr);
+    virtual ~Consolidator();
+    Q_DISABLE_COPY(Consolidator)
+
+    static constexpr int MAX_INCREMENTALS {7};
+
+    void start(int max_incrementals = MAX_INCREMENTALS);
+    void cancel();
+    bool is_active() const;
+
+Q_SIGNALS:
+    void finished(bool success);
+
+private:
+    QScopedPointer<ConsolidatorPrivate> const d_ptr;
+};
@@ -51,6 +51,28 @@ QDBusUnixFileDescriptor KeeperHelper::StartRestore()
     return keeper_.StartRestore(bus, msg);
 }
 
+QDBusUnixFileDescriptor KeeperHelper::StartBackupDirect(quint64 n_bytes)
+{
+    // pass it back to Keeper to do the work
+    Q_ASSERT(calledFromDBus());
+    auto bus = connection();
+    auto& msg = message();
+    return keeper_.StartBackupDirect(bus, msg, n_bytes);
+}
+
+void KeeperHelper::UpdateBackupProgress(quint64 n_bytes)
+{
+    // the path tells keeper which task's helper this is
+    Q_ASSERT(calledFromDBus());
+    keeper_.UpdateBackupProgress(message().path(), n_bytes);
+}
+
+void KeeperHelper::SetBackupCatalog(QByteArray const& catalog)
+{
+    Q_ASSERT(calledFromDBus());
+    keeper_.SetBackupCatalog(message().path(), catalog);
+}
+
 void KeeperHelper::UpdateStatus(const QString &app_id, const QString &status, double percentage)
 {
     qDebug() << "KeeperHelper::UpdateStatus(" << app_id << "," << status << "," << percentage << ")";
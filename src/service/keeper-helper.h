@@ -35,6 +35,9 @@ public:
 public Q_SLOTS:
     QDBusUnixFileDescriptor StartBackup(quint64 nbytes);
     QDBusUnixFileDescriptor StartRestore();
+    QDBusUnixFileDescriptor StartBackupDirect(quint64 nbytes);
+    void UpdateBackupProgress(quint64 nbytes);
+    void SetBackupCatalog(QByteArray const& catalog);
 
     void UpdateStatus(const QString &app_id, const QString &status, double percentage);
 
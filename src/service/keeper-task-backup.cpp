@@ -53,23 +53,35 @@ public:
         QObject::connect(helper_.data(), &Helper::error, [this](keeper::Error error){ error_ = error;});
     }
 
-    void ask_for_uploader(quint64 n_bytes, QString const & dir_name)
+    void ask_for_uploader(quint64 n_bytes, QString const & dir_name, bool direct, PartedUploader::Resume const & resume)
     {
         qDebug() << "asking storage framework for a socket";
 
         helper_->set_expected_size(n_bytes);
+        dir_name_ = dir_name;
 
         const auto file_name = QString("%1.keeper").arg(task_data_.metadata.get_display_name());
 
         connections_.connect_future(
-            storage_->get_new_uploader(n_bytes, dir_name, file_name),
+            storage_->get_new_archive_uploader(n_bytes, dir_name, file_name, resume),
             std::function<void(std::shared_ptr<Uploader> const&)>{
-                [this](std::shared_ptr<Uploader> const& uploader){
+                [this, direct](std::shared_ptr<Uploader> const& uploader){
                     auto fd {-1};
                     if (uploader) {
+                        track_retries(uploader);
+                        auto parted = std::dynamic_pointer_cast<PartedUploader>(uploader);
+                        if (parted)
+                        {
+                            QObject::connect(parted.get(), &PartedUploader::part_committed,
+                                             static_cast<KeeperTaskBackup*>(q_ptr), &KeeperTaskBackup::part_committed);
+                            QObject::connect(parted.get(), &PartedUploader::resume_invalid,
+                                             static_cast<KeeperTaskBackup*>(q_ptr), &KeeperTaskBackup::resume_invalid);
+                        }
+
                         auto backup_helper = qSharedPointerDynamicCast<BackupHelper>(helper_);
-                        backup_helper->set_uploader(uploader);
-                        fd = backup_helper->get_helper_socket();
+                        backup_helper->set_uploader(uploader, direct);
+                        fd = direct ? int(uploader->socket()->socketDescriptor())
+                                    : backup_helper->get_helper_socket();
                         qDebug("emitting task_socket_ready(socket=%d)", fd);
                         Q_EMIT(q_ptr->task_socket_ready(fd));
                     }
@@ -84,15 +96,64 @@ public:
         );
     }
 
+    QString get_dir_name() const
+    {
+        return dir_name_;
+    }
+
     QString get_file_name() const
     {
         auto backup_helper = qSharedPointerDynamicCast<BackupHelper>(helper_);
         return backup_helper->get_uploader_committed_file_name();
     }
 
+    QStringList get_parts() const
+    {
+        auto backup_helper = qSharedPointerDynamicCast<BackupHelper>(helper_);
+        return backup_helper->get_uploader_committed_parts();
+    }
+
+    qint64 get_part_size() const
+    {
+        auto backup_helper = qSharedPointerDynamicCast<BackupHelper>(helper_);
+        return backup_helper->get_uploader_committed_part_size();
+    }
+
+    qint64 get_archive_size() const
+    {
+        return helper_->expected_size();
+    }
+
+    bool is_incremental() const
+    {
+        auto backup_helper = qSharedPointerDynamicCast<BackupHelper>(helper_);
+        return backup_helper->is_incremental();
+    }
+
+    QByteArray get_catalog() const
+    {
+        auto backup_helper = qSharedPointerDynamicCast<BackupHelper>(helper_);
+        return backup_helper->get_catalog();
+    }
+
+    void update_progress(quint64 n_bytes)
+    {
+        auto backup_helper = qSharedPointerDynamicCast<BackupHelper>(helper_);
+        if (backup_helper)
+            backup_helper->set_direct_progress(qint64(n_bytes));
+    }
+
+    void set_catalog(QByteArray const & catalog)
+    {
+        auto backup_helper = qSharedPointerDynamicCast<BackupHelper>(helper_);
+        if (backup_helper)
+            backup_helper->set_direct_catalog(catalog);
+    }
+
 private:
     ConnectionHelper connections_;
     QString file_name_;
+    QString dir_name_;
 };
 
 KeeperTaskBackup::KeeperTaskBackup(TaskData & task_data,
@@ -119,11 +180,32 @@ void KeeperTaskBackup::init_helper()
     d->init_helper();
 }
 
-void KeeperTaskBackup::ask_for_uploader(quint64 n_bytes, QString const & dir_name)
+void KeeperTaskBackup::ask_for_uploader(quint64 n_bytes, QString const & dir_name, bool direct, PartedUploader::Resume const & resume)
+{
+    Q_D(KeeperTaskBackup);
+
+    d->ask_for_uploader(n_bytes, dir_name, direct, resume);
+}
+
+void KeeperTaskBackup::update_progress(quint64 n_bytes)
 {
     Q_D(KeeperTaskBackup);
 
-    d->ask_for_uploader(n_bytes, dir_name);
+    d->update_progress(n_bytes);
+}
+
+void KeeperTaskBackup::set_catalog(QByteArray const & catalog)
+{
+    Q_D(KeeperTaskBackup);
+
+    d->set_catalog(catalog);
+}
+
+QString KeeperTaskBackup::get_dir_name() const
+{
+    Q_D(const KeeperTaskBackup);
+
+    return d->get_dir_name();
 }
 
 QString KeeperTaskBackup::get_file_name() const
@@ -132,3 +214,38 @@ QString KeeperTaskBackup::get_file_name() const
 
     return d->get_file_name();
 }
+
+QStringList KeeperTaskBackup::get_parts() const
+{
+    Q_D(const KeeperTaskBackup);
+
+    return d->get_parts();
+}
+
+qint64 KeeperTaskBackup::get_part_size() const
+{
+    Q_D(const KeeperTaskBackup);
+
+    return d->get_part_size();
+}
+
+qint64 KeeperTaskBackup::get_archive_size() const
+{
+    Q_D(const KeeperTaskBackup);
+
+    return d->get_archive_size();
+}
+
+bool KeeperTaskBackup::is_incremental() const
+{
+    Q_D(const KeeperTaskBackup);
+
+    return d->is_incremental();
+}
+
+QByteArray KeeperTaskBackup::get_catalog() const
+{
+    Q_D(const KeeperTaskBackup);
+
+    return d->get_catalog();
+}
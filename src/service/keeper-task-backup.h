@@ -20,6 +20,7 @@
 #pragma once
 
 #include "keeper-task.h"
+#include "storage-framework/parted-uploader.h" // Resume
 
 class KeeperTaskBackupPrivate;
 
@@ -37,9 +38,27 @@ public:
 
     Q_DISABLE_COPY(KeeperTaskBackup)
 
-    void ask_for_uploader(quint64 n_bytes, QString const & dir_name);
+    // `resume` lists the parts that an interrupted upload into `dir_name` already committed
+    void ask_for_uploader(quint64 n_bytes,
+                          QString const & dir_name,
+                          bool direct = false,
+                          PartedUploader::Resume const & resume = PartedUploader::Resume());
+    void update_progress(quint64 n_bytes);
+    void set_catalog(QByteArray const & catalog);
 
+    QString get_dir_name() const;
     QString get_file_name() const;
+    QStringList get_parts() const; // empty unless it was uploaded in parts
+    qint64 get_part_size() const;
+    qint64 get_archive_size() const;
+    bool is_incremental() const;
+    QByteArray get_catalog() const;
+
+Q_SIGNALS:
+    // if the archive is being uploaded in parts, see PartedUploader::part_committed()
+    void part_committed(int part, QString const & committed_name, QByteArray const & digest);
+    // see PartedUploader::resume_invalid()
+    void resume_invalid();
 
 protected:
     QStringList get_helper_urls() const override;
@@ -19,12 +19,24 @@
  */
 
 #include "util/connection-helper.h"
+#include "storage-framework/download-reader.h"
 #include "storage-framework/storage_framework_client.h"
 #include "helper/restore-helper.h"
 #include "service/app-const.h" // DEKKO_APP_ID
 #include "service/keeper-task-restore.h"
 #include "service/keeper-task.h"
+#include "service/manifest.h"
 #include "service/private/keeper-task_p.h"
+#include "service/restore-planner.h"
+#include "tar/tar-index.h"
+
+#include <QFile>
+#include <QSet>
+#include <QTemporaryDir>
+
+#include <fstream>
+#include <sstream>
+#include <vector>
 
 namespace sf = unity::storage::qt::client;
 
@@ -42,9 +54,14 @@ public:
 
     ~KeeperTaskRestorePrivate() = default;
 
+    // "${catalog}" is where the helper can find the archive's catalog.
+    // It's written before the helper gets its socket, if there is one.
     QStringList get_helper_urls() const
     {
-        return helper_registry_->get_restore_helper_urls(task_data_.metadata);
+        auto urls = helper_registry_->get_restore_helper_urls(task_data_.metadata);
+        urls.replaceInStrings(QStringLiteral("${catalog}"), catalog_path());
+        urls.removeAll(QString());
+        return urls;
     }
 
     void init_helper()
@@ -71,13 +88,34 @@ public:
             return;
         }
 
-        // extract the dir_name.
+        // restoring an incremental backup needs the backups it builds on
+        if (task_data_.chain.size() > 1)
+        {
+            read_catalogs();
+            return;
+        }
+
+        // a backup without a catalog is still restored, just without skipping
+        download_file(dir_name, Manifest::catalog_name(file_name), [this](QByteArray const& bytes){
+            std::istringstream in(bytes.toStdString());
+            std::vector<TarIndexer::Entry> catalog;
+            if (TarIndexer::read_catalog(in, catalog))
+                save_catalog(catalog);
+            ask_for_archive_downloader();
+        });
+    }
+
+private:
+
+    void ask_for_archive_downloader()
+    {
         connections_.connect_future(
-            storage_->get_new_downloader(dir_name, file_name),
+            Manifest::open_archive(storage_, task_data_.metadata),
             std::function<void(std::shared_ptr<Downloader> const&)>{
                 [this](std::shared_ptr<Downloader> const& downloader){
                     auto fd {-1};
                     if (downloader) {
+                        track_retries(downloader);
                         auto restore_helper = qSharedPointerDynamicCast<RestoreHelper>(helper_);
                         restore_helper->set_downloader(downloader);
                         fd = restore_helper->get_helper_socket();
@@ -94,7 +132,186 @@ public:
         );
     }
 
-private:
+    /***
+    ****  Catalog
+    ***/
+
+    QString catalog_path() const
+    {
+        return catalog_dir_.isValid()
+            ? catalog_dir_.filePath(QStringLiteral("catalog"))
+            : QString();
+    }
+
+    // lets the helper leave alone files that are already restored
+    void save_catalog(std::vector<TarIndexer::Entry> const& catalog)
+    {
+        auto const path = catalog_path();
+        if (path.isEmpty() || catalog.empty())
+            return;
+
+        std::ofstream out(path.toStdString(), std::ios::binary);
+        if (!TarIndexer::write_catalog(out, catalog) || !out.flush())
+        {
+            qWarning() << "unable to write" << path;
+            out.close();
+            QFile::remove(path);
+        }
+    }
+
+    /***
+    ****  Chains
+    ***/
+
+    void read_catalogs()
+    {
+        auto const& chain = task_data_.chain;
+
+        catalogs_.clear();
+        catalogs_.resize(size_t(chain.size()));
+        missing_catalogs_.clear();
+        catalogs_to_read_ = chain.size();
+        for (int i=0, n=chain.size(); i<n; ++i)
+        {
+            auto const& backup = chain[i];
+            auto const dir_name = backup.get_dir_name();
+            download_file(dir_name, Manifest::catalog_name(backup.get_file_name()), [this, i, dir_name](QByteArray const& bytes){
+                // an empty catalog is fine; it's a backup of an empty folder
+                std::istringstream in(bytes.toStdString());
+                if (!TarIndexer::read_catalog(in, catalogs_[size_t(i)]))
+                    missing_catalogs_ << dir_name;
+                if (!--catalogs_to_read_)
+                    start_chain();
+            });
+        }
+    }
+
+    void start_chain()
+    {
+        // restoring only the newest incremental
+        // would silently drop every file it didn't change
+        if (!missing_catalogs_.isEmpty())
+        {
+            qWarning() << "Missing catalogs for" << task_data_.metadata.get_display_name()
+                       << "in" << missing_catalogs_.toList()
+                       << "; unable to restore an incremental backup without them";
+            catalogs_.clear();
+            error_ = keeper::Error::READING_REMOTE_FILE;
+            qDebug("Emitting task_socket_error(error=%d)", static_cast<int>(error_));
+            Q_EMIT(q_ptr->task_socket_error(error_));
+            return;
+        }
+
+        planner_.reset(new RestorePlanner(task_data_.chain, catalogs_));
+
+        // oldest first, so a file's newest full copy is the one compared
+        std::vector<TarIndexer::Entry> all;
+        for (auto const& catalog : catalogs_)
+            all.insert(all.end(), catalog.begin(), catalog.end());
+        save_catalog(all);
+        catalogs_.clear();
+
+        // nothing in the chain is needed when the newest backup is
+        // of an empty folder, so that backup stands on its own
+        if (planner_->steps().empty())
+        {
+            planner_.reset();
+            qDebug() << "nothing to restore from the chain before" << task_data_.metadata.get_display_name();
+            task_data_.chain = QVector<Metadata>{task_data_.metadata};
+            ask_for_downloader();
+            return;
+        }
+
+        qDebug() << "restoring" << task_data_.metadata.get_display_name() << "from"
+                 << planner_->steps().size() << "archives," << planner_->n_bytes() << "bytes";
+
+        auto restore_helper = qSharedPointerDynamicCast<RestoreHelper>(helper_);
+        restore_helper->set_expected_size(planner_->n_bytes());
+        connections_.remember(QObject::connect(
+            restore_helper.data(), &RestoreHelper::downloader_needed,
+            std::bind(&KeeperTaskRestorePrivate::ask_for_next_chain_downloader, this)
+        ));
+
+        step_ = 0;
+        ask_for_chain_downloader();
+    }
+
+    void ask_for_next_chain_downloader()
+    {
+        ++step_;
+        ask_for_chain_downloader();
+    }
+
+    void ask_for_chain_downloader()
+    {
+        if (step_ >= planner_->steps().size())
+            return;
+
+        auto const& backup = planner_->steps()[step_].backup;
+        connections_.connect_future(
+            Manifest::open_archive(storage_, backup),
+            std::function<void(std::shared_ptr<Downloader> const&)>{
+                [this](std::shared_ptr<Downloader> const& downloader){
+                    auto restore_helper = qSharedPointerDynamicCast<RestoreHelper>(helper_);
+                    if (downloader)
+                    {
+                        track_retries(downloader);
+                        restore_helper->add_downloader(downloader, planner_->create_filter(step_));
+                        if (step_ == 0)
+                            Q_EMIT(q_ptr->task_socket_ready(restore_helper->get_helper_socket()));
+                    }
+                    else if (step_ == 0)
+                    {
+                        error_ = storage_->get_last_error();
+                        qDebug("Emitting task_socket_error(error=%d)", static_cast<int>(error_));
+                        Q_EMIT(q_ptr->task_socket_error(error_));
+                    }
+                    else
+                    {
+                        error_ = storage_->get_last_error();
+                        qWarning() << "unable to download the next backup in the chain";
+                        restore_helper->stop();
+                    }
+                }
+            }
+        );
+    }
+
+    // reads a small file, eg a catalog. Passes an empty array if it can't be read.
+    void download_file(QString const& dir_name, QString const& file_name, std::function<void(QByteArray const&)> const& on_done)
+    {
+        connections_.connect_future(
+            storage_->get_new_downloader(dir_name, file_name),
+            std::function<void(std::shared_ptr<Downloader> const&)>{
+                [this, on_done](std::shared_ptr<Downloader> const& downloader){
+                    if (!downloader)
+                    {
+                        on_done(QByteArray());
+                        return;
+                    }
+                    track_retries(downloader);
+
+                    QSharedPointer<DownloadReader> reader(new DownloadReader(downloader), [](DownloadReader *r){r->deleteLater();});
+                    connections_.connect_oneshot(
+                        reader.data(),
+                        &DownloadReader::finished,
+                        std::function<void(bool)>{[downloader, reader, on_done](bool success){
+                            downloader->finish();
+                            on_done(success ? reader->bytes() : QByteArray());
+                        }}
+                    );
+                    reader->start();
+                }
+            }
+        );
+    }
+
+    QTemporaryDir catalog_dir_;
+    std::vector<std::vector<TarIndexer::Entry>> catalogs_;
+    QSet<QString> missing_catalogs_; // dirs of the chain's backups that have no catalog
+    int catalogs_to_read_ {};
+    QScopedPointer<RestorePlanner> planner_;
+    size_t step_ {};
     ConnectionHelper connections_;
 };
 
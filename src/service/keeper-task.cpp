@@ -20,11 +20,13 @@
 
 #include "helper/metadata.h"
 #include "keeper-task.h"
+#include "qdbus-stubs/dbus-types.h"
 
 #include "private/keeper-task_p.h"
 
 #include <QJsonDocument>
 #include <QJsonObject>
+#include <QLoggingCategory>
 #include <QString>
 
 KeeperTaskPrivate::KeeperTaskPrivate(KeeperTask * keeper_task,
@@ -45,8 +47,9 @@ bool KeeperTaskPrivate::start()
 {
     // initialize the helper
     q_ptr->init_helper();
+    helper_->set_rate_limit(rate_limit_);
 
-    const auto urls = q_ptr->get_helper_urls();
+    auto urls = q_ptr->get_helper_urls();
     if (urls.isEmpty())
     {
         task_data_.action = helper_->to_string(Helper::State::FAILED);
@@ -56,6 +59,12 @@ bool KeeperTaskPrivate::start()
         return false;
     }
 
+    // tell the helper which bus path to call in on
+    auto const helper_path = task_data_.helper_path.isEmpty()
+        ? QString(DBusTypes::KEEPER_HELPER_PATH)
+        : task_data_.helper_path;
+    urls.replaceInStrings(QStringLiteral("${helper-path}"), helper_path);
+
     // listen for helper state changes
     QObject::connect(helper_.data(), &Helper::state_changed,
         std::bind(&KeeperTaskPrivate::on_helper_state_changed, this, std::placeholders::_1)
@@ -136,6 +145,17 @@ QVariantMap KeeperTaskPrivate::calculate_task_state()
     auto const percent_done = helper_->percent_done();
     ret.insert(keeper::Item::PERCENT_DONE_KEY, double(percent_done));
 
+    auto const stats = helper_->transfer_stats();
+    ret.insert(keeper::Item::BYTES_DONE_KEY, quint64(stats.n_bytes));
+    if (helper_->expected_size() > 0)
+        ret.insert(keeper::Item::BYTES_REMAINING_KEY, quint64(stats.n_remaining));
+    ret.insert(keeper::Item::AVERAGE_SPEED_KEY, quint64(stats.average_bps));
+    ret.insert(keeper::Item::SMOOTHED_SPEED_KEY, quint64(stats.smoothed_bps));
+    ret.insert(keeper::Item::STALLED_SECONDS_KEY, quint64(stats.stalled_msec / 1000));
+    ret.insert(keeper::Item::ETA_SECONDS_KEY, qint64(stats.eta_msec < 0 ? -1 : (stats.eta_msec + 999) / 1000));
+    ret.insert(keeper::Item::RETRIES_KEY, quint32(retry_stats_.n_retries));
+    ret.insert(keeper::Item::RETRY_MSEC_KEY, quint64(retry_stats_.msec));
+
     if (task_data_.action == "failed" || task_data_.action == "cancelled")
     {
         auto error = error_;
@@ -148,8 +168,12 @@ QVariantMap KeeperTaskPrivate::calculate_task_state()
 
     ret.insert(keeper::Item::UUID_KEY, uuid);
 
-    QJsonDocument doc(QJsonObject::fromVariantMap(ret));
-    qDebug() << QString(doc.toJson(QJsonDocument::Compact));
+    // this runs several times a second, so don't format it for nothing
+    if (QLoggingCategory::defaultCategory()->isDebugEnabled())
+    {
+        QJsonDocument doc(QJsonObject::fromVariantMap(ret));
+        qDebug() << QString(doc.toJson(QJsonDocument::Compact));
+    }
 
     return ret;
 }
@@ -186,6 +210,8 @@ QVariantMap KeeperTaskPrivate::get_initial_state(KeeperTask::TaskData const &td)
     ret.insert(keeper::Item::DISPLAY_NAME_KEY, td.metadata.get_display_name());
     ret.insert(keeper::Item::SPEED_KEY, 0);
     ret.insert(keeper::Item::PERCENT_DONE_KEY, double(0.0));
+    ret.insert(keeper::Item::BYTES_DONE_KEY, quint64(0));
+    ret.insert(keeper::Item::ETA_SECONDS_KEY, qint64(-1));
     ret.insert(keeper::Item::UUID_KEY, uuid);
 
     return ret;
@@ -209,6 +235,16 @@ keeper::Error KeeperTaskPrivate::error() const
     return error_;
 }
 
+void KeeperTaskPrivate::set_rate_limit(quint64 bytes_per_second)
+{
+    rate_limit_ = bytes_per_second;
+
+    if (helper_)
+    {
+        helper_->set_rate_limit(bytes_per_second);
+    }
+}
+
 KeeperTask::KeeperTask(TaskData & task_data,
                        QSharedPointer<HelperRegistry> const & helper_registry,
                        QSharedPointer<StorageFrameworkClient> const & storage,
@@ -274,3 +310,10 @@ keeper::Error KeeperTask::error() const
 
     return d->error();
 }
+
+void KeeperTask::set_rate_limit(quint64 bytes_per_second)
+{
+    Q_D(KeeperTask);
+
+    d->set_rate_limit(bytes_per_second);
+}
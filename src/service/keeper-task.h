@@ -27,6 +27,7 @@
 
 #include <QObject>
 #include <QSharedPointer>
+#include <QVector>
 
 class HelperRegistry;
 class KeeperTaskPrivate;
@@ -43,6 +44,8 @@ public:
         QString action;
         keeper::Error error;
         Metadata metadata;
+        QVector<Metadata> chain; // restores: the backups to read, oldest first
+        QString helper_path;     // the bus path that the task's helper calls in on
     };
 
     KeeperTask(TaskData & task_data,
@@ -64,6 +67,9 @@ public:
     QString to_string(Helper::State state);
 
     keeper::Error error() const;
+
+    // NB: units is bytes_per_second; 0 means unlimited
+    void set_rate_limit(quint64 bytes_per_second);
 Q_SIGNALS:
     void task_state_changed(Helper::State state);
     void task_socket_ready(int socket_descriptor);
@@ -24,11 +24,20 @@
 #include <QDebug>
 #include <QDBusMessage>
 #include <QDBusConnection>
+#include <QDBusError>
+
+#include <limits>
+
+namespace
+{
+    constexpr uint MAX_PARALLEL_PARTS {16};
+}
 
 KeeperUser::KeeperUser(Keeper* keeper)
   : QObject(keeper)
   , keeper_(*keeper)
 {
+    connect(keeper, &Keeper::state_delta, this, &KeeperUser::StateChanged);
 }
 
 KeeperUser::~KeeperUser() =default;
@@ -97,3 +106,65 @@ KeeperUser::GetStorageAccounts()
 
     return keeper_.get_storage_accounts(bus, msg);
 }
+
+void
+KeeperUser::SetBandwidthLimits(quint64 upload, quint64 download)
+{
+    keeper_.set_bandwidth_limits(upload, download);
+}
+
+void
+KeeperUser::SetBandwidthProfiles(QVariantDictMap const & profiles)
+{
+    Q_ASSERT(calledFromDBus());
+
+    QString error;
+    if (!keeper_.set_bandwidth_profiles(profiles, error))
+        sendErrorReply(QDBusError::InvalidArgs, error);
+}
+
+void
+KeeperUser::SetForeground(bool foreground)
+{
+    keeper_.set_foreground(foreground);
+}
+
+void
+KeeperUser::SetMaxConcurrentTasks(uint max_tasks)
+{
+    Q_ASSERT(calledFromDBus());
+
+    if (max_tasks < 1 || max_tasks > uint(DBusTypes::KEEPER_HELPER_MAX_TASKS))
+    {
+        sendErrorReply(QDBusError::InvalidArgs, QStringLiteral("max_tasks must be from 1 to %1").arg(DBusTypes::KEEPER_HELPER_MAX_TASKS));
+        return;
+    }
+
+    keeper_.set_max_concurrent_tasks(int(max_tasks));
+}
+
+void
+KeeperUser::SetMultipartUpload(quint64 part_size, uint max_parallel)
+{
+    Q_ASSERT(calledFromDBus());
+
+    if (max_parallel < 1 || max_parallel > MAX_PARALLEL_PARTS)
+    {
+        sendErrorReply(QDBusError::InvalidArgs, QStringLiteral("max_parallel must be from 1 to %1").arg(MAX_PARALLEL_PARTS));
+        return;
+    }
+
+    if (part_size > quint64(std::numeric_limits<qint64>::max()))
+    {
+        sendErrorReply(QDBusError::InvalidArgs, QStringLiteral("part_size is too large"));
+        return;
+    }
+
+    keeper_.set_multipart_upload(qint64(part_size), int(max_parallel));
+}
+
+void
+KeeperUser::SetDirectUploads(bool enabled)
+{
+    keeper_.set_direct_uploads(enabled);
+}
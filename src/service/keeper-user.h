@@ -47,6 +47,8 @@ Q_SIGNALS:
 
     void state_changed();
 
+    void StateChanged(keeper::Items const & changes, QStringList const & removed);
+
 public Q_SLOTS:
 
     keeper::Items GetBackupChoices();
@@ -59,6 +61,13 @@ public Q_SLOTS:
 
     QStringList GetStorageAccounts();
 
+    void SetBandwidthLimits(quint64 upload, quint64 download);
+    void SetBandwidthProfiles(QVariantDictMap const & profiles);
+    void SetForeground(bool foreground);
+    void SetMaxConcurrentTasks(uint max_tasks);
+    void SetMultipartUpload(quint64 part_size, uint max_parallel);
+    void SetDirectUploads(bool enabled);
+
 private:
 
     Keeper& keeper_;
@@ -21,13 +21,18 @@
 #include "util/connection-helper.h"
 #include "storage-framework/storage_framework_client.h"
 #include "helper/metadata.h"
+#include "service/bandwidth-schedule.h"
+#include "service/consolidator.h"
 #include "service/metadata-provider.h"
 #include "service/keeper.h"
 #include "service/task-manager.h"
+#include "service/transfer-settings.h"
 
 #include <QDebug>
 #include <QDBusMessage>
 #include <QDBusConnection>
+#include <QDBusConnectionInterface>
+#include <QDBusReply>
 #include <QSharedPointer>
 #include <QVector>
 
@@ -77,10 +82,28 @@ public:
         , backup_choices_(backup_choices)
         , restore_choices_(restore_choices)
         , task_manager_{helper_registry, storage_}
+        , consolidator_{storage_}
     {
         QObject::connect(&task_manager_, &TaskManager::finished,
             std::bind(&KeeperPrivate::on_task_manager_finished, this)
         );
+
+        QObject::connect(&task_manager_, &TaskManager::state_delta, q_ptr, &Keeper::state_delta);
+
+        // reply to the helpers that are waiting for a storage socket
+        QObject::connect(&task_manager_, &TaskManager::socket_ready,
+            std::bind(&KeeperPrivate::on_socket_ready, this, std::placeholders::_1, std::placeholders::_2)
+        );
+        QObject::connect(&task_manager_, &TaskManager::socket_error,
+            std::bind(&KeeperPrivate::on_socket_error, this, std::placeholders::_1, std::placeholders::_2)
+        );
+
+        task_manager_.set_bandwidth_schedule(BandwidthSchedule::load(BandwidthSchedule::default_path()));
+
+        transfer_settings_ = TransferSettings::load(TransferSettings::default_path());
+        task_manager_.set_direct_uploads(transfer_settings_.direct_uploads());
+        task_manager_.set_max_concurrent_tasks(transfer_settings_.max_concurrent_tasks());
+        storage_->set_multipart_upload(transfer_settings_.part_size(), transfer_settings_.max_parallel_parts());
     }
 
     enum class ChoicesType { BACKUP_CHOICES, RESTORES_CHOICES };
@@ -115,7 +138,10 @@ public:
                 {
                     auto unhandled = QSet<QString>::fromList(uuids);
                     if (task_manager_.start_backup(tasks.values(), storage))
+                    {
                         unhandled.subtract(QSet<QString>::fromList(tasks.keys()));
+                        backup_running_ = true;
+                    }
 
                     check_for_unhandled_tasks_and_reply(unhandled, bus, msg);
                 }
@@ -132,7 +158,7 @@ public:
                             {
                                 auto restore_tasks = get_tasks(cached_restore_choices_, uuids);
                                 qDebug() << "After getting tasks...";
-                                if (!restore_tasks.empty() && task_manager_.start_restore(restore_tasks.values(), storage))
+                                if (!restore_tasks.empty() && task_manager_.start_restore(restore_tasks.values(), storage, cached_restore_choices_))
                                     unhandled.subtract(QSet<QString>::fromList(restore_tasks.keys()));
                             }
                             check_for_unhandled_tasks_and_reply(unhandled, bus, msg);
@@ -264,36 +290,19 @@ public:
 
     QDBusUnixFileDescriptor start_backup(QDBusConnection bus,
                                          QDBusMessage const & msg,
-                                         quint64 n_bytes)
+                                         quint64 n_bytes,
+                                         bool direct)
     {
-        qDebug("Keeper::StartBackup(n_bytes=%zu)", size_t(n_bytes));
+        qDebug("Keeper::StartBackup(n_bytes=%zu, direct=%d)", size_t(n_bytes), int(direct));
 
-        connections_.connect_oneshot(
-            &task_manager_,
-            &TaskManager::socket_ready,
-            std::function<void(int)>{
-                [bus,msg](int fd){
-                    qDebug("BackupManager returned socket %d", fd);
-                    auto reply = msg.createReply();
-                    reply << QVariant::fromValue(QDBusUnixFileDescriptor(fd));
-                    bus.send(reply);
-                }
-            }
-        );
+        // claim the task first, so that the helper's pid goes to the right one
+        auto const uuid = task_manager_.claim_task(msg.path());
+        pending_socket_requests_.insert(uuid, PendingSocketRequest{bus, msg, false});
 
-        connections_.connect_oneshot(
-            &task_manager_,
-            &TaskManager::socket_error,
-            std::function<void(keeper::Error)>{
-                [bus,msg](keeper::Error error){
-                    qDebug("BackupManager returned socket error: %d", static_cast<int>(error));
-                    bus.send(msg.createErrorReply(QDBusError::InvalidArgs, "Error obtaining remote backup socket"));
-                }
-            }
-        );
+        task_manager_.set_helper_process(uuid, caller_pid(bus, msg));
 
         qDebug() << "Asking for a storage framework socket from the task manager";
-        task_manager_.ask_for_uploader(n_bytes);
+        task_manager_.ask_for_uploader(uuid, n_bytes, direct);
 
         // tell the caller that we'll be responding async
         msg.setDelayedReply(true);
@@ -306,42 +315,34 @@ public:
     {
         qDebug() << "Keeper::StartRestore()";
 
-        connections_.connect_oneshot(
-            &task_manager_,
-            &TaskManager::socket_ready,
-            std::function<void(int)>{
-                [bus,msg](int fd){
-                    qDebug("RestoreManager returned socket %d", fd);
-                    auto reply = msg.createReply();
-                    reply << QVariant::fromValue(QDBusUnixFileDescriptor(fd));
-                    close(fd);
-                    bus.send(reply);
-                }
-            }
-        );
+        auto const uuid = task_manager_.claim_task(msg.path());
+        pending_socket_requests_.insert(uuid, PendingSocketRequest{bus, msg, true});
 
-        connections_.connect_oneshot(
-            &task_manager_,
-            &TaskManager::socket_error,
-            std::function<void(keeper::Error)>{
-                [bus,msg](keeper::Error error){
-                    qDebug("RestoreManager returned socket error: %d", static_cast<int>(error));
-                    bus.send(msg.createErrorReply(QDBusError::InvalidArgs, "Error obtaining remote restore socket"));
-                }
-            }
-        );
+        task_manager_.set_helper_process(uuid, caller_pid(bus, msg));
 
         qDebug() << "Asking for a storage framework socket from the task manager";
-        task_manager_.ask_for_downloader();
+        task_manager_.ask_for_downloader(uuid);
 
         // tell the caller that we'll be responding async
         msg.setDelayedReply(true);
         return QDBusUnixFileDescriptor(0);
     }
 
+    void update_backup_progress(QString const & helper_path, quint64 n_bytes)
+    {
+        task_manager_.update_backup_progress(helper_path, n_bytes);
+    }
+
+    void set_backup_catalog(QString const & helper_path, QByteArray const & catalog)
+    {
+        task_manager_.set_backup_catalog(helper_path, catalog);
+    }
+
     void cancel()
     {
+        backup_running_ = false;
         task_manager_.cancel();
+        consolidator_.cancel();
     }
 
     void invalidate_choices_cache()
@@ -368,6 +369,67 @@ public:
         return QStringList();
     }
 
+    void set_bandwidth_limits(quint64 upload, quint64 download)
+    {
+        BandwidthSchedule::Limits limits;
+        limits.upload = upload;
+        limits.download = download;
+
+        auto schedule = task_manager_.bandwidth_schedule();
+        schedule.set_default_limits(limits);
+        set_bandwidth_schedule(schedule);
+    }
+
+    bool set_bandwidth_profiles(QVariantDictMap const & map, QString & error)
+    {
+        QVector<BandwidthSchedule::Profile> profiles;
+        if (!BandwidthSchedule::parse_profiles(map, profiles, error))
+        {
+            qWarning() << "rejecting bandwidth profiles:" << error;
+            return false;
+        }
+
+        auto schedule = task_manager_.bandwidth_schedule();
+        schedule.set_profiles(profiles);
+        set_bandwidth_schedule(schedule);
+        return true;
+    }
+
+    void set_bandwidth_schedule(BandwidthSchedule const & schedule)
+    {
+        task_manager_.set_bandwidth_schedule(schedule);
+        schedule.save(BandwidthSchedule::default_path());
+    }
+
+    void set_foreground(bool foreground)
+    {
+        task_manager_.set_foreground(foreground);
+    }
+
+    void set_max_concurrent_tasks(int n)
+    {
+        task_manager_.set_max_concurrent_tasks(n);
+
+        transfer_settings_.set_max_concurrent_tasks(task_manager_.max_concurrent_tasks());
+        transfer_settings_.save(TransferSettings::default_path());
+    }
+
+    void set_multipart_upload(qint64 part_size, int max_parallel)
+    {
+        storage_->set_multipart_upload(part_size, max_parallel);
+
+        transfer_settings_.set_multipart_upload(part_size, max_parallel);
+        transfer_settings_.save(TransferSettings::default_path());
+    }
+
+    void set_direct_uploads(bool direct)
+    {
+        task_manager_.set_direct_uploads(direct);
+
+        transfer_settings_.set_direct_uploads(direct);
+        transfer_settings_.save(TransferSettings::default_path());
+    }
+
 Q_SIGNALS:
     void backup_choices_ready(keeper::Error error);
     void restore_choices_ready(keeper::Error error);
@@ -378,6 +440,73 @@ private:
         // force a backup choices regeneration to avoid repeating uuids
         // between backups
         invalidate_choices_cache();
+
+        // keep incremental chains short now that a backup has added to them.
+        // If the backup index couldn't say how long they are, let the
+        // consolidator read the manifests and decide
+        if (backup_running_)
+        {
+            backup_running_ = false;
+            auto const n = task_manager_.longest_incremental_chain();
+            if ((n < 0) || (n > Consolidator::MAX_INCREMENTALS))
+                consolidator_.start();
+        }
+    }
+
+    // a StartBackup or StartRestore call that's waiting for its socket
+    struct PendingSocketRequest
+    {
+        QDBusConnection bus;
+        QDBusMessage msg;
+        bool restore;
+    };
+
+    void on_socket_ready(QString const & uuid, int fd)
+    {
+        auto it = pending_socket_requests_.find(uuid);
+        if (it == pending_socket_requests_.end())
+        {
+            qWarning() << "no helper is waiting for a socket for task" << uuid;
+            return;
+        }
+        auto const request = it.value();
+        pending_socket_requests_.erase(it);
+
+        qDebug("%s returned socket %d", request.restore ? "RestoreManager" : "BackupManager", fd);
+        auto reply = request.msg.createReply();
+        reply << QVariant::fromValue(QDBusUnixFileDescriptor(fd));
+        if (request.restore)
+            close(fd);
+        request.bus.send(reply);
+    }
+
+    void on_socket_error(QString const & uuid, keeper::Error error)
+    {
+        auto it = pending_socket_requests_.find(uuid);
+        if (it == pending_socket_requests_.end())
+        {
+            qWarning() << "no helper is waiting for a socket for task" << uuid;
+            return;
+        }
+        auto const request = it.value();
+        pending_socket_requests_.erase(it);
+
+        qDebug("%s returned socket error: %d", request.restore ? "RestoreManager" : "BackupManager", static_cast<int>(error));
+        auto const text = request.restore
+            ? QStringLiteral("Error obtaining remote restore socket")
+            : QStringLiteral("Error obtaining remote backup socket");
+        request.bus.send(request.msg.createErrorReply(QDBusError::InvalidArgs, text));
+    }
+
+    static pid_t caller_pid(QDBusConnection bus, QDBusMessage const & msg)
+    {
+        QDBusReply<uint> const reply = bus.interface()->servicePid(msg.service());
+        if (!reply.isValid())
+        {
+            qWarning() << "unable to get the helper's pid:" << reply.error().message();
+            return 0;
+        }
+        return pid_t(reply.value());
     }
 
     void check_for_unhandled_tasks_and_reply(QSet<QString> const & unhandled,
@@ -405,7 +534,12 @@ private:
     mutable QVector<Metadata> cached_backup_choices_;
     mutable QVector<Metadata> cached_restore_choices_;
     TaskManager task_manager_;
+    Consolidator consolidator_;
+    TransferSettings transfer_settings_;
+    bool backup_running_ {};
     ConnectionHelper connections_;
+    // keyed by task uuid, since helpers on the shared path can't be told apart by path
+    QMap<QString,PendingSocketRequest> pending_socket_requests_;
 };
 
 
@@ -438,7 +572,33 @@ Keeper::StartBackup(QDBusConnection bus,
 {
     Q_D(Keeper);
 
-    return d->start_backup(bus, msg, n_bytes);
+    return d->start_backup(bus, msg, n_bytes, false);
+}
+
+QDBusUnixFileDescriptor
+Keeper::StartBackupDirect(QDBusConnection bus,
+                          QDBusMessage const & msg,
+                          quint64 n_bytes)
+{
+    Q_D(Keeper);
+
+    return d->start_backup(bus, msg, n_bytes, true);
+}
+
+void
+Keeper::UpdateBackupProgress(QString const & helper_path, quint64 n_bytes)
+{
+    Q_D(Keeper);
+
+    d->update_backup_progress(helper_path, n_bytes);
+}
+
+void
+Keeper::SetBackupCatalog(QString const & helper_path, QByteArray const & catalog)
+{
+    Q_D(Keeper);
+
+    d->set_backup_catalog(helper_path, catalog);
 }
 
 QDBusUnixFileDescriptor
@@ -502,5 +662,52 @@ Keeper::get_storage_accounts(QDBusConnection bus,
     return d->get_storage_accounts(bus,message);
 }
 
+void
+Keeper::set_bandwidth_limits(quint64 upload, quint64 download)
+{
+    Q_D(Keeper);
+
+    d->set_bandwidth_limits(upload, download);
+}
+
+bool
+Keeper::set_bandwidth_profiles(QVariantDictMap const & profiles, QString & error)
+{
+    Q_D(Keeper);
+
+    return d->set_bandwidth_profiles(profiles, error);
+}
+
+void
+Keeper::set_foreground(bool foreground)
+{
+    Q_D(Keeper);
+
+    d->set_foreground(foreground);
+}
+
+void
+Keeper::set_max_concurrent_tasks(int n)
+{
+    Q_D(Keeper);
+
+    d->set_max_concurrent_tasks(n);
+}
+
+void
+Keeper::set_multipart_upload(qint64 part_size, int max_parallel)
+{
+    Q_D(Keeper);
+
+    d->set_multipart_upload(part_size, max_parallel);
+}
+
+void
+Keeper::set_direct_uploads(bool direct)
+{
+    Q_D(Keeper);
+
+    d->set_direct_uploads(direct);
+}
 
 #include "keeper.moc"
@@ -28,6 +28,7 @@
 #include <QScopedPointer>
 #include <QSharedPointer>
 #include <QString>
+#include <QStringList>
 #include <QVector>
 
 #include <memory> // sd::shared_ptr
@@ -63,6 +64,16 @@ public:
     QDBusUnixFileDescriptor StartRestore(QDBusConnection,
                                         QDBusMessage const & message);
 
+    // like StartBackup, but hands the helper the storage socket itself
+    QDBusUnixFileDescriptor StartBackupDirect(QDBusConnection,
+                                              QDBusMessage const & message,
+                                              quint64 nbytes);
+
+    // `helper_path` is the bus path that the helper called in on
+    void UpdateBackupProgress(QString const & helper_path, quint64 nbytes);
+
+    void SetBackupCatalog(QString const & helper_path, QByteArray const & catalog);
+
     void start_tasks(QStringList const & uuids,
                      QString const & storage,
                      QDBusConnection bus,
@@ -77,6 +88,27 @@ public:
     QStringList get_storage_accounts(QDBusConnection,
                                      QDBusMessage const & message);
 
+    // NB: units is bytes_per_second; 0 means unlimited
+    void set_bandwidth_limits(quint64 upload, quint64 download);
+
+    // returns false and sets `error` if the profiles are malformed
+    bool set_bandwidth_profiles(QVariantDictMap const & profiles, QString & error);
+
+    // helpers run at normal priority while the user is watching them
+    void set_foreground(bool foreground);
+
+    // how many backup or restore tasks may run at once
+    void set_max_concurrent_tasks(int n);
+
+    // archives larger than `part_size` are uploaded in parts; 0 turns that off
+    void set_multipart_upload(qint64 part_size, int max_parallel);
+
+    // lets helpers write straight to the uploader instead of through keeper
+    void set_direct_uploads(bool direct);
+
+Q_SIGNALS:
+    void state_delta(keeper::Items const & changes, QStringList const & removed);
+
 private:
     QScopedPointer<KeeperPrivate> const d_ptr;
 };
@@ -36,6 +36,7 @@
 #include <QDBusConnectionInterface>
 
 #include <libintl.h>
+#include <csignal>
 #include <cstdlib>
 #include <ctime>
 
@@ -54,6 +55,10 @@ main(int argc, char **argv)
     });
     handler.setupUnixSignalHandlers();
 
+    // a helper or storage-framework socket closing under a splice()
+    // should be reported as EPIPE, not kill the service
+    std::signal(SIGPIPE, SIG_IGN);
+
     // boilerplate locale
     bind_textdomain_codeset(GETTEXT_PACKAGE, "UTF-8");
     setlocale(LC_ALL, "");
@@ -95,6 +100,17 @@ main(int argc, char **argv)
             return EXIT_FAILURE;
         }
 
+        // and again for each running task's helper, so that we know who's calling
+        for (int slot=0; slot<DBusTypes::KEEPER_HELPER_MAX_TASKS; ++slot)
+        {
+            auto const path = DBusTypes::keeperHelperTaskPath(slot);
+            if (!connection.registerObject(path, helper))
+            {
+                qCritical("Could not register keeper dbus helper object at %s: [%s]", qPrintable(path), connection.lastError().message().toStdString().c_str());
+                return EXIT_FAILURE;
+            }
+        }
+
         // register the user object
         auto user  = new KeeperUser(service);
         new KeeperUserAdaptor(user);
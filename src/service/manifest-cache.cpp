@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+
+#include "service/manifest-cache.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+#include <QSet>
+#include <QStandardPaths>
+
+ManifestCache::ManifestCache(QString const & path)
+    : path_(path)
+{
+    load();
+}
+
+QString
+ManifestCache::default_path()
+{
+    // anything that's lost can be downloaded again, so it's cache
+    auto const dir = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation);
+    return QDir(dir).filePath(QStringLiteral("keeper/manifests.json"));
+}
+
+bool
+ManifestCache::get(QString const & storage, QString const & dir_name, QVector<Metadata> & entries) const
+{
+    auto const dirs = manifests_.find(storage);
+    if (dirs == manifests_.end())
+        return false;
+
+    auto const it = dirs.value().find(dir_name);
+    if (it == dirs.value().end())
+        return false;
+
+    entries = it.value();
+    return true;
+}
+
+void
+ManifestCache::set(QString const & storage, QString const & dir_name, QVector<Metadata> const & entries)
+{
+    manifests_[storage][dir_name] = entries;
+    dirty_ = true;
+}
+
+void
+ManifestCache::prune(QString const & storage, QVector<QString> const & dir_names)
+{
+    auto const dirs = manifests_.find(storage);
+    if (dirs == manifests_.end())
+        return;
+
+    QSet<QString> const keep = QSet<QString>::fromList(dir_names.toList());
+    for (auto it=dirs.value().begin(); it!=dirs.value().end(); )
+    {
+        if (keep.contains(it.key()))
+        {
+            ++it;
+        }
+        else
+        {
+            qDebug() << "forgetting the manifest of" << it.key() << "; it's not in storage anymore";
+            it = dirs.value().erase(it);
+            dirty_ = true;
+        }
+    }
+}
+
+/***
+****
+***/
+
+void
+ManifestCache::load()
+{
+    QFile file(path_);
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+
+    auto const root = QJsonDocument::fromJson(file.readAll()).object();
+    for (auto sit=root.begin(), send=root.end(); sit!=send; ++sit)
+    {
+        auto const dirs = sit.value().toObject();
+        for (auto dit=dirs.begin(), dend=dirs.end(); dit!=dend; ++dit)
+        {
+            QVector<Metadata> entries;
+            for (auto const& val : dit.value().toArray())
+                entries.push_back(Metadata(val.toObject()));
+            manifests_[sit.key()][dit.key()] = entries;
+        }
+    }
+}
+
+void
+ManifestCache::save()
+{
+    if (!dirty_)
+        return;
+
+    QJsonObject root;
+    for (auto sit=manifests_.cbegin(), send=manifests_.cend(); sit!=send; ++sit)
+    {
+        QJsonObject dirs;
+        for (auto dit=sit.value().cbegin(), dend=sit.value().cend(); dit!=dend; ++dit)
+        {
+            QJsonArray entries;
+            for (auto const& entry : dit.value())
+                entries.append(entry.json());
+            dirs[dit.key()] = entries;
+        }
+        root[sit.key()] = dirs;
+    }
+
+    QDir().mkpath(QFileInfo(path_).path());
+    QSaveFile file(path_);
+    if (!file.open(QIODevice::WriteOnly) ||
+        (file.write(QJsonDocument(root).toJson(QJsonDocument::Compact)) == -1) ||
+        !file.commit())
+    {
+        qWarning() << "unable to save the manifest cache to" << path_ << ":" << file.errorString();
+        return;
+    }
+
+    dirty_ = false;
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+
+#pragma once
+
+#include "helper/metadata.h"
+
+#include <QMap>
+#include <QString>
+#include <QVector>
+
+/**
+ * A local copy of the manifests that have been read from storage,
+ * so that listing the restore choices only has to download new ones.
+ *
+ * A backup's manifest is written once, when the backup finishes, and is
+ * never changed afterwards. So a cached manifest stays valid for as long
+ * as its backup directory is still listed in storage; prune() drops the
+ * ones that aren't.
+ *
+ * Manifests are kept per storage and per backup directory, and are
+ * written to disk by save().
+ */
+class ManifestCache
+{
+public:
+    explicit ManifestCache(QString const & path = default_path());
+
+    static QString default_path();
+
+    // returns true and sets `entries` if `dir_name`'s manifest is cached
+    bool get(QString const & storage, QString const & dir_name, QVector<Metadata> & entries) const;
+
+    void set(QString const & storage, QString const & dir_name, QVector<Metadata> const & entries);
+
+    // forgets the backups that aren't in `dir_names` anymore
+    void prune(QString const & storage, QVector<QString> const & dir_names);
+
+    void save();
+
+private:
+
+    void load();
+
+    QString const path_;
+    QMap<QString,QMap<QString,QVector<Metadata>>> manifests_; // storage -> dir -> entries
+    bool dirty_ {};
+};
@@ -19,6 +19,7 @@
 
 #include "manifest.h"
 
+#include "storage-framework/download-reader.h"
 #include "storage-framework/storage_framework_client.h"
 #include "util/connection-helper.h"
 
@@ -64,46 +65,41 @@ public:
         entries_.push_back(entry);
     }
 
+    void add_catalog(QString const & archive_name, QByteArray const & catalog, QString const & dir_name)
+    {
+        Catalog c;
+        c.dir_name = dir_name.isEmpty() ? dir_ : dir_name;
+        c.file_name = Manifest::catalog_name(archive_name);
+        c.contents = catalog;
+        catalogs_.push_back(c);
+    }
+
     void store()
     {
-        qDebug() << "Metadata asking storage framework for a socket";
-        auto json_data = to_json();
-        auto n_bytes = json_data.size();
+        // the catalogs go first so that the manifest never refers to missing ones
+        if (!catalogs_.isEmpty())
+        {
+            auto const catalog = catalogs_.takeFirst();
+            upload(catalog.dir_name, catalog.file_name, catalog.contents, [this, catalog](QString const& /*committed_name*/, bool success){
+                if (!success)
+                    qWarning() << "Error storing catalog" << catalog.file_name << "; restores will read whole archives";
+                store();
+            });
+            return;
+        }
 
-        connections_.connect_future(
-            storage_->get_new_uploader(n_bytes, dir_, MANIFEST_FILE_NAME),
-            std::function<void(std::shared_ptr<Uploader> const&)>{
-                [this, json_data](std::shared_ptr<Uploader> const& uploader){
-                    qDebug() << "Manifest uploader is" << static_cast<void*>(uploader.get());
-                    if (uploader)
-                    {
-                        auto socket = uploader->socket();
-                        socket->write(json_data);
-                        connections_.connect_oneshot(
-                            uploader.get(),
-                            &Uploader::commit_finished,
-                            std::function<void(bool)>{[this, uploader](bool success){
-                                qDebug() << "Metadata commit finished";
-                                if (!success)
-                                {
-                                    finish_with_error(QStringLiteral("Error committing manifest file to storage-framework"));
-                                }
-                                else
-                                {
-                                    uploader_committed_file_name_ = uploader->file_name();
-                                    finish();
-                                }
-                            }}
-                        );
-                        uploader->commit();
-                    }
-                    else
-                    {
-                        finish_with_error(QStringLiteral("Error retrieving uploader for manifest file from storage-framework"));
-                    }
-                }
+        upload(dir_, MANIFEST_FILE_NAME, to_json(), [this](QString const& committed_name, bool success){
+            qDebug() << "Metadata commit finished";
+            if (!success)
+            {
+                finish_with_error(QStringLiteral("Error committing manifest file to storage-framework"));
             }
-        );
+            else
+            {
+                uploader_committed_file_name_ = committed_name;
+                finish();
+            }
+        });
     }
 
     void read()
@@ -112,25 +108,31 @@ public:
             storage_->get_new_downloader(dir_, MANIFEST_FILE_NAME),
             std::function<void(std::shared_ptr<Downloader> const&)>{
                 [this](std::shared_ptr<Downloader> const& downloader){
-                    if (downloader)
-                    {
-                        auto socket = downloader->socket();
-                        if (socket->atEnd())
-                        {
-                            if (!socket->waitForReadyRead(5000))
-                            {
-                                qWarning() << "Manifest socket was not ready to read after timeout";
-                            }
-                        }
-                        auto json_content = socket->readAll();
-                        from_json(json_content);
-                        downloader->finish();
-                        finish();
-                    }
-                    else
+                    if (!downloader)
                     {
                         finish_with_error(QStringLiteral("Error retrieving downloader for manifest file from storage-framework"));
+                        return;
                     }
+
+                    // collect it as it arrives so that other manifests,
+                    // and everything else, can be served meanwhile
+                    reader_.reset(new DownloadReader(downloader), [](DownloadReader *r){r->deleteLater();});
+                    connections_.connect_oneshot(
+                        reader_.data(),
+                        &DownloadReader::finished,
+                        std::function<void(bool)>{[this, downloader](bool success){
+                            downloader->finish();
+                            auto const json = reader_->bytes();
+                            reader_.reset();
+                            if (!success)
+                                finish_with_error(QStringLiteral("Error reading manifest file from storage-framework"));
+                            else if (!from_json(json))
+                                finish_with_error(QStringLiteral("Error parsing manifest file"));
+                            else
+                                finish();
+                        }}
+                    );
+                    reader_->start();
                 }
             }
         );
@@ -160,22 +162,59 @@ public:
         return doc.toJson(QJsonDocument::Compact);
     }
 
-    void from_json(QByteArray const & json)
+    bool from_json(QByteArray const & json)
     {
         auto doc_read = QJsonDocument::fromJson(json);
+        if (!doc_read.isObject())
+            return false;
 
         auto json_read_root = doc_read.object();
         auto items = json_read_root[ENTRIES_KEY].toArray();
 
-        QVector<Metadata> read_metadata;
         for( auto iter = items.begin(); iter != items.end(); ++iter)
         {
             entries_.push_back(Metadata((*iter).toObject()));
         }
+        return true;
     }
 
 private:
 
+    void upload(QString const & dir_name,
+                QString const & file_name,
+                QByteArray const & data,
+                std::function<void(QString const &, bool)> const & on_done)
+    {
+        qDebug() << "Manifest asking storage framework for a socket for" << file_name;
+
+        connections_.connect_future(
+            storage_->get_new_uploader(data.size(), dir_name, file_name),
+            std::function<void(std::shared_ptr<Uploader> const&)>{
+                [this, data, on_done](std::shared_ptr<Uploader> const& uploader){
+                    qDebug() << "Manifest uploader is" << static_cast<void*>(uploader.get());
+                    if (uploader)
+                    {
+                        auto socket = uploader->socket();
+                        socket->write(data);
+                        connections_.connect_oneshot(
+                            uploader.get(),
+                            &Uploader::commit_finished,
+                            std::function<void(bool)>{[uploader, on_done](bool success){
+                                on_done(success ? uploader->file_name() : QString(), success);
+                            }}
+                        );
+                        uploader->commit();
+                    }
+                    else
+                    {
+                        qWarning() << "Error retrieving uploader from storage-framework";
+                        on_done(QString(), false);
+                    }
+                }
+            }
+        );
+    }
+
     void finish_with_error(QString const & message)
     {
         error_string_ = message;
@@ -192,9 +231,18 @@ private:
     QSharedPointer<StorageFrameworkClient> storage_;
     QString dir_;
 
+    struct Catalog
+    {
+        QString dir_name;
+        QString file_name;
+        QByteArray contents;
+    };
+
     QVector<Metadata> entries_;
+    QVector<Catalog> catalogs_;
     QString error_string_;
     QString uploader_committed_file_name_;
+    QSharedPointer<DownloadReader> reader_;
 
     ConnectionHelper connections_;
 };
@@ -219,6 +267,30 @@ void Manifest::add_entry(Metadata const & entry)
     d->add_entry(entry);
 }
 
+void Manifest::add_catalog(QString const & archive_name, QByteArray const & catalog, QString const & dir_name)
+{
+    Q_D(Manifest);
+
+    d->add_catalog(archive_name, catalog, dir_name);
+}
+
+QString Manifest::catalog_name(QString const & archive_name)
+{
+    return archive_name + QStringLiteral(".catalog");
+}
+
+QFuture<std::shared_ptr<Downloader>> Manifest::open_archive(QSharedPointer<StorageFrameworkClient> const & storage, Metadata const & entry)
+{
+    auto const parts = entry.get_parts();
+    if (parts.isEmpty())
+        return storage->get_new_downloader(entry.get_dir_name(), entry.get_file_name());
+
+    return storage->get_new_parted_downloader(entry.get_dir_name(),
+                                              parts,
+                                              int64_t(entry.get_part_size()),
+                                              int64_t(entry.get_archive_size()));
+}
+
 void Manifest::store()
 {
     Q_D(Manifest);
@@ -21,9 +21,14 @@
 
 #include <helper/metadata.h>
 
+#include <QFuture>
 #include <QObject>
+#include <QSharedPointer>
+
+#include <memory>
 
 class ManifestPrivate;
+class Downloader;
 class StorageFrameworkClient;
 
 class Manifest : public QObject
@@ -36,6 +41,16 @@ public:
     Q_DISABLE_COPY(Manifest)
 
     void add_entry(Metadata const & entry);
+
+    // a catalog lists an archive's members; see TarIndexer.
+    // It's stored next to the archive, in `dir_name` if that's not this manifest's dir
+    void add_catalog(QString const & archive_name, QByteArray const & catalog, QString const & dir_name = QString());
+    static QString catalog_name(QString const & archive_name);
+
+    // opens the archive that `entry` describes, whether it was
+    // uploaded whole or in parts
+    static QFuture<std::shared_ptr<Downloader>> open_archive(QSharedPointer<StorageFrameworkClient> const & storage, Metadata const & entry);
+
     void store();
 
     void read();
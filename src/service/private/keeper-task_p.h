@@ -20,6 +20,9 @@
 
 #pragma once
 #include "../keeper-task.h"
+#include "util/retry-policy.h"
+
+#include <memory>
 
 class KeeperTaskPrivate
 {
@@ -44,6 +47,18 @@ public:
 
     keeper::Error error() const;
 
+    void set_rate_limit(quint64 bytes_per_second);
+
+    // counts storage's retries for `transfer` in this task's state, including later ones
+    template<typename T>
+    void track_retries(std::shared_ptr<T> const & transfer)
+    {
+        retry_stats_ += transfer->retry_stats();
+        QObject::connect(transfer.get(), &T::retried, q_ptr, [this](RetryPolicy::Stats const & stats){
+            retry_stats_ += stats;
+        });
+    }
+
 protected:
     void set_current_task_action(QString const& action);
     void on_helper_percent_done_changed(float percent_done);
@@ -61,4 +76,6 @@ protected:
     QSharedPointer<Helper> helper_;
     QVariantMap state_;
     keeper::Error error_;
+    quint64 rate_limit_ {};
+    RetryPolicy::Stats retry_stats_;
 };
@@ -49,31 +49,10 @@ RestoreChoices::get_backups_async(QString const & storage)
     connections_.connect_future(
         storage_->get_keeper_dirs(),
         std::function<void(QVector<QString> const &)>{
-            [this](QVector<QString> const & dirs){
+            [this, storage](QVector<QString> const & dirs){
                 if (dirs.size() > 0)
                 {
-                    manifests_to_read_ = dirs.size();
-                    for (auto i = 0; i < dirs.size(); ++i)
-                    {
-                        QSharedPointer<Manifest> manifest(new Manifest(storage_, dirs.at(i)), [](Manifest *m){m->deleteLater();});
-                        connections_.connect_oneshot(
-                            manifest.data(),
-                            &Manifest::finished,
-                            std::function<void(bool)>{[this, dirs, manifest, i](bool success){
-                                qDebug() << "Finished reading manifest in dir: " << dirs.at(i) << " success =" << success;
-                                if (success)
-                                {
-                                    this->backups_ += manifest->get_entries();
-                                }
-                                manifests_to_read_--;
-                                if (!manifests_to_read_)
-                                {
-                                     Q_EMIT(finished(keeper::Error::OK));
-                                }
-                            }}
-                        );
-                        manifest->read();
-                    }
+                    read_manifests(storage, dirs);
                 }
                 else
                 {
@@ -84,3 +63,94 @@ RestoreChoices::get_backups_async(QString const & storage)
         }
     );
 }
+
+void
+RestoreChoices::read_manifests(QString const & storage, QVector<QString> const & dirs)
+{
+    cache_.prune(storage, dirs);
+
+    // only download the manifests that aren't cached
+    QVector<QString> uncached;
+    for (auto const& dir : dirs)
+    {
+        QVector<Metadata> entries;
+        if (cache_.get(storage, dir, entries))
+            backups_ += entries;
+        else
+            uncached << dir;
+    }
+    qDebug() << uncached.size() << "of" << dirs.size() << "manifests aren't cached";
+
+    // one index read is cheaper than two or more manifest reads
+    if (uncached.size() > 1)
+        read_index(storage, dirs, uncached);
+    else
+        download_manifests(storage, uncached);
+}
+
+void
+RestoreChoices::read_index(QString const & storage, QVector<QString> const & dirs, QVector<QString> const & uncached)
+{
+    index_.reset(new BackupIndex(storage_), [](BackupIndex *i){i->deleteLater();});
+    connections_.connect_oneshot(
+        index_.data(),
+        &BackupIndex::finished,
+        std::function<void(bool)>{[this, storage, uncached](bool /*success*/){
+            auto const backups = index_->backups();
+            QVector<QString> remaining;
+            for (auto const& dir : uncached)
+            {
+                auto const it = backups.find(dir);
+                if (it == backups.end())
+                {
+                    remaining << dir;
+                    continue;
+                }
+                backups_ += it.value();
+                cache_.set(storage, dir, it.value());
+            }
+            qDebug() << "the backup index covered" << (uncached.size() - remaining.size()) << "of" << uncached.size() << "uncached manifests";
+            download_manifests(storage, remaining);
+        }}
+    );
+    index_->read(dirs);
+}
+
+void
+RestoreChoices::download_manifests(QString const & storage, QVector<QString> const & dirs)
+{
+    manifests_to_read_ = dirs.size();
+    if (!manifests_to_read_)
+    {
+        finish_reading();
+        return;
+    }
+
+    for (auto const& dir : dirs)
+    {
+        QSharedPointer<Manifest> manifest(new Manifest(storage_, dir), [](Manifest *m){m->deleteLater();});
+        connections_.connect_oneshot(
+            manifest.data(),
+            &Manifest::finished,
+            std::function<void(bool)>{[this, storage, dir, manifest](bool success){
+                qDebug() << "Finished reading manifest in dir: " << dir << " success =" << success;
+                if (success)
+                {
+                    auto const entries = manifest->get_entries();
+                    backups_ += entries;
+                    cache_.set(storage, dir, entries);
+                }
+                if (!--manifests_to_read_)
+                    finish_reading();
+            }}
+        );
+        manifest->read();
+    }
+}
+
+void
+RestoreChoices::finish_reading()
+{
+    cache_.save();
+    Q_EMIT(finished(keeper::Error::OK));
+}
@@ -19,6 +19,8 @@
 
 #pragma once
 
+#include "service/backup-index.h"
+#include "service/manifest-cache.h"
 #include "service/metadata-provider.h"
 #include "util/connection-helper.h"
 
@@ -28,7 +30,11 @@
 class StorageFrameworkClient;
 
 /**
- * A MetadataProvider that lists the backups that can be restored
+ * A MetadataProvider that lists the backups that can be restored.
+ *
+ * Manifests that were read before come from a ManifestCache. The rest
+ * come from the newest BackupIndex when there's more than one to get,
+ * so only the backups that it doesn't cover need their own download.
  */
 class RestoreChoices: public MetadataProvider
 {
@@ -39,7 +45,14 @@ public:
     void get_backups_async(QString const & storage) override;
 
 private:
+    void read_manifests(QString const & storage, QVector<QString> const & dirs);
+    void read_index(QString const & storage, QVector<QString> const & dirs, QVector<QString> const & uncached);
+    void download_manifests(QString const & storage, QVector<QString> const & dirs);
+    void finish_reading();
+
     QSharedPointer<StorageFrameworkClient> storage_;
     ConnectionHelper connections_;
     int manifests_to_read_ = 0;
+    ManifestCache cache_;
+    QSharedPointer<BackupIndex> index_;
 };
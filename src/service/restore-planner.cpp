@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "service/restore-planner.h"
+
+#include "tar/delta.h"
+#include "tar/tar-filter.h"
+
+#include <algorithm> // std::min()
+#include <set>
+#include <string>
+#include <unordered_set>
+
+RestorePlanner::RestorePlanner(QVector<Metadata> const& chain,
+                               std::vector<std::vector<TarIndexer::Entry>> const& catalogs)
+{
+    auto const n = std::min(size_t(chain.size()), catalogs.size());
+    if (!n)
+        return;
+
+    // only the files in the newest backup get restored
+    std::unordered_set<std::string> live;
+    for (auto const& entry : catalogs[n-1])
+        live.insert(Delta::target_name(entry.path));
+
+    // walk from newest to oldest. Once a file's newest full copy is found,
+    // older copies of it are superseded.
+    std::unordered_set<std::string> complete;
+    std::vector<Step> steps(n);
+    for (size_t i=n; i-- > 0; )
+    {
+        std::unordered_set<std::string> complete_here;
+        for (auto const& entry : catalogs[i])
+        {
+            auto const path = Delta::target_name(entry.path);
+            if (!live.count(path) || complete.count(path))
+                continue;
+            steps[i].kept.push_back(entry);
+            if (!Delta::is_delta_name(entry.path))
+                complete_here.insert(path);
+        }
+        complete.insert(complete_here.begin(), complete_here.end());
+        steps[i].backup = chain[int(i)];
+    }
+
+    for (auto& step : steps)
+    {
+        if (step.kept.empty())
+            continue;
+        n_bytes_ += qint64(TarFilter::filtered_size(step.kept));
+        steps_.push_back(std::move(step));
+    }
+}
+
+std::vector<RestorePlanner::Step> const&
+RestorePlanner::steps() const
+{
+    return steps_;
+}
+
+qint64
+RestorePlanner::n_bytes() const
+{
+    return n_bytes_;
+}
+
+std::shared_ptr<TarFilter>
+RestorePlanner::create_filter(size_t step) const
+{
+    std::set<uint64_t> offsets;
+    for (auto const& entry : steps_.at(step).kept)
+        offsets.insert(entry.start_offset);
+
+    return std::make_shared<TarFilter>([offsets](TarIndexer::Entry const& entry){
+        return offsets.count(entry.start_offset) != 0;
+    });
+}
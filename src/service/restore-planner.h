@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#pragma once
+
+#include "helper/metadata.h"
+#include "tar/tar-index.h"
+
+#include <QVector>
+
+#include <memory>
+#include <vector>
+
+class TarFilter;
+
+/**
+ * Plans the restore of a backup that depends on a chain of earlier ones.
+ *
+ * Given the chain's catalogs, this picks the archive members that are
+ * needed to rebuild the newest backup: each file's newest full copy plus
+ * any deltas that were made on top of it. Superseded copies, and files
+ * that were gone by the newest backup, are left out, so each file is
+ * written once and archives that contribute nothing aren't downloaded.
+ */
+class RestorePlanner
+{
+public:
+    // `chain` is oldest first, and `catalogs[i]` lists the members of `chain[i]`
+    RestorePlanner(QVector<Metadata> const& chain,
+                   std::vector<std::vector<TarIndexer::Entry>> const& catalogs);
+
+    struct Step
+    {
+        Metadata backup;
+        std::vector<TarIndexer::Entry> kept;
+    };
+
+    // the archives to read, oldest first
+    std::vector<Step> const& steps() const;
+
+    // the size of the restore stream, ie all the steps' filtered archives
+    qint64 n_bytes() const;
+
+    // a filter that passes through only a step's kept members
+    std::shared_ptr<TarFilter> create_filter(size_t step) const;
+
+private:
+    std::vector<Step> steps_;
+    qint64 n_bytes_ {};
+};
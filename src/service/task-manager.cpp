@@ -19,13 +19,22 @@
  */
 
 #include "helper/metadata.h"
+#include "backup-chains.h"
+#include "backup-checkpoints.h"
+#include "backup-index.h"
 #include "keeper-task-backup.h"
 #include "keeper-task-restore.h"
 #include "manifest.h"
 #include "storage-framework/storage_framework_client.h"
+#include "tar/tar-creator.h"
 #include "task-manager.h"
 #include "util/connection-helper.h"
 #include "util/dbus-utils.h"
+#include "util/process-priority.h"
+
+#include <QTimer>
+
+#include <algorithm> // std::count_if(), std::min(), std::max()
 
 class TaskManagerPrivate
 {
@@ -37,6 +46,17 @@ public:
         , helper_registry_(helper_registry)
         , storage_(storage)
     {
+        // re-apply the limits when a time-of-day profile starts or ends
+        bandwidth_timer_.setSingleShot(true);
+        QObject::connect(&bandwidth_timer_, &QTimer::timeout,
+            std::bind(&TaskManagerPrivate::apply_bandwidth_limits, this)
+        );
+
+        // progress is published in batches rather than on every change
+        publish_timer_.setInterval(PUBLISH_INTERVAL_MSEC);
+        QObject::connect(&publish_timer_, &QTimer::timeout,
+            std::bind(&TaskManagerPrivate::on_publish_tick, this)
+        );
     }
 
     ~TaskManagerPrivate() = default;
@@ -45,14 +65,22 @@ public:
     {
         auto const now = QDateTime::currentDateTime();
         backup_dir_name_ = now.toString("yyyy-MM-ddTHH-mm-ss");
+        longest_chain_ = -1;
         active_manifest_.reset(new Manifest(storage_, backup_dir_name_), [](Manifest *m){m->deleteLater();});
-        return start_tasks(tasks, storage, Mode::BACKUP);
+        if (!start_tasks(tasks, storage, Mode::BACKUP))
+            return false;
+
+        // every task uploads into the same folder, so create it while
+        // the first helper is still starting up
+        storage_->prepare_folder(backup_dir_name_, true);
+        return true;
     }
 
-    bool start_restore(QList<Metadata> const& tasks, QString const & storage)
+    bool start_restore(QList<Metadata> const& tasks, QString const & storage, QVector<Metadata> const& backups)
     {
         qDebug() << "Starting restore...";
-        return start_tasks(tasks, storage, Mode::RESTORE);
+        BackupChains const chains(backups);
+        return start_tasks(tasks, storage, Mode::RESTORE, &chains);
     }
 
     /***
@@ -76,46 +104,143 @@ public:
 //        return state_;
     }
 
-    void ask_for_uploader(quint64 n_bytes)
+    QString claim_task(QString const & helper_path)
+    {
+        return find_task_for_helper(helper_path, true);
+    }
+
+    void ask_for_uploader(QString const & uuid, quint64 n_bytes, bool direct)
     {
-        qDebug() << "Starting backup";
-        if (task_)
+        qDebug() << "Starting backup for task" << uuid;
+        auto backup_task_ = qSharedPointerDynamicCast<KeeperTaskBackup>(running_.value(uuid).task);
+        if (!backup_task_)
         {
-            auto backup_task_ = qSharedPointerDynamicCast<KeeperTaskBackup>(task_);
-            if (!backup_task_)
-            {
-                qWarning() << "Only backup tasks are allowed to ask for storage framework sockets";
-                // TODO Mark this as an error at the current task and move to the next task
-                return;
-            }
-            backup_task_->ask_for_uploader(n_bytes, backup_dir_name_);
+            qWarning() << "Only backup tasks are allowed to ask for storage framework sockets";
+            Q_EMIT(q_ptr->socket_error(uuid, keeper::Error::UNKNOWN));
+            return;
+        }
+        if (direct && !direct_uploads_)
+        {
+            qDebug() << "relaying the backup because direct uploads are off";
+            direct = false;
+        }
+
+        // a direct upload bypasses keeper, so it can't be rate limited
+        if (direct && bandwidth_schedule_.limits_uploads())
+        {
+            qDebug() << "relaying the backup so that its upload can be rate limited";
+            direct = false;
+        }
+
+        // pick up where an interrupted upload of the same archive left off
+        auto dir_name = backup_dir_name_;
+        PartedUploader::Resume resume;
+        auto const checkpoint = checkpoints_.get(checkpoint_key(uuid));
+        if (checkpoint.matches(qint64(n_bytes), storage_->multipart_part_size()))
+        {
+            dir_name = checkpoint.dir_name;
+            resume = checkpoint.resume();
+            qDebug() << "resuming the upload into" << dir_name << "after" << resume.parts.size() << "parts";
         }
+
+        backup_task_->ask_for_uploader(n_bytes, dir_name, direct, resume);
+    }
+
+    QString checkpoint_key(QString const& uuid) const
+    {
+        return BackupCheckpoints::key(storage_id_, task_data_.value(uuid).metadata);
     }
 
-    void ask_for_downloader()
+    void on_part_committed(QString const& uuid, int part, QString const& committed_name, QByteArray const& digest)
     {
-        qDebug() << "Starting restore";
-        if (task_)
+        auto backup_task = qSharedPointerDynamicCast<KeeperTaskBackup>(running_.value(uuid).task);
+        if (!backup_task)
+            return;
+
+        auto const key = checkpoint_key(uuid);
+        auto const n_bytes = backup_task->get_archive_size();
+        auto const part_size = storage_->multipart_part_size();
+        auto checkpoint = checkpoints_.get(key);
+        if (!checkpoint.matches(n_bytes, part_size) || (checkpoint.dir_name != backup_task->get_dir_name()))
         {
-            auto restore_task_ = qSharedPointerDynamicCast<KeeperTaskRestore>(task_);
-            if (!restore_task_)
-            {
-                qWarning() << "Only restore tasks are allowed to ask for storage framework downloaders";
-                // TODO Mark this as an error at the current task and move to the next task
-                return;
-            }
-            restore_task_->ask_for_downloader();
+            checkpoint = BackupCheckpoints::Checkpoint();
+            checkpoint.dir_name = backup_task->get_dir_name();
+            checkpoint.n_bytes = n_bytes;
+            checkpoint.part_size = part_size;
         }
+
+        BackupCheckpoints::Part p;
+        p.name = committed_name;
+        p.digest = digest;
+        checkpoint.parts[part] = p;
+        checkpoints_.set(key, checkpoint);
     }
 
-    void cancel()
+    void on_resume_invalid(QString const& uuid)
     {
-        qDebug() << "=============== CANCELING =======================";
-        if (task_)
+        // the checkpoint would fail every run after this one too, so forget
+        // it and start the task over once its helper has given up.
+        // Archives can differ between runs without their size changing,
+        // eg if a file was rewritten in place
+        qWarning() << "the interrupted upload can't be resumed; discarding its checkpoint";
+        checkpoints_.remove(checkpoint_key(uuid));
+        if (running_.contains(uuid))
+            running_[uuid].restart = true;
+    }
+
+    // runs a task again from the start, without telling clients that it failed
+    void restart_task(QString const& uuid)
+    {
+        qDebug() << "restarting" << uuid << "without resuming";
+
+        auto const running = running_.take(uuid);
+        running_uuids_.removeAll(uuid);
+        running.task->disconnect();
+
+        auto& td = task_data_[uuid];
+        finish_signatures(td.metadata, false);
+        td.error = keeper::Error::OK;
+
+        if (!start_task(uuid))
+            qWarning() << "unable to restart" << uuid;
+    }
+
+    void update_backup_progress(QString const & helper_path, quint64 n_bytes)
+    {
+        auto const uuid = find_task_for_helper(helper_path, false);
+        auto backup_task = qSharedPointerDynamicCast<KeeperTaskBackup>(running_.value(uuid).task);
+        if (backup_task)
+            backup_task->update_progress(n_bytes);
+    }
+
+    void set_backup_catalog(QString const & helper_path, QByteArray const & catalog)
+    {
+        auto const uuid = find_task_for_helper(helper_path, false);
+        auto backup_task = qSharedPointerDynamicCast<KeeperTaskBackup>(running_.value(uuid).task);
+        if (backup_task)
+            backup_task->set_catalog(catalog);
+    }
+
+    void ask_for_downloader(QString const & uuid)
+    {
+        qDebug() << "Starting restore for task" << uuid;
+        auto restore_task_ = qSharedPointerDynamicCast<KeeperTaskRestore>(running_.value(uuid).task);
+        if (!restore_task_)
         {
-            task_->cancel();
+            qWarning() << "Only restore tasks are allowed to ask for storage framework downloaders";
+            Q_EMIT(q_ptr->socket_error(uuid, keeper::Error::UNKNOWN));
+            return;
         }
-        for (auto const & task: remaining_tasks_)
+        restore_task_->ask_for_downloader();
+    }
+
+    void cancel()
+    {
+        qDebug() << "=============== CANCELING =======================";
+        auto const remaining = remaining_tasks_;
+        remaining_tasks_.clear();
+
+        for (auto const & task: remaining)
         {
             auto& td = task_data_[task];
             td.action = QStringLiteral("cancelled"); // TODO i18n
@@ -123,20 +248,148 @@ public:
         }
         // notify the initial state once for all tasks
         notify_state_changed();
-        remaining_tasks_.clear();
+
+        for (auto const & uuid : QStringList(running_uuids_))
+        {
+            auto const task = running_.value(uuid).task;
+            if (task)
+                task->cancel();
+        }
         Q_EMIT(q_ptr->finished());
     }
 
+    void set_bandwidth_schedule(BandwidthSchedule const & schedule)
+    {
+        bandwidth_schedule_ = schedule;
+        apply_bandwidth_limits();
+    }
+
+    BandwidthSchedule bandwidth_schedule() const
+    {
+        return bandwidth_schedule_;
+    }
+
+    void set_max_concurrent_tasks(int n)
+    {
+        max_concurrent_tasks_ = std::min(std::max(n, 1), DBusTypes::KEEPER_HELPER_MAX_TASKS);
+        qDebug() << "running up to" << max_concurrent_tasks_ << "tasks at once";
+
+        // if we're in the middle of something, fill any new slots now
+        if (!running_.isEmpty())
+            start_next_tasks();
+    }
+
+    int max_concurrent_tasks() const
+    {
+        return max_concurrent_tasks_;
+    }
+
+    void set_direct_uploads(bool direct)
+    {
+        direct_uploads_ = direct;
+    }
+
+    bool direct_uploads() const
+    {
+        return direct_uploads_;
+    }
+
+    int longest_incremental_chain() const
+    {
+        return longest_chain_;
+    }
+
+    void set_helper_process(QString const & uuid, pid_t pid)
+    {
+        auto it = running_.find(uuid);
+        if (it == running_.end())
+            return;
+
+        it->helper_pid = pid;
+        apply_priority(it.value());
+    }
+
+    void set_foreground(bool foreground)
+    {
+        if (foreground_ == foreground)
+            return;
+
+        foreground_ = foreground;
+        for (auto const& running : running_)
+            apply_priority(running);
+    }
+
 private:
 
     enum class Mode { IDLE, BACKUP, RESTORE };
 
-    bool start_tasks(QList<Metadata> const& tasks, QString const & storage, Mode mode)
+    static constexpr int PUBLISH_INTERVAL_MSEC {250};
+
+    struct RunningTask
+    {
+        QSharedPointer<KeeperTask> task;
+        QString caller_path; // the path its helper called in on, if it has
+        pid_t helper_pid {};
+        bool draining {};    // its data is sent; it's only finishing up
+        bool restart {};     // its resumed upload was invalid, so run it again
+    };
+
+    // the tasks that are still moving data
+    int n_transferring() const
+    {
+        return int(std::count_if(running_.cbegin(), running_.cend(), [](RunningTask const& r){return !r.draining;}));
+    }
+
+    void apply_priority(RunningTask const & running)
+    {
+        if (running.helper_pid <= 0)
+            return;
+
+        // backups can take as long as they need; restores are awaited
+        ProcessPriority::Level level;
+        if (foreground_)
+            level = ProcessPriority::Level::NORMAL;
+        else if (mode_ == Mode::BACKUP)
+            level = ProcessPriority::Level::IDLE;
+        else
+            level = ProcessPriority::Level::BACKGROUND;
+
+        auto const pids = ProcessPriority::helper_processes(running.helper_pid);
+        auto const result = ProcessPriority::apply(pids, level);
+        qDebug() << "helper" << running.helper_pid << "priority" << ProcessPriority::to_string(level)
+                 << "threads:" << result.n_threads
+                 << "failed:" << result.n_failed
+                 << "reniced:" << result.reniced
+                 << "cgroup:" << result.cgroup;
+    }
+
+    void apply_bandwidth_limits()
+    {
+        auto const now = QTime::currentTime();
+        auto const limits = bandwidth_schedule_.limits_at(now);
+
+        // the tasks that are still moving data share the limit evenly
+        auto limit = mode_ == Mode::RESTORE ? limits.download : limits.upload;
+        auto const n = n_transferring();
+        if (limit && n > 1)
+            limit = std::max(quint64(1), limit / quint64(n));
+        for (auto const& running : running_)
+            running.task->set_rate_limit(limit);
+
+        auto const msec = bandwidth_schedule_.msec_until_change(now);
+        if (msec >= 0)
+            bandwidth_timer_.start(msec);
+        else
+            bandwidth_timer_.stop();
+    }
+
+    bool start_tasks(QList<Metadata> const& tasks, QString const & storage, Mode mode, BackupChains const* chains = nullptr)
     {
         storage_->set_storage(storage);
+        storage_id_ = storage;
         bool success = true;
 
-        if (!remaining_tasks_.isEmpty())
+        if (!remaining_tasks_.isEmpty() || !running_.isEmpty())
         {
             // FIXME: return a dbus error here
             qWarning() << "keeper is already active";
@@ -147,8 +400,9 @@ private:
             // rebuild the state variables
             state_.clear();
             task_data_.clear();
-            current_task_.clear();
             remaining_tasks_.clear();
+            last_task_.reset();
+            last_task_uuid_.clear();
 
             mode_ = mode;
 
@@ -160,6 +414,8 @@ private:
 
                 auto& td = task_data_[uuid];
                 td.metadata = metadata;
+                if (chains)
+                    td.chain = chains->restore_chain(metadata);
                 td.action = QStringLiteral("queued"); // TODO i18n
                 td.error = keeper::Error::OK;
                 set_initial_task_state(td);
@@ -168,7 +424,7 @@ private:
             // notify the initial state once for all tasks
             notify_state_changed();
 
-            start_next_task();
+            start_next_tasks();
         }
 
         return success;
@@ -176,65 +432,176 @@ private:
 
     void manifest_stored(bool success)
     {
-        qDebug() << "Manifest upload finished success = " << success << " current task=" << current_task_;
-        auto& td = task_data_[current_task_];
-        if (success)
-        {
-            update_task_state(td);
-        }
-        else
+        qDebug() << "Manifest upload finished success = " << success << " last task=" << last_task_uuid_;
+        for (auto const& entry : active_manifest_->get_entries())
+            finish_signatures(entry, success);
+
+        if (!success)
         {
-            td.error = keeper::Error::MANIFEST_STORAGE;
-            set_current_task_action(task_->to_string(Helper::State::FAILED));
+            if (last_task_)
+            {
+                task_data_[last_task_uuid_].error = keeper::Error::MANIFEST_STORAGE;
+                set_task_action(last_task_uuid_, last_task_->to_string(Helper::State::FAILED));
+            }
+            active_manifest_.reset();
+            Q_EMIT(q_ptr->finished());
+            return;
         }
-        active_manifest_.reset();
 
-        Q_EMIT(q_ptr->finished());
+        update_task_state(last_task_uuid_);
+
+        // the backup is safe now; the index only saves readers some
+        // round trips, so failing to update it isn't an error
+        update_index(active_manifest_->get_entries(), [this](){
+            active_manifest_.reset();
+            Q_EMIT(q_ptr->finished());
+        });
     }
 
-    void on_helper_state_changed(Helper::State state)
+    // A folder backup leaves its signatures for the next run's deltas
+    // pending, since they're only a valid basis once the backup is stored.
+    // Anything left uncommitted is dropped by that folder's next backup.
+    static void finish_signatures(Metadata const & metadata, bool stored)
     {
-        auto backup_task_ = qSharedPointerDynamicCast<KeeperTaskBackup>(task_);
-        auto& td = task_data_[current_task_];
+        if (metadata.get_type() != Metadata::FOLDER_VALUE)
+            return;
 
-        // for the last completed backup task we delay updating the
-        // state until the manifest file is stored
-        if (remaining_tasks_.size() || (state != Helper::State::COMPLETE && state != Helper::State::FAILED))
-            update_task_state(td);
+        auto const signatures_dir = TarCreator::default_signatures_dir();
+        auto const source_dir = metadata.get_property_value(Metadata::SUBTYPE_KEY).toString();
+        if (!stored)
+            TarCreator::discard_signatures(signatures_dir, source_dir);
+        else if (!TarCreator::commit_signatures(signatures_dir, source_dir))
+            qWarning() << "unable to commit the delta signatures for" << source_dir << "; its next backup may be larger";
+    }
 
-        if (state == Helper::State::COMPLETE || state == Helper::State::FAILED)
-        {
-            if (backup_task_ && state == Helper::State::COMPLETE && active_manifest_)
-            {
-                qDebug() << "Backup task finished. The file created in storage framework is: [" << backup_task_->get_file_name() << "]";
-                td.metadata.set_property_value(keeper::Item::FILE_NAME_KEY, backup_task_->get_file_name());
-                td.metadata.set_property_value(keeper::Item::DIR_NAME_KEY, backup_dir_name_);
-                active_manifest_->add_entry(td.metadata);
-            }
-            if (remaining_tasks_.size())
-            {
-                qDebug() << "STARTING NEXT TASK ---------------------------------------";
-                start_next_task();
-            }
-            else
-            {
-                if (active_manifest_ && active_manifest_->get_entries().size())
-                {
-                    qDebug() << "STORING MANIFEST------------";
+    void update_index(QVector<Metadata> const & entries, std::function<void()> const & on_done)
+    {
+        auto const dir_name = backup_dir_name_;
+        connections_.connect_future(
+            storage_->get_keeper_dirs(),
+            std::function<void(QVector<QString> const&)>{
+                [this, dir_name, entries, on_done](QVector<QString> const& dirs){
+                    if (dirs.isEmpty())
+                    {
+                        qWarning() << "unable to list the backups; not updating the backup index";
+                        on_done();
+                        return;
+                    }
+                    QSharedPointer<BackupIndex> index(new BackupIndex(storage_), [](BackupIndex *i){i->deleteLater();});
                     connections_.connect_oneshot(
-                        active_manifest_.data(),
-                        &Manifest::finished,
-                        std::function<void(bool)>{[this](bool success){
-                            manifest_stored(success);
+                        index.data(),
+                        &BackupIndex::finished,
+                        std::function<void(bool)>{[this, index, on_done](bool success){
+                            if (!success)
+                                qWarning() << "unable to store the backup index; restore choices will read the manifests instead";
+                            else
+                                longest_chain_ = longest_chain(index->backups());
+                            on_done();
                         }}
                     );
-                    active_manifest_->store();
-                }
-                else
-                {
-                    update_task_state(td);
+                    index->update(dirs, dir_name, entries);
                 }
             }
+        );
+    }
+
+    static int longest_chain(BackupIndex::Backups const & backups)
+    {
+        QVector<Metadata> entries;
+        for (auto const& dir_entries : backups)
+            entries += dir_entries;
+
+        BackupChains const chains(entries);
+        int longest {};
+        for (auto const& key : chains.keys())
+            longest = std::max(longest, chains.incrementals_since_full(key));
+        return longest;
+    }
+
+    void on_helper_state_changed(QString const& uuid, Helper::State state)
+    {
+        auto const task = running_.value(uuid).task;
+        if (!task)
+            return;
+
+        auto backup_task_ = qSharedPointerDynamicCast<KeeperTaskBackup>(task);
+        auto& td = task_data_[uuid];
+        auto const done = state == Helper::State::COMPLETE || state == Helper::State::FAILED;
+
+        if (backup_task_ && (state == Helper::State::FAILED) && running_[uuid].restart)
+        {
+            restart_task(uuid);
+            return;
+        }
+
+        // for the last completed backup task we delay updating the
+        // state until the manifest file is stored
+        if (!done || remaining_tasks_.size() || running_.size() > 1)
+            update_task_state(uuid);
+
+        // Once a task's data has all been sent, all that's left is
+        // committing the upload or waiting for the helper to finish
+        // writing files. Start the next task now so that its helper
+        // launch and uploader setup overlap with that tail.
+        if (state == Helper::State::DATA_COMPLETE && !running_[uuid].draining)
+        {
+            running_[uuid].draining = true;
+            start_next_tasks();
+            apply_bandwidth_limits();
+        }
+
+        if (!done)
+            return;
+
+        if (backup_task_ && state == Helper::State::COMPLETE && active_manifest_)
+        {
+            qDebug() << "Backup task finished. The file created in storage framework is: [" << backup_task_->get_file_name() << "]";
+            td.metadata.set_property_value(keeper::Item::FILE_NAME_KEY, backup_task_->get_file_name());
+            td.metadata.set_property_value(keeper::Item::DIR_NAME_KEY, backup_task_->get_dir_name());
+            td.metadata.set_property_value(keeper::Item::INCREMENTAL_KEY, backup_task_->is_incremental());
+            td.metadata.set_parts(backup_task_->get_parts(), backup_task_->get_part_size(), backup_task_->get_archive_size());
+            active_manifest_->add_entry(td.metadata);
+
+            auto const catalog = backup_task_->get_catalog();
+            if (!catalog.isEmpty())
+                active_manifest_->add_catalog(backup_task_->get_file_name(), catalog, backup_task_->get_dir_name());
+
+            // a failed or cancelled upload keeps its checkpoint for next time
+            checkpoints_.remove(checkpoint_key(uuid));
+        }
+        else if (backup_task_)
+        {
+            finish_signatures(td.metadata, false);
+        }
+
+        retire_task(uuid);
+
+        if (remaining_tasks_.size())
+        {
+            qDebug() << "STARTING NEXT TASK ---------------------------------------";
+            start_next_tasks();
+        }
+
+        if (!running_.isEmpty())
+        {
+            // the share of the bandwidth limit that was freed up
+            apply_bandwidth_limits();
+        }
+        else if (active_manifest_ && active_manifest_->get_entries().size())
+        {
+            qDebug() << "STORING MANIFEST------------";
+            connections_.connect_oneshot(
+                active_manifest_.data(),
+                &Manifest::finished,
+                std::function<void(bool)>{[this](bool success){
+                    manifest_stored(success);
+                }}
+            );
+            active_manifest_->store();
+        }
+        else
+        {
+            update_task_state(last_task_uuid_);
         }
     }
 
@@ -242,6 +609,62 @@ private:
     ****  Task Queueing
     ***/
 
+    // each running task's helper gets a bus path of its own
+    QString get_free_helper_path() const
+    {
+        QStringList used;
+        for (auto const& uuid : running_uuids_)
+            used << task_data_.value(uuid).helper_path;
+
+        for (int slot=0; slot<DBusTypes::KEEPER_HELPER_MAX_TASKS; ++slot)
+        {
+            auto const path = DBusTypes::keeperHelperTaskPath(slot);
+            if (!used.contains(path))
+                return path;
+        }
+
+        return QString();
+    }
+
+    // Returns the uuid of the task whose helper is calling in on `helper_path`.
+    // Helpers that don't know about per-task paths all call in on
+    // KEEPER_HELPER_PATH, so they're matched to the oldest running task
+    // that hasn't heard from its helper yet.
+    QString find_task_for_helper(QString const & helper_path, bool claim)
+    {
+        for (auto const& uuid : running_uuids_)
+            if (task_data_.value(uuid).helper_path == helper_path)
+                return uuid;
+
+        // a draining task's helper is done talking to us, so
+        // prefer the tasks that are still transferring
+        QString found;
+        QString fallback;
+        for (auto const& uuid : running_uuids_)
+        {
+            auto const& running = running_[uuid];
+            if (running.draining)
+                continue;
+            if (fallback.isEmpty())
+                fallback = uuid;
+            if (claim ? running.caller_path.isEmpty() : running.caller_path == helper_path)
+            {
+                found = uuid;
+                break;
+            }
+        }
+
+        if (found.isEmpty())
+            found = fallback;
+        if (found.isEmpty() && !running_uuids_.isEmpty())
+            found = running_uuids_.front();
+
+        if (claim && !found.isEmpty())
+            running_[found].caller_path = helper_path;
+
+        return found;
+    }
+
     bool start_task(QString const& uuid)
     {
         auto it = task_data_.find(uuid);
@@ -252,94 +675,138 @@ private:
         }
 
         auto& td = it.value();
+        td.helper_path = get_free_helper_path();
 
-        qDebug() << "Creating task for uuid = " << uuid;
+        qDebug() << "Creating task for uuid = " << uuid << "on helper path" << td.helper_path;
         // initialize a new task
 
-        if (task_)
-            task_.data()->disconnect();
-
+        QSharedPointer<KeeperTask> task;
         if (mode_ == Mode::BACKUP)
         {
-            task_.reset(new KeeperTaskBackup(td, helper_registry_, storage_));
+            task.reset(new KeeperTaskBackup(td, helper_registry_, storage_), [](KeeperTask *t){t->deleteLater();});
         }
         else
         {
-            task_.reset(new KeeperTaskRestore(td, helper_registry_, storage_));
+            task.reset(new KeeperTaskRestore(td, helper_registry_, storage_), [](KeeperTask *t){t->deleteLater();});
         }
 
         qDebug() << "task created: " << state_;
 
-        set_current_task(uuid);
+        // the new task's helper hasn't checked in yet
+        running_uuids_ << uuid;
+        running_[uuid].task = task;
 
-        QObject::connect(task_.data(), &KeeperTask::task_state_changed,
-            std::bind(&TaskManagerPrivate::on_helper_state_changed, this, std::placeholders::_1)
-        );
+        if (!publish_timer_.isActive())
+            publish_timer_.start();
+
+        apply_bandwidth_limits();
+
+        update_task_state(uuid);
 
-        QObject::connect(task_.data(), &KeeperTask::task_socket_ready,
-            std::bind(&TaskManager::socket_ready, q_ptr, std::placeholders::_1)
+        QObject::connect(task.data(), &KeeperTask::task_state_changed,
+            std::bind(&TaskManagerPrivate::on_helper_state_changed, this, uuid, std::placeholders::_1)
         );
 
-        QObject::connect(task_.data(), &KeeperTask::task_socket_error,
-                    std::bind(&TaskManagerPrivate::on_task_socket_error, this, std::placeholders::_1)
+        QObject::connect(task.data(), &KeeperTask::task_socket_ready,
+            std::bind(&TaskManagerPrivate::on_task_socket_ready, this, uuid, std::placeholders::_1)
         );
 
-        return task_->start();
-    }
+        QObject::connect(task.data(), &KeeperTask::task_socket_error,
+            std::bind(&TaskManagerPrivate::on_task_socket_error, this, uuid, std::placeholders::_1)
+        );
 
-    void on_task_socket_error(keeper::Error error)
-    {
-        if (!task_)
+        auto backup_task = qSharedPointerDynamicCast<KeeperTaskBackup>(task);
+        if (backup_task)
         {
-            qWarning() << "Error updating current task state";
+            QObject::connect(backup_task.data(), &KeeperTaskBackup::part_committed,
+                std::bind(&TaskManagerPrivate::on_part_committed, this, uuid,
+                          std::placeholders::_1, std::placeholders::_2, std::placeholders::_3)
+            );
+            QObject::connect(backup_task.data(), &KeeperTaskBackup::resume_invalid,
+                std::bind(&TaskManagerPrivate::on_resume_invalid, this, uuid)
+            );
         }
-        auto& td = task_data_[current_task_];
-        td.error = error;
-        set_current_task_action(task_->to_string(Helper::State::FAILED));
-        Q_EMIT(q_ptr->socket_error(error));
+
+        if (task->start())
+            return true;
+
+        // a task that fails to start has usually been retired already
+        if (running_.contains(uuid))
+            retire_task(uuid);
+        return false;
     }
 
-    void set_current_task(QString const& uuid)
+    // stops tracking a task that's done, but holds onto it
+    // in case it's the last one and its final state is delayed
+    void retire_task(QString const& uuid)
     {
-        auto const prev = current_task_;
+        if (!running_.contains(uuid))
+            return;
 
-        current_task_ = uuid;
+        auto const running = running_.take(uuid);
+        running_uuids_.removeAll(uuid);
+        running.task->disconnect();
 
-        if (!uuid.isEmpty())
-            update_task_state(uuid);
+        last_task_ = running.task;
+        last_task_uuid_ = uuid;
     }
 
-    void clear_current_task()
+    void on_task_socket_ready(QString const& uuid, int fd)
     {
-        set_current_task(QString());
+        Q_EMIT(q_ptr->socket_ready(uuid, fd));
     }
 
-    void start_next_task()
+    void on_task_socket_error(QString const& uuid, keeper::Error error)
     {
-        bool started {false};
+        auto const task = running_.value(uuid).task;
+        if (!task)
+        {
+            qWarning() << "Error updating task state for" << uuid;
+        }
+        else
+        {
+            task_data_[uuid].error = error;
+            set_task_action(uuid, task->to_string(Helper::State::FAILED));
+        }
+        Q_EMIT(q_ptr->socket_error(uuid, error));
+    }
+
+    // draining tasks don't count against max_concurrent_tasks_,
+    // but they do keep their helper path until they're done
+    void start_next_tasks()
+    {
+        while (n_transferring() < max_concurrent_tasks_
+               && !remaining_tasks_.isEmpty()
+               && !get_free_helper_path().isEmpty())
+            start_task(remaining_tasks_.takeFirst());
+
+        prepare_next_folder();
+    }
 
-        while (!started && !remaining_tasks_.isEmpty())
-            started = start_task(remaining_tasks_.takeFirst());
+    // looks up the folder the next queued restore reads from, so
+    // that it's cached by the time that task asks for a downloader
+    void prepare_next_folder()
+    {
+        if (mode_ != Mode::RESTORE || remaining_tasks_.isEmpty())
+            return;
 
-        if (!started)
-            clear_current_task();
+        auto const dir_name = task_data_.value(remaining_tasks_.front()).metadata.get_dir_name();
+        if (!dir_name.isEmpty())
+            storage_->prepare_folder(dir_name, false);
     }
 
     /***
     ****  State
     ***/
 
-    void update_task_state(QString const& uuid)
+    QSharedPointer<KeeperTask> find_task(QString const& uuid) const
     {
-        qDebug() << "Updating state for " << uuid << static_cast<void *>(task_.data());
-        auto it = task_data_.find(uuid);
-        if (it == task_data_.end())
-        {
-            qCritical() << "no task data for" << uuid;
-            return;
-        }
-
-        update_task_state(it.value());
+        auto const it = running_.find(uuid);
+        if (it != running_.end())
+            return it->task;
+        if (uuid == last_task_uuid_)
+            return last_task_;
+        return QSharedPointer<KeeperTask>();
     }
 
     void set_initial_task_state(KeeperTask::KeeperTask::TaskData& td)
@@ -347,8 +814,13 @@ private:
         state_[td.metadata.get_uuid()] = KeeperTask::get_initial_state(td);
     }
 
+    // publishes the state now, along with anything that was waiting for the next tick
     void notify_state_changed()
     {
+        state_dirty_ = false;
+
+        emit_state_delta();
+
         DBusUtils::notifyPropertyChanged(
             QDBusConnection::sessionBus(),
             *q_ptr,
@@ -360,30 +832,78 @@ private:
         Q_EMIT(q_ptr->state_changed());
     }
 
-    void update_task_state(KeeperTask::KeeperTask::TaskData& td)
+    void emit_state_delta()
     {
-        auto task_state = task_->state();
+        keeper::Items changes;
+        QStringList removed;
+        TaskManager::diff_state(published_, state_, changes, removed);
+
+        published_ = state_;
+
+        if (!changes.isEmpty() || !removed.isEmpty())
+            Q_EMIT(q_ptr->state_delta(changes, removed));
+    }
+
+    void update_task_state(QString const& uuid)
+    {
+        auto const task = find_task(uuid);
+        if (!task)
+        {
+            qCritical() << "no task for" << uuid;
+            return;
+        }
+
+        auto task_state = task->state();
 
         // avoid sending repeated states to minimize the use of the bus
-        if (task_state != state_[td.metadata.get_uuid()] && !task_state.isEmpty())
+        auto& published = state_[uuid];
+        if (task_state != published && !task_state.isEmpty())
         {
-            state_[td.metadata.get_uuid()] = task_state;
+            // clients follow the actions step by step, so those go out right away;
+            // progress and speed changes wait for the next tick
+            auto const action_changed = task_state.value(keeper::Item::STATUS_KEY) != published.value(keeper::Item::STATUS_KEY);
+            published = task_state;
 
-            // FIXME: we don't need this to work correctly for the sprint because Marcus is polling in a loop
-            // but we will need this in order for him to stop doing that
+            if (action_changed)
+                notify_state_changed();
+            else
+                state_dirty_ = true;
+        }
+    }
 
-            // TODO: compare old and new and decide if it's worth emitting a PropertyChanged signal;
-            // eg don't contribute to dbus noise for minor speed fluctuations
-            notify_state_changed();
+    void on_publish_tick()
+    {
+        // refresh the running tasks' speed, stall time, and ETA even if no
+        // data has moved. Action changes aren't picked up here, since they
+        // have to go through on_helper_state_changed()
+        for (auto it = running_.cbegin(); it != running_.cend(); ++it)
+        {
+            it->task->recalculate_task_state();
+            auto const task_state = it->task->state();
+            auto& published = state_[it.key()];
+            if (!task_state.isEmpty() && task_state != published &&
+                task_state.value(keeper::Item::STATUS_KEY) == published.value(keeper::Item::STATUS_KEY))
+            {
+                published = task_state;
+                state_dirty_ = true;
+            }
         }
+
+        if (state_dirty_)
+            notify_state_changed();
+        else if (running_.isEmpty())
+            publish_timer_.stop();
     }
 
-    void set_current_task_action(QString const& action)
+    void set_task_action(QString const& uuid, QString const& action)
     {
-        auto& td = task_data_[current_task_];
-        td.action = action;
-        task_->recalculate_task_state();
-        update_task_state(td);
+        auto const task = find_task(uuid);
+        if (!task)
+            return;
+
+        task_data_[uuid].action = action;
+        task->recalculate_task_state();
+        update_task_state(uuid);
     }
 
     /***
@@ -395,20 +915,40 @@ private:
     QSharedPointer<HelperRegistry> helper_registry_;
     QSharedPointer<StorageFrameworkClient> storage_;
 
+    QString storage_id_;
     QStringList remaining_tasks_;
-    QString current_task_;
     QString backup_dir_name_;
+    BackupCheckpoints checkpoints_;
 
     QVariantDictMap state_;
-    QSharedPointer<KeeperTask> task_;
+    QVariantDictMap published_; // the state that clients last heard about
+
+    // default to one at a time, since helpers that predate per-task
+    // bus paths can't say which task they're working on
+    int max_concurrent_tasks_ {1};
+    bool direct_uploads_ {};
+    QStringList running_uuids_; // in the order they were started
+    QMap<QString,RunningTask> running_;
+    QSharedPointer<KeeperTask> last_task_;
+    QString last_task_uuid_;
 
     QSharedPointer<Manifest> active_manifest_;
 
+    // incrementals in the longest chain after the last backup, or -1 if unknown
+    int longest_chain_ {-1};
+
     ConnectionHelper connections_;
 
+    BandwidthSchedule bandwidth_schedule_;
+    QTimer bandwidth_timer_;
+
+    QTimer publish_timer_;
+    bool state_dirty_ {};
+
+    bool foreground_ {};
+
     mutable QMap<QString,KeeperTask::TaskData> task_data_;
 };
-
 /***
 ****
 ***/
@@ -432,11 +972,11 @@ TaskManager::start_backup(QList<Metadata> const& tasks, QString const & storage)
 }
 
 bool
-TaskManager::start_restore(QList<Metadata> const& tasks, QString const & storage)
+TaskManager::start_restore(QList<Metadata> const& tasks, QString const & storage, QVector<Metadata> const& backups)
 {
     Q_D(TaskManager);
 
-    return d->start_restore(tasks, storage);
+    return d->start_restore(tasks, storage, backups);
 }
 
 keeper::Items TaskManager::get_state() const
@@ -446,18 +986,77 @@ keeper::Items TaskManager::get_state() const
     return d->get_state();
 }
 
-void TaskManager::ask_for_uploader(quint64 n_bytes)
+void TaskManager::diff_state(QVariantDictMap const & before,
+                             QVariantDictMap const & after,
+                             keeper::Items & changes,
+                             QStringList & removed)
+{
+    for (auto it = before.cbegin(); it != before.cend(); ++it)
+        if (!after.contains(it.key()))
+            removed << it.key();
+
+    for (auto it = after.cbegin(); it != after.cend(); ++it)
+    {
+        auto const& uuid = it.key();
+        auto const& task_state = it.value();
+        auto const old = before.value(uuid);
+
+        keeper::Item changed;
+        for (auto kit = task_state.cbegin(); kit != task_state.cend(); ++kit)
+        {
+            auto const oit = old.find(kit.key());
+            if (oit == old.end() || oit.value() != kit.value())
+                changed.insert(kit.key(), kit.value());
+        }
+
+        // clients can't unset a property, so start them over
+        bool lost_keys {false};
+        for (auto kit = old.cbegin(); !lost_keys && kit != old.cend(); ++kit)
+            lost_keys = !task_state.contains(kit.key());
+        if (lost_keys)
+        {
+            removed << uuid;
+            changed = keeper::Item(task_state);
+        }
+
+        if (lost_keys || !changed.isEmpty())
+            changes.insert(uuid, changed);
+    }
+}
+
+QString TaskManager::claim_task(QString const & helper_path)
+{
+    Q_D(TaskManager);
+
+    return d->claim_task(helper_path);
+}
+
+void TaskManager::ask_for_uploader(QString const & uuid, quint64 n_bytes, bool direct)
+{
+    Q_D(TaskManager);
+
+    d->ask_for_uploader(uuid, n_bytes, direct);
+}
+
+void TaskManager::update_backup_progress(QString const & helper_path, quint64 n_bytes)
+{
+    Q_D(TaskManager);
+
+    d->update_backup_progress(helper_path, n_bytes);
+}
+
+void TaskManager::set_backup_catalog(QString const & helper_path, QByteArray const & catalog)
 {
     Q_D(TaskManager);
 
-    d->ask_for_uploader(n_bytes);
+    d->set_backup_catalog(helper_path, catalog);
 }
 
-void TaskManager::ask_for_downloader()
+void TaskManager::ask_for_downloader(QString const & uuid)
 {
     Q_D(TaskManager);
 
-    d->ask_for_downloader();
+    d->ask_for_downloader(uuid);
 }
 
 void TaskManager::cancel()
@@ -466,3 +1065,66 @@ void TaskManager::cancel()
 
     d->cancel();
 }
+
+void TaskManager::set_bandwidth_schedule(BandwidthSchedule const & schedule)
+{
+    Q_D(TaskManager);
+
+    d->set_bandwidth_schedule(schedule);
+}
+
+BandwidthSchedule TaskManager::bandwidth_schedule() const
+{
+    Q_D(const TaskManager);
+
+    return d->bandwidth_schedule();
+}
+
+void TaskManager::set_max_concurrent_tasks(int n)
+{
+    Q_D(TaskManager);
+
+    d->set_max_concurrent_tasks(n);
+}
+
+int TaskManager::max_concurrent_tasks() const
+{
+    Q_D(const TaskManager);
+
+    return d->max_concurrent_tasks();
+}
+
+void TaskManager::set_direct_uploads(bool direct)
+{
+    Q_D(TaskManager);
+
+    d->set_direct_uploads(direct);
+}
+
+bool TaskManager::direct_uploads() const
+{
+    Q_D(const TaskManager);
+
+    return d->direct_uploads();
+}
+
+int TaskManager::longest_incremental_chain() const
+{
+    Q_D(const TaskManager);
+
+    return d->longest_incremental_chain();
+}
+
+void TaskManager::set_helper_process(QString const & uuid, pid_t pid)
+{
+    Q_D(TaskManager);
+
+    d->set_helper_process(uuid, pid);
+}
+
+void TaskManager::set_foreground(bool foreground)
+{
+    Q_D(TaskManager);
+
+    d->set_foreground(foreground);
+}
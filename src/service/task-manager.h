@@ -22,10 +22,15 @@
 
 #include "qdbus-stubs/dbus-types.h"
 #include "helper/metadata.h"
+#include "bandwidth-schedule.h"
 #include "keeper-task.h"
 
 #include <QObject>
 #include <QList>
+#include <QStringList>
+#include <QVector>
+
+#include <sys/types.h> // pid_t
 
 class HelperRegistry;
 class TaskManagerPrivate;
@@ -52,20 +57,67 @@ public:
 
     bool start_backup(QList<Metadata> const& tasks, QString const & storage);
 
-    bool start_restore(QList<Metadata> const& tasks, QString const & storage);
+    // `backups` is every backup that's available, so that restoring an
+    // incremental backup can pull in the backups that it depends on
+    bool start_restore(QList<Metadata> const& tasks, QString const & storage, QVector<Metadata> const& backups);
 
     keeper::Items get_state() const;
 
-    void ask_for_uploader(quint64 n_bytes);
+    // `helper_path` is the bus path that the helper called in on,
+    // which tells us which of the running tasks it belongs to.
+    // Returns that task's uuid, or an empty string if nothing is running
+    QString claim_task(QString const & helper_path);
+
+    // if `direct` is true, the helper gets the uploader's socket instead of
+    // relaying through keeper, and reports its progress and catalog itself
+    void ask_for_uploader(QString const & uuid, quint64 n_bytes, bool direct = false);
+
+    void update_backup_progress(QString const & helper_path, quint64 n_bytes);
+
+    void set_backup_catalog(QString const & helper_path, QByteArray const & catalog);
 
-    void ask_for_downloader();
+    void ask_for_downloader(QString const & uuid);
 
     void cancel();
 
+    // takes effect immediately, including on a running task
+    void set_bandwidth_schedule(BandwidthSchedule const & schedule);
+    BandwidthSchedule bandwidth_schedule() const;
+
+    // how many tasks may run at once. Defaults to 1
+    void set_max_concurrent_tasks(int n);
+    int max_concurrent_tasks() const;
+
+    // whether helpers that ask for it may write straight to the uploader.
+    // Defaults to false, ie every backup is relayed through keeper
+    void set_direct_uploads(bool direct);
+    bool direct_uploads() const;
+
+    // how many incrementals the longest chain had once the last backup
+    // was stored, or -1 if that isn't known
+    int longest_incremental_chain() const;
+
+    // the pid of the helper that claimed task `uuid`
+    void set_helper_process(QString const & uuid, pid_t pid);
+
+    // helpers run at normal priority while the user is watching them
+    void set_foreground(bool foreground);
+
+    // what state_delta() carries when the state goes from `before` to `after`
+    static void diff_state(QVariantDictMap const & before,
+                           QVariantDictMap const & after,
+                           keeper::Items & changes,
+                           QStringList & removed);
+
 Q_SIGNALS:
-    void socket_ready(int reply);
-    void socket_error(keeper::Error error);
+    // `uuid` is the task that ask_for_uploader() or ask_for_downloader() was called for
+    void socket_ready(QString const & uuid, int reply);
+    void socket_error(QString const & uuid, keeper::Error error);
     void state_changed();
+
+    // what changed since the last state_changed()
+    void state_delta(keeper::Items const & changes, QStringList const & removed);
+
     void finished();
 
 private:
@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "service/transfer-settings.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+#include <algorithm> // std::max()
+
+QString const TransferSettings::DIRECT_UPLOADS_KEY {QStringLiteral("direct-uploads")};
+QString const TransferSettings::MAX_CONCURRENT_TASKS_KEY {QStringLiteral("max-concurrent-tasks")};
+QString const TransferSettings::PART_SIZE_KEY {QStringLiteral("part-size")};
+QString const TransferSettings::MAX_PARALLEL_PARTS_KEY {QStringLiteral("max-parallel-parts")};
+
+void
+TransferSettings::set_direct_uploads(bool direct)
+{
+    direct_uploads_ = direct;
+}
+
+bool
+TransferSettings::direct_uploads() const
+{
+    return direct_uploads_;
+}
+
+void
+TransferSettings::set_max_concurrent_tasks(int n)
+{
+    max_concurrent_tasks_ = n;
+}
+
+int
+TransferSettings::max_concurrent_tasks() const
+{
+    return max_concurrent_tasks_;
+}
+
+void
+TransferSettings::set_multipart_upload(qint64 part_size, int max_parallel)
+{
+    part_size_ = part_size;
+    max_parallel_parts_ = max_parallel;
+}
+
+qint64
+TransferSettings::part_size() const
+{
+    return part_size_;
+}
+
+int
+TransferSettings::max_parallel_parts() const
+{
+    return max_parallel_parts_;
+}
+
+QJsonObject
+TransferSettings::to_json() const
+{
+    QJsonObject json;
+    json[DIRECT_UPLOADS_KEY] = direct_uploads_;
+    json[MAX_CONCURRENT_TASKS_KEY] = max_concurrent_tasks_;
+    json[PART_SIZE_KEY] = double(part_size_);
+    json[MAX_PARALLEL_PARTS_KEY] = max_parallel_parts_;
+    return json;
+}
+
+TransferSettings
+TransferSettings::from_json(QJsonObject const& json)
+{
+    TransferSettings settings;
+    settings.direct_uploads_ = json[DIRECT_UPLOADS_KEY].toBool(false);
+    settings.max_concurrent_tasks_ = json[MAX_CONCURRENT_TASKS_KEY].toInt(1);
+    settings.part_size_ = qint64(std::max(json[PART_SIZE_KEY].toDouble(), 0.0));
+    settings.max_parallel_parts_ = std::max(json[MAX_PARALLEL_PARTS_KEY].toInt(PartedUploader::DEFAULT_MAX_PARALLEL), 1);
+    return settings;
+}
+
+QString
+TransferSettings::default_path()
+{
+    return QDir(QStandardPaths::writableLocation(QStandardPaths::GenericConfigLocation))
+        .filePath(QStringLiteral("keeper/transfers.json"));
+}
+
+bool
+TransferSettings::save(QString const& path) const
+{
+    QDir().mkpath(QFileInfo(path).absolutePath());
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        qWarning() << "Unable to save transfer settings to" << path << ':' << file.errorString();
+        return false;
+    }
+    file.write(QJsonDocument(to_json()).toJson());
+    return file.commit();
+}
+
+TransferSettings
+TransferSettings::load(QString const& path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return TransferSettings();
+
+    QJsonParseError error;
+    auto const doc = QJsonDocument::fromJson(file.readAll(), &error);
+    if (error.error != QJsonParseError::NoError)
+    {
+        qWarning() << "Ignoring unreadable transfer settings" << path << ':' << error.errorString();
+        return TransferSettings();
+    }
+
+    return from_json(doc.object());
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#pragma once
+
+#include "storage-framework/parted-uploader.h" // DEFAULT_MAX_PARALLEL
+
+#include <QJsonObject>
+#include <QString>
+
+/**
+ * How backups and restores move their data, kept between runs.
+ *
+ * The defaults are the safest choices, so a missing or unreadable
+ * settings file behaves the same as one that was never changed.
+ */
+class TransferSettings
+{
+public:
+    // whether helpers may write straight to the uploader's socket.
+    // Defaults to false, ie backups are relayed through keeper
+    void set_direct_uploads(bool direct);
+    bool direct_uploads() const;
+
+    // how many tasks may run at once. Defaults to 1
+    void set_max_concurrent_tasks(int n);
+    int max_concurrent_tasks() const;
+
+    // archives larger than `part_size` are uploaded in parts.
+    // Defaults to 0, ie every archive is uploaded whole
+    void set_multipart_upload(qint64 part_size, int max_parallel);
+    qint64 part_size() const;
+    int max_parallel_parts() const;
+
+    QJsonObject to_json() const;
+    static TransferSettings from_json(QJsonObject const& json);
+
+    // where the user's settings are kept between runs
+    static QString default_path();
+    bool save(QString const& path) const;
+    static TransferSettings load(QString const& path);
+
+    static QString const DIRECT_UPLOADS_KEY;
+    static QString const MAX_CONCURRENT_TASKS_KEY;
+    static QString const PART_SIZE_KEY;
+    static QString const MAX_PARALLEL_PARTS_KEY;
+
+private:
+    bool direct_uploads_ {};
+    int max_concurrent_tasks_ {1};
+    qint64 part_size_ {};
+    int max_parallel_parts_ {PartedUploader::DEFAULT_MAX_PARALLEL};
+};
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+
+#include "storage-framework/download-reader.h"
+
+#include <QDebug>
+
+constexpr int DownloadReader::IDLE_TIMEOUT_MSEC;
+
+DownloadReader::DownloadReader(std::shared_ptr<Downloader> const & downloader, QObject * parent):
+    QObject(parent),
+    downloader_(downloader),
+    socket_(downloader->socket())
+{
+    idle_timer_.setSingleShot(true);
+    idle_timer_.setInterval(IDLE_TIMEOUT_MSEC);
+    connect(&idle_timer_, &QTimer::timeout, this, [this](){
+        qWarning() << "download stalled after" << bytes_.size() << "of" << downloader_->file_size() << "bytes";
+        finish(false);
+    });
+}
+
+void
+DownloadReader::start()
+{
+    // a closed socket may still have bytes buffered, so drain it either way
+    connect(socket_.get(), &QLocalSocket::readyRead, this, &DownloadReader::on_ready_read);
+    connect(socket_.get(), &QLocalSocket::readChannelFinished, this, &DownloadReader::on_ready_read);
+    connect(socket_.get(), &QLocalSocket::disconnected, this, &DownloadReader::on_ready_read);
+    idle_timer_.start();
+
+    // some of it may have arrived before we were listening,
+    // but don't finish before start() has returned
+    QTimer::singleShot(0, this, [this](){on_ready_read();});
+}
+
+QByteArray const &
+DownloadReader::bytes() const
+{
+    return bytes_;
+}
+
+void
+DownloadReader::on_ready_read()
+{
+    if (done_)
+        return;
+
+    auto const n_wanted = downloader_->file_size() - bytes_.size();
+    if (n_wanted > 0)
+        bytes_ += socket_->read(n_wanted);
+
+    if (bytes_.size() == downloader_->file_size())
+    {
+        finish(true);
+    }
+    else if (!socket_->isOpen() || ((socket_->state() != QLocalSocket::ConnectedState) && !socket_->bytesAvailable()))
+    {
+        qWarning() << "download ended after" << bytes_.size() << "of" << downloader_->file_size() << "bytes";
+        finish(false);
+    }
+    else
+    {
+        idle_timer_.start();
+    }
+}
+
+void
+DownloadReader::finish(bool success)
+{
+    done_ = true;
+    idle_timer_.stop();
+    socket_->disconnect(this);
+    Q_EMIT(finished(success));
+}
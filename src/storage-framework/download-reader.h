@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+
+#pragma once
+
+#include "storage-framework/downloader.h"
+
+#include <QByteArray>
+#include <QLocalSocket>
+#include <QObject>
+#include <QTimer>
+
+#include <memory>
+
+/**
+ * Reads a whole download into memory without blocking the event loop,
+ * eg a manifest or a catalog.
+ *
+ * Bytes are collected as the socket reports them. The read succeeds once
+ * file_size() bytes have arrived, and fails if the socket closes first
+ * or if nothing arrives for IDLE_TIMEOUT_MSEC. The caller still owns the
+ * downloader and should finish() it afterwards.
+ */
+class DownloadReader final: public QObject
+{
+    Q_OBJECT
+
+public:
+
+    Q_DISABLE_COPY(DownloadReader)
+
+    explicit DownloadReader(std::shared_ptr<Downloader> const & downloader, QObject * parent = nullptr);
+    ~DownloadReader() =default;
+
+    // emits finished() once the download is read or has failed
+    void start();
+
+    QByteArray const & bytes() const;
+
+    static constexpr int IDLE_TIMEOUT_MSEC {30000};
+
+Q_SIGNALS:
+
+    void finished(bool success);
+
+private:
+
+    void on_ready_read();
+    void finish(bool success);
+
+    std::shared_ptr<Downloader> const downloader_;
+    std::shared_ptr<QLocalSocket> const socket_;
+    QByteArray bytes_;
+    QTimer idle_timer_;
+    bool done_ {};
+};
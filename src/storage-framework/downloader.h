@@ -20,6 +20,8 @@
 
 #pragma once
 
+#include "util/retry-policy.h"
+
 #include <QLocalSocket>
 #include <QObject>
 
@@ -40,7 +42,22 @@ public:
     virtual void finish() =0;
     virtual qint64 file_size() const =0;
 
+    // how often storage had to be asked again for this, and how long that took
+    RetryPolicy::Stats retry_stats() const { return retry_stats_; }
+    void add_retry_stats(RetryPolicy::Stats const& stats)
+    {
+        retry_stats_ += stats;
+        Q_EMIT(retried(stats));
+    }
+
 Q_SIGNALS:
 
     void download_finished();
+
+    // `stats` is what was just added to retry_stats()
+    void retried(RetryPolicy::Stats const& stats);
+
+private:
+
+    RetryPolicy::Stats retry_stats_;
 };
@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+
+#include "storage-framework/local-downloader.h"
+
+#include <QDebug>
+#include <QFile>
+
+#include <fcntl.h> // open(), fcntl()
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h> // fstat()
+#include <sys/types.h>
+#include <unistd.h> // close()
+
+#include <algorithm> // std::min()
+#include <cerrno>
+#include <cstring> // strerror()
+
+constexpr size_t LocalDownloader::CHUNK_SIZE;
+
+LocalDownloader::LocalDownloader(QString const & path, QObject * parent):
+    Downloader(parent),
+    path_(path),
+    socket_(std::make_shared<QLocalSocket>())
+{
+    file_fd_ = ::open(QFile::encodeName(path_).constData(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if ((file_fd_ == -1) || (::fstat(file_fd_, &st) == -1))
+    {
+        qWarning() << "unable to open" << path_ << ':' << strerror(errno);
+        stop();
+        return;
+    }
+    file_size_ = qint64(st.st_size);
+
+    // the reader gets one end, and the sender blocks on the other
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == -1)
+    {
+        qWarning() << "unable to create a socket:" << strerror(errno);
+        stop();
+        return;
+    }
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+    socket_->setSocketDescriptor(fds[0], QLocalSocket::ConnectedState, QIODevice::ReadOnly);
+    write_fd_ = fds[1];
+
+    sender_ = std::thread(&LocalDownloader::send, path_, file_fd_, write_fd_, file_size_);
+    valid_ = true;
+}
+
+LocalDownloader::~LocalDownloader()
+{
+    stop();
+}
+
+bool
+LocalDownloader::is_valid() const
+{
+    return valid_;
+}
+
+std::shared_ptr<QLocalSocket>
+LocalDownloader::socket()
+{
+    return socket_;
+}
+
+void
+LocalDownloader::finish()
+{
+    stop();
+    Q_EMIT(download_finished());
+}
+
+qint64
+LocalDownloader::file_size() const
+{
+    return file_size_;
+}
+
+/***
+****
+***/
+
+// runs in sender_
+void
+LocalDownloader::send(QString const & path, int file_fd, int write_fd, qint64 n_bytes)
+{
+    qint64 n_sent {};
+    while (n_sent < n_bytes)
+    {
+        auto const n_wanted = std::min(size_t(n_bytes - n_sent), CHUNK_SIZE);
+        auto const n = ::sendfile(write_fd, file_fd, nullptr, n_wanted);
+        if (n > 0)
+        {
+            n_sent += n;
+        }
+        else if ((n < 0) && (errno == EINTR))
+        {
+            continue;
+        }
+        else
+        {
+            // the reader sees a short read and fails
+            if (n == 0)
+                qWarning() << path << "shrank while it was being read";
+            else if (errno != EPIPE) // EPIPE: stop() hung up on us
+                qWarning() << "unable to send" << path << ':' << strerror(errno);
+            break;
+        }
+    }
+
+    // let the reader see the end of the file
+    ::shutdown(write_fd, SHUT_WR);
+}
+
+void
+LocalDownloader::stop()
+{
+    // wake the sender if it's blocked waiting for the reader
+    if (write_fd_ != -1)
+        ::shutdown(write_fd_, SHUT_RDWR);
+    if (sender_.joinable())
+        sender_.join();
+
+    for (auto fd : {&file_fd_, &write_fd_})
+    {
+        if (*fd != -1)
+        {
+            ::close(*fd);
+            *fd = -1;
+        }
+    }
+}
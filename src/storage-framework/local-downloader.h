@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+
+#pragma once
+
+#include "storage-framework/downloader.h"
+
+#include <QLocalSocket>
+#include <QString>
+
+#include <memory>
+#include <thread>
+
+/**
+ * Reads a file from a local or network-mounted directory.
+ *
+ * The file is sent to socket() with sendfile(), so its contents never
+ * have to be copied through keeper's memory. That happens in a thread
+ * of its own, so that, as with a storage-framework downloader, readers
+ * can block on socket() without starving the sender.
+ */
+class LocalDownloader final: public Downloader
+{
+public:
+
+    explicit LocalDownloader(QString const & path, QObject * parent = nullptr);
+    ~LocalDownloader();
+
+    // false if the file couldn't be opened
+    bool is_valid() const;
+
+    std::shared_ptr<QLocalSocket> socket() override;
+    void finish() override;
+    qint64 file_size() const override;
+
+private:
+
+    static void send(QString const & path, int file_fd, int write_fd, qint64 n_bytes);
+    void stop();
+
+    static constexpr size_t CHUNK_SIZE {1024*1024};
+
+    QString const path_;
+    qint64 file_size_ {};
+
+    std::shared_ptr<QLocalSocket> socket_;
+    int file_fd_ {-1};
+    int write_fd_ {-1};
+    std::thread sender_;
+    bool valid_ {};
+};
@@ -0,0 +1,237 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+
+#include "storage-framework/local-uploader.h"
+#include "util/pipeline.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QTimer>
+
+#include <fcntl.h> // open()
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h> // fsync(), close(), link(), unlink()
+
+#include <cerrno>
+#include <cstdlib> // mkostemp()
+#include <cstring> // strerror()
+#include <functional> // std::bind()
+
+constexpr size_t LocalUploader::BUFFER_SIZE;
+
+LocalUploader::LocalUploader(qint64 n_bytes, QString const & path, QObject * parent):
+    Uploader(parent),
+    n_bytes_(n_bytes),
+    path_(path),
+    socket_(std::make_shared<QLocalSocket>())
+{
+    // write to a hidden file alongside the real one, so that giving it its real name is atomic
+    QFileInfo const info(path_);
+    auto tmpl = QFile::encodeName(info.dir().filePath(QStringLiteral(".%1.XXXXXX").arg(info.fileName())));
+    file_fd_ = mkostemp(tmpl.data(), O_CLOEXEC);
+    if (file_fd_ == -1)
+    {
+        qWarning() << "unable to create a file in" << info.path() << ':' << strerror(errno);
+        failed_ = true;
+        return;
+    }
+    tmp_path_ = QFile::decodeName(tmpl);
+
+    // the writer gets one end, and we read the other
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds) == -1)
+    {
+        fail(QStringLiteral("unable to create a socket: %1").arg(strerror(errno)));
+        return;
+    }
+    socket_->setSocketDescriptor(fds[1], QLocalSocket::ConnectedState, QIODevice::WriteOnly);
+    read_fd_ = fds[0];
+
+    pipeline_.reset(new Pipeline(BUFFER_SIZE));
+    pipeline_->set_source(std::make_shared<FdSource>(read_fd_));
+    pipeline_->set_sink(std::make_shared<FdSink>(file_fd_));
+
+    read_notifier_.reset(new QSocketNotifier(read_fd_, QSocketNotifier::Read));
+    QObject::connect(read_notifier_.get(), &QSocketNotifier::activated,
+        std::bind(&LocalUploader::on_ready_read, this)
+    );
+}
+
+LocalUploader::~LocalUploader()
+{
+    close_fds();
+
+    // uncommitted files are discarded
+    if (!committed_ && !tmp_path_.isEmpty())
+        ::unlink(QFile::encodeName(tmp_path_).constData());
+}
+
+bool
+LocalUploader::is_valid() const
+{
+    return !failed_;
+}
+
+std::shared_ptr<QLocalSocket>
+LocalUploader::socket()
+{
+    return socket_;
+}
+
+void
+LocalUploader::commit()
+{
+    commit_requested_ = true;
+
+    if (failed_)
+    {
+        QTimer::singleShot(0, this, [this](){Q_EMIT(commit_finished(false));});
+        return;
+    }
+
+    on_ready_read();
+}
+
+QString
+LocalUploader::file_name() const
+{
+    return committed_ ? QFileInfo(path_).fileName() : QString();
+}
+
+/***
+****
+***/
+
+void
+LocalUploader::on_ready_read()
+{
+    if (failed_ || eof_)
+        return;
+
+    auto const result = pipeline_->pump();
+    n_written_ += result.n_written;
+
+    if (result.read_error || result.write_error)
+    {
+        fail(QString::fromStdString(result.error));
+        return;
+    }
+    if (n_written_ > n_bytes_)
+    {
+        fail(QStringLiteral("received %1 bytes; expected %2").arg(n_written_).arg(n_bytes_));
+        return;
+    }
+    if (result.eof) // the writer hung up
+    {
+        eof_ = true;
+        read_notifier_->setEnabled(false);
+    }
+
+    check_for_done();
+}
+
+void
+LocalUploader::check_for_done()
+{
+    if (!commit_requested_ || committed_ || failed_)
+        return;
+
+    if (n_written_ < n_bytes_)
+    {
+        if (eof_)
+            fail(QStringLiteral("received %1 bytes; expected %2").arg(n_written_).arg(n_bytes_));
+        return;
+    }
+
+    // make sure it's on disk before it gets its real name
+    if (::fsync(file_fd_) == -1)
+    {
+        fail(QStringLiteral("unable to flush %1: %2").arg(tmp_path_).arg(strerror(errno)));
+        return;
+    }
+    // link() won't replace a file that's already there, and unlike checking
+    // for it before a rename(), nothing can create one in between
+    auto const tmp_name = QFile::encodeName(tmp_path_);
+    if (::link(tmp_name.constData(), QFile::encodeName(path_).constData()) == -1)
+    {
+        if (errno == EEXIST)
+            fail(QStringLiteral("%1 already exists").arg(path_));
+        else
+            fail(QStringLiteral("unable to rename %1: %2").arg(tmp_path_).arg(strerror(errno)));
+        return;
+    }
+    if (::unlink(tmp_name.constData()) == -1)
+        qWarning() << "unable to remove" << tmp_path_ << strerror(errno);
+    tmp_path_.clear();
+
+    // and that the rename is, too
+    auto const dir_fd = ::open(QFile::encodeName(QFileInfo(path_).path()).constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd != -1)
+    {
+        ::fsync(dir_fd);
+        ::close(dir_fd);
+    }
+
+    committed_ = true;
+    close_fds();
+    qDebug() << "committed" << path_ << n_written_ << "bytes";
+    QTimer::singleShot(0, this, [this](){Q_EMIT(commit_finished(true));});
+}
+
+void
+LocalUploader::fail(QString const & why)
+{
+    if (failed_)
+        return;
+
+    qWarning() << "uploading" << path_ << "failed:" << why;
+    failed_ = true;
+
+    // let the writer know
+    close_fds();
+
+    if (!tmp_path_.isEmpty())
+    {
+        ::unlink(QFile::encodeName(tmp_path_).constData());
+        tmp_path_.clear();
+    }
+
+    if (commit_requested_)
+        QTimer::singleShot(0, this, [this](){Q_EMIT(commit_finished(false));});
+}
+
+void
+LocalUploader::close_fds()
+{
+    read_notifier_.reset();
+    pipeline_.reset();
+
+    for (auto fd : {&read_fd_, &file_fd_})
+    {
+        if (*fd != -1)
+        {
+            ::close(*fd);
+            *fd = -1;
+        }
+    }
+}
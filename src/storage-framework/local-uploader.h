@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+
+#pragma once
+
+#include "storage-framework/uploader.h"
+
+#include <QLocalSocket>
+#include <QSocketNotifier>
+#include <QString>
+
+#include <memory>
+
+class Pipeline;
+
+/**
+ * Uploads straight into a file in a local or network-mounted directory.
+ *
+ * The data is written to a hidden temporary file next to `path`. A
+ * Pipeline moves it there from socket(), splicing it so that it doesn't
+ * pass through keeper's memory. On commit the file is flushed to disk
+ * and renamed to `path`, so a file by that name is always complete.
+ * Uncommitted files are removed.
+ */
+class LocalUploader final: public Uploader
+{
+public:
+
+    LocalUploader(qint64 n_bytes, QString const & path, QObject * parent = nullptr);
+    ~LocalUploader();
+
+    // false if the temporary file couldn't be created
+    bool is_valid() const;
+
+    std::shared_ptr<QLocalSocket> socket() override;
+    void commit() override;
+    QString file_name() const override;
+
+private:
+
+    void on_ready_read();
+    void check_for_done();
+    void fail(QString const & why);
+    void close_fds();
+
+    static constexpr size_t BUFFER_SIZE {256*1024};
+
+    qint64 const n_bytes_;
+    QString const path_;
+    QString tmp_path_;
+
+    std::shared_ptr<QLocalSocket> socket_;
+    int read_fd_ {-1};
+    int file_fd_ {-1};
+    std::unique_ptr<QSocketNotifier> read_notifier_;
+    std::unique_ptr<Pipeline> pipeline_;
+
+    qint64 n_written_ {};
+    bool eof_ {};
+    bool commit_requested_ {};
+    bool committed_ {};
+    bool failed_ {};
+};
@@ -0,0 +1,257 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+
+#include "storage-framework/parted-downloader.h"
+
+#include <QDebug>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h> // write(), close()
+
+#include <algorithm> // std::min(), std::max()
+#include <cerrno>
+#include <cstring> // strerror()
+
+constexpr qint64 PartedDownloader::PART_READ_AHEAD;
+constexpr qint64 PartedDownloader::READ_CHUNK_SIZE;
+
+PartedDownloader::PartedDownloader(
+    QStringList const & part_names,
+    qint64 part_size,
+    qint64 n_bytes,
+    int max_parallel,
+    Factory const & factory,
+    QObject * parent
+):
+    Downloader(parent),
+    n_bytes_(n_bytes),
+    max_parallel_(std::max(max_parallel, 1)),
+    factory_(factory),
+    socket_(std::make_shared<QLocalSocket>())
+{
+    // every part but the last is part_size bytes
+    qint64 offset {};
+    for (auto const& name : part_names)
+    {
+        Part part;
+        part.name = name;
+        part.n_bytes = std::max(std::min(part_size, n_bytes - offset), qint64(0));
+        offset += part.n_bytes;
+        parts_.push_back(part);
+    }
+
+    // we write one end, and the reader gets the other
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) == -1)
+    {
+        fail(QStringLiteral("unable to create a socket: %1").arg(strerror(errno)));
+        return;
+    }
+    socket_->setSocketDescriptor(fds[1], QLocalSocket::ConnectedState, QIODevice::ReadOnly);
+    write_fd_ = fds[0];
+    write_notifier_.reset(new QSocketNotifier(write_fd_, QSocketNotifier::Write));
+    write_notifier_->setEnabled(false);
+    QObject::connect(write_notifier_.get(), &QSocketNotifier::activated,
+        std::bind(&PartedDownloader::pump, this)
+    );
+
+    if (offset != n_bytes)
+    {
+        fail(QStringLiteral("%1 parts can't hold %2 bytes").arg(part_names.size()).arg(n_bytes));
+        return;
+    }
+
+    open_parts();
+}
+
+PartedDownloader::~PartedDownloader()
+{
+    close_write_fd();
+}
+
+std::shared_ptr<QLocalSocket>
+PartedDownloader::socket()
+{
+    return socket_;
+}
+
+void
+PartedDownloader::finish()
+{
+    for (auto& part : parts_)
+    {
+        if (part.downloader)
+        {
+            part.downloader->finish();
+            part.downloader.reset();
+        }
+    }
+    close_write_fd();
+
+    Q_EMIT(download_finished());
+}
+
+qint64
+PartedDownloader::file_size() const
+{
+    return n_bytes_;
+}
+
+/***
+****
+***/
+
+void
+PartedDownloader::open_parts()
+{
+    while (!failed_ && (next_request_ < parts_.size()) && (next_request_ < current_ + size_t(max_parallel_)))
+    {
+        auto const i = next_request_++;
+        parts_[i].requested = true;
+
+        connections_.connect_future(
+            factory_(parts_[i].name),
+            std::function<void(std::shared_ptr<Downloader> const&)>{
+                [this, i](std::shared_ptr<Downloader> const& downloader){
+                    on_part_opened(i, downloader);
+                }
+            }
+        );
+    }
+
+    // maybe there's nothing left to read
+    pump();
+}
+
+void
+PartedDownloader::on_part_opened(size_t i, std::shared_ptr<Downloader> const & downloader)
+{
+    auto& part = parts_[i];
+
+    if (!downloader)
+    {
+        fail(QStringLiteral("unable to open %1").arg(part.name));
+        return;
+    }
+    if (downloader->file_size() != part.n_bytes)
+    {
+        fail(QStringLiteral("%1 has %2 bytes; expected %3").arg(part.name).arg(downloader->file_size()).arg(part.n_bytes));
+        return;
+    }
+    if (failed_)
+        return;
+
+    if (downloader->retry_stats().n_retries)
+        add_retry_stats(downloader->retry_stats());
+
+    part.downloader = downloader;
+
+    // bound how far the waiting parts read ahead
+    auto socket = downloader->socket();
+    socket->setReadBufferSize(PART_READ_AHEAD);
+    QObject::connect(socket.get(), &QLocalSocket::readyRead, this, [this, i](){
+        if (i == current_)
+            pump();
+    });
+
+    if (i == current_)
+        pump();
+}
+
+void
+PartedDownloader::pump()
+{
+    while (!failed_ && (write_fd_ != -1))
+    {
+        // finish writing what we have before reading more
+        if (!pending_.isEmpty())
+        {
+            auto const n_written = ::write(write_fd_, pending_.constData(), size_t(pending_.size()));
+            if (n_written < 0)
+            {
+                if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+                    write_notifier_->setEnabled(true); // wait for the reader to make room
+                else
+                    fail(QStringLiteral("write error: %1").arg(strerror(errno)));
+                return;
+            }
+            pending_.remove(0, int(n_written));
+            continue;
+        }
+        write_notifier_->setEnabled(false);
+
+        // when every part's been written, let the reader know
+        if (current_ >= parts_.size())
+        {
+            qDebug() << "done reading" << parts_.size() << "parts";
+            close_write_fd();
+            return;
+        }
+
+        auto& part = parts_[current_];
+        if (part.n_read >= part.n_bytes)
+        {
+            if (part.downloader)
+            {
+                part.downloader->finish();
+                part.downloader.reset();
+            }
+            ++current_;
+            open_parts();
+            return;
+        }
+
+        if (!part.downloader) // still waiting for it
+            return;
+
+        pending_ = part.downloader->socket()->read(std::min(READ_CHUNK_SIZE, part.n_bytes - part.n_read));
+        if (pending_.isEmpty()) // wait for readyRead
+            return;
+        part.n_read += pending_.size();
+    }
+}
+
+void
+PartedDownloader::fail(QString const & why)
+{
+    if (failed_)
+        return;
+
+    qWarning() << "downloading parts failed:" << why;
+    failed_ = true;
+
+    for (auto& part : parts_)
+        part.downloader.reset();
+
+    // the reader will see the stream end early
+    close_write_fd();
+}
+
+void
+PartedDownloader::close_write_fd()
+{
+    write_notifier_.reset();
+    if (write_fd_ != -1)
+    {
+        ::close(write_fd_);
+        write_fd_ = -1;
+    }
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+
+#pragma once
+
+#include "util/connection-helper.h"
+#include "storage-framework/downloader.h"
+
+#include <QByteArray>
+#include <QFuture>
+#include <QLocalSocket>
+#include <QMetaObject>
+#include <QSocketNotifier>
+#include <QString>
+#include <QStringList>
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+/**
+ * Reads a file that was uploaded in parts by PartedUploader.
+ *
+ * Up to `max_parallel` parts are downloaded at once. The parts after the
+ * current one read ahead up to PART_READ_AHEAD bytes each while they
+ * wait their turn, and socket() gets the parts' contents in order.
+ */
+class PartedDownloader final: public Downloader
+{
+public:
+
+    // creates the downloader for one part
+    using Factory = std::function<QFuture<std::shared_ptr<Downloader>>(QString const & file_name)>;
+
+    PartedDownloader(QStringList const & part_names,
+                     qint64 part_size,
+                     qint64 n_bytes,
+                     int max_parallel,
+                     Factory const & factory,
+                     QObject * parent = nullptr);
+    ~PartedDownloader();
+
+    std::shared_ptr<QLocalSocket> socket() override;
+    void finish() override;
+    qint64 file_size() const override;
+
+    static constexpr qint64 PART_READ_AHEAD {8*1024*1024};
+
+private:
+
+    struct Part
+    {
+        QString name;
+        qint64 n_bytes {};
+        qint64 n_read {};
+        std::shared_ptr<Downloader> downloader;
+        bool requested {};
+    };
+
+    void open_parts();
+    void on_part_opened(size_t i, std::shared_ptr<Downloader> const & downloader);
+    void pump();
+    void fail(QString const & why);
+    void close_write_fd();
+
+    static constexpr qint64 READ_CHUNK_SIZE {64*1024};
+
+    qint64 const n_bytes_;
+    int const max_parallel_;
+    Factory const factory_;
+
+    std::vector<Part> parts_;
+    size_t current_ {};      // the part that's being written to socket()
+    size_t next_request_ {}; // the next part to create a downloader for
+
+    std::shared_ptr<QLocalSocket> socket_;
+    int write_fd_ {-1};
+    std::unique_ptr<QSocketNotifier> write_notifier_;
+    QByteArray pending_; // read from the current part, but not yet written
+
+    bool failed_ {};
+
+    ConnectionHelper connections_;
+};
@@ -0,0 +1,405 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+
+#include "storage-framework/parted-uploader.h"
+
+#include <QDebug>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h> // read(), close()
+
+#include <algorithm> // std::min(), std::max()
+#include <cerrno>
+#include <cstring> // strerror()
+
+constexpr qint64 PartedUploader::DEFAULT_PART_SIZE;
+constexpr int PartedUploader::DEFAULT_MAX_PARALLEL;
+constexpr qint64 PartedUploader::MAX_PART_BACKLOG;
+constexpr qint64 PartedUploader::READ_CHUNK_SIZE;
+constexpr qint64 PartedUploader::SOCKET_BUFFER_SIZE;
+constexpr QCryptographicHash::Algorithm PartedUploader::DIGEST_ALGORITHM;
+
+PartedUploader::PartedUploader(
+    qint64 n_bytes,
+    QString const & file_name,
+    qint64 part_size,
+    int max_parallel,
+    Factory const & factory,
+    Resume const & resume,
+    QObject * parent
+):
+    Uploader(parent),
+    file_name_(file_name),
+    part_size_(std::max(part_size, qint64(1))),
+    max_parallel_(std::max(max_parallel, 1)),
+    factory_(factory),
+    socket_(std::make_shared<QLocalSocket>())
+{
+    // carve up the file
+    qint64 offset {};
+    do
+    {
+        Part part;
+        part.name = part_name(file_name_, int(parts_.size()));
+        part.n_bytes = std::min(part_size_, n_bytes - offset);
+        part.hash.reset(new QCryptographicHash(DIGEST_ALGORITHM));
+        offset += part.n_bytes;
+        parts_.push_back(std::move(part));
+    }
+    while (offset < n_bytes);
+
+    // skip the parts that are already there
+    if (resume.part_size == part_size_)
+    {
+        for (size_t i=0, n=std::min(size_t(resume.parts.size()), size_t(resume.digests.size())); i<n && i<parts_.size(); ++i)
+        {
+            auto& part = parts_[i];
+            part.skip = part.requested = part.committed = true;
+            part.committed_name = resume.parts[int(i)];
+            part.digest = resume.digests[int(i)];
+            next_request_ = n_skipped_ = i + 1;
+        }
+    }
+
+    // the writer gets one end, and we read the other
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) == -1)
+    {
+        fail(QStringLiteral("unable to create a socket: %1").arg(strerror(errno)));
+        return;
+    }
+    socket_->setSocketDescriptor(fds[1], QLocalSocket::ConnectedState, QIODevice::WriteOnly);
+    read_fd_ = fds[0];
+    read_notifier_.reset(new QSocketNotifier(read_fd_, QSocketNotifier::Read));
+    read_notifier_->setEnabled(false);
+    QObject::connect(read_notifier_.get(), &QSocketNotifier::activated,
+        std::bind(&PartedUploader::on_ready_read, this)
+    );
+
+    qDebug() << "uploading" << file_name_ << "in" << parts_.size() << "parts,"
+             << max_parallel_ << "at a time," << next_request_ << "already uploaded";
+
+    open_parts();
+}
+
+PartedUploader::~PartedUploader()
+{
+    close_read_fd();
+}
+
+QString
+PartedUploader::part_name(QString const & file_name, int part)
+{
+    return QStringLiteral("%1.part%2").arg(file_name).arg(part, 3, 10, QLatin1Char('0'));
+}
+
+std::shared_ptr<QLocalSocket>
+PartedUploader::socket()
+{
+    return socket_;
+}
+
+void
+PartedUploader::commit()
+{
+    commit_requested_ = true;
+
+    if (failed_)
+    {
+        finished_ = true;
+        Q_EMIT(commit_finished(false));
+        return;
+    }
+
+    check_for_done();
+}
+
+QString
+PartedUploader::file_name() const
+{
+    return finished_ && !failed_ ? file_name_ : QString();
+}
+
+QStringList
+PartedUploader::part_names() const
+{
+    QStringList names;
+    if (finished_ && !failed_)
+        for (auto const& part : parts_)
+            names << part.committed_name;
+    return names;
+}
+
+qint64
+PartedUploader::part_size() const
+{
+    return part_size_;
+}
+
+/***
+****
+***/
+
+// keep up to max_parallel_ parts open, including the one after the current
+// one so that it's ready to go as soon as the current one is full.
+// The first part after any skipped ones is opened right away, since
+// reading through the skipped ones doesn't have to wait on the network
+void
+PartedUploader::open_parts()
+{
+    int n_open {};
+    for (auto const& part : parts_)
+        if (part.requested && !part.committed)
+            ++n_open;
+
+    while (!failed_ && (n_open < max_parallel_) && (next_request_ < parts_.size()) && (next_request_ <= std::max(current_ + 1, n_skipped_)))
+    {
+        auto const i = next_request_++;
+        auto& part = parts_[i];
+        part.requested = true;
+        ++n_open;
+
+        connections_.connect_future(
+            factory_(part.n_bytes, part.name),
+            std::function<void(std::shared_ptr<Uploader> const&)>{
+                [this, i](std::shared_ptr<Uploader> const& uploader){
+                    on_part_opened(i, uploader);
+                }
+            }
+        );
+    }
+
+    update_reading();
+}
+
+void
+PartedUploader::on_part_opened(size_t i, std::shared_ptr<Uploader> const & uploader)
+{
+    auto& part = parts_[i];
+
+    if (!uploader)
+    {
+        fail(QStringLiteral("unable to create %1").arg(part.name));
+        return;
+    }
+    if (failed_)
+        return;
+
+    if (uploader->retry_stats().n_retries)
+        add_retry_stats(uploader->retry_stats());
+
+    part.uploader = uploader;
+    QObject::connect(uploader->socket().get(), &QLocalSocket::bytesWritten, this,
+        std::bind(&PartedUploader::flush, this, i)
+    );
+    flush(i);
+}
+
+void
+PartedUploader::on_ready_read()
+{
+    while (!failed_ && (current_ < parts_.size()))
+    {
+        auto& part = parts_[current_];
+
+        // if this part's queue is full, wait for its uploader to catch up.
+        // Skipped parts don't queue anything
+        auto n_wanted = part.n_bytes - part.n_received;
+        if (!part.skip)
+            n_wanted = std::min(n_wanted, MAX_PART_BACKLOG - part.n_backlog);
+        if (n_wanted > 0)
+        {
+            QByteArray buf(int(std::min(n_wanted, READ_CHUNK_SIZE)), Qt::Uninitialized);
+            auto const n_read = ::read(read_fd_, buf.data(), size_t(buf.size()));
+            if (n_read < 0)
+            {
+                if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+                    fail(QStringLiteral("read error: %1").arg(strerror(errno)));
+                break;
+            }
+            if (n_read == 0) // the writer hung up before sending all of it
+            {
+                fail(QStringLiteral("the stream ended partway through %1").arg(part.name));
+                break;
+            }
+
+            buf.resize(int(n_read));
+            part.hash->addData(buf);
+            part.n_received += n_read;
+            if (!part.skip)
+            {
+                part.backlog.append(buf);
+                part.n_backlog += n_read;
+                flush(current_);
+            }
+        }
+
+        if (part.n_received < part.n_bytes)
+            break;
+
+        auto const digest = part.hash->result();
+        part.hash.reset();
+        if (!part.skip)
+            part.digest = digest;
+        else if (digest != part.digest)
+        {
+            fail(QStringLiteral("%1 has changed since it was uploaded").arg(part.name));
+            Q_EMIT(resume_invalid());
+            break;
+        }
+
+        // on to the next part
+        ++current_;
+        open_parts();
+    }
+
+    update_reading();
+    check_for_done();
+}
+
+// only listen to socket() when there's somewhere to put what we read
+void
+PartedUploader::update_reading()
+{
+    if (!read_notifier_)
+        return;
+
+    auto enabled = !failed_ && (current_ < parts_.size());
+    if (enabled)
+    {
+        auto const& part = parts_[current_];
+        enabled = part.requested && (part.n_backlog < MAX_PART_BACKLOG);
+    }
+
+    read_notifier_->setEnabled(enabled);
+}
+
+void
+PartedUploader::flush(size_t i)
+{
+    auto& part = parts_[i];
+    if (failed_ || !part.uploader || part.committing)
+        return;
+
+    // hand the uploader a little at a time so that the backlog stays ours to bound
+    auto socket = part.uploader->socket();
+    while (!part.backlog.isEmpty() && (socket->bytesToWrite() < SOCKET_BUFFER_SIZE))
+    {
+        auto const chunk = part.backlog.takeFirst();
+        part.n_backlog -= chunk.size();
+        if (socket->write(chunk) != chunk.size())
+        {
+            fail(QStringLiteral("unable to write to %1: %2").arg(part.name).arg(socket->errorString()));
+            return;
+        }
+    }
+
+    // commit once everything has been sent
+    if ((part.n_received == part.n_bytes) && part.backlog.isEmpty() && !socket->bytesToWrite())
+    {
+        part.committing = true;
+        connections_.connect_oneshot(
+            part.uploader.get(),
+            &Uploader::commit_finished,
+            std::function<void(bool)>{[this, i](bool success){
+                on_part_committed(i, success);
+            }}
+        );
+        part.uploader->commit();
+    }
+
+    if (i == current_)
+        update_reading();
+}
+
+void
+PartedUploader::on_part_committed(size_t i, bool success)
+{
+    auto& part = parts_[i];
+
+    if (!success)
+    {
+        fail(QStringLiteral("unable to commit %1").arg(part.name));
+        return;
+    }
+
+    part.committed = true;
+    part.committed_name = part.uploader->file_name();
+    part.uploader.reset();
+    qDebug() << "committed part" << (i+1) << "of" << parts_.size() << "as" << part.committed_name;
+    Q_EMIT(part_committed(int(i), part.committed_name, part.digest));
+
+    // that frees up a slot
+    open_parts();
+    check_for_done();
+}
+
+void
+PartedUploader::check_for_done()
+{
+    if (!commit_requested_ || finished_ || failed_)
+        return;
+
+    // skipped parts are committed before their data has been checked
+    if (current_ < parts_.size())
+        return;
+
+    for (auto const& part : parts_)
+        if (!part.committed)
+            return;
+
+    finished_ = true;
+    Q_EMIT(commit_finished(true));
+}
+
+void
+PartedUploader::fail(QString const & why)
+{
+    if (failed_)
+        return;
+
+    qWarning() << "uploading" << file_name_ << "failed:" << why;
+    failed_ = true;
+
+    // uncommitted parts are discarded when their uploaders are destroyed
+    for (auto& part : parts_)
+        part.uploader.reset();
+
+    // let the writer know
+    close_read_fd();
+
+    if (commit_requested_ && !finished_)
+    {
+        finished_ = true;
+        Q_EMIT(commit_finished(false));
+    }
+}
+
+void
+PartedUploader::close_read_fd()
+{
+    read_notifier_.reset();
+    if (read_fd_ != -1)
+    {
+        ::close(read_fd_);
+        read_fd_ = -1;
+    }
+}
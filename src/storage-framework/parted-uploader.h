@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+
+#pragma once
+
+#include "util/connection-helper.h"
+#include "storage-framework/uploader.h"
+
+#include <QByteArray>
+#include <QCryptographicHash>
+#include <QFuture>
+#include <QList>
+#include <QLocalSocket>
+#include <QSocketNotifier>
+#include <QString>
+#include <QStringList>
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+/**
+ * Uploads one file as several fixed-size parts, a few at a time.
+ *
+ * On a high-latency link a single stream can't keep the pipe full, so
+ * while one part is still draining, the next is already being filled.
+ * Data is read from socket() in order and queued for the part it belongs
+ * to. Each part's queue is bounded by MAX_PART_BACKLOG, so at most
+ * `max_parallel` * MAX_PART_BACKLOG bytes are held in memory.
+ *
+ * Each part is committed as soon as all of its data has been sent, and
+ * part_committed() is emitted with a digest of its contents.
+ * commit_finished() is emitted once every part has been committed.
+ * If a part can't be created or committed, socket() is closed so that
+ * whoever is writing to it sees an error.
+ *
+ * An interrupted upload can be resumed by passing in the parts that it
+ * committed. Their data still has to be written to socket(), but it's
+ * only checked against their digests instead of being uploaded again.
+ * If it doesn't match, resume_invalid() is emitted and the upload fails,
+ * so that the caller can start over without resuming.
+ */
+class PartedUploader final: public Uploader
+{
+    Q_OBJECT
+
+public:
+
+    // creates the uploader for one part
+    using Factory = std::function<QFuture<std::shared_ptr<Uploader>>(qint64 n_bytes, QString const & file_name)>;
+
+    // the leading parts that an earlier upload of the same file committed
+    struct Resume
+    {
+        qint64 part_size {};
+        QStringList parts;         // their committed names
+        QList<QByteArray> digests; // what part_committed() reported for them
+    };
+
+    PartedUploader(qint64 n_bytes,
+                   QString const & file_name,
+                   qint64 part_size,
+                   int max_parallel,
+                   Factory const & factory,
+                   Resume const & resume = Resume(),
+                   QObject * parent = nullptr);
+    ~PartedUploader();
+
+    std::shared_ptr<QLocalSocket> socket() override;
+    void commit() override;
+    QString file_name() const override;
+    QStringList part_names() const override;
+    qint64 part_size() const override;
+
+    static constexpr qint64 DEFAULT_PART_SIZE {64*1024*1024};
+    static constexpr int DEFAULT_MAX_PARALLEL {4};
+    static constexpr qint64 MAX_PART_BACKLOG {16*1024*1024};
+
+    static QString part_name(QString const & file_name, int part);
+
+    static constexpr QCryptographicHash::Algorithm DIGEST_ALGORITHM {QCryptographicHash::Md5};
+
+Q_SIGNALS:
+
+    void part_committed(int part, QString const & committed_name, QByteArray const & digest);
+
+    // the resumed parts don't hold this data, so resuming them won't work
+    void resume_invalid();
+
+private:
+
+    struct Part
+    {
+        QString name;
+        qint64 n_bytes {};
+        qint64 n_received {};    // how much has been read from socket()
+        QList<QByteArray> backlog; // read, but not handed to the uploader yet
+        qint64 n_backlog {};
+        std::shared_ptr<Uploader> uploader;
+        bool requested {};
+        bool committing {};
+        bool committed {};
+        QString committed_name;
+        bool skip {};            // committed by an earlier upload
+        std::unique_ptr<QCryptographicHash> hash;
+        QByteArray digest;
+    };
+
+    void open_parts();
+    void on_part_opened(size_t i, std::shared_ptr<Uploader> const & uploader);
+    void on_ready_read();
+    void update_reading();
+    void flush(size_t i);
+    void on_part_committed(size_t i, bool success);
+    void check_for_done();
+    void fail(QString const & why);
+    void close_read_fd();
+
+    static constexpr qint64 READ_CHUNK_SIZE {64*1024};
+    static constexpr qint64 SOCKET_BUFFER_SIZE {256*1024};
+
+    QString const file_name_;
+    qint64 const part_size_;
+    int const max_parallel_;
+    Factory const factory_;
+
+    std::vector<Part> parts_;
+    size_t current_ {};      // the part that's being read into
+    size_t next_request_ {}; // the next part to create an uploader for
+    size_t n_skipped_ {};    // how many leading parts are being resumed
+
+    std::shared_ptr<QLocalSocket> socket_;
+    int read_fd_ {-1};
+    std::unique_ptr<QSocketNotifier> read_notifier_;
+
+    bool commit_requested_ {};
+    bool finished_ {};
+    bool failed_ {};
+
+    ConnectionHelper connections_;
+};
@@ -19,15 +19,36 @@
  */
 
 #include "storage-framework/storage_framework_client.h"
+#include "storage-framework/local-downloader.h"
+#include "storage-framework/local-uploader.h"
+#include "storage-framework/parted-downloader.h"
+#include "storage-framework/parted-uploader.h"
 #include "storage-framework/sf-downloader.h"
 #include "storage-framework/sf-uploader.h"
 
 #include <QDateTime>
+#include <QDir>
+#include <QTimer>
+#include <QUrl>
 #include <QVector>
 #include <QString>
 
+#include <algorithm> // std::max()
+
 namespace sf = unity::storage::qt::client;
 
+namespace
+{
+    template<typename T>
+    QFuture<T> make_ready_future(T const & value)
+    {
+        QFutureInterface<T> fi;
+        fi.reportResult(value);
+        fi.reportFinished();
+        return fi.future();
+    }
+}
+
 /***
 ****
 ***/
@@ -38,6 +59,7 @@ StorageFrameworkClient::StorageFrameworkClient(QObject *parent)
     : QObject(parent)
     , runtime_(sf::Runtime::create())
 {
+    clock_.start();
 }
 
 StorageFrameworkClient::~StorageFrameworkClient() = default;
@@ -47,7 +69,7 @@ StorageFrameworkClient::~StorageFrameworkClient() = default;
 ***/
 
 sf::Account::SPtr
-StorageFrameworkClient::choose(QVector<sf::Account::SPtr> const& choices) const
+StorageFrameworkClient::choose(QVector<sf::Account::SPtr> const& choices, keeper::Error & error) const
 {
     sf::Account::SPtr ret;
 
@@ -55,7 +77,7 @@ StorageFrameworkClient::choose(QVector<sf::Account::SPtr> const& choices) const
     if (choices.empty())
     {
         qWarning() << "no storage-framework accounts to pick from";
-        last_error_ = keeper::Error::NO_REMOTE_ACCOUNTS;
+        error = keeper::Error::NO_REMOTE_ACCOUNTS;
     }
     else // for now just pick the first one. FIXME
     {
@@ -81,7 +103,7 @@ StorageFrameworkClient::choose(QVector<sf::Account::SPtr> const& choices) const
             if (!ret)
             {
                 qWarning() << "Storage framework account [" << storage_id_ << "] was not found";
-                last_error_ = keeper::Error::ACCOUNT_NOT_FOUND;
+                error = keeper::Error::ACCOUNT_NOT_FOUND;
             }
         }
     }
@@ -90,22 +112,19 @@ StorageFrameworkClient::choose(QVector<sf::Account::SPtr> const& choices) const
 }
 
 sf::Root::SPtr
-StorageFrameworkClient::choose(QVector<sf::Root::SPtr> const& choices) const
+StorageFrameworkClient::choose(QVector<sf::Root::SPtr> const& choices, keeper::Error & error) const
 {
     sf::Root::SPtr ret;
 
-    if (last_error_ != keeper::Error::ACCOUNT_NOT_FOUND)
+    qDebug() << "choosing from" << choices.size() << "roots";
+    if (choices.empty())
     {
-        qDebug() << "choosing from" << choices.size() << "roots";
-        if (choices.empty())
-        {
-            qWarning() << "no storage-framework roots to pick from";
-            last_error_ = keeper::Error::NO_REMOTE_ROOTS;
-        }
-        else // for now just pick the first one. FIXME
-        {
-            ret = choices.front();
-        }
+        qWarning() << "no storage-framework roots to pick from";
+        error = keeper::Error::NO_REMOTE_ROOTS;
+    }
+    else // for now just pick the first one. FIXME
+    {
+        ret = choices.front();
     }
 
     return ret;
@@ -122,48 +141,155 @@ StorageFrameworkClient::add_accounts_task(std::function<void(QVector<sf::Account
 }
 
 void
-StorageFrameworkClient::add_roots_task(std::function<void(QVector<sf::Root::SPtr> const&)> task)
+StorageFrameworkClient::add_roots_task(std::function<void(sf::Root::SPtr const&, keeper::Error)> task)
 {
+    if (root_)
+    {
+        connection_helper_.connect_future(
+            make_ready_future(root_),
+            std::function<void(sf::Root::SPtr const&)>{
+                [task](sf::Root::SPtr const& root){
+                    task(root, keeper::Error::OK);
+                }
+            }
+        );
+        return;
+    }
+
     add_accounts_task([this, task](QVector<sf::Account::SPtr> const& accounts)
     {
-        auto account = choose(accounts);
+        auto error = keeper::Error::OK;
+        auto account = choose(accounts, error);
         if (account)
-            connection_helper_.connect_future(account->roots(), task);
+        {
+            connection_helper_.connect_future(
+                account->roots(),
+                std::function<void(QVector<sf::Root::SPtr> const&)>{
+                    [this, task, account](QVector<sf::Root::SPtr> const& roots){
+                        auto root_error = keeper::Error::OK;
+                        auto root = choose(roots, root_error);
+                        if (root)
+                        {
+                            // remember the choice for next time
+                            account_ = account;
+                            root_ = root;
+                        }
+                        task(root, root_error);
+                    }
+                }
+            );
+        }
         else
         {
-            QVector<sf::Root::SPtr> no_accounts;
-            task(no_accounts);
+            task(sf::Root::SPtr(), error);
         }
     });
 }
 
 void StorageFrameworkClient::set_storage(QString const & storage)
 {
+    if (storage_id_ != storage)
+        invalidate_cache();
+
     storage_id_ = storage;
+    local_dir_ = local_storage_dir(storage);
+    if (!local_dir_.isEmpty())
+        qDebug() << "storing backups in" << local_dir_;
+}
+
+QString
+StorageFrameworkClient::local_storage_dir(QString const & storage)
+{
+    QUrl const url(storage);
+    return url.isLocalFile() ? QDir::cleanPath(url.toLocalFile()) : QString();
+}
+
+void StorageFrameworkClient::invalidate_cache()
+{
+    account_.reset();
+    root_.reset();
+    keeper_folder_.reset();
+    backup_folders_.clear();
+    pending_keeper_folder_ = QFuture<sf::Folder::SPtr>();
+    pending_folders_.clear();
+}
+
+QFuture<bool>
+StorageFrameworkClient::prepare_folder(QString const & dir_name, bool create_if_not_exists)
+{
+    if (!local_dir_.isEmpty())
+    {
+        auto const path = local_path(dir_name);
+        return make_ready_future(create_if_not_exists ? QDir().mkpath(path) : QDir(path).exists());
+    }
+
+    QFutureInterface<bool> fi;
+
+    add_roots_task([this, fi, dir_name, create_if_not_exists](sf::Root::SPtr const& root, keeper::Error /*error*/)
+    {
+        if (!root)
+        {
+            QFutureInterface<bool> qfi(fi);
+            qfi.reportResult(false);
+            qfi.reportFinished();
+            return;
+        }
+
+        connection_helper_.connect_future(
+            get_keeper_folder(root, dir_name, create_if_not_exists),
+            std::function<void(sf::Folder::SPtr const&)>{
+                [fi, dir_name](sf::Folder::SPtr const& folder){
+                    qDebug() << "prepared folder" << dir_name << bool(folder);
+                    QFutureInterface<bool> qfi(fi);
+                    qfi.reportResult(bool(folder));
+                    qfi.reportFinished();
+                }
+            }
+        );
+    });
+
+    return fi.future();
 }
 
 QFuture<std::shared_ptr<Uploader>>
 StorageFrameworkClient::get_new_uploader(int64_t n_bytes, QString const & dir_name, QString const & file_name)
 {
-    clear_last_error();
+    if (!local_dir_.isEmpty())
+    {
+        clear_last_error();
+        return get_new_local_uploader(n_bytes, dir_name, file_name);
+    }
 
-    QFutureInterface<std::shared_ptr<Uploader>> fi;
+    // creating a file only stages it, so trying again can't leave a duplicate behind
+    return with_retries<Uploader>(
+        QStringLiteral("creating %1/%2").arg(dir_name).arg(file_name),
+        [this, n_bytes, dir_name, file_name](){
+            return try_new_uploader(n_bytes, dir_name, file_name);
+        }
+    );
+}
+
+QFuture<StorageFrameworkClient::Attempt<Uploader>>
+StorageFrameworkClient::try_new_uploader(int64_t n_bytes, QString const & dir_name, QString const & file_name)
+{
+    QFutureInterface<Attempt<Uploader>> fi;
 
-    add_roots_task([this, fi, n_bytes, dir_name, file_name](QVector<sf::Root::SPtr> const& roots)
+    // if this goes wrong with cached handles, they may be stale
+    auto const cached = bool(root_) && backup_folders_.contains(dir_name);
+
+    add_roots_task([this, fi, n_bytes, dir_name, file_name, cached](sf::Root::SPtr const& root, keeper::Error error)
     {
-        auto root = choose(roots);
         if (root)
         {
             connection_helper_.connect_future(
                 get_keeper_folder(root, dir_name, true),
                 std::function<void(sf::Folder::SPtr const&)>{
-                    [this, fi, n_bytes, file_name,root](sf::Folder::SPtr const& keeper_folder){
+                    [this, fi, n_bytes, dir_name, file_name, root, cached](sf::Folder::SPtr const& keeper_folder){
                         if (!keeper_folder)
                         {
                             qWarning() << "Error creating keeper root folder";
-                            std::shared_ptr<Uploader> ret;
-                            QFutureInterface<decltype(ret)> qfi(fi);
-                            qfi.reportResult(ret);
+                            QFutureInterface<Attempt<Uploader>> qfi(fi);
+                            qfi.reportResult(Attempt<Uploader>(nullptr, folder_error(true)));
                             qfi.reportFinished();
                         }
                         else
@@ -171,22 +297,38 @@ StorageFrameworkClient::get_new_uploader(int64_t n_bytes, QString const & dir_na
                             connection_helper_.connect_future(
                                 keeper_folder->create_file(file_name, n_bytes),
                                 std::function<void(std::shared_ptr<sf::Uploader> const&)>{
-                                    [this, fi, keeper_folder](std::shared_ptr<sf::Uploader> const& sf_uploader){
+                                    [this, fi, n_bytes, dir_name, file_name, keeper_folder, cached](std::shared_ptr<sf::Uploader> const& sf_uploader){
                                         qDebug() << "keeper_root->create_file() finished";
-                                        std::shared_ptr<Uploader> ret;
+                                        if (!sf_uploader && cached)
+                                        {
+                                            qDebug() << "retrying with fresh storage-framework handles";
+                                            invalidate_cache();
+                                            connection_helper_.connect_future(
+                                                try_new_uploader(n_bytes, dir_name, file_name),
+                                                std::function<void(Attempt<Uploader> const&)>{
+                                                    [fi](Attempt<Uploader> const& attempt){
+                                                        QFutureInterface<Attempt<Uploader>> qfi(fi);
+                                                        qfi.reportResult(attempt);
+                                                        qfi.reportFinished();
+                                                    }
+                                                }
+                                            );
+                                            return;
+                                        }
+                                        Attempt<Uploader> attempt;
                                         if (sf_uploader)
                                         {
-                                            ret.reset(
+                                            attempt.result.reset(
                                                 new StorageFrameworkUploader(sf_uploader, this),
                                                 [](Uploader* u){u->deleteLater();}
                                             );
                                         }
                                         else
                                         {
-                                            last_error_ = keeper::Error::CREATING_REMOTE_FILE;
+                                            attempt.error = keeper::Error::CREATING_REMOTE_FILE;
                                         }
-                                        QFutureInterface<decltype(ret)> qfi(fi);
-                                        qfi.reportResult(ret);
+                                        QFutureInterface<Attempt<Uploader>> qfi(fi);
+                                        qfi.reportResult(attempt);
                                         qfi.reportFinished();
                                     }
                                 }
@@ -198,9 +340,8 @@ StorageFrameworkClient::get_new_uploader(int64_t n_bytes, QString const & dir_na
         }
         else
         {
-            std::shared_ptr<Uploader> ret;
-            QFutureInterface<decltype(ret)> qfi(fi);
-            qfi.reportResult(ret);
+            QFutureInterface<Attempt<Uploader>> qfi(fi);
+            qfi.reportResult(Attempt<Uploader>(nullptr, error));
             qfi.reportFinished();
         }
     });
@@ -208,16 +349,92 @@ StorageFrameworkClient::get_new_uploader(int64_t n_bytes, QString const & dir_na
     return fi.future();
 }
 
+QFuture<std::shared_ptr<Uploader>>
+StorageFrameworkClient::get_new_archive_uploader(int64_t n_bytes,
+                                                 QString const & dir_name,
+                                                 QString const & file_name,
+                                                 PartedUploader::Resume const & resume)
+{
+    if ((part_size_ <= 0) || (n_bytes <= part_size_))
+        return get_new_uploader(n_bytes, dir_name, file_name);
+
+    clear_last_error();
+
+    std::shared_ptr<Uploader> uploader(
+        new PartedUploader(
+            n_bytes,
+            file_name,
+            part_size_,
+            max_parallel_parts_,
+            [this, dir_name](qint64 part_bytes, QString const & part_name){
+                return get_new_uploader(part_bytes, dir_name, part_name);
+            },
+            resume,
+            this
+        ),
+        [](Uploader* u){u->deleteLater();}
+    );
+    return make_ready_future(uploader);
+}
+
 QFuture<std::shared_ptr<Downloader>>
-StorageFrameworkClient::get_new_downloader(QString const & dir_name, QString const & file_name)
+StorageFrameworkClient::get_new_parted_downloader(QString const & dir_name, QStringList const & part_names, int64_t part_size, int64_t n_bytes)
 {
     clear_last_error();
 
-    QFutureInterface<std::shared_ptr<Downloader>> fi;
+    std::shared_ptr<Downloader> downloader(
+        new PartedDownloader(
+            part_names,
+            part_size,
+            n_bytes,
+            max_parallel_parts_,
+            [this, dir_name](QString const & part_name){
+                return get_new_downloader(dir_name, part_name);
+            },
+            this
+        ),
+        [](Downloader* d){d->deleteLater();}
+    );
+    return make_ready_future(downloader);
+}
+
+void
+StorageFrameworkClient::set_multipart_upload(int64_t part_size, int max_parallel)
+{
+    part_size_ = std::max(part_size, int64_t(0));
+    max_parallel_parts_ = std::max(max_parallel, 1);
+}
+
+int64_t
+StorageFrameworkClient::multipart_part_size() const
+{
+    return part_size_;
+}
+
+QFuture<std::shared_ptr<Downloader>>
+StorageFrameworkClient::get_new_downloader(QString const & dir_name, QString const & file_name)
+{
+    if (!local_dir_.isEmpty())
+    {
+        clear_last_error();
+        return get_new_local_downloader(dir_name, file_name);
+    }
+
+    return with_retries<Downloader>(
+        QStringLiteral("opening %1/%2").arg(dir_name).arg(file_name),
+        [this, dir_name, file_name](){
+            return try_new_downloader(dir_name, file_name);
+        }
+    );
+}
+
+QFuture<StorageFrameworkClient::Attempt<Downloader>>
+StorageFrameworkClient::try_new_downloader(QString const & dir_name, QString const & file_name)
+{
+    QFutureInterface<Attempt<Downloader>> fi;
 
-    add_roots_task([this, fi, dir_name, file_name](QVector<sf::Root::SPtr> const& roots)
+    add_roots_task([this, fi, dir_name, file_name](sf::Root::SPtr const& root, keeper::Error error)
     {
-        auto root = choose(roots);
         if (root)
         {
             connection_helper_.connect_future(
@@ -227,9 +444,8 @@ StorageFrameworkClient::get_new_downloader(QString const & dir_name, QString con
                         if (!keeper_root)
                         {
                             qWarning() << "Error accessing keeper root folder";
-                            std::shared_ptr<Downloader> ret;
-                            QFutureInterface<decltype(ret)> qfi(fi);
-                            qfi.reportResult(ret);
+                            QFutureInterface<Attempt<Downloader>> qfi(fi);
+                            qfi.reportResult(Attempt<Downloader>(nullptr, folder_error(false)));
                             qfi.reportFinished();
                         }
                         else
@@ -244,29 +460,29 @@ StorageFrameworkClient::get_new_downloader(QString const & dir_name, QString con
                                                 sf_file->create_downloader(),
                                                 std::function<void(sf::Downloader::SPtr const&)>{
                                                     [this, fi, sf_file, keeper_root, root](sf::Downloader::SPtr const& sf_downloader){
-                                                        std::shared_ptr<Downloader> ret;
+                                                        Attempt<Downloader> attempt;
                                                         if (sf_downloader)
                                                         {
-                                                            ret.reset(
+                                                            attempt.result.reset(
                                                                 new StorageFrameworkDownloader(sf_downloader, sf_file->size(), this),
                                                                 [](Downloader* d){d->deleteLater();}
                                                             );
                                                         }
                                                         else
                                                         {
-                                                            last_error_ = keeper::Error::READING_REMOTE_FILE;
+                                                            attempt.error = keeper::Error::READING_REMOTE_FILE;
+                                                            invalidate_cache();
                                                         }
-                                                        QFutureInterface<decltype(ret)> qfi(fi);
-                                                        qfi.reportResult(ret);
+                                                        QFutureInterface<Attempt<Downloader>> qfi(fi);
+                                                        qfi.reportResult(attempt);
                                                         qfi.reportFinished();
                                                     }
                                                 }
                                             );
                                         } else {
-                                            last_error_ = keeper::Error::READING_REMOTE_FILE;
-                                            std::shared_ptr<Downloader> ret_null;
-                                            QFutureInterface<decltype(ret_null)> qfi(fi);
-                                            qfi.reportResult(ret_null);
+                                            // it's not there, so looking again won't help
+                                            QFutureInterface<Attempt<Downloader>> qfi(fi);
+                                            qfi.reportResult(Attempt<Downloader>(nullptr, keeper::Error::READING_REMOTE_FILE, true));
                                             qfi.reportFinished();
                                         }
                                     }
@@ -279,9 +495,8 @@ StorageFrameworkClient::get_new_downloader(QString const & dir_name, QString con
         }
         else
         {
-            std::shared_ptr<Downloader> ret;
-            QFutureInterface<decltype(ret)> qfi(fi);
-            qfi.reportResult(ret);
+            QFutureInterface<Attempt<Downloader>> qfi(fi);
+            qfi.reportResult(Attempt<Downloader>(nullptr, error));
             qfi.reportFinished();
         }
     });
@@ -292,17 +507,20 @@ StorageFrameworkClient::get_new_downloader(QString const & dir_name, QString con
 QFuture<QVector<QString>>
 StorageFrameworkClient::get_keeper_dirs()
 {
-    clear_last_error();
+    if (!local_dir_.isEmpty())
+    {
+        clear_last_error();
+        return make_ready_future(get_local_dirs());
+    }
 
     QFutureInterface<QVector<QString>> fi;
 
-    add_roots_task([this, fi](QVector<sf::Root::SPtr> const& roots)
+    add_roots_task([this, fi](sf::Root::SPtr const& root, keeper::Error error)
     {
-        auto root = choose(roots);
         if (root)
         {
             connection_helper_.connect_future(
-                     get_storage_framework_folder(root, KEEPER_FOLDER, false),
+                     get_keeper_root_folder(root, false),
                      std::function<void(sf::Folder::SPtr const &)>{
                           [this, fi, root](sf::Folder::SPtr const & keeper_folder){
                               QVector<QString> res;
@@ -313,6 +531,7 @@ StorageFrameworkClient::get_keeper_dirs()
                                           get_storage_framework_dirs(keeper_folder),
                                           std::function<void(QVector<QString> const &)> {
                                               [this, fi, res](QVector<QString> const & keeper_folders){
+                                                  last_error_ = keeper::Error::OK;
                                                   QFutureInterface<decltype(res)> qfi(fi);
                                                   qfi.reportResult(keeper_folders);
                                                   qfi.reportFinished();
@@ -323,6 +542,7 @@ StorageFrameworkClient::get_keeper_dirs()
                               else
                               {
                                   qWarning() << "Keeper root folder was not found";
+                                  last_error_ = folder_error(false);
                                   QFutureInterface<decltype(res)> qfi(fi);
                                   qfi.reportResult(res);
                                   qfi.reportFinished();
@@ -334,6 +554,7 @@ StorageFrameworkClient::get_keeper_dirs()
         else
         {
             qDebug() << "No dirs were found";
+            last_error_ = error;
             QVector<QString> res;
             QFutureInterface<decltype(res)> qfi(fi);
             qfi.reportResult(res);
@@ -349,6 +570,76 @@ StorageFrameworkClient::get_last_error() const
     return last_error_;
 }
 
+/***
+****  Local directories
+***/
+
+QString
+StorageFrameworkClient::local_path(QString const & dir_name, QString const & file_name) const
+{
+    // the same layout as in a storage-framework root
+    auto path = QDir(local_dir_).filePath(KEEPER_FOLDER);
+    if (!dir_name.isEmpty())
+        path = QDir(path).filePath(dir_name);
+    if (!file_name.isEmpty())
+        path = QDir(path).filePath(file_name);
+    return path;
+}
+
+QFuture<std::shared_ptr<Uploader>>
+StorageFrameworkClient::get_new_local_uploader(int64_t n_bytes, QString const & dir_name, QString const & file_name)
+{
+    std::shared_ptr<Uploader> ret;
+
+    if (!QDir().mkpath(local_path(dir_name)))
+    {
+        qWarning() << "unable to create" << local_path(dir_name);
+        last_error_ = keeper::Error::CREATING_REMOTE_DIR;
+        return make_ready_future(ret);
+    }
+
+    auto uploader = new LocalUploader(n_bytes, local_path(dir_name, file_name), this);
+    ret.reset(uploader, [](Uploader* u){u->deleteLater();});
+    if (!uploader->is_valid())
+    {
+        last_error_ = keeper::Error::CREATING_REMOTE_FILE;
+        ret.reset();
+    }
+
+    return make_ready_future(ret);
+}
+
+QFuture<std::shared_ptr<Downloader>>
+StorageFrameworkClient::get_new_local_downloader(QString const & dir_name, QString const & file_name)
+{
+    std::shared_ptr<Downloader> ret;
+
+    if (!QDir(local_path(dir_name)).exists())
+    {
+        last_error_ = keeper::Error::REMOTE_DIR_NOT_EXISTS;
+        return make_ready_future(ret);
+    }
+
+    auto downloader = new LocalDownloader(local_path(dir_name, file_name), this);
+    ret.reset(downloader, [](Downloader* d){d->deleteLater();});
+    if (!downloader->is_valid())
+    {
+        last_error_ = keeper::Error::READING_REMOTE_FILE;
+        ret.reset();
+    }
+
+    return make_ready_future(ret);
+}
+
+QVector<QString>
+StorageFrameworkClient::get_local_dirs() const
+{
+    QVector<QString> dirs;
+    for (auto const& name : QDir(local_path(QString())).entryList(QDir::Dirs | QDir::NoDotAndDotDot))
+        dirs << name;
+    return dirs;
+}
+
 QFuture<QStringList>
 StorageFrameworkClient::get_accounts()
 {
@@ -369,12 +660,51 @@ StorageFrameworkClient::get_accounts()
 }
 
 QFuture<sf::Folder::SPtr>
-StorageFrameworkClient::get_keeper_folder(sf::Folder::SPtr const & root, QString const & dir_name, bool create_if_not_exists)
+StorageFrameworkClient::get_keeper_root_folder(sf::Root::SPtr const & root, bool create_if_not_exists)
 {
+    if (keeper_folder_ && (root == root_))
+        return make_ready_future(keeper_folder_);
+
+    if (!pending_keeper_folder_.isFinished())
+        return pending_keeper_folder_;
+
     QFutureInterface<sf::Folder::SPtr> fi;
+    if (create_if_not_exists)
+        pending_keeper_folder_ = fi.future();
 
     connection_helper_.connect_future(
         get_storage_framework_folder(root, KEEPER_FOLDER, create_if_not_exists),
+        std::function<void(sf::Folder::SPtr const &)>{
+            [this, fi, root](sf::Folder::SPtr const & keeper_folder){
+                if (keeper_folder && (root == root_))
+                    keeper_folder_ = keeper_folder;
+                QFutureInterface<sf::Folder::SPtr> qfi(fi);
+                qfi.reportResult(keeper_folder);
+                qfi.reportFinished();
+            }
+        }
+    );
+
+    return fi.future();
+}
+
+QFuture<sf::Folder::SPtr>
+StorageFrameworkClient::get_keeper_folder(sf::Root::SPtr const & root, QString const & dir_name, bool create_if_not_exists)
+{
+    auto const cached = backup_folders_.find(dir_name);
+    if ((cached != backup_folders_.end()) && (root == root_))
+        return make_ready_future(cached.value());
+
+    auto const pending = pending_folders_.find(dir_name);
+    if ((pending != pending_folders_.end()) && !pending.value().isFinished())
+        return pending.value();
+
+    QFutureInterface<sf::Folder::SPtr> fi;
+    if (create_if_not_exists)
+        pending_folders_[dir_name] = fi.future();
+
+    connection_helper_.connect_future(
+        get_keeper_root_folder(root, create_if_not_exists),
         std::function<void(sf::Folder::SPtr const &)>{
             [this, fi, root, dir_name, create_if_not_exists](sf::Folder::SPtr const & keeper_folder){
                 if (!keeper_folder)
@@ -390,11 +720,15 @@ StorageFrameworkClient::get_keeper_folder(sf::Folder::SPtr const & root, QString
                     connection_helper_.connect_future(
                         get_storage_framework_folder(keeper_folder, dir_name, create_if_not_exists),
                         std::function<void(sf::Folder::SPtr const &)>{
-                            [this, fi, root](sf::Folder::SPtr const & timestamp_folder){
+                            [this, fi, root, dir_name](sf::Folder::SPtr const & timestamp_folder){
                                 if (!timestamp_folder)
                                 {
                                     qWarning() << "Error creating keeper time stamp folder";
                                 }
+                                else if (root == root_)
+                                {
+                                    backup_folders_[dir_name] = timestamp_folder;
+                                }
                                 QFutureInterface<sf::Folder::SPtr> qfi(fi);
                                 qfi.reportResult(timestamp_folder);
                                 qfi.reportFinished();
@@ -437,7 +771,6 @@ StorageFrameworkClient::get_storage_framework_folder(sf::Folder::SPtr const & ro
                         QFutureInterface<decltype(res)> qfi(fi);
                         qfi.reportResult(res);
                         qfi.reportFinished();
-                        last_error_ = keeper::Error::REMOTE_DIR_NOT_EXISTS;
                     }
                     else
                     {
@@ -446,10 +779,6 @@ StorageFrameworkClient::get_storage_framework_folder(sf::Folder::SPtr const & ro
                             root->create_folder(dir_name),
                             std::function<void(sf::Folder::SPtr const &)>{
                                 [this, fi, res, root](sf::Folder::SPtr const & folder){
-                                    if (!folder)
-                                    {
-                                        last_error_ = keeper::Error::CREATING_REMOTE_DIR;
-                                    }
                                     QFutureInterface<decltype(res)> qfi(fi);
                                     qfi.reportResult(folder);
                                     qfi.reportFinished();
@@ -535,6 +864,87 @@ StorageFrameworkClient::clear_last_error()
     last_error_ = keeper::Error::OK;
 }
 
+keeper::Error
+StorageFrameworkClient::folder_error(bool create_if_not_exists)
+{
+    return create_if_not_exists ? keeper::Error::CREATING_REMOTE_DIR : keeper::Error::REMOTE_DIR_NOT_EXISTS;
+}
+
+template<typename T>
+bool
+StorageFrameworkClient::is_transient(Attempt<T> const & attempt)
+{
+    if (attempt.error_is_permanent)
+        return false;
+
+    switch (attempt.error)
+    {
+        // the provider may have had a hiccup
+        case keeper::Error::CREATING_REMOTE_DIR:
+        case keeper::Error::CREATING_REMOTE_FILE:
+        case keeper::Error::READING_REMOTE_FILE:
+        case keeper::Error::NO_REMOTE_ROOTS:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+template<typename T>
+QFuture<std::shared_ptr<T>>
+StorageFrameworkClient::with_retries(QString const & what, std::function<QFuture<Attempt<T>>()> const & attempt)
+{
+    QFutureInterface<std::shared_ptr<T>> fi;
+    try_with_retries(fi, what, attempt, 0, clock_.elapsed());
+    return fi.future();
+}
+
+template<typename T>
+void
+StorageFrameworkClient::try_with_retries(QFutureInterface<std::shared_ptr<T>> fi,
+                                         QString const & what,
+                                         std::function<QFuture<Attempt<T>>()> const & attempt,
+                                         int n_failures,
+                                         qint64 started_msec)
+{
+    connection_helper_.connect_future(
+        attempt(),
+        std::function<void(Attempt<T> const&)>{
+            [this, fi, what, attempt, n_failures, started_msec](Attempt<T> const& tried){
+                auto const& result = tried.result;
+                if (!result && is_transient(tried) && retry_policy_.should_retry(n_failures + 1))
+                {
+                    auto const delay = retry_policy_.next_delay_msec(n_failures + 1);
+                    qWarning() << what << "failed with error" << int(tried.error) << "; retrying in" << delay << "msec";
+                    QTimer::singleShot(int(delay), this, [this, fi, what, attempt, n_failures, started_msec](){
+                        try_with_retries(fi, what, attempt, n_failures + 1, started_msec);
+                    });
+                    return;
+                }
+
+                if (result)
+                    retry_policy_.on_success();
+
+                if (n_failures)
+                {
+                    RetryPolicy::Stats stats;
+                    stats.n_retries = uint32_t(n_failures);
+                    stats.msec = uint64_t(clock_.elapsed() - started_msec);
+                    qDebug() << what << (result ? "succeeded" : "failed") << "after" << stats.n_retries << "retries and" << stats.msec << "msec";
+                    if (result)
+                        result->add_retry_stats(stats);
+                }
+
+                last_error_ = tried.error;
+                QFutureInterface<std::shared_ptr<T>> qfi(fi);
+                qfi.reportResult(result);
+                qfi.reportFinished();
+            }
+        }
+    );
+}
+
 QString
 StorageFrameworkClient::get_account_id(unity::storage::qt::client::Account::SPtr const & account)
 {
@@ -22,11 +22,15 @@
 
 #include "client/keeper-errors.h"
 #include "util/connection-helper.h"
+#include "util/retry-policy.h"
 #include "storage-framework/uploader.h"
 #include "storage-framework/downloader.h"
+#include "storage-framework/parted-uploader.h" // DEFAULT_MAX_PARALLEL
 
 #include <unity/storage/qt/client/client-api.h>
 
+#include <QElapsedTimer>
+#include <QMap>
 #include <QObject>
 #include <QFutureWatcher>
 
@@ -45,33 +49,126 @@ public:
 
     Q_DISABLE_COPY(StorageFrameworkClient)
 
+    // `storage` is a storage-framework account id, or a "file://" url
+    // to store the backups in a local or network-mounted directory
     void set_storage(QString const & storage);
     QFuture<std::shared_ptr<Uploader>> get_new_uploader(int64_t n_bytes, QString const & dir_name, QString const & file_name);
     QFuture<std::shared_ptr<Downloader>> get_new_downloader(QString const & dir_name, QString const & file_name);
+
+    // like get_new_uploader(), but large files are uploaded in parts
+    // if set_multipart_upload() has turned that on. `resume` is only
+    // used if it was uploaded with the same part size
+    QFuture<std::shared_ptr<Uploader>> get_new_archive_uploader(int64_t n_bytes,
+                                                                QString const & dir_name,
+                                                                QString const & file_name,
+                                                                PartedUploader::Resume const & resume = PartedUploader::Resume());
+
+    // reads a file that was uploaded in parts as one stream
+    QFuture<std::shared_ptr<Downloader>> get_new_parted_downloader(QString const & dir_name, QStringList const & part_names, int64_t part_size, int64_t n_bytes);
+
+    // `part_size` 0 uploads every file whole
+    void set_multipart_upload(int64_t part_size, int max_parallel);
+    int64_t multipart_part_size() const;
+
     QFuture<QVector<QString>> get_keeper_dirs();
     keeper::Error get_last_error() const;
     QFuture<QStringList> get_accounts();
 
+    // looks up, and optionally creates, a folder ahead of time so that
+    // later uploaders or downloaders for it don't have to wait on that
+    QFuture<bool> prepare_folder(QString const & dir_name, bool create_if_not_exists);
+
+    // forgets the account, root, and folders that were looked up before,
+    // eg if they might have changed behind our back
+    void invalidate_cache();
+
     static QString const KEEPER_FOLDER;
+
+    // the directory that `storage` refers to, or an empty string
+    // if it's not a "file://" url
+    static QString local_storage_dir(QString const & storage);
+
 private:
 
+    // the outcome of one try, which carries its own error
+    // so that tries that overlap can't see each other's
+    template<typename T>
+    struct Attempt
+    {
+        Attempt(std::shared_ptr<T> const & result_in = std::shared_ptr<T>(),
+                keeper::Error error_in = keeper::Error::OK,
+                bool error_is_permanent_in = false):
+            result(result_in),
+            error(error_in),
+            error_is_permanent(error_is_permanent_in)
+        {
+        }
+
+        std::shared_ptr<T> result;
+        keeper::Error error;
+        bool error_is_permanent;
+    };
+
+    QFuture<Attempt<Uploader>> try_new_uploader(int64_t n_bytes, QString const & dir_name, QString const & file_name);
+    QFuture<Attempt<Downloader>> try_new_downloader(QString const & dir_name, QString const & file_name);
+
+    // runs `attempt`, and runs it again after a while if it fails with a transient error
+    template<typename T>
+    QFuture<std::shared_ptr<T>> with_retries(QString const & what, std::function<QFuture<Attempt<T>>()> const & attempt);
+    template<typename T>
+    void try_with_retries(QFutureInterface<std::shared_ptr<T>> fi,
+                          QString const & what,
+                          std::function<QFuture<Attempt<T>>()> const & attempt,
+                          int n_failures,
+                          qint64 started_msec);
+    template<typename T>
+    static bool is_transient(Attempt<T> const & attempt);
+
+    QString local_path(QString const & dir_name, QString const & file_name = QString()) const;
+    QFuture<std::shared_ptr<Uploader>> get_new_local_uploader(int64_t n_bytes, QString const & dir_name, QString const & file_name);
+    QFuture<std::shared_ptr<Downloader>> get_new_local_downloader(QString const & dir_name, QString const & file_name);
+    QVector<QString> get_local_dirs() const;
+
     void add_accounts_task(std::function<void(QVector<unity::storage::qt::client::Account::SPtr> const&)> task);
-    void add_roots_task(std::function<void(QVector<unity::storage::qt::client::Root::SPtr> const&)> task);
+    // calls `task` with the chosen root, or with nullptr and what went wrong
+    void add_roots_task(std::function<void(unity::storage::qt::client::Root::SPtr const&, keeper::Error)> task);
 
-    unity::storage::qt::client::Account::SPtr choose(QVector<unity::storage::qt::client::Account::SPtr> const& choices) const;
-    unity::storage::qt::client::Root::SPtr choose(QVector<unity::storage::qt::client::Root::SPtr> const& choices) const;
+    unity::storage::qt::client::Account::SPtr choose(QVector<unity::storage::qt::client::Account::SPtr> const& choices, keeper::Error & error) const;
+    unity::storage::qt::client::Root::SPtr choose(QVector<unity::storage::qt::client::Root::SPtr> const& choices, keeper::Error & error) const;
 
-    QFuture<unity::storage::qt::client::Folder::SPtr> get_keeper_folder(unity::storage::qt::client::Folder::SPtr const & root, QString const & dir_name, bool create_if_not_exists);
+    QFuture<unity::storage::qt::client::Folder::SPtr> get_keeper_root_folder(unity::storage::qt::client::Root::SPtr const & root, bool create_if_not_exists);
+    QFuture<unity::storage::qt::client::Folder::SPtr> get_keeper_folder(unity::storage::qt::client::Root::SPtr const & root, QString const & dir_name, bool create_if_not_exists);
     QFuture<unity::storage::qt::client::Folder::SPtr> get_storage_framework_folder(unity::storage::qt::client::Folder::SPtr const & root, QString const & dir_name, bool create_if_not_exists);
     QFuture<unity::storage::qt::client::File::SPtr> get_storage_framework_file(unity::storage::qt::client::Folder::SPtr const & root, QString const & file_name);
     QFuture<QVector<QString>> get_storage_framework_dirs(unity::storage::qt::client::Folder::SPtr const & root);
 
     void clear_last_error();
+    static keeper::Error folder_error(bool create_if_not_exists);
 
     static QString get_account_id(unity::storage::qt::client::Account::SPtr const & account);
 
     unity::storage::qt::client::Runtime::SPtr runtime_;
     ConnectionHelper connection_helper_;
     QString storage_id_ = "";
-    mutable keeper::Error last_error_ = keeper::Error::OK;
+    QString local_dir_; // set if storage_id_ is a local directory
+    // what went wrong with the request that finished last
+    keeper::Error last_error_ = keeper::Error::OK;
+
+    RetryPolicy retry_policy_;
+    QElapsedTimer clock_;
+
+    // handles that have already been looked up, so that each task
+    // doesn't have to walk the whole path again
+    unity::storage::qt::client::Account::SPtr account_;
+    unity::storage::qt::client::Root::SPtr root_;
+    unity::storage::qt::client::Folder::SPtr keeper_folder_;
+    QMap<QString, unity::storage::qt::client::Folder::SPtr> backup_folders_;
+
+    // folders that are being created right now, so that two requests
+    // for the same one don't each create a copy of it
+    QFuture<unity::storage::qt::client::Folder::SPtr> pending_keeper_folder_;
+    QMap<QString, QFuture<unity::storage::qt::client::Folder::SPtr>> pending_folders_;
+
+    int64_t part_size_ {};
+    int max_parallel_parts_ {PartedUploader::DEFAULT_MAX_PARALLEL};
 };
@@ -19,8 +19,11 @@
 
 #pragma once
 
+#include "util/retry-policy.h"
+
 #include <QLocalSocket>
 #include <QObject>
+#include <QStringList>
 
 #include <memory>
 
@@ -39,7 +42,26 @@ public:
     virtual void commit() =0;
     virtual QString file_name() const =0;
 
+    // if the file was uploaded in parts, the parts' names in order
+    virtual QStringList part_names() const { return QStringList(); }
+    virtual qint64 part_size() const { return 0; }
+
+    // how often storage had to be asked again for this, and how long that took
+    RetryPolicy::Stats retry_stats() const { return retry_stats_; }
+    void add_retry_stats(RetryPolicy::Stats const& stats)
+    {
+        retry_stats_ += stats;
+        Q_EMIT(retried(stats));
+    }
+
 Q_SIGNALS:
 
     void commit_finished(bool success);
+
+    // `stats` is what was just added to retry_stats()
+    void retried(RetryPolicy::Stats const& stats);
+
+private:
+
+    RetryPolicy::Stats retry_stats_;
 };
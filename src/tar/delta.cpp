@@ -0,0 +1,639 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "tar/delta.h"
+#include "tar/digest.h"
+
+#include <algorithm> // std::min(), std::max()
+#include <cmath> // sqrt()
+#include <cstring> // memcpy(), strlen()
+#include <istream>
+#include <ostream>
+#include <unordered_map>
+
+namespace Delta
+{
+
+char const * const SUFFIX = ".keeper-delta";
+
+bool
+is_delta_name(std::string const& name)
+{
+    auto const suffix_len = strlen(SUFFIX);
+    return (name.size() > suffix_len) && !name.compare(name.size()-suffix_len, suffix_len, SUFFIX);
+}
+
+std::string
+target_name(std::string const& name)
+{
+    return is_delta_name(name) ? name.substr(0, name.size()-strlen(SUFFIX)) : name;
+}
+
+namespace
+{
+
+constexpr char SIGNATURE_MAGIC[4] = {'K','S','I','G'};
+constexpr char PATCH_MAGIC[4] = {'K','D','L','T'};
+constexpr uint32_t FORMAT_VERSION {1};
+
+constexpr uint32_t MIN_BLOCK_SIZE {2048};
+constexpr uint32_t MAX_BLOCK_SIZE {128*1024};
+
+// how much to read from the target at a time
+constexpr size_t READ_CHUNK {64*1024};
+
+// flush pending literal bytes once they get this big
+constexpr size_t MAX_LITERAL {1024*1024};
+
+enum Op : uint8_t
+{
+    OP_END = 0,
+    OP_COPY = 1,
+    OP_LITERAL = 2
+};
+
+/***
+****  little-endian serialization
+***/
+
+template<typename T>
+void put(std::ostream& out, T val)
+{
+    char buf[sizeof(T)];
+    for (size_t i=0; i<sizeof(T); ++i)
+    {
+        buf[i] = char(val & 0xFF);
+        val = T(val >> 8);
+    }
+    out.write(buf, sizeof(buf));
+}
+
+template<typename T>
+bool get(std::istream& in, T& setme)
+{
+    unsigned char buf[sizeof(T)];
+    if (!in.read(reinterpret_cast<char*>(buf), sizeof(buf)))
+        return false;
+    T val {};
+    for (size_t i=sizeof(T); i>0; --i)
+        val = T((val << 8) | buf[i-1]);
+    setme = val;
+    return true;
+}
+
+template<>
+void put<uint8_t>(std::ostream& out, uint8_t val)
+{
+    out.put(char(val));
+}
+
+/***
+****  rolling checksum
+***/
+
+class RollingChecksum
+{
+public:
+    void reset(char const* data, size_t len)
+    {
+        a_ = b_ = 0;
+        len_ = uint32_t(len);
+        for (size_t i=0; i<len; ++i)
+        {
+            auto const c = uint32_t(static_cast<unsigned char>(data[i]));
+            a_ += c;
+            b_ += uint32_t(len - i) * c;
+        }
+    }
+
+    void roll(char out_c, char in_c)
+    {
+        auto const out = uint32_t(static_cast<unsigned char>(out_c));
+        auto const in = uint32_t(static_cast<unsigned char>(in_c));
+        a_ = a_ - out + in;
+        b_ = b_ - len_*out + a_;
+    }
+
+    uint32_t value() const
+    {
+        return (a_ & 0xFFFF) | ((b_ & 0xFFFF) << 16);
+    }
+
+private:
+    uint32_t a_ {};
+    uint32_t b_ {};
+    uint32_t len_ {};
+};
+
+/***
+****  patch writer
+***/
+
+class PatchWriter
+{
+public:
+    explicit PatchWriter(std::ostream& out): out_(out) {}
+
+    void copy(uint64_t block_index)
+    {
+        // coalesce runs of consecutive blocks into a single op
+        if (copy_len_ && (copy_start_ + copy_len_ == block_index))
+        {
+            ++copy_len_;
+            return;
+        }
+        flush_copy();
+        copy_start_ = block_index;
+        copy_len_ = 1;
+    }
+
+    void literal(char const* data, size_t len)
+    {
+        if (len == 0)
+            return;
+        flush_copy();
+        put<uint8_t>(out_, OP_LITERAL);
+        put<uint32_t>(out_, uint32_t(len));
+        out_.write(data, std::streamsize(len));
+        n_literal_ += len;
+    }
+
+    void end()
+    {
+        flush_copy();
+        put<uint8_t>(out_, OP_END);
+    }
+
+    int64_t n_literal() const { return int64_t(n_literal_); }
+
+private:
+    void flush_copy()
+    {
+        if (!copy_len_)
+            return;
+        put<uint8_t>(out_, OP_COPY);
+        put<uint64_t>(out_, copy_start_);
+        put<uint32_t>(out_, copy_len_);
+        copy_len_ = 0;
+    }
+
+    std::ostream& out_;
+    uint64_t copy_start_ {};
+    uint32_t copy_len_ {};
+    size_t n_literal_ {};
+};
+
+} // anonymous namespace
+
+/***
+****  Signature
+***/
+
+bool
+Signature::serialize(std::ostream& out) const
+{
+    out.write(SIGNATURE_MAGIC, sizeof(SIGNATURE_MAGIC));
+    put<uint32_t>(out, FORMAT_VERSION);
+    put<uint32_t>(out, block_size);
+    put<uint64_t>(out, file_size);
+    put<uint32_t>(out, uint32_t(blocks.size()));
+    for (auto const& block : blocks)
+    {
+        put<uint32_t>(out, block.weak);
+        put<uint64_t>(out, block.strong);
+    }
+    return bool(out);
+}
+
+bool
+Signature::parse(std::istream& in)
+{
+    char magic[sizeof(SIGNATURE_MAGIC)];
+    uint32_t version {};
+    uint32_t n_blocks {};
+
+    if (!in.read(magic, sizeof(magic)) || memcmp(magic, SIGNATURE_MAGIC, sizeof(magic)))
+        return false;
+    if (!get(in, version) || (version != FORMAT_VERSION))
+        return false;
+    if (!get(in, block_size) || !block_size || !get(in, file_size) || !get(in, n_blocks))
+        return false;
+    if (n_blocks != (file_size + block_size - 1) / block_size)
+        return false;
+
+    blocks.resize(n_blocks);
+    for (auto& block : blocks)
+        if (!get(in, block.weak) || !get(in, block.strong))
+            return false;
+
+    return true;
+}
+
+/***
+****  SignatureBuilder
+***/
+
+SignatureBuilder::SignatureBuilder(uint32_t block_size)
+{
+    sig_.block_size = block_size;
+    pending_.reserve(block_size);
+}
+
+void
+SignatureBuilder::update(char const* data, size_t len)
+{
+    sig_.file_size += len;
+
+    auto const block_size = size_t(sig_.block_size);
+    while (len > 0)
+    {
+        // fast path: hash whole blocks straight from the input
+        if (pending_.empty() && len >= block_size)
+        {
+            add_block(data, block_size);
+            data += block_size;
+            len -= block_size;
+            continue;
+        }
+
+        auto const n = std::min(len, block_size - pending_.size());
+        pending_.insert(pending_.end(), data, data+n);
+        data += n;
+        len -= n;
+        if (pending_.size() == block_size)
+        {
+            add_block(pending_.data(), pending_.size());
+            pending_.clear();
+        }
+    }
+}
+
+Signature
+SignatureBuilder::finish()
+{
+    if (!pending_.empty())
+    {
+        add_block(pending_.data(), pending_.size());
+        pending_.clear();
+    }
+    return sig_;
+}
+
+void
+SignatureBuilder::add_block(char const* data, size_t len)
+{
+    sig_.blocks.push_back(BlockSignature{weak_checksum(data, len), Digest::of(data, len)});
+}
+
+/***
+****
+***/
+
+uint32_t
+choose_block_size(uint64_t file_size)
+{
+    // same heuristic as rsync: roughly sqrt(size), rounded to a multiple of 64
+    auto block_size = uint64_t(std::sqrt(double(file_size)));
+    block_size = (block_size + 63) & ~uint64_t(63);
+    return uint32_t(std::max(uint64_t(MIN_BLOCK_SIZE), std::min(uint64_t(MAX_BLOCK_SIZE), block_size)));
+}
+
+uint32_t
+weak_checksum(char const* data, size_t len)
+{
+    RollingChecksum sum;
+    sum.reset(data, len);
+    return sum.value();
+}
+
+Signature
+make_signature(std::istream& in, uint32_t block_size)
+{
+    SignatureBuilder builder{block_size};
+    std::vector<char> buf(READ_CHUNK);
+    while (in)
+    {
+        in.read(buf.data(), std::streamsize(buf.size()));
+        auto const n = in.gcount();
+        if (n <= 0)
+            break;
+        builder.update(buf.data(), size_t(n));
+    }
+    return builder.finish();
+}
+
+/***
+****  encode
+***/
+
+int64_t
+encode(Signature const& basis,
+       std::istream& target,
+       std::ostream& patch,
+       SignatureBuilder* next)
+{
+    auto const block_size = size_t(basis.block_size);
+    if (!block_size)
+        return -1;
+
+    // index the basis' full-sized blocks by their weak checksum
+    std::unordered_map<uint32_t,std::vector<uint64_t>> index;
+    index.reserve(basis.blocks.size());
+    uint64_t n_full_blocks = basis.file_size / block_size;
+    for (uint64_t i=0; i<n_full_blocks; ++i)
+        index[basis.blocks[i].weak].push_back(i);
+
+    // a short trailing block can only match at the very end of the target
+    bool const has_short_tail = basis.file_size % block_size;
+    auto const tail_len = size_t(basis.file_size % block_size);
+
+    // write the header; we don't know the target's size & digest yet,
+    // so reserve space for them and fill them in at the end
+    patch.write(PATCH_MAGIC, sizeof(PATCH_MAGIC));
+    put<uint32_t>(patch, FORMAT_VERSION);
+    put<uint32_t>(patch, basis.block_size);
+    put<uint64_t>(patch, basis.file_size);
+    auto const fixup_pos = patch.tellp();
+    put<uint64_t>(patch, 0); // target size
+    put<uint64_t>(patch, 0); // target digest
+
+    PatchWriter writer{patch};
+    Digest target_digest;
+    uint64_t target_size {};
+
+    // buf[lit,pos) is literal data waiting to be written;
+    // buf[pos,pos+block_size) is the window being checksummed
+    std::vector<char> buf;
+    size_t lit {};
+    size_t pos {};
+    bool eof {};
+
+    auto fill = [&](size_t want)
+    {
+        while (!eof && (buf.size() - pos < want))
+        {
+            // drop the bytes that have already been written
+            if (lit > READ_CHUNK)
+            {
+                buf.erase(buf.begin(), buf.begin()+std::ptrdiff_t(lit));
+                pos -= lit;
+                lit = 0;
+            }
+
+            auto const old_size = buf.size();
+            buf.resize(old_size + READ_CHUNK);
+            target.read(buf.data()+old_size, std::streamsize(READ_CHUNK));
+            auto const n = size_t(std::max(std::streamsize(0), target.gcount()));
+            buf.resize(old_size + n);
+            target_digest.update(buf.data()+old_size, n);
+            if (next != nullptr)
+                next->update(buf.data()+old_size, n);
+            target_size += n;
+            if (n == 0)
+                eof = true;
+        }
+    };
+
+    auto find_block = [&](uint32_t weak, char const* data) -> int64_t
+    {
+        auto const it = index.find(weak);
+        if (it == index.end())
+            return -1;
+        auto const strong = Digest::of(data, block_size);
+        for (auto const& block_index : it->second)
+            if (basis.blocks[block_index].strong == strong)
+                return int64_t(block_index);
+        return -1;
+    };
+
+    // no full blocks to match against, so stream everything but the tail
+    if (!n_full_blocks)
+    {
+        for (;;)
+        {
+            fill(MAX_LITERAL + tail_len);
+            if (eof)
+                break;
+            pos = buf.size() - tail_len;
+            writer.literal(buf.data()+lit, pos-lit);
+            lit = pos;
+        }
+    }
+
+    RollingChecksum sum;
+    bool have_sum {};
+
+    fill(block_size);
+    while (n_full_blocks && (buf.size() - pos >= block_size))
+    {
+        if (!have_sum)
+        {
+            sum.reset(buf.data()+pos, block_size);
+            have_sum = true;
+        }
+
+        auto const block_index = find_block(sum.value(), buf.data()+pos);
+        if (block_index >= 0)
+        {
+            writer.literal(buf.data()+lit, pos-lit);
+            writer.copy(uint64_t(block_index));
+            pos += block_size;
+            lit = pos;
+            have_sum = false;
+            fill(block_size);
+            continue;
+        }
+
+        if (pos - lit >= MAX_LITERAL)
+        {
+            writer.literal(buf.data()+lit, pos-lit);
+            lit = pos;
+        }
+
+        // slide the window forward by one byte
+        fill(block_size + 1);
+        if (buf.size() - pos > block_size)
+            sum.roll(buf[pos], buf[pos+block_size]);
+        ++pos;
+    }
+
+    // handle the tail
+    fill(SIZE_MAX);
+    auto const n_left = buf.size() - pos;
+    if (has_short_tail && (n_left >= tail_len))
+    {
+        auto const tail = buf.data() + buf.size() - tail_len;
+        auto const& block = basis.blocks.back();
+        if ((weak_checksum(tail, tail_len) == block.weak) && (Digest::of(tail, tail_len) == block.strong))
+        {
+            writer.literal(buf.data()+lit, size_t(tail - (buf.data()+lit)));
+            writer.copy(basis.blocks.size()-1);
+            lit = buf.size();
+        }
+    }
+    writer.literal(buf.data()+lit, buf.size()-lit);
+    writer.end();
+
+    // now that we know them, fill in the target's size & digest
+    auto const end_pos = patch.tellp();
+    patch.seekp(fixup_pos);
+    put<uint64_t>(patch, target_size);
+    put<uint64_t>(patch, target_digest.value());
+    patch.seekp(end_pos);
+
+    if (!patch || target.bad())
+        return -1;
+
+    return writer.n_literal();
+}
+
+/***
+****  apply
+***/
+
+bool
+apply(std::istream& basis, std::istream& patch, std::ostream& out, std::string& error)
+{
+    char magic[sizeof(PATCH_MAGIC)];
+    uint32_t version {};
+    uint32_t block_size {};
+    uint64_t basis_size {};
+    uint64_t target_size {};
+    uint64_t target_digest {};
+
+    if (!patch.read(magic, sizeof(magic)) || memcmp(magic, PATCH_MAGIC, sizeof(magic)))
+    {
+        error = "not a keeper delta";
+        return false;
+    }
+    if (!get(patch, version) || (version != FORMAT_VERSION))
+    {
+        error = "unsupported delta version";
+        return false;
+    }
+    if (!get(patch, block_size) || !block_size || !get(patch, basis_size)
+            || !get(patch, target_size) || !get(patch, target_digest))
+    {
+        error = "truncated delta header";
+        return false;
+    }
+
+    // confirm the basis is the size that the patch expects
+    basis.seekg(0, std::ios::end);
+    if (uint64_t(basis.tellg()) != basis_size)
+    {
+        error = "basis file size mismatch";
+        return false;
+    }
+
+    Digest digest;
+    uint64_t n_written {};
+    std::vector<char> buf(READ_CHUNK);
+
+    auto emit = [&](char const* data, size_t len)
+    {
+        out.write(data, std::streamsize(len));
+        digest.update(data, len);
+        n_written += len;
+    };
+
+    for (;;)
+    {
+        uint8_t op {};
+        if (!get(patch, op))
+        {
+            error = "truncated delta";
+            return false;
+        }
+
+        if (op == OP_END)
+            break;
+
+        if (op == OP_COPY)
+        {
+            uint64_t block_index {};
+            uint32_t n_blocks {};
+            if (!get(patch, block_index) || !get(patch, n_blocks))
+            {
+                error = "truncated copy instruction";
+                return false;
+            }
+            auto const begin = block_index * block_size;
+            auto const end = std::min(basis_size, begin + uint64_t(n_blocks)*block_size);
+            if (begin >= end)
+            {
+                error = "copy instruction out of range";
+                return false;
+            }
+            basis.clear();
+            basis.seekg(std::streamoff(begin));
+            for (auto n_left = end - begin; n_left > 0; )
+            {
+                auto const n = std::min(uint64_t(buf.size()), n_left);
+                if (!basis.read(buf.data(), std::streamsize(n)))
+                {
+                    error = "error reading basis file";
+                    return false;
+                }
+                emit(buf.data(), size_t(n));
+                n_left -= n;
+            }
+        }
+        else if (op == OP_LITERAL)
+        {
+            uint32_t len {};
+            if (!get(patch, len))
+            {
+                error = "truncated literal instruction";
+                return false;
+            }
+            for (auto n_left = size_t(len); n_left > 0; )
+            {
+                auto const n = std::min(buf.size(), n_left);
+                if (!patch.read(buf.data(), std::streamsize(n)))
+                {
+                    error = "truncated literal data";
+                    return false;
+                }
+                emit(buf.data(), n);
+                n_left -= n;
+            }
+        }
+        else
+        {
+            error = "unknown delta instruction";
+            return false;
+        }
+    }
+
+    if (!out)
+    {
+        error = "error writing output";
+        return false;
+    }
+    if ((n_written != target_size) || (digest.value() != target_digest))
+    {
+        error = "patched file does not match the original";
+        return false;
+    }
+
+    return true;
+}
+
+} // namespace Delta
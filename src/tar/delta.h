@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#pragma once
+
+#include <cstddef> // size_t
+#include <cstdint> // uint32_t, uint64_t
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+/**
+ * rsync-style delta encoding.
+ *
+ * A Signature describes a basis file as a list of fixed-size blocks,
+ * each with a weak rolling checksum and a strong XXH64 hash.
+ * encode() walks the new version of the file, rolling the weak checksum
+ * one byte at a time to find blocks that the basis already has, and
+ * writes a patch made of COPY (block range from the basis) and LITERAL
+ * (new bytes) instructions. apply() rebuilds the new version from the
+ * basis and the patch, and verifies the result's size and digest.
+ */
+namespace Delta
+{
+
+// archive members holding a patch are named "<path>" + SUFFIX
+extern char const * const SUFFIX;
+
+bool is_delta_name(std::string const& name);
+
+// the path of the file that a member restores
+std::string target_name(std::string const& name);
+
+struct BlockSignature
+{
+    uint32_t weak {};
+    uint64_t strong {};
+};
+
+struct Signature
+{
+    uint32_t block_size {};
+    uint64_t file_size {};
+    std::vector<BlockSignature> blocks;
+
+    bool serialize(std::ostream& out) const;
+    bool parse(std::istream& in);
+};
+
+class SignatureBuilder
+{
+public:
+    explicit SignatureBuilder(uint32_t block_size);
+
+    void update(char const* data, size_t len);
+    Signature finish();
+
+private:
+    void add_block(char const* data, size_t len);
+
+    Signature sig_;
+    std::vector<char> pending_;
+};
+
+uint32_t choose_block_size(uint64_t file_size);
+
+uint32_t weak_checksum(char const* data, size_t len);
+
+Signature make_signature(std::istream& in, uint32_t block_size);
+
+/**
+ * Writes a patch that turns the basis described by `basis` into `target`.
+ * If `next` is provided, it is fed the target too so that the signature
+ * for the next backup can be built without a second pass over the file.
+ * Returns the number of literal bytes in the patch, or -1 on error.
+ */
+int64_t encode(Signature const& basis,
+               std::istream& target,
+               std::ostream& patch,
+               SignatureBuilder* next = nullptr);
+
+/**
+ * Rebuilds the target into `out` by applying `patch` to the seekable `basis`.
+ * On failure, returns false and sets `error`.
+ */
+bool apply(std::istream& basis, std::istream& patch, std::ostream& out, std::string& error);
+
+} // namespace Delta
@@ -0,0 +1,200 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "tar/digest.h"
+
+#include <cstring> // memcpy()
+
+/**
+ * The XXH64 algorithm is by Yann Collet and is
+ * described at https://github.com/Cyan4973/xxHash
+ */
+
+namespace
+{
+
+constexpr uint64_t PRIME1 {11400714785074694791ULL};
+constexpr uint64_t PRIME2 {14029467366897019727ULL};
+constexpr uint64_t PRIME3 {1609587929392839161ULL};
+constexpr uint64_t PRIME4 {9650029242287828579ULL};
+constexpr uint64_t PRIME5 {2870177450012600261ULL};
+
+inline uint64_t rotl(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t read64(unsigned char const* p)
+{
+    uint64_t val {};
+    for (int i=7; i>=0; --i)
+        val = (val << 8) | p[i];
+    return val;
+}
+
+inline uint32_t read32(unsigned char const* p)
+{
+    return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+}
+
+inline uint64_t round(uint64_t acc, uint64_t input)
+{
+    acc += input * PRIME2;
+    acc = rotl(acc, 31);
+    acc *= PRIME1;
+    return acc;
+}
+
+inline uint64_t merge_round(uint64_t acc, uint64_t val)
+{
+    val = round(0, val);
+    acc ^= val;
+    acc = acc * PRIME1 + PRIME4;
+    return acc;
+}
+
+} // anonymous namespace
+
+Digest::Digest(uint64_t seed)
+    : seed_{seed}
+    , v1_{seed + PRIME1 + PRIME2}
+    , v2_{seed + PRIME2}
+    , v3_{seed}
+    , v4_{seed - PRIME1}
+{
+}
+
+void
+Digest::update(void const* vdata, size_t len)
+{
+    auto p = static_cast<unsigned char const*>(vdata);
+    auto const end = p + len;
+
+    total_len_ += len;
+
+    // not enough for a full stripe yet; just buffer it
+    if (memsize_ + len < sizeof(mem_))
+    {
+        memcpy(mem_ + memsize_, p, len);
+        memsize_ += len;
+        return;
+    }
+
+    // finish the buffered stripe
+    if (memsize_ > 0)
+    {
+        auto const n = sizeof(mem_) - memsize_;
+        memcpy(mem_ + memsize_, p, n);
+        v1_ = round(v1_, read64(mem_));
+        v2_ = round(v2_, read64(mem_+8));
+        v3_ = round(v3_, read64(mem_+16));
+        v4_ = round(v4_, read64(mem_+24));
+        p += n;
+        memsize_ = 0;
+    }
+
+    // process full stripes straight from the input
+    while (p + 32 <= end)
+    {
+        v1_ = round(v1_, read64(p));
+        v2_ = round(v2_, read64(p+8));
+        v3_ = round(v3_, read64(p+16));
+        v4_ = round(v4_, read64(p+24));
+        p += 32;
+    }
+
+    // buffer the leftovers
+    memsize_ = size_t(end - p);
+    memcpy(mem_, p, memsize_);
+}
+
+uint64_t
+Digest::value() const
+{
+    uint64_t h64;
+
+    if (total_len_ >= 32)
+    {
+        h64 = rotl(v1_, 1) + rotl(v2_, 7) + rotl(v3_, 12) + rotl(v4_, 18);
+        h64 = merge_round(h64, v1_);
+        h64 = merge_round(h64, v2_);
+        h64 = merge_round(h64, v3_);
+        h64 = merge_round(h64, v4_);
+    }
+    else
+    {
+        h64 = seed_ + PRIME5;
+    }
+
+    h64 += total_len_;
+
+    auto p = mem_;
+    auto const end = mem_ + memsize_;
+
+    while (p + 8 <= end)
+    {
+        h64 ^= round(0, read64(p));
+        h64 = rotl(h64, 27) * PRIME1 + PRIME4;
+        p += 8;
+    }
+
+    if (p + 4 <= end)
+    {
+        h64 ^= uint64_t(read32(p)) * PRIME1;
+        h64 = rotl(h64, 23) * PRIME2 + PRIME3;
+        p += 4;
+    }
+
+    while (p < end)
+    {
+        h64 ^= (*p) * PRIME5;
+        h64 = rotl(h64, 11) * PRIME1;
+        ++p;
+    }
+
+    h64 ^= h64 >> 33;
+    h64 *= PRIME2;
+    h64 ^= h64 >> 29;
+    h64 *= PRIME3;
+    h64 ^= h64 >> 32;
+
+    return h64;
+}
+
+uint64_t
+Digest::of(void const* data, size_t len, uint64_t seed)
+{
+    Digest digest{seed};
+    digest.update(data, len);
+    return digest.value();
+}
+
+std::string
+Digest::to_hex(uint64_t value)
+{
+    static constexpr char const digits[] = "0123456789abcdef";
+
+    std::string ret(16, '0');
+    for (int i=15; i>=0; --i)
+    {
+        ret[size_t(i)] = digits[value & 0xF];
+        value >>= 4;
+    }
+    return ret;
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#pragma once
+
+#include <cstddef> // size_t
+#include <cstdint> // uint64_t
+#include <string>
+
+/**
+ * Streaming XXH64 hash.
+ *
+ * This is a fast non-cryptographic hash, suitable for
+ * detecting changed data but not for authentication.
+ */
+class Digest
+{
+public:
+    explicit Digest(uint64_t seed=0);
+
+    void update(void const* data, size_t len);
+    uint64_t value() const;
+
+    static uint64_t of(void const* data, size_t len, uint64_t seed=0);
+    static std::string to_hex(uint64_t value);
+
+private:
+    uint64_t seed_ {};
+    uint64_t v1_ {};
+    uint64_t v2_ {};
+    uint64_t v3_ {};
+    uint64_t v4_ {};
+    uint64_t total_len_ {};
+    unsigned char mem_[32] {};
+    size_t memsize_ {};
+};
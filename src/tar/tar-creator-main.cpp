@@ -18,6 +18,7 @@
  */
 
 #include "tar/tar-creator.h"
+#include "tar/tar-index.h"
 #include "qdbus-stubs/dbus-types.h"
 #include "qdbus-stubs/keeper_helper_interface.h"
 
@@ -27,6 +28,7 @@
 #include <QDBusConnection>
 #include <QDBusConnectionInterface>
 #include <QDBusUnixFileDescriptor>
+#include <QElapsedTimer>
 #include <QFile>
 #include <QLocalSocket>
 
@@ -36,6 +38,8 @@
 #include <cstdio> // fileno()
 #include <ctime>
 #include <iostream>
+#include <memory>
+#include <sstream>
 #include <type_traits>
 
 namespace
@@ -72,7 +76,17 @@ get_filenames_from_file(FILE * fp)
     return filenames;
 }
 
-std::tuple<bool,QString,QStringList>
+struct Options
+{
+    bool compress {};
+    bool direct {};
+    QString bus_path;
+    QString signatures_dir;
+    qint64 delta_min_size {};
+    QStringList filenames;
+};
+
+Options
 parse_args(QCoreApplication& app)
 {
     // parse the command line
@@ -101,41 +115,67 @@ parse_args(QCoreApplication& app)
         QStringLiteral("bus-path")
     };
     parser.addOption(bus_path_option);
+    QCommandLineOption signatures_dir_option{
+        QStringList() << "s" << "signatures-dir",
+        QStringLiteral("Archive large files as deltas against the signatures saved here by the previous backup. Ignored with --compress"),
+        QStringLiteral("dir")
+    };
+    parser.addOption(signatures_dir_option);
+    QCommandLineOption delta_min_size_option{
+        QStringList() << "delta-min-size",
+        QStringLiteral("Smallest file, in bytes, to archive as a delta [default: 8 MiB]"),
+        QStringLiteral("bytes"),
+        QString::number(8*1024*1024)
+    };
+    parser.addOption(delta_min_size_option);
+    QCommandLineOption direct_option{
+        QStringList() << "d" << "direct",
+        QStringLiteral("Write straight to the storage socket instead of relaying through Keeper")
+    };
+    parser.addOption(direct_option);
     parser.process(app);
-    const bool compress = parser.isSet(compress_option);
-    const auto bus_path = parser.value(bus_path_option);
+
+    Options options;
+    options.compress = parser.isSet(compress_option);
+    options.direct = parser.isSet(direct_option);
+    options.bus_path = parser.value(bus_path_option);
+    options.signatures_dir = parser.value(signatures_dir_option);
+    options.delta_min_size = parser.value(delta_min_size_option).toLongLong();
+
+    // keeper-untar finds the deltas by reading the uncompressed archive
+    if (options.compress && !options.signatures_dir.isEmpty()) {
+        qWarning() << "Deltas can't be used in compressed archives; archiving files in full";
+        options.signatures_dir.clear();
+    }
 
     // gotta have the bus path
-    if (bus_path.isEmpty()) {
+    if (options.bus_path.isEmpty()) {
         std::cerr << "Missing required argument: --bus-path" << std::endl;
         parser.showHelp(EXIT_FAILURE);
     }
 
     // gotta have files
-    const auto filenames = get_filenames_from_file(stdin);
-    for (const auto& filename : filenames)
+    options.filenames = get_filenames_from_file(stdin);
+    for (const auto& filename : options.filenames)
         qDebug() << "filename:" << filename;
 
-    return std::make_tuple(compress, bus_path, filenames);
+    return options;
 }
 
 QDBusUnixFileDescriptor
-get_socket_from_keeper(size_t n_bytes, const QString& bus_path)
+get_socket_from_keeper(size_t n_bytes, DBusInterfaceKeeperHelper& helperInterface, bool direct)
 {
     QDBusUnixFileDescriptor ret;
 
     qDebug() << "asking keeper for a socket";
-    DBusInterfaceKeeperHelper helperInterface(
-        DBusTypes::KEEPER_SERVICE,
-        bus_path,
-        QDBusConnection::sessionBus()
-    );
-    auto fd_reply = helperInterface.StartBackup(n_bytes);
+    auto fd_reply = direct
+        ? helperInterface.StartBackupDirect(n_bytes)
+        : helperInterface.StartBackup(n_bytes);
     fd_reply.waitForFinished();
     if (fd_reply.isError()) {
         qCritical("Call to '%s.StartBackup() at '%s' call failed: %s",
             DBusTypes::KEEPER_SERVICE,
-            qPrintable(bus_path),
+            qPrintable(helperInterface.path()),
             qPrintable(fd_reply.error().message())
         );
     } else {
@@ -145,8 +185,48 @@ get_socket_from_keeper(size_t n_bytes, const QString& bus_path)
     return ret;
 }
 
+// when writing straight to storage, Keeper relies on us for progress and the catalog
+class DirectReporter
+{
+public:
+    explicit DirectReporter(DBusInterfaceKeeperHelper& helperInterface)
+        : helperInterface_(helperInterface)
+    {
+        timer_.start();
+    }
+
+    void sent(char const* data, size_t n_bytes)
+    {
+        indexer_.feed(data, n_bytes);
+        n_sent_ += n_bytes;
+
+        static constexpr qint64 REPORT_INTERVAL_MSEC {250};
+        if (timer_.elapsed() >= REPORT_INTERVAL_MSEC) {
+            helperInterface_.UpdateBackupProgress(n_sent_); // no need to wait for a reply
+            timer_.restart();
+        }
+    }
+
+    // wait for these replies, so that Keeper has them before we exit
+    void finish()
+    {
+        std::ostringstream out;
+        if (indexer_.is_tar() && indexer_.finished())
+            TarIndexer::write_catalog(out, indexer_.entries());
+        auto const catalog = out.str();
+        helperInterface_.SetBackupCatalog(QByteArray(catalog.data(), int(catalog.size()))).waitForFinished();
+        helperInterface_.UpdateBackupProgress(n_sent_).waitForFinished();
+    }
+
+private:
+    DBusInterfaceKeeperHelper& helperInterface_;
+    TarIndexer indexer_;
+    quint64 n_sent_ {};
+    QElapsedTimer timer_;
+};
+
 ssize_t
-send_tar_to_keeper(TarCreator& tar_creator, int fd)
+send_tar_to_keeper(TarCreator& tar_creator, int fd, DirectReporter* reporter)
 {
     ssize_t n_sent {};
 
@@ -169,8 +249,13 @@ send_tar_to_keeper(TarCreator& tar_creator, int fd)
                 return -1;
             }
         }
+        if (reporter)
+            reporter->sent(buf.data(), buf.size());
     }
 
+    if (reporter)
+        reporter->finish();
+
     return n_sent;
 }
 
@@ -182,13 +267,13 @@ main(int argc, char **argv)
     QCoreApplication app(argc, argv);
 
     // get the inputs
-    bool compress;
-    QString bus_path;
-    QStringList filenames;
-    std::tie(compress, bus_path, filenames) = parse_args(app);
+    const auto options = parse_args(app);
+    const auto& bus_path = options.bus_path;
 
     // build the creator
-    TarCreator tar_creator{filenames, compress};
+    TarCreator tar_creator{options.filenames, options.compress};
+    if (!options.signatures_dir.isEmpty())
+        tar_creator.enable_delta(options.signatures_dir, options.delta_min_size);
     const auto n_bytes_in = tar_creator.calculate_size();
     if (n_bytes_in < 0) {
         qCritical("Unable to estimate tar size");
@@ -198,13 +283,21 @@ main(int argc, char **argv)
     qDebug() << "tar size should be" << n_bytes;
 
     // do it!
-    const auto qfd = get_socket_from_keeper(n_bytes, bus_path);
+    DBusInterfaceKeeperHelper helperInterface(
+        DBusTypes::KEEPER_SERVICE,
+        bus_path,
+        QDBusConnection::sessionBus()
+    );
+    const auto qfd = get_socket_from_keeper(n_bytes, helperInterface, options.direct);
     if (!qfd.isValid()) {
         qCritical() << "Can't proceed without a socket from keeper";
         return EXIT_FAILURE;
     }
     const auto fd = qfd.fileDescriptor();
-    const auto n_sent = send_tar_to_keeper(tar_creator, fd);
+    std::unique_ptr<DirectReporter> reporter;
+    if (options.direct)
+        reporter.reset(new DirectReporter(helperInterface));
+    const auto n_sent = send_tar_to_keeper(tar_creator, fd, reporter.get());
     qDebug() << "tar size was" << n_sent;
 
     return EXIT_SUCCESS;
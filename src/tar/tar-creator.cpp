@@ -30,17 +30,43 @@
 #define _FILE_OFFSET_BITS 64
 
 #include "tar/tar-creator.h"
+#include "tar/delta.h"
+#include "tar/digest.h"
 
 #include <archive.h>
 #include <archive_entry.h>
 
 #include <QDebug>
+#include <QDir>
 #include <QFile>
+#include <QFileInfo>
 #include <QSharedPointer>
+#include <QStandardPaths>
 #include <QString>
+#include <QTemporaryFile>
 
+#include <cerrno>
+#include <cstdio> // std::rename()
+#include <cstring> // strerror()
+#include <fstream>
 #include <memory>
 
+namespace
+{
+
+// each source dir gets its own pending set, so that
+// backups of different folders can't drop each other's
+QString
+pending_signatures_dir(QString const& signatures_dir, QString const& source_dir)
+{
+    const QFileInfo info(source_dir);
+    const auto key = (info.exists() ? info.canonicalFilePath() : info.absoluteFilePath()).toUtf8();
+    return QDir(signatures_dir).filePath(QStringLiteral("pending/")
+        + QString::fromStdString(Digest::to_hex(Digest::of(key.constData(), size_t(key.size())))));
+}
+
+} // anonymous namespace
+
 class TarCreator::Impl
 {
 public:
@@ -55,8 +81,20 @@ public:
     {
     }
 
+    void enable_delta(QString const& signatures_dir, qint64 min_size)
+    {
+        signatures_dir_ = signatures_dir;
+        delta_min_size_ = min_size;
+    }
+
+    void set_base_dir(QString const& dir)
+    {
+        base_dir_ = dir;
+    }
+
     ssize_t calculate_size() const
     {
+        prepare();
         return compress_ ? calculate_compressed_size() : calculate_uncompressed_size();
     }
 
@@ -68,6 +106,8 @@ public:
         // if this is the first step, create an archive
         if (!step_archive_)
         {
+            prepare();
+
             step_archive_.reset(archive_write_new(), [](struct archive* a){archive_write_free(a);});
             archive_write_set_format_pax(step_archive_.get());
             if (compress_)
@@ -81,23 +121,24 @@ public:
         // if we don't have a file we're working on, then get one
         if (!step_file_)
         {
-            if (step_filenum_ >= filenames_.size()) // tried to read past the end
+            const auto n_members = int(members_.size());
+            if (step_filenum_ >= n_members) // tried to read past the end
             {
                 success = false;
             }
             // step to next file
-            else if (++step_filenum_ == filenames_.size()) // we made it to the end!
+            else if (++step_filenum_ == n_members) // we made it to the end!
             {
                 archive_write_close(step_archive_.get());
             }
             else
             {
                 // write the file's header
-                const auto& filename = filenames_[step_filenum_];
-                add_file_header_to_archive(step_archive_.get(), filename);
+                const auto& member = members_[size_t(step_filenum_)];
+                add_file_header_to_archive(step_archive_.get(), member);
 
                 // prep it for reading
-                step_file_.reset(new QFile(filename));
+                step_file_.reset(new QFile(member.data_path));
                 step_file_->open(QIODevice::ReadOnly);
             }
         }
@@ -171,16 +212,120 @@ private:
         return ssize_t(len);
     }
 
+    struct Member
+    {
+        QString filename;     // the file being backed up
+        QString archive_name; // its name inside the archive
+        QString source_path;  // where to find it on disk
+        QString data_path;    // where to read its archived contents from
+        qint64 size {-1};     // if >= 0, overrides the size from stat()
+    };
+
+    /***
+    ****  Delta
+    ***/
+
+    // decide how each file will be archived
+    void prepare() const
+    {
+        if (prepared_)
+            return;
+        prepared_ = true;
+
+        // the last run's leftovers were never stored, so they mustn't become a basis
+        if (!signatures_dir_.isEmpty())
+        {
+            pending_dir_ = pending_signatures_dir(signatures_dir_, base_dir_.isEmpty() ? QDir::currentPath() : base_dir_);
+            QDir(pending_dir_).removeRecursively();
+        }
+
+        members_.clear();
+        members_.reserve(size_t(filenames_.size()));
+        for (const auto& filename : filenames_)
+        {
+            const auto source_path = base_dir_.isEmpty() ? filename : QDir(base_dir_).filePath(filename);
+            Member member {filename, filename, source_path, source_path, -1};
+            if (!signatures_dir_.isEmpty())
+                prepare_delta(member);
+            members_.push_back(member);
+        }
+    }
+
+    void prepare_delta(Member& member) const
+    {
+        const QFileInfo info(member.source_path);
+        if (!info.isFile() || (info.size() < delta_min_size_))
+            return;
+
+        // key the signature on the file's absolute path
+        const auto key = info.absoluteFilePath().toUtf8();
+        const auto sig_path = QDir(signatures_dir_).filePath(
+            QString::fromStdString(Digest::to_hex(Digest::of(key.constData(), size_t(key.size())))) + QStringLiteral(".sig"));
+        const auto pending_path = QDir(pending_dir_).filePath(QFileInfo(sig_path).fileName());
+
+        const auto filename_str = member.source_path.toStdString();
+        std::ifstream target(filename_str, std::ios::binary);
+        if (!target)
+            return;
+
+        const auto block_size = Delta::choose_block_size(uint64_t(info.size()));
+
+        // if there's no previous version to diff against, just remember this one
+        Delta::Signature basis;
+        std::ifstream basis_in(sig_path.toStdString(), std::ios::binary);
+        QSharedPointer<QTemporaryFile> patch_file(new QTemporaryFile(
+            QDir(QDir::tempPath()).filePath(QStringLiteral("keeper-delta-XXXXXX"))));
+        if (!basis_in || !basis.parse(basis_in) || !patch_file->open())
+        {
+            save_signature(Delta::make_signature(target, block_size), pending_path);
+            return;
+        }
+
+        // build the patch and the next signature in a single pass
+        Delta::SignatureBuilder next{block_size};
+        std::ofstream patch(patch_file->fileName().toStdString(), std::ios::binary|std::ios::trunc);
+        const auto n_literal = Delta::encode(basis, target, patch, &next);
+        patch.close();
+        const auto patch_size = patch_file->size();
+
+        // only use the patch if it's actually smaller than the file
+        if ((n_literal >= 0) && !patch.fail() && (patch_size < info.size()))
+        {
+            qDebug() << "archiving" << member.filename << "as a" << patch_size << "byte delta";
+            member.archive_name = member.filename + QString::fromUtf8(Delta::SUFFIX);
+            member.data_path = patch_file->fileName();
+            member.size = patch_size;
+            patches_.push_back(patch_file);
+        }
+
+        save_signature(next.finish(), pending_path);
+    }
+
+    void save_signature(Delta::Signature const& sig, QString const& pending_path) const
+    {
+        QDir().mkpath(pending_dir_);
+
+        std::ofstream out(pending_path.toStdString(), std::ios::binary|std::ios::trunc);
+        if (!sig.serialize(out) || (out.flush(), !out.good()))
+            qWarning() << "Unable to save delta signature" << pending_path;
+    }
+
+    /***
+    ****
+    ***/
+
     static void add_file_header_to_archive(struct archive* archive,
-                                           const QString& filename)
+                                           const Member& member)
     {
+        const auto& filename = member.filename;
         struct stat st;
-        const auto filename_utf8 = filename.toUtf8();
-        stat(filename_utf8.constData(), &st);
+        stat(member.source_path.toUtf8().constData(), &st);
 
         auto entry = archive_entry_new();
         archive_entry_copy_stat(entry, &st);
-        archive_entry_set_pathname(entry, filename_utf8.constData());
+        archive_entry_set_pathname(entry, member.archive_name.toUtf8().constData());
+        if (member.size >= 0)
+            archive_entry_set_size(entry, member.size);
 
         int ret;
         do {
@@ -208,9 +353,9 @@ private:
         archive_write_set_format_pax(a);
         archive_write_open(a, &archive_size, nullptr, count_bytes_write_cb, nullptr);
 
-        for (const auto& filename : filenames_)
+        for (const auto& member : members_)
         {
-            add_file_header_to_archive(a, filename);
+            add_file_header_to_archive(a, member);
 
             // libarchive pads any missing data,
             // so we don't need to call archive_write_data()
@@ -230,12 +375,12 @@ private:
         archive_write_add_filter_xz(a);
         archive_write_open(a, &archive_size, nullptr, count_bytes_write_cb, nullptr);
 
-        for (const auto& filename : filenames_)
+        for (const auto& member : members_)
         {
-            add_file_header_to_archive(a, filename);
+            add_file_header_to_archive(a, member);
 
             // process the file
-            QFile file(filename);
+            QFile file(member.data_path);
             file.open(QIODevice::ReadOnly);
             static constexpr int BUFSIZE {4096};
             char buf[BUFSIZE];
@@ -264,6 +409,14 @@ private:
     const QStringList filenames_;
     const bool compress_ {};
 
+    QString base_dir_;
+    QString signatures_dir_;
+    qint64 delta_min_size_ {};
+    mutable bool prepared_ {};
+    mutable std::vector<Member> members_;
+    mutable std::vector<QSharedPointer<QTemporaryFile>> patches_;
+    mutable QString pending_dir_; // where this run's signatures wait to be committed
+
     std::shared_ptr<struct archive> step_archive_;
     int step_filenum_ {-1};
     QSharedPointer<QFile> step_file_;
@@ -281,6 +434,55 @@ TarCreator::TarCreator(const QStringList& filenames, bool compress)
 
 TarCreator::~TarCreator() =default;
 
+void
+TarCreator::enable_delta(QString const& signatures_dir, qint64 min_size)
+{
+    impl_->enable_delta(signatures_dir, min_size);
+}
+
+bool
+TarCreator::commit_signatures(QString const& signatures_dir, QString const& source_dir)
+{
+    QDir pending(pending_signatures_dir(signatures_dir, source_dir));
+    if (!pending.exists())
+        return true;
+
+    bool success = true;
+    const QDir dir(signatures_dir);
+    for (const auto& name : pending.entryList(QDir::Files))
+    {
+        const auto from = pending.filePath(name);
+        const auto to = dir.filePath(name);
+        if (std::rename(from.toUtf8().constData(), to.toUtf8().constData()) != 0)
+        {
+            qWarning() << "Unable to rename" << from << "to" << to << strerror(errno);
+            success = false;
+        }
+    }
+    pending.removeRecursively();
+    return success;
+}
+
+void
+TarCreator::discard_signatures(QString const& signatures_dir, QString const& source_dir)
+{
+    QDir(pending_signatures_dir(signatures_dir, source_dir)).removeRecursively();
+}
+
+QString
+TarCreator::default_signatures_dir()
+{
+    // keep in sync with folder-backup.sh
+    auto const dir = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation);
+    return QDir(dir).filePath(QStringLiteral("keeper/signatures"));
+}
+
+void
+TarCreator::set_base_dir(QString const& dir)
+{
+    impl_->set_base_dir(dir);
+}
+
 ssize_t
 TarCreator::calculate_size() const
 {
@@ -32,6 +32,37 @@ public:
     TarCreator(const QStringList& files, bool compress);
     ~TarCreator();
 
+    /**
+     * Enables delta mode: regular files of at least `min_size` bytes that
+     * have a signature in `signatures_dir` from a previous run are archived
+     * as "<path>.keeper-delta" patches instead of in full.
+     *
+     * Signatures for the next run are kept pending until the backup has
+     * been stored and commit_signatures() is called. Whatever is still
+     * pending from an earlier run is discarded, so deltas are only ever
+     * made against a backup that was stored.
+     * This must be called before calculate_size() or step().
+     */
+    void enable_delta(QString const& signatures_dir, qint64 min_size);
+
+    /**
+     * Makes the signatures that a backup of `source_dir` left pending
+     * the basis for the next backup's deltas.
+     */
+    static bool commit_signatures(QString const& signatures_dir, QString const& source_dir);
+
+    // drops the signatures that a backup of `source_dir` left pending
+    static void discard_signatures(QString const& signatures_dir, QString const& source_dir);
+
+    // where keeper's folder backups keep their signatures
+    static QString default_signatures_dir();
+
+    /**
+     * Reads the files relative to `dir` instead of the current directory.
+     * The names stored in the archive are unchanged.
+     */
+    void set_base_dir(QString const& dir);
+
     ssize_t calculate_size() const;
     bool step(std::vector<char>& fillme);
 
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "tar/tar-filter.h"
+
+#include <algorithm> // std::min()
+
+TarFilter::TarFilter(Predicate const& keep)
+    : keep_{keep}
+{
+}
+
+void
+TarFilter::feed(char const* data, size_t len, std::string& out)
+{
+    if (done_)
+        return;
+
+    held_.append(data, len);
+    indexer_.feed(data, len);
+
+    if (!indexer_.is_tar())
+    {
+        out += held_;
+        pos_ += held_.size();
+        held_.clear();
+        return;
+    }
+
+    // pass through or drop each member whose header has been parsed
+    auto const& entries = indexer_.entries();
+    while (n_decided_ < entries.size())
+    {
+        auto const& entry = entries[n_decided_];
+
+        // drop anything between members, eg a stray zero block
+        if (pos_ < entry.start_offset)
+        {
+            auto const n = size_t(std::min(uint64_t(held_.size()), entry.start_offset - pos_));
+            held_.erase(0, n);
+            pos_ += n;
+            if (pos_ < entry.start_offset)
+                break;
+        }
+
+        if (!have_decision_)
+        {
+            keep_current_ = keep_(entry);
+            have_decision_ = true;
+        }
+
+        auto const n = size_t(std::min(uint64_t(held_.size()), entry.end_offset - pos_));
+        if (keep_current_)
+            out.append(held_, 0, n);
+        held_.erase(0, n);
+        pos_ += n;
+
+        if (pos_ < entry.end_offset) // wait for the rest of it
+            break;
+        ++n_decided_;
+        have_decision_ = false;
+    }
+
+    // replace the end-of-archive marker and any padding with a bare marker
+    if (indexer_.finished() && (n_decided_ == entries.size()))
+    {
+        out.append(END_SIZE, '\0');
+        held_.clear();
+        done_ = true;
+    }
+}
+
+uint64_t
+TarFilter::filtered_size(std::vector<TarIndexer::Entry> const& kept)
+{
+    uint64_t n_bytes {END_SIZE};
+    for (auto const& entry : kept)
+        n_bytes += entry.end_offset - entry.start_offset;
+    return n_bytes;
+}
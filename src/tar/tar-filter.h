@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#pragma once
+
+#include "tar/tar-index.h"
+
+#include <cstddef> // size_t
+#include <cstdint> // uint64_t
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+ * Drops members from an uncompressed tar stream as it goes by.
+ *
+ * Each member (along with any extended headers that describe it) is
+ * passed through only if `keep` returns true for it. The output is a
+ * valid tar ending with a bare end-of-archive marker, so its size is
+ * the sum of the kept members' sizes plus END_SIZE.
+ *
+ * Streams that aren't uncompressed tars are passed through unchanged.
+ */
+class TarFilter
+{
+public:
+    using Predicate = std::function<bool(TarIndexer::Entry const&)>;
+
+    explicit TarFilter(Predicate const& keep);
+
+    // appends the bytes that should be passed through to `out`
+    void feed(char const* data, size_t len, std::string& out);
+
+    static constexpr size_t END_SIZE {TarIndexer::BLOCK_SIZE*2};
+
+    // the size of the filtered stream
+    static uint64_t filtered_size(std::vector<TarIndexer::Entry> const& kept);
+
+private:
+    Predicate keep_;
+    TarIndexer indexer_;
+    std::string held_;      // bytes whose member hasn't been identified yet
+    uint64_t pos_ {};       // stream offset of held_'s first byte
+    size_t n_decided_ {};   // how many of indexer_'s entries are fully handled
+    bool have_decision_ {}; // whether keep_ has been asked about the current entry
+    bool keep_current_ {};
+    bool done_ {};
+};
@@ -0,0 +1,461 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "tar/tar-index.h"
+
+#include <algorithm> // std::min()
+#include <cstdlib> // strtoll()
+#include <cstring> // memcmp(), strnlen()
+#include <istream>
+#include <ostream>
+
+namespace
+{
+
+// field offsets & sizes in a ustar header
+constexpr size_t NAME_OFFSET {0};
+constexpr size_t NAME_SIZE {100};
+constexpr size_t MODE_OFFSET {100};
+constexpr size_t MODE_SIZE {8};
+constexpr size_t SIZE_OFFSET {124};
+constexpr size_t SIZE_SIZE {12};
+constexpr size_t MTIME_OFFSET {136};
+constexpr size_t MTIME_SIZE {12};
+constexpr size_t CHKSUM_OFFSET {148};
+constexpr size_t CHKSUM_SIZE {8};
+constexpr size_t TYPE_OFFSET {156};
+constexpr size_t MAGIC_OFFSET {257};
+constexpr size_t PREFIX_OFFSET {345};
+constexpr size_t PREFIX_SIZE {155};
+
+constexpr char CATALOG_MAGIC[4] = {'K','C','A','T'};
+constexpr uint32_t CATALOG_VERSION {2}; // 2: added digests
+
+// sanity limit when reading a catalog
+constexpr uint32_t MAX_PATH_LEN {64*1024};
+
+uint64_t parse_number(char const* field, size_t len)
+{
+    auto const bytes = reinterpret_cast<unsigned char const*>(field);
+
+    // base-256, used by GNU tar & libarchive for values that don't fit in octal
+    if (bytes[0] & 0x80)
+    {
+        uint64_t val = bytes[0] & 0x3F;
+        for (size_t i=1; i<len; ++i)
+            val = (val << 8) | bytes[i];
+        return val;
+    }
+
+    uint64_t val {};
+    size_t i {};
+    while ((i < len) && (field[i] == ' '))
+        ++i;
+    for (; (i < len) && (field[i] >= '0') && (field[i] <= '7'); ++i)
+        val = (val << 3) | uint64_t(field[i] - '0');
+    return val;
+}
+
+std::string parse_string(char const* field, size_t len)
+{
+    return std::string(field, strnlen(field, len));
+}
+
+bool is_zero_block(char const* block)
+{
+    for (size_t i=0; i<TarIndexer::BLOCK_SIZE; ++i)
+        if (block[i])
+            return false;
+    return true;
+}
+
+bool checksum_ok(char const* block)
+{
+    auto const expected = parse_number(block+CHKSUM_OFFSET, CHKSUM_SIZE);
+
+    // the checksum field itself is summed as if it were all spaces.
+    // some old tars summed signed chars, so accept either.
+    uint64_t unsigned_sum {};
+    int64_t signed_sum {};
+    for (size_t i=0; i<TarIndexer::BLOCK_SIZE; ++i)
+    {
+        auto const in_chksum = (i >= CHKSUM_OFFSET) && (i < CHKSUM_OFFSET+CHKSUM_SIZE);
+        auto const ch = in_chksum ? ' ' : block[i];
+        unsigned_sum += static_cast<unsigned char>(ch);
+        signed_sum += static_cast<signed char>(ch);
+    }
+
+    return (expected == unsigned_sum) || (int64_t(expected) == signed_sum);
+}
+
+template<typename T>
+void put(std::ostream& out, T val)
+{
+    char buf[sizeof(T)];
+    for (size_t i=0; i<sizeof(T); ++i)
+    {
+        buf[i] = char(val & 0xFF);
+        val = T(val >> 8);
+    }
+    out.write(buf, sizeof(buf));
+}
+
+template<typename T>
+bool get(std::istream& in, T& setme)
+{
+    unsigned char buf[sizeof(T)];
+    if (!in.read(reinterpret_cast<char*>(buf), sizeof(buf)))
+        return false;
+    T val {};
+    for (size_t i=sizeof(T); i>0; --i)
+        val = T((val << 8) | buf[i-1]);
+    setme = val;
+    return true;
+}
+
+} // anonymous namespace
+
+/***
+****
+***/
+
+uint64_t
+TarIndexer::padded(uint64_t size)
+{
+    return (size + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+}
+
+void
+TarIndexer::feed(char const* data, size_t len)
+{
+    while (len > 0)
+    {
+        size_t n {};
+
+        switch (state_)
+        {
+            case State::HEADER:
+                n = std::min(len, BLOCK_SIZE - block_.size());
+                block_.append(data, n);
+                offset_ += n;
+                if (block_.size() == BLOCK_SIZE)
+                {
+                    std::string block;
+                    block.swap(block_);
+                    process_header(block.data());
+                }
+                break;
+
+            case State::DATA:
+            {
+                n = size_t(std::min(uint64_t(len), bytes_left_));
+                auto const n_hash = size_t(std::min(uint64_t(n), digest_left_));
+                if (n_hash)
+                {
+                    digest_.update(data, n_hash);
+                    digest_left_ -= n_hash;
+                    if (!digest_left_)
+                        finish_digest();
+                }
+                offset_ += n;
+                bytes_left_ -= n;
+                if (!bytes_left_)
+                    state_ = State::HEADER;
+                break;
+            }
+
+            case State::EXTENDED_DATA:
+            {
+                n = size_t(std::min(uint64_t(len), bytes_left_));
+                auto const n_keep = size_t(std::min(uint64_t(n), data_left_));
+                extended_data_.append(data, n_keep);
+                data_left_ -= n_keep;
+                offset_ += n;
+                bytes_left_ -= n;
+                if (!bytes_left_)
+                {
+                    process_extended(extended_type_, extended_data_);
+                    extended_data_.clear();
+                    state_ = State::HEADER;
+                }
+                break;
+            }
+
+            case State::DONE:
+            case State::NOT_TAR:
+                n = len;
+                offset_ += n;
+                break;
+        }
+
+        data += n;
+        len -= n;
+    }
+}
+
+void
+TarIndexer::process_header(char const* block)
+{
+    auto const header_offset = offset_ - BLOCK_SIZE;
+
+    if (is_zero_block(block))
+    {
+        // two zero blocks in a row mark the end of the archive
+        if (++n_zero_blocks_ >= 2)
+        {
+            state_ = State::DONE;
+            archive_size_ = offset_;
+        }
+        return;
+    }
+    n_zero_blocks_ = 0;
+
+    if (!checksum_ok(block))
+    {
+        state_ = State::NOT_TAR;
+        return;
+    }
+
+    auto const type = block[TYPE_OFFSET];
+    auto const size = parse_number(block+SIZE_OFFSET, SIZE_SIZE);
+
+    // extended headers describe the entry that follows them
+    if ((type == 'x') || (type == 'g') || (type == 'L') || (type == 'K'))
+    {
+        if (!have_start_)
+        {
+            have_start_ = true;
+            pending_start_ = header_offset;
+        }
+        extended_type_ = type;
+        data_left_ = size;
+        bytes_left_ = padded(size);
+        if (bytes_left_)
+        {
+            state_ = State::EXTENDED_DATA;
+        }
+        else
+        {
+            process_extended(type, std::string());
+            state_ = State::HEADER;
+        }
+        return;
+    }
+
+    Entry entry;
+
+    entry.path = pending_path_;
+    if (entry.path.empty())
+    {
+        entry.path = parse_string(block+NAME_OFFSET, NAME_SIZE);
+
+        // the prefix field is only a prefix in POSIX ustar headers
+        static constexpr char const posix_magic[] = "ustar";
+        if (!memcmp(block+MAGIC_OFFSET, posix_magic, sizeof(posix_magic)))
+        {
+            auto const prefix = parse_string(block+PREFIX_OFFSET, PREFIX_SIZE);
+            if (!prefix.empty())
+                entry.path = prefix + '/' + entry.path;
+        }
+    }
+
+    entry.type = type ? type : '0';
+    entry.mode = uint32_t(parse_number(block+MODE_OFFSET, MODE_SIZE));
+    entry.mtime = have_pending_mtime_ ? pending_mtime_ : int64_t(parse_number(block+MTIME_OFFSET, MTIME_SIZE));
+    entry.size = have_pending_size_ ? pending_size_ : size;
+    entry.start_offset = have_start_ ? pending_start_ : header_offset;
+    entry.data_offset = offset_;
+    entry.end_offset = offset_ + padded(entry.size);
+    entries_.push_back(entry);
+
+    pending_path_.clear();
+    have_pending_size_ = false;
+    have_pending_mtime_ = false;
+    have_start_ = false;
+
+    digest_ = Digest();
+    digest_left_ = entry.size;
+    if (!digest_left_)
+        finish_digest();
+
+    bytes_left_ = padded(entry.size);
+    state_ = bytes_left_ ? State::DATA : State::HEADER;
+}
+
+void
+TarIndexer::finish_digest()
+{
+    auto& entry = entries_.back();
+    entry.digest = digest_.value();
+    entry.has_digest = true;
+}
+
+void
+TarIndexer::process_extended(char type, std::string const& data)
+{
+    if (type == 'L')
+    {
+        pending_path_ = data.substr(0, strnlen(data.c_str(), data.size()));
+        return;
+    }
+
+    if (type != 'x')
+        return;
+
+    // pax records look like "%d %s=%s\n" where %d is the record's length
+    size_t pos {};
+    while (pos < data.size())
+    {
+        auto const space = data.find(' ', pos);
+        if (space == std::string::npos)
+            break;
+        auto const record_len = size_t(strtoull(data.c_str()+pos, nullptr, 10));
+        if ((record_len == 0) || (pos + record_len > data.size()))
+            break;
+
+        auto const record = data.substr(space+1, pos + record_len - (space+1));
+        auto const equals = record.find('=');
+        if (equals != std::string::npos)
+        {
+            auto const key = record.substr(0, equals);
+            auto value = record.substr(equals+1);
+            if (!value.empty() && (value.back() == '\n'))
+                value.pop_back();
+
+            if (key == "path")
+            {
+                pending_path_ = value;
+            }
+            else if (key == "size")
+            {
+                pending_size_ = strtoull(value.c_str(), nullptr, 10);
+                have_pending_size_ = true;
+            }
+            else if (key == "mtime")
+            {
+                pending_mtime_ = strtoll(value.c_str(), nullptr, 10);
+                have_pending_mtime_ = true;
+            }
+        }
+
+        pos += record_len;
+    }
+}
+
+bool
+TarIndexer::is_tar() const
+{
+    return state_ != State::NOT_TAR;
+}
+
+bool
+TarIndexer::finished() const
+{
+    return state_ == State::DONE;
+}
+
+uint64_t
+TarIndexer::n_bytes() const
+{
+    return offset_;
+}
+
+std::vector<TarIndexer::Entry> const&
+TarIndexer::entries() const
+{
+    return entries_;
+}
+
+uint64_t
+TarIndexer::archive_size() const
+{
+    return archive_size_;
+}
+
+/***
+****  Catalog
+***/
+
+bool
+TarIndexer::write_catalog(std::ostream& out, std::vector<Entry> const& entries)
+{
+    out.write(CATALOG_MAGIC, sizeof(CATALOG_MAGIC));
+    put(out, CATALOG_VERSION);
+    put(out, uint32_t(entries.size()));
+    for (auto const& entry : entries)
+    {
+        out.put(entry.type);
+        put(out, entry.mode);
+        put(out, uint64_t(entry.mtime));
+        put(out, entry.size);
+        put(out, entry.start_offset);
+        put(out, entry.data_offset);
+        put(out, entry.end_offset);
+        put(out, uint32_t(entry.path.size()));
+        out.write(entry.path.data(), std::streamsize(entry.path.size()));
+        out.put(entry.has_digest ? 1 : 0);
+        put(out, entry.digest);
+    }
+    return bool(out);
+}
+
+bool
+TarIndexer::read_catalog(std::istream& in, std::vector<Entry>& setme)
+{
+    char magic[sizeof(CATALOG_MAGIC)];
+    uint32_t version {};
+    uint32_t n {};
+    if (!in.read(magic, sizeof(magic)) || memcmp(magic, CATALOG_MAGIC, sizeof(magic)))
+        return false;
+    if (!get(in, version) || (version < 1) || (version > CATALOG_VERSION) || !get(in, n))
+        return false;
+
+    std::vector<Entry> entries;
+    for (uint32_t i=0; i<n; ++i)
+    {
+        Entry entry;
+        uint64_t mtime {};
+        uint32_t path_len {};
+        if (!in.get(entry.type) ||
+            !get(in, entry.mode) ||
+            !get(in, mtime) ||
+            !get(in, entry.size) ||
+            !get(in, entry.start_offset) ||
+            !get(in, entry.data_offset) ||
+            !get(in, entry.end_offset) ||
+            !get(in, path_len) ||
+            (path_len > MAX_PATH_LEN))
+            return false;
+        entry.mtime = int64_t(mtime);
+        entry.path.resize(path_len);
+        if (path_len && !in.read(&entry.path[0], path_len))
+            return false;
+        if (version >= 2)
+        {
+            char has_digest {};
+            if (!in.get(has_digest) || !get(in, entry.digest))
+                return false;
+            entry.has_digest = has_digest != 0;
+        }
+        entries.push_back(std::move(entry));
+    }
+
+    setme.swap(entries);
+    return true;
+}
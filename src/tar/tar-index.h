@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#pragma once
+
+#include "tar/digest.h"
+
+#include <cstddef> // size_t
+#include <cstdint> // uint64_t
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+/**
+ * Indexes an uncompressed tar stream as it goes by, without buffering it.
+ *
+ * This understands ustar headers, pax extended headers and GNU long names,
+ * which covers everything that TarCreator and GNU tar produce. If the
+ * stream doesn't look like an uncompressed tar (eg it's xz-compressed),
+ * is_tar() returns false and the rest of the stream is ignored.
+ *
+ * Each entry's data is hashed as it goes by, so the entries can be
+ * saved as a catalog that describes an archive's layout and contents
+ * without downloading it or re-reading the files that went into it.
+ */
+class TarIndexer
+{
+public:
+    struct Entry
+    {
+        std::string path;
+        char type {};
+        uint32_t mode {};
+        int64_t mtime {};
+        uint64_t size {};
+        uint64_t start_offset {}; // the first extended header for this entry, if any
+        uint64_t data_offset {};  // the entry's data
+        uint64_t end_offset {};   // one past the entry's padded data
+        bool has_digest {};
+        uint64_t digest {};       // XXH64 of the entry's data, eg a file or a delta
+    };
+
+    void feed(char const* data, size_t len);
+
+    bool is_tar() const;
+    bool finished() const;
+    uint64_t n_bytes() const;
+    std::vector<Entry> const& entries() const;
+
+    // where the end-of-archive marker ends, or 0 if it hasn't been seen yet
+    uint64_t archive_size() const;
+
+    static constexpr size_t BLOCK_SIZE {512};
+
+    static uint64_t padded(uint64_t size);
+
+    static bool write_catalog(std::ostream& out, std::vector<Entry> const& entries);
+    static bool read_catalog(std::istream& in, std::vector<Entry>& setme);
+
+private:
+    enum class State { HEADER, DATA, EXTENDED_DATA, DONE, NOT_TAR };
+
+    void process_header(char const* block);
+    void process_extended(char type, std::string const& data);
+    void finish_digest();
+
+    State state_ {State::HEADER};
+    uint64_t offset_ {};
+    uint64_t archive_size_ {};
+    std::string block_;          // a partially-received header block
+    uint64_t bytes_left_ {};     // in the current data section, including padding
+    uint64_t digest_left_ {};    // in the current entry's data, excluding padding
+    Digest digest_;
+    uint64_t data_left_ {};      // in the current extended header's data
+    char extended_type_ {};
+    std::string extended_data_;
+    std::string pending_path_;   // from a pax header or GNU longname
+    bool have_pending_size_ {};
+    uint64_t pending_size_ {};
+    bool have_pending_mtime_ {};
+    int64_t pending_mtime_ {};
+    bool have_start_ {};
+    uint64_t pending_start_ {};
+    int n_zero_blocks_ {};
+    std::vector<Entry> entries_;
+};
@@ -35,13 +35,14 @@
 
 #include <cstdio> // fileno()
 #include <ctime>
+#include <fstream>
 #include <iostream>
 #include <type_traits>
 
 namespace
 {
 
-std::tuple<QString>
+std::tuple<QString,bool,QStringList>
 parse_args(QCoreApplication& app)
 {
     // parse the command line
@@ -53,16 +54,31 @@ parse_args(QCoreApplication& app)
         "that socket through xzcat and tar to restore the archive data into the current\n"
         "working directory.\n"
         "\n"
-        "Helper usage: "  APP_NAME " -a /bus/path"
+        "Helper usage: "  APP_NAME " -a /bus/path [--skip-identical [--catalog file]...]"
     );
     QCommandLineOption bus_path_option{
         QStringList() << "a" << "bus-path",
         QStringLiteral("Keeper service's DBus path"),
         QStringLiteral("bus-path")
     };
+    QCommandLineOption skip_identical_option{
+        QStringList() << "s" << "skip-identical",
+        QStringLiteral("Don't rewrite files whose size and mtime already match the archive. "
+                       "Without --catalog, contents aren't compared")
+    };
+    QCommandLineOption catalog_option{
+        QStringList() << "c" << "catalog",
+        QStringLiteral("With --skip-identical, also compare contents against this archive catalog. "
+                       "If it doesn't exist once keeper hands over the archive, nothing is skipped"),
+        QStringLiteral("catalog")
+    };
     parser.addOption(bus_path_option);
+    parser.addOption(skip_identical_option);
+    parser.addOption(catalog_option);
     parser.process(app);
     const auto bus_path = parser.value(bus_path_option);
+    const auto skip_identical = parser.isSet(skip_identical_option);
+    const auto catalogs = parser.values(catalog_option);
 
     // gotta have the bus path
     if (bus_path.isEmpty()) {
@@ -70,7 +86,28 @@ parse_args(QCoreApplication& app)
         parser.showHelp(EXIT_FAILURE);
     }
 
-    return std::make_tuple(bus_path);
+    return std::make_tuple(bus_path, skip_identical, catalogs);
+}
+
+bool
+read_catalogs(QStringList const& filenames, std::vector<TarIndexer::Entry>& setme)
+{
+    std::vector<TarIndexer::Entry> all;
+
+    for (auto const& filename : filenames)
+    {
+        std::ifstream in(filename.toStdString(), std::ios::binary);
+        std::vector<TarIndexer::Entry> entries;
+        if (!TarIndexer::read_catalog(in, entries))
+        {
+            qCritical() << "Unable to read catalog" << filename;
+            return false;
+        }
+        all.insert(all.end(), entries.begin(), entries.end());
+    }
+
+    setme.swap(all);
+    return true;
 }
 
 QDBusUnixFileDescriptor
@@ -149,7 +186,9 @@ main(int argc, char **argv)
 
     // get the inputs
     QString bus_path;
-    std::tie(bus_path) = parse_args(app);
+    bool skip_identical;
+    QStringList catalogs;
+    std::tie(bus_path, skip_identical, catalogs) = parse_args(app);
 
     // ask keeper for a socket to read
     const auto qfd = get_socket_from_keeper(bus_path);
@@ -158,9 +197,25 @@ main(int argc, char **argv)
         return EXIT_FAILURE;
     }
 
+    // keeper writes the catalog, if it has one, before handing over the socket
+    for (auto const& filename : catalogs)
+    {
+        if (skip_identical && !QFile::exists(filename))
+        {
+            qInfo() << "No catalog at" << filename << "; restoring every file";
+            skip_identical = false;
+        }
+    }
+    std::vector<TarIndexer::Entry> catalog;
+    if (skip_identical && !read_catalogs(catalogs, catalog))
+        return EXIT_FAILURE;
+
     // do it!
     auto const cwd = QDir::currentPath().toStdString();
     Untar untar{cwd};
+    untar.set_skip_identical(skip_identical);
+    if (!catalogs.isEmpty())
+        untar.set_catalog(catalog);
     auto const ret = untar_from_socket(untar, qfd.fileDescriptor())
         ? EXIT_SUCCESS
         : EXIT_FAILURE;
@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "tar/untar-thread.h"
+#include "tar/untar.h"
+
+#include <QDebug>
+
+constexpr qint64 UntarThread::MAX_QUEUED;
+
+UntarThread::UntarThread(std::string const& target_path, QObject * parent):
+    QObject(parent),
+    target_path_(target_path)
+{
+    thread_ = std::thread(&UntarThread::run, this);
+}
+
+UntarThread::~UntarThread()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    cv_.notify_one();
+    thread_.join();
+}
+
+bool
+UntarThread::step(QByteArray const& buf)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (!buf.isEmpty())
+    {
+        queue_.push_back(buf);
+        n_queued_ += buf.size();
+        cv_.notify_one();
+    }
+
+    if (n_queued_ < MAX_QUEUED)
+        return true;
+
+    waiting_for_room_ = true;
+    return false;
+}
+
+void
+UntarThread::finish()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        eof_ = true;
+    }
+    cv_.notify_one();
+}
+
+// runs in thread_
+void
+UntarThread::run()
+{
+    // Untar's processes belong to this thread, so it's created here too
+    Untar untar(target_path_);
+    bool ok = true;
+
+    for (;;)
+    {
+        QByteArray buf;
+        bool room_made {};
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this](){return stopping_ || eof_ || !queue_.empty();});
+            if (stopping_)
+                return;
+            if (queue_.empty()) // eof
+                break;
+            buf = queue_.front();
+            queue_.pop_front();
+            n_queued_ -= buf.size();
+            if (waiting_for_room_ && (n_queued_ <= MAX_QUEUED/2))
+            {
+                waiting_for_room_ = false;
+                room_made = true;
+            }
+        }
+
+        if (!untar.step(buf.constData(), size_t(buf.size())))
+        {
+            ok = false;
+            break;
+        }
+
+        if (room_made)
+            Q_EMIT(ready_for_more());
+    }
+
+    if (!untar.finish())
+        ok = false;
+
+    qDebug() << "extracting into" << target_path_.c_str() << "finished; success =" << ok;
+    Q_EMIT(finished(ok));
+}
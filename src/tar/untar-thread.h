@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#pragma once
+
+#include <QByteArray>
+#include <QObject>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/**
+ * Runs an Untar in a thread of its own.
+ *
+ * Untar blocks while it waits on xz and tar and while it applies deltas,
+ * which is fine in keeper-untar but would stall the service's event loop.
+ * Callers queue what they've read with step() and hear back through
+ * signals, which are delivered in the caller's thread.
+ */
+class UntarThread final: public QObject
+{
+    Q_OBJECT
+
+public:
+
+    explicit UntarThread(std::string const& target_path, QObject * parent = nullptr);
+    ~UntarThread();
+
+    Q_DISABLE_COPY(UntarThread)
+
+    // queues `buf` to be extracted. Returns false once enough is queued
+    // that the caller should wait for ready_for_more() before adding more
+    bool step(QByteArray const& buf);
+
+    // no more input is coming. finished() is emitted when it's all extracted
+    void finish();
+
+    static constexpr qint64 MAX_QUEUED {4*1024*1024};
+
+Q_SIGNALS:
+    void ready_for_more();
+    void finished(bool success);
+
+private:
+
+    void run();
+
+    std::string const target_path_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<QByteArray> queue_;
+    qint64 n_queued_ {};
+    bool waiting_for_room_ {};
+    bool eof_ {};
+    bool stopping_ {};
+
+    std::thread thread_;
+};
@@ -18,11 +18,25 @@
  */
 
 #include "tar/untar.h"
+#include "tar/delta.h"
+#include "tar/digest.h"
+#include "tar/tar-filter.h"
+#include "tar/tar-index.h"
 
 #include <QDebug>
+#include <QDir>
 #include <QProcess>
 #include <QString>
 
+#include <sys/stat.h> // stat(), chmod(), utimensat()
+#include <fcntl.h> // AT_FDCWD
+
+#include <cerrno>
+#include <cstdio> // std::rename(), std::remove()
+#include <cstring> // strerror()
+#include <fstream>
+#include <map>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -33,19 +47,140 @@ public:
     explicit Impl(std::string const& path)
         : path_{path}
     {
+        start_session();
+    }
+
+    ~Impl()
+    {
+        finish();
+    }
+
+    void set_skip_identical(bool skip)
+    {
+        skip_identical_ = skip;
+    }
+
+    void set_catalog(std::vector<TarIndexer::Entry> const& catalog)
+    {
+        // a later full copy of a file replaces an earlier one
+        digests_.clear();
+        for (auto const& entry : catalog)
+            if (entry.has_digest && !Delta::is_delta_name(entry.path))
+                digests_[entry.path] = entry.digest;
+        verify_digests_ = true;
+    }
+
+    bool step(char const * buf, size_t buflen)
+    {
+        bool success = true;
+
+        while (success && (buflen > 0))
+        {
+            // skip the padding after an archive.
+            // the next archive, if any, starts at the next nonzero byte.
+            if (between_archives_)
+            {
+                size_t n {};
+                while ((n < buflen) && !buf[n])
+                    ++n;
+                buf += n;
+                buflen -= n;
+                if (!buflen)
+                    break;
+                between_archives_ = false;
+                start_session();
+            }
+
+            // the stream may hold several uncompressed archives back to back,
+            // eg when restoring a chain of incremental backups. Each archive
+            // gets its own tar so that its deltas apply on top of the last one.
+            auto n = buflen;
+            if (indexer_.is_tar())
+            {
+                auto const n_before = indexer_.n_bytes();
+                indexer_.feed(buf, buflen);
+                if (indexer_.finished())
+                    n = size_t(indexer_.archive_size() - n_before);
+            }
+
+            if (skip_identical_)
+            {
+                if (!filter_)
+                    filter_.reset(new TarFilter([this](TarIndexer::Entry const& entry){return needs_extract(entry);}));
+                std::string filtered;
+                filter_->feed(buf, n, filtered);
+                success = write(filtered.data(), filtered.size());
+            }
+            else
+            {
+                success = write(buf, n);
+            }
+            buf += n;
+            buflen -= n;
+
+            if (indexer_.is_tar() && indexer_.finished())
+            {
+                if (!finish_session())
+                    success = false;
+                between_archives_ = true;
+            }
+        }
+
+        return success;
+    }
+
+    bool finish ()
+    {
+        if (session_active_ && !finish_session())
+            ok_ = false;
+
+        if (n_skipped_)
+        {
+            qDebug() << "skipped" << n_skipped_ << "files that were already restored";
+            n_skipped_ = 0;
+        }
+
+        return ok_;
+    }
+
+private:
+
+    void start_session()
+    {
+        indexer_ = TarIndexer{};
+        filter_.reset();
+        session_active_ = true;
+
         uncompress_.setStandardOutputProcess(&untar_);
         uncompress_.start("xz", QStringList{ "--decompress", "--stdout", "--force" });
 
-        untar_.start("tar", QStringList{ "-xv", "-C", path_.c_str()});
         untar_.setProcessChannelMode(QProcess::ForwardedChannels);
+        untar_.start("tar", QStringList{ "-xv", "-C", path_.c_str()});
     }
 
-    ~Impl()
+    bool finish_session()
     {
-        finish();
+        bool ok = true;
+
+        session_active_ = false;
+
+        uncompress_.closeWriteChannel();
+        if (!finish(uncompress_, "xz"))
+            ok = false;
+
+        if (!finish(untar_, "untar"))
+            ok = false;
+
+        if (ok && !apply_deltas())
+            ok = false;
+
+        if (!ok)
+            ok_ = false;
+
+        return ok;
     }
 
-    bool step(char const * buf, size_t buflen)
+    bool write(char const * buf, size_t buflen)
     {
         bool success = true;
 
@@ -63,25 +198,131 @@ public:
             }
         }
 
+        // QProcess only hands its buffer to xz from an event loop or a
+        // waitFor call, so don't let it grow to hold the whole archive
+        while (success && (uncompress_.bytesToWrite() > WRITE_BUFFER_MAX))
+        {
+            if (!uncompress_.waitForBytesWritten() && (uncompress_.state() == QProcess::NotRunning))
+            {
+                qCritical() << "xz exited before reading the whole archive";
+                success = false;
+            }
+        }
+
         return success;
     }
 
-    bool finish ()
+    // returns false if the file on disk already matches the archived one
+    bool needs_extract(TarIndexer::Entry const& entry)
+    {
+        if ((entry.type != '0') || Delta::is_delta_name(entry.path))
+            return true;
+
+        auto const path = QDir(QString::fromStdString(path_)).filePath(QString::fromStdString(entry.path)).toStdString();
+        struct stat st;
+        if ((stat(path.c_str(), &st) != 0) ||
+            !S_ISREG(st.st_mode) ||
+            (uint64_t(st.st_size) != entry.size) ||
+            (int64_t(st.st_mtime) != entry.mtime))
+            return true;
+
+        if (verify_digests_)
+        {
+            auto const it = digests_.find(entry.path);
+            if ((it == digests_.end()) || (digest_file(path) != it->second))
+                return true;
+        }
+
+        ++n_skipped_;
+        return false;
+    }
+
+    static uint64_t digest_file(std::string const& path)
+    {
+        Digest digest;
+        std::ifstream in(path, std::ios::binary);
+        char buf[64*1024];
+        while (in.read(buf, sizeof(buf)) || in.gcount())
+            digest.update(buf, size_t(in.gcount()));
+        return digest.value();
+    }
+
+    // the indexer saw the archive's raw member names, so this finds the
+    // deltas even if tar would have escaped their names in a listing.
+    // Deltas are only written into uncompressed archives, which is the
+    // only kind that the indexer can read.
+    bool apply_deltas()
     {
         bool ok = true;
 
-        uncompress_.closeWriteChannel();
-        if (!finish(uncompress_, "xz"))
-            ok = false;
+        for (auto const& entry : indexer_.entries())
+            if ((entry.type == '0') && Delta::is_delta_name(entry.path))
+                if (!apply_delta(entry.path))
+                    ok = false;
 
-        if (!finish(untar_, "untar"))
+        return ok;
+    }
+
+    // patch the file that's already on disk with the delta that was just extracted
+    bool apply_delta(std::string const& delta_name)
+    {
+        auto const delta_path = path_ + '/' + delta_name;
+        auto const target_path = delta_path.substr(0, delta_path.size() - strlen(Delta::SUFFIX));
+        auto const tmp_path = target_path + ".keeper-tmp";
+
+        std::string error;
+        bool ok;
+        {
+            std::ifstream basis(target_path, std::ios::binary);
+            std::ifstream patch(delta_path, std::ios::binary);
+            std::ofstream out(tmp_path, std::ios::binary|std::ios::trunc);
+            if (!basis)
+            {
+                error = "no previous version to apply it to";
+                ok = false;
+            }
+            else
+            {
+                ok = Delta::apply(basis, patch, out, error);
+                out.close();
+                if (ok && out.fail())
+                {
+                    error = "unable to write patched file";
+                    ok = false;
+                }
+            }
+        }
+
+        // tar restored the original file's mode & mtime onto the delta
+        struct stat st;
+        if (ok && (stat(delta_path.c_str(), &st) == 0))
+        {
+            chmod(tmp_path.c_str(), st.st_mode & 07777);
+            struct timespec const times[2] = { st.st_atim, st.st_mtim };
+            utimensat(AT_FDCWD, tmp_path.c_str(), times, 0);
+        }
+
+        if (ok && (std::rename(tmp_path.c_str(), target_path.c_str()) != 0))
+        {
+            error = strerror(errno);
             ok = false;
+        }
+
+        if (ok)
+        {
+            std::remove(delta_path.c_str());
+            qDebug() << "applied delta to" << target_path.c_str();
+        }
+        else
+        {
+            // leave the delta in place so that nothing is lost
+            std::remove(tmp_path.c_str());
+            qCritical() << "unable to apply delta" << delta_path.c_str() << ":" << error.c_str();
+        }
 
         return ok;
     }
 
-private:
-
     bool finish (QProcess& proc, QString const& name)
     {
         if (proc.state() != QProcess::NotRunning)
@@ -115,9 +356,20 @@ private:
         return ok;
     }
 
+    static constexpr qint64 WRITE_BUFFER_MAX {1024*1024};
+
     std::string const path_;
     QProcess uncompress_;
     QProcess untar_;
+    TarIndexer indexer_;
+    std::unique_ptr<TarFilter> filter_;
+    bool skip_identical_ {};
+    bool verify_digests_ {};
+    std::map<std::string,uint64_t> digests_;
+    int n_skipped_ {};
+    bool session_active_ {};
+    bool between_archives_ {};
+    bool ok_ {true};
 };
 
 /**
@@ -131,6 +383,18 @@ Untar::Untar(std::string const& path)
 
 Untar::~Untar() =default;
 
+void
+Untar::set_skip_identical(bool skip)
+{
+    impl_->set_skip_identical(skip);
+}
+
+void
+Untar::set_catalog(std::vector<TarIndexer::Entry> const& catalog)
+{
+    impl_->set_catalog(catalog);
+}
+
 bool
 Untar::step(char const * buf, size_t buflen)
 {
@@ -19,8 +19,12 @@
 
 #pragma once
 
+#include "tar/tar-index.h"
+
 #include <cstddef> // size_t
 #include <memory> // shared_ptr
+#include <string>
+#include <vector>
 
 
 class Untar
@@ -28,6 +32,20 @@ class Untar
 public:
     explicit Untar(std::string const& target_path);
     ~Untar();
+
+    /**
+     * Don't rewrite files that already match the archive.
+     *
+     * A regular file is skipped if the copy on disk has the same size and
+     * mtime as the archived one. If the archive's catalog is given, the
+     * contents' digests must match too; files missing from it are written.
+     * Without a catalog, a file whose contents changed but whose size and
+     * mtime didn't is left alone, so callers should only opt into that.
+     * Deltas are always applied. This must be called before step().
+     */
+    void set_skip_identical(bool skip);
+    void set_catalog(std::vector<TarIndexer::Entry> const& catalog);
+
     bool step(char const * buf, size_t n_bytes);
     bool finish();
 
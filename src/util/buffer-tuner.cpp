@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "util/buffer-tuner.h"
+
+#include <sys/socket.h>
+
+#include <algorithm> // std::max(), std::min()
+
+namespace
+{
+
+// how many buffers' worth of data to watch before reconsidering the size
+constexpr uint64_t WINDOW_BUFFERS {4};
+
+size_t round_up_to_power_of_two(uint64_t n)
+{
+    size_t ret {1};
+    while ((ret < n) && (ret < (size_t(1) << 30)))
+        ret <<= 1;
+    return ret;
+}
+
+} // anonymous namespace
+
+constexpr size_t BufferTuner::DEFAULT_MIN_SIZE;
+constexpr size_t BufferTuner::DEFAULT_MAX_SIZE;
+constexpr int BufferTuner::DEFAULT_TARGET_MSEC;
+
+BufferTuner::BufferTuner(size_t min_size, size_t max_size, int target_msec)
+    : min_size_{std::max(min_size, size_t(1))}
+    , max_size_{std::max(max_size, min_size_)}
+    , target_msec_{std::max(target_msec, 1)}
+    , size_{min_size_}
+{
+    stats_.largest_size = size_;
+}
+
+size_t
+BufferTuner::size() const
+{
+    return size_;
+}
+
+BufferTuner::Stats const&
+BufferTuner::stats() const
+{
+    return stats_;
+}
+
+bool
+BufferTuner::update(size_t n_bytes, uint64_t bytes_per_second)
+{
+    ++stats_.n_wakeups;
+    stats_.n_bytes += n_bytes;
+
+    ++window_wakeups_;
+    window_bytes_ += n_bytes;
+    if (n_bytes >= size_)
+        ++window_full_;
+
+    if (window_bytes_ < size_*WINDOW_BUFFERS)
+        return false;
+
+    // enough room for target_msec_ of data at the current speed...
+    auto want = round_up_to_power_of_two(bytes_per_second * uint64_t(target_msec_) / 1000u);
+
+    // ...but if most wakeups fill the buffer, the buffer is what's holding us back
+    if (window_full_*2 >= window_wakeups_)
+        want = std::max(want, size_*2);
+
+    // only shrink when it's far too big
+    if ((want < size_) && (want*4 > size_))
+        want = size_;
+
+    want = std::min(std::max(want, min_size_), max_size_);
+
+    window_bytes_ = 0;
+    window_wakeups_ = 0;
+    window_full_ = 0;
+
+    if (want == size_)
+        return false;
+
+    size_ = want;
+    ++stats_.n_resizes;
+    stats_.largest_size = std::max(stats_.largest_size, size_);
+    return true;
+}
+
+size_t
+BufferTuner::apply_to_socket(int fd, size_t n_bytes)
+{
+    auto const val = int(std::min(n_bytes, size_t(1) << 30));
+    if ((setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &val, sizeof(val)) == -1) ||
+        (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &val, sizeof(val)) == -1))
+        return 0;
+
+    // the kernel clamps it to wmem_max and doubles it for bookkeeping overhead
+    int actual {};
+    socklen_t len = sizeof(actual);
+    if (getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &actual, &len) == -1)
+        return 0;
+    return size_t(std::max(actual, 0));
+}
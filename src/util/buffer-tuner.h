@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#pragma once
+
+#include <cstddef> // size_t
+#include <cstdint> // uint64_t
+
+/**
+ * Picks a buffer size for a relay from how fast data is moving through it.
+ *
+ * The goal is to hold about `target_msec` worth of data at the measured
+ * throughput, so that a fast stream isn't throttled by a small buffer and
+ * doesn't wake us up for every few kilobytes, while a slow one doesn't tie
+ * up memory it will never use. Sizes are powers of two kept between
+ * `min_size` and `max_size`, the latter being the memory budget.
+ *
+ * The size is only reconsidered after a few buffers' worth of data has
+ * gone by, and only shrinks when it's far too big, so it doesn't flap.
+ */
+class BufferTuner
+{
+public:
+    static constexpr size_t DEFAULT_MIN_SIZE {16*1024};
+    static constexpr size_t DEFAULT_MAX_SIZE {1024*1024}; // the default pipe-max-size
+    static constexpr int DEFAULT_TARGET_MSEC {250};
+
+    explicit BufferTuner(size_t min_size = DEFAULT_MIN_SIZE,
+                         size_t max_size = DEFAULT_MAX_SIZE,
+                         int target_msec = DEFAULT_TARGET_MSEC);
+
+    size_t size() const;
+
+    // call once per wakeup with the number of bytes moved during it and
+    // the current throughput. Returns true if size() changed.
+    bool update(size_t n_bytes, uint64_t bytes_per_second);
+
+    struct Stats
+    {
+        uint64_t n_wakeups {};
+        uint64_t n_bytes {};
+        uint64_t n_resizes {};
+        size_t largest_size {};
+    };
+    Stats const& stats() const;
+
+    // sets SO_SNDBUF and SO_RCVBUF on a socket. Returns the send buffer
+    // size that the kernel settled on, or 0 if it couldn't be set.
+    static size_t apply_to_socket(int fd, size_t n_bytes);
+
+private:
+    size_t min_size_;
+    size_t max_size_;
+    int target_msec_;
+    size_t size_;
+    Stats stats_;
+
+    // since the size was last reconsidered
+    uint64_t window_bytes_ {};
+    uint64_t window_wakeups_ {};
+    uint64_t window_full_ {}; // wakeups that moved a whole buffer
+};
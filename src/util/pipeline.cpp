@@ -0,0 +1,630 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "util/pipeline.h"
+#include "util/splice-relay.h"
+
+#include <sys/socket.h> // sendmsg()
+#include <unistd.h> // read(), writev()
+
+#include <algorithm> // std::all_of(), std::find_if(), std::max(), std::min()
+#include <cerrno>
+#include <cstring> // strerror()
+#include <iterator> // std::distance()
+
+namespace
+{
+
+// trims iovecs so that they hold at most max_bytes
+int clamp_iov(struct iovec* iov, int n_iov, size_t max_bytes)
+{
+    for (int i=0; i<n_iov; ++i)
+    {
+        if (iov[i].iov_len >= max_bytes)
+        {
+            iov[i].iov_len = max_bytes;
+            return i+1;
+        }
+        max_bytes -= iov[i].iov_len;
+    }
+    return n_iov;
+}
+
+} // anonymous namespace
+
+/***
+****
+***/
+
+void
+Pipeline::Tap::process(char const* data, size_t len, std::string& out)
+{
+    observe(data, len);
+    out.append(data, len);
+}
+
+Pipeline::Pipeline(size_t buffer_size)
+    : buffer_size_{buffer_size}
+{
+    source_counters_.name = "source";
+    sink_counters_.name = "sink";
+}
+
+Pipeline::~Pipeline() =default;
+
+void
+Pipeline::set_source(std::shared_ptr<Source> const& source)
+{
+    source_ = source;
+    source_done_ = false;
+
+    // the relay remembers whether the old source ended
+    relay_stale_ = relay_ != nullptr;
+}
+
+void
+Pipeline::set_sink(std::shared_ptr<Sink> const& sink)
+{
+    sink_ = sink;
+}
+
+void
+Pipeline::add_transform(std::string const& name, std::shared_ptr<Transform> const& transform)
+{
+    // stages with the same name share counters
+    auto it = std::find_if(transform_counters_.begin(), transform_counters_.end(),
+                           [&name](Counters const& c){return c.name == name;});
+    if (it == transform_counters_.end())
+    {
+        Counters counters;
+        counters.name = name;
+        it = transform_counters_.insert(transform_counters_.end(), counters);
+    }
+
+    Stage stage;
+    stage.transform = transform;
+    stage.tap = dynamic_cast<Tap*>(transform.get());
+    stage.counters = size_t(std::distance(transform_counters_.begin(), it));
+    stages_.push_back(stage);
+
+    // a relay that was created without an observer can't feed the new stage
+    if (relay_ && !relay_observes_)
+        relay_stale_ = true;
+}
+
+void
+Pipeline::clear_transforms()
+{
+    stages_.clear();
+}
+
+void
+Pipeline::clear()
+{
+    if (ring_)
+        ring_->clear();
+    overflow_.clear();
+    relay_.reset();
+    relay_stale_ = false;
+    source_done_ = false;
+
+    for (auto* counters : {&source_counters_, &sink_counters_})
+        counters->n_calls = counters->n_bytes_in = counters->n_bytes_out = 0;
+    for (auto& counters : transform_counters_)
+        counters.n_calls = counters.n_bytes_in = counters.n_bytes_out = 0;
+    max_pending_ = 0;
+
+    resize_buffers();
+}
+
+void
+Pipeline::set_buffer_size(size_t n_bytes)
+{
+    buffer_size_ = n_bytes;
+    resize_pending_ = true;
+    resize_buffers();
+}
+
+size_t
+Pipeline::buffer_size() const
+{
+    return buffer_size_;
+}
+
+void
+Pipeline::set_splice_enabled(bool enabled)
+{
+    splice_enabled_ = enabled;
+}
+
+size_t
+Pipeline::n_pending() const
+{
+    size_t n_bytes = overflow_.size();
+    if (ring_)
+        n_bytes += ring_->size();
+    if (relay_)
+        n_bytes += size_t(relay_->n_pending());
+    return n_bytes;
+}
+
+std::vector<Pipeline::Counters>
+Pipeline::counters() const
+{
+    std::vector<Counters> ret;
+    ret.reserve(transform_counters_.size() + 2);
+    ret.push_back(source_counters_);
+    ret.insert(ret.end(), transform_counters_.begin(), transform_counters_.end());
+    ret.push_back(sink_counters_);
+    return ret;
+}
+
+size_t
+Pipeline::max_pending() const
+{
+    return max_pending_;
+}
+
+/***
+****
+***/
+
+Pipeline::Result
+Pipeline::pump(size_t max_write)
+{
+    Result result;
+
+    if (!source_ || !sink_)
+        return result;
+
+    // anything still in the relay from before the stream changed goes first
+    if (relay_ && (relay_->n_pending() > 0) && (relay_stale_ || !can_splice()))
+    {
+        result = splice(-1, max_write);
+        if (result.read_error || result.write_error || (relay_->n_pending() > 0))
+            return result;
+        max_write -= size_t(result.n_written);
+    }
+    if (relay_stale_)
+    {
+        relay_.reset();
+        relay_stale_ = false;
+    }
+
+    auto const n_flushed = result.n_written;
+    result = can_splice() && create_relay()
+        ? splice(source_->fd(), max_write)
+        : copy(max_write);
+    result.n_written += n_flushed;
+
+    max_pending_ = std::max(max_pending_, n_pending());
+    resize_buffers();
+    return result;
+}
+
+bool
+Pipeline::only_taps() const
+{
+    return std::all_of(stages_.begin(), stages_.end(), [](Stage const& s){return s.tap != nullptr;});
+}
+
+bool
+Pipeline::can_splice() const
+{
+    return splice_enabled_
+        && !source_done_
+        && (source_->fd() != -1)
+        && (sink_->fd() != -1)
+        && only_taps()
+        && (!ring_ || ring_->empty())
+        && overflow_.empty();
+}
+
+bool
+Pipeline::create_relay()
+{
+    if (!relay_)
+    {
+        relay_observes_ = !stages_.empty();
+        SpliceRelay::Observer observer;
+        if (relay_observes_)
+            observer = [this](char const* data, size_t len){observe(data, len);};
+        relay_.reset(new SpliceRelay(observer));
+        relay_->set_pipe_size(buffer_size_);
+    }
+
+    if (!relay_->is_valid())
+    {
+        // splice() isn't available here, so stick to copying
+        relay_.reset();
+        splice_enabled_ = false;
+        return false;
+    }
+
+    return true;
+}
+
+Pipeline::Result
+Pipeline::splice(int in_fd, size_t max_write)
+{
+    auto const r = relay_->relay(in_fd, sink_->fd(), max_write);
+
+    Result result;
+    result.n_read = r.n_read;
+    result.n_written = r.n_written;
+    result.want_read = r.want_read;
+    result.want_write = r.want_write;
+    result.throttled = r.throttled;
+    result.spliced = true;
+    if (r.read_errno)
+    {
+        result.read_error = true;
+        result.error = strerror(r.read_errno);
+    }
+    if (r.write_errno)
+    {
+        result.write_error = true;
+        result.error = strerror(r.write_errno);
+    }
+    if (r.eof && (in_fd != -1))
+    {
+        result.eof = true;
+        source_done_ = true;
+    }
+
+    if (in_fd != -1)
+    {
+        ++source_counters_.n_calls;
+        source_counters_.n_bytes_out += uint64_t(r.n_read);
+    }
+    ++sink_counters_.n_calls;
+    sink_counters_.n_bytes_in += uint64_t(r.n_written);
+    return result;
+}
+
+Pipeline::Result
+Pipeline::copy(size_t max_write)
+{
+    Result result;
+
+    if (!ring_)
+        ring_.reset(new RingBuffer(buffer_size_));
+
+    for (;;)
+    {
+        // make room for the source by handing the ring to the sink
+        if (!overflow_.empty())
+            overflow_.erase(0, ring_->write(overflow_.data(), overflow_.size()));
+
+        int64_t n_in {};
+        result.want_read = false;
+        if (!source_done_ && overflow_.empty() && !ring_->full())
+        {
+            n_in = fill(result);
+            if (n_in < 0)
+                return result;
+            result.want_read = (n_in == 0) && !source_done_;
+            max_pending_ = std::max(max_pending_, n_pending());
+        }
+
+        int64_t n_out {};
+        result.want_write = false;
+        result.throttled = false;
+        if (!ring_->empty())
+        {
+            auto const allowed = max_write - size_t(result.n_written);
+            if (allowed == 0)
+            {
+                result.throttled = true;
+            }
+            else
+            {
+                struct iovec iov[2];
+                auto const n_iov = clamp_iov(iov, ring_->readable(iov), allowed);
+                ++sink_counters_.n_calls;
+                auto const n = sink_->write(iov, n_iov);
+                if (n < 0)
+                {
+                    result.write_error = true;
+                    result.error = sink_->error_string();
+                    return result;
+                }
+                result.want_write = n == 0;
+                ring_->consume(size_t(n));
+                sink_counters_.n_bytes_in += uint64_t(n);
+                result.n_written += n;
+                n_out = n;
+            }
+        }
+
+        if ((n_in <= 0) && (n_out <= 0))
+            break;
+    }
+
+    result.eof = source_done_ && ring_->empty() && overflow_.empty();
+    return result;
+}
+
+// reads from the source and passes the data down to the ring
+int64_t
+Pipeline::fill(Result& result)
+{
+    ++source_counters_.n_calls;
+
+    ssize_t n {};
+    if (only_taps())
+    {
+        // nothing changes the data, so read it straight into the ring
+        struct iovec iov[2];
+        auto const n_iov = ring_->writable(iov);
+        for (int i=0; i<n_iov; ++i)
+        {
+            auto const n_i = source_->read(static_cast<char*>(iov[i].iov_base), iov[i].iov_len);
+            if (n_i < 0)
+            {
+                n = -1;
+                break;
+            }
+            n += n_i;
+            if (size_t(n_i) < iov[i].iov_len)
+                break;
+        }
+        auto left = n > 0 ? size_t(n) : size_t(0);
+        for (int i=0; (i<n_iov) && (left>0); ++i)
+        {
+            auto const len = std::min(left, iov[i].iov_len);
+            observe(static_cast<char const*>(iov[i].iov_base), len);
+            left -= len;
+        }
+        if (n > 0)
+            ring_->commit(size_t(n));
+    }
+    else
+    {
+        auto const max_bytes = ring_->space();
+        if (scratch_.size() < max_bytes)
+            scratch_.resize(max_bytes);
+        n = source_->read(scratch_.data(), max_bytes);
+        if (n > 0)
+            transform(0, scratch_.data(), size_t(n));
+    }
+
+    if (n < 0)
+    {
+        result.read_error = true;
+        result.error = source_->error_string();
+        return -1;
+    }
+
+    source_counters_.n_bytes_out += uint64_t(n);
+    result.n_read += n;
+
+    if (source_->eof())
+    {
+        source_done_ = true;
+        finish();
+    }
+
+    return n;
+}
+
+// passes data through stages_[first_stage...] and into the ring
+void
+Pipeline::transform(size_t first_stage, char const* data, size_t len)
+{
+    int which {};
+    for (size_t i=first_stage; (i<stages_.size()) && (len>0); ++i)
+    {
+        auto& stage = stages_[i];
+        auto& counters = transform_counters_[stage.counters];
+        ++counters.n_calls;
+        counters.n_bytes_in += len;
+        if (stage.tap)
+        {
+            stage.tap->observe(data, len);
+        }
+        else
+        {
+            auto& out = bufs_[which];
+            which ^= 1;
+            out.clear();
+            stage.transform->process(data, len, out);
+            data = out.data();
+            len = out.size();
+        }
+        counters.n_bytes_out += len;
+    }
+
+    push(data, len);
+}
+
+void
+Pipeline::push(char const* data, size_t len)
+{
+    size_t n {};
+    if (overflow_.empty())
+        n = ring_->write(data, len);
+    overflow_.append(data+n, len-n);
+}
+
+// flushes each transform in turn through the stages after it
+void
+Pipeline::finish()
+{
+    std::string tail;
+    for (size_t i=0; i<stages_.size(); ++i)
+    {
+        if (stages_[i].tap)
+            continue;
+        tail.clear();
+        stages_[i].transform->finish(tail);
+        if (!tail.empty())
+        {
+            transform_counters_[stages_[i].counters].n_bytes_out += tail.size();
+            transform(i+1, tail.data(), tail.size());
+        }
+    }
+}
+
+// hands data that bypassed transform() to the taps
+void
+Pipeline::observe(char const* data, size_t len)
+{
+    for (auto& stage : stages_)
+    {
+        auto& counters = transform_counters_[stage.counters];
+        ++counters.n_calls;
+        counters.n_bytes_in += len;
+        counters.n_bytes_out += len;
+        if (stage.tap)
+            stage.tap->observe(data, len);
+    }
+}
+
+void
+Pipeline::resize_buffers()
+{
+    if (!resize_pending_)
+        return;
+
+    bool done {true};
+
+    if (ring_ && (ring_->capacity() != buffer_size_))
+    {
+        if (ring_->empty() && overflow_.empty())
+            ring_.reset(new RingBuffer(buffer_size_));
+        else
+            done = false;
+    }
+
+    if (relay_)
+    {
+        if (relay_->n_pending() == 0)
+            relay_->set_pipe_size(buffer_size_); // best effort
+        else
+            done = false;
+    }
+
+    resize_pending_ = !done;
+}
+
+/***
+****
+***/
+
+FdSource::FdSource(int fd)
+    : fd_{fd}
+{
+}
+
+ssize_t
+FdSource::read(char* buf, size_t max_bytes)
+{
+    for (;;)
+    {
+        auto const n = ::read(fd_, buf, max_bytes);
+        if (n > 0)
+            return n;
+        if (n == 0)
+        {
+            if (max_bytes > 0)
+                eof_ = true;
+            return 0;
+        }
+        if (errno == EINTR)
+            continue;
+        if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            return 0;
+        errno_ = errno;
+        return -1;
+    }
+}
+
+bool
+FdSource::eof() const
+{
+    return eof_;
+}
+
+int
+FdSource::fd() const
+{
+    return fd_;
+}
+
+std::string
+FdSource::error_string() const
+{
+    return strerror(errno_);
+}
+
+/***
+****
+***/
+
+FdSink::FdSink(int fd)
+    : fd_{fd}
+{
+}
+
+ssize_t
+FdSink::write(struct iovec const* iov, int n_iov)
+{
+    for (;;)
+    {
+        ssize_t n;
+        if (is_socket_)
+        {
+            struct msghdr msg {};
+            msg.msg_iov = const_cast<struct iovec*>(iov);
+            msg.msg_iovlen = size_t(n_iov);
+            n = sendmsg(fd_, &msg, MSG_NOSIGNAL);
+            if ((n == -1) && (errno == ENOTSOCK))
+            {
+                is_socket_ = false;
+                continue;
+            }
+        }
+        else
+        {
+            n = ::writev(fd_, iov, n_iov);
+        }
+
+        if (n >= 0)
+            return n;
+        if (errno == EINTR)
+            continue;
+        if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            return 0;
+        errno_ = errno;
+        return -1;
+    }
+}
+
+int
+FdSink::fd() const
+{
+    return fd_;
+}
+
+std::string
+FdSink::error_string() const
+{
+    return strerror(errno_);
+}
@@ -0,0 +1,227 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#pragma once
+
+#include "util/ring-buffer.h"
+
+#include <sys/types.h> // ssize_t
+#include <sys/uio.h> // struct iovec
+
+#include <cstddef> // size_t
+#include <cstdint> // int64_t, uint64_t, SIZE_MAX
+#include <memory>
+#include <string>
+#include <vector>
+
+class SpliceRelay;
+
+/**
+ * Moves a byte stream from a Source, through any number of Transforms,
+ * to a Sink.
+ *
+ * Transformed data waits for the sink in a bounded RingBuffer, and the
+ * source isn't read while that buffer is full, so a slow sink pushes
+ * back on the source. Each pump() moves as much as it can without
+ * blocking and reports what it's waiting for.
+ *
+ * If both ends are file descriptors and every stage is a Tap, the data
+ * is spliced from one fd to the other instead (see SpliceRelay) and the
+ * taps see a tee()d copy of it.
+ */
+class Pipeline
+{
+public:
+
+    class Source
+    {
+    public:
+        virtual ~Source() =default;
+        // returns how many bytes were read, 0 if none are ready, or -1 on error
+        virtual ssize_t read(char* buf, size_t max_bytes) =0;
+        // true once the stream has ended
+        virtual bool eof() const =0;
+        // the fd to splice from, or -1
+        virtual int fd() const { return -1; }
+        virtual std::string error_string() const =0;
+    };
+
+    class Transform
+    {
+    public:
+        virtual ~Transform() =default;
+        // appends what should be passed downstream to `out`
+        virtual void process(char const* data, size_t len, std::string& out) =0;
+        // called once after the source ends, to flush anything held back
+        virtual void finish(std::string& /*out*/) {}
+    };
+
+    // a Transform that only looks at the data, eg to index or hash it
+    class Tap: public Transform
+    {
+    public:
+        virtual void observe(char const* data, size_t len) =0;
+        void process(char const* data, size_t len, std::string& out) override;
+    };
+
+    class Sink
+    {
+    public:
+        virtual ~Sink() =default;
+        // returns how many bytes were written, 0 if none could be, or -1 on error
+        virtual ssize_t write(struct iovec const* iov, int n_iov) =0;
+        // the fd to splice to, or -1
+        virtual int fd() const { return -1; }
+        virtual std::string error_string() const =0;
+    };
+
+    explicit Pipeline(size_t buffer_size);
+    ~Pipeline();
+
+    Pipeline(Pipeline const&) =delete;
+    Pipeline& operator=(Pipeline const&) =delete;
+
+    // Data that has already been transformed stays buffered when the
+    // source or the transforms are changed, eg to read the next archive.
+    void set_source(std::shared_ptr<Source> const& source);
+    void set_sink(std::shared_ptr<Sink> const& sink);
+    void add_transform(std::string const& name, std::shared_ptr<Transform> const& transform);
+    void clear_transforms();
+
+    // drops any buffered data and zeroes the counters
+    void clear();
+
+    // buffers are only resized while they're empty, so this may take effect later
+    void set_buffer_size(size_t n_bytes);
+    size_t buffer_size() const;
+
+    // if false, data is always copied through the ring buffer
+    void set_splice_enabled(bool enabled);
+
+    struct Result
+    {
+        int64_t n_read {};     // bytes taken from the source
+        int64_t n_written {};  // bytes delivered to the sink
+        bool eof {};           // the source has ended and everything's been written
+        bool want_read {};     // stopped because the source had nothing to read
+        bool want_write {};    // stopped because the sink was full
+        bool throttled {};     // stopped because max_write was reached
+        bool spliced {};       // the data bypassed the ring buffer
+        bool read_error {};
+        bool write_error {};
+        std::string error;
+    };
+
+    // moves as much as possible without blocking, writing at most max_write bytes
+    Result pump(size_t max_write = SIZE_MAX);
+
+    // bytes that have been read but not yet written
+    size_t n_pending() const;
+
+    struct Counters
+    {
+        std::string name;
+        uint64_t n_calls {};
+        uint64_t n_bytes_in {};
+        uint64_t n_bytes_out {};
+    };
+
+    // the source's, then each transform's, then the sink's
+    std::vector<Counters> counters() const;
+
+    // the most that's ever been pending at once
+    size_t max_pending() const;
+
+private:
+    struct Stage
+    {
+        std::shared_ptr<Transform> transform;
+        Tap* tap;
+        size_t counters; // index into transform_counters_
+    };
+
+    bool only_taps() const;
+    bool can_splice() const;
+    bool create_relay();
+    Result splice(int in_fd, size_t max_write);
+    Result copy(size_t max_write);
+    int64_t fill(Result& result);
+    void transform(size_t first_stage, char const* data, size_t len);
+    void push(char const* data, size_t len);
+    void finish();
+    void observe(char const* data, size_t len);
+    void resize_buffers();
+
+    std::shared_ptr<Source> source_;
+    std::shared_ptr<Sink> sink_;
+    std::vector<Stage> stages_;
+    std::unique_ptr<SpliceRelay> relay_;
+    bool relay_observes_ {};
+    bool relay_stale_ {};
+    bool splice_enabled_ {true};
+    bool source_done_ {};
+
+    size_t buffer_size_ {};
+    bool resize_pending_ {};
+    std::unique_ptr<RingBuffer> ring_; // allocated the first time it's needed
+    std::string overflow_;             // transformed data that didn't fit in ring_
+    std::vector<char> scratch_;        // untransformed data
+    std::string bufs_[2];              // for passing data between transforms
+
+    Counters source_counters_;
+    Counters sink_counters_;
+    std::vector<Counters> transform_counters_;
+    size_t max_pending_ {};
+};
+
+/**
+ * Reads from a nonblocking fd.
+ */
+class FdSource final: public Pipeline::Source
+{
+public:
+    explicit FdSource(int fd);
+    ssize_t read(char* buf, size_t max_bytes) override;
+    bool eof() const override;
+    int fd() const override;
+    std::string error_string() const override;
+
+private:
+    int const fd_;
+    bool eof_ {};
+    int errno_ {};
+};
+
+/**
+ * Writes to a nonblocking fd. If it's a socket, a closed peer is
+ * reported as an error instead of raising SIGPIPE.
+ */
+class FdSink final: public Pipeline::Sink
+{
+public:
+    explicit FdSink(int fd);
+    ssize_t write(struct iovec const* iov, int n_iov) override;
+    int fd() const override;
+    std::string error_string() const override;
+
+private:
+    int const fd_;
+    bool is_socket_ {true};
+    int errno_ {};
+};
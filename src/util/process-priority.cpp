@@ -0,0 +1,243 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "util/process-priority.h"
+
+#include <dirent.h>
+#include <sched.h>
+#include <sys/resource.h> // getrlimit(), setpriority()
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm> // std::find()
+#include <cstdio> // sscanf()
+#include <cstdlib> // strtol()
+#include <fstream>
+#include <string>
+
+constexpr int ProcessPriority::IOPRIO_CLASS_BE;
+constexpr int ProcessPriority::IOPRIO_CLASS_IDLE;
+
+namespace
+{
+
+// from linux/ioprio.h, which isn't always installed
+constexpr int IOPRIO_WHO_PROCESS {1};
+constexpr int IOPRIO_CLASS_SHIFT {13};
+constexpr int IOPRIO_PRIO_MASK {(1 << IOPRIO_CLASS_SHIFT) - 1};
+
+std::vector<pid_t> numeric_entries(std::string const& dirname)
+{
+    std::vector<pid_t> ret;
+
+    auto dir = opendir(dirname.c_str());
+    if (dir == nullptr)
+        return ret;
+
+    while (auto entry = readdir(dir))
+    {
+        char* end {};
+        auto const n = strtol(entry->d_name, &end, 10);
+        if ((n > 0) && (*end == '\0'))
+            ret.push_back(pid_t(n));
+    }
+
+    closedir(dir);
+    return ret;
+}
+
+// the process group field of /proc/<pid>/stat, or -1
+pid_t get_pgrp(pid_t pid)
+{
+    std::ifstream in("/proc/" + std::to_string(pid) + "/stat");
+    std::string stat;
+    std::getline(in, stat);
+
+    // the command name can hold anything, so start after its closing paren
+    auto const pos = stat.rfind(')');
+    if (pos == std::string::npos)
+        return -1;
+
+    char state {};
+    long ppid {}, pgrp {-1};
+    if (sscanf(stat.c_str() + pos + 1, " %c %ld %ld", &state, &ppid, &pgrp) != 3)
+        return -1;
+    return pid_t(pgrp);
+}
+
+// the cgroup v2 path of a process, or empty if it's not in one
+std::string get_cgroup(pid_t pid)
+{
+    std::ifstream in("/proc/" + std::to_string(pid) + "/cgroup");
+    std::string line;
+    while (std::getline(in, line))
+        if (line.compare(0, 3, "0::") == 0)
+            return line.substr(3);
+    return std::string();
+}
+
+bool write_file(std::string const& filename, std::string const& contents)
+{
+    std::ofstream out(filename);
+    out << contents;
+    out.close();
+    return !out.fail();
+}
+
+// only touch a cgroup if it holds nothing but the helper
+bool apply_cgroup(std::vector<pid_t> const& pids, int weight)
+{
+    if (pids.empty())
+        return false;
+
+    auto const cgroup = get_cgroup(pids.front());
+    if (cgroup.empty() || (cgroup == "/") || (cgroup == get_cgroup(getpid())))
+        return false;
+
+    auto const dir = "/sys/fs/cgroup" + cgroup;
+    std::ifstream in(dir + "/cgroup.procs");
+    if (!in)
+        return false;
+    for (long pid; in >> pid; )
+        if (std::find(pids.begin(), pids.end(), pid_t(pid)) == pids.end())
+            return false;
+
+    auto const cpu = write_file(dir + "/cpu.weight", std::to_string(weight));
+    auto const io = write_file(dir + "/io.weight", "default " + std::to_string(weight));
+    return cpu || io;
+}
+
+bool apply_thread(pid_t tid, ProcessPriority::Settings const& settings, bool renice)
+{
+    bool ok {true};
+
+    // switching between SCHED_BATCH and SCHED_OTHER needs no privileges
+    struct sched_param param {};
+    ok &= sched_setscheduler(tid, settings.policy, &param) == 0;
+    if (renice)
+        ok &= setpriority(PRIO_PROCESS, id_t(tid), settings.nice) == 0;
+
+    auto const ioprio = (settings.io_class << IOPRIO_CLASS_SHIFT) | settings.io_level;
+    ok &= syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid, ioprio) == 0;
+
+    return ok;
+}
+
+} // anonymous namespace
+
+ProcessPriority::Settings
+ProcessPriority::settings(Level level)
+{
+    switch (level)
+    {
+        case Level::IDLE:
+            return Settings{SCHED_BATCH, 10, IOPRIO_CLASS_IDLE, 7, 1};
+
+        case Level::BACKGROUND:
+            return Settings{SCHED_BATCH, 10, IOPRIO_CLASS_BE, 7, 25};
+
+        case Level::NORMAL:
+        default:
+            return Settings{SCHED_OTHER, 0, IOPRIO_CLASS_BE, 4, 100};
+    }
+}
+
+ProcessPriority::Result
+ProcessPriority::apply(std::vector<pid_t> const& pids, Level level)
+{
+    Result result;
+    auto const s = settings(level);
+
+    // a nice value that can't be undone would keep
+    // the helper slow after the user starts watching it
+    result.reniced = can_renice();
+
+    for (auto const pid : pids)
+    {
+        for (auto const tid : numeric_entries("/proc/" + std::to_string(pid) + "/task"))
+        {
+            ++result.n_threads;
+            if (!apply_thread(tid, s, result.reniced))
+                ++result.n_failed;
+        }
+    }
+
+    result.cgroup = apply_cgroup(pids, s.cgroup_weight);
+    return result;
+}
+
+bool
+ProcessPriority::can_renice()
+{
+    if (geteuid() == 0)
+        return true;
+
+    // the lowest nice value that RLIMIT_NICE allows is 20 - rlim_cur
+    struct rlimit limit {};
+    if (getrlimit(RLIMIT_NICE, &limit) != 0)
+        return false;
+    return (limit.rlim_cur == RLIM_INFINITY) || (limit.rlim_cur >= 20);
+}
+
+std::vector<pid_t>
+ProcessPriority::helper_processes(pid_t pid)
+{
+    auto const pgid = getpgid(pid);
+    if ((pgid <= 0) || (pgid == getpgrp()))
+        return std::vector<pid_t>{pid};
+
+    return processes_in_group(pgid);
+}
+
+std::vector<pid_t>
+ProcessPriority::processes_in_group(pid_t pgid)
+{
+    std::vector<pid_t> ret;
+
+    for (auto const pid : numeric_entries("/proc"))
+        if (get_pgrp(pid) == pgid)
+            ret.push_back(pid);
+
+    return ret;
+}
+
+bool
+ProcessPriority::get_io_priority(pid_t tid, int& setme_class, int& setme_level)
+{
+    auto const ioprio = syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, tid);
+    if (ioprio == -1)
+        return false;
+
+    setme_class = int(ioprio >> IOPRIO_CLASS_SHIFT);
+    setme_level = int(ioprio & IOPRIO_PRIO_MASK);
+    return true;
+}
+
+char const*
+ProcessPriority::to_string(Level level)
+{
+    switch (level)
+    {
+        case Level::IDLE:       return "idle";
+        case Level::BACKGROUND: return "background";
+        case Level::NORMAL:     return "normal";
+    }
+
+    return "bug";
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#pragma once
+
+#include <sys/types.h> // pid_t
+
+#include <vector>
+
+/**
+ * Sets how a helper's processes compete with foreground apps for CPU and disk.
+ *
+ * Each level sets the CPU scheduling policy and nice value and the I/O
+ * priority of every thread in the helper's processes. If those processes
+ * have a cgroup v2 group to themselves that we may write to, the level's
+ * cpu.weight and io.weight are set there too.
+ *
+ * Every level has to be reachable from every other one, since a helper
+ * goes back to normal priority while the user watches it. So SCHED_IDLE
+ * is never used, and nice values are only raised if RLIMIT_NICE lets us
+ * lower them back to 0 again. Without that, which is the usual case for
+ * an unprivileged user, the I/O priority and the cgroup weights are what
+ * keep a helper out of the way.
+ */
+class ProcessPriority
+{
+public:
+    enum class Level { IDLE, BACKGROUND, NORMAL };
+
+    struct Settings
+    {
+        int policy;         // SCHED_BATCH or SCHED_OTHER
+        int nice;           // only applied if can_renice()
+        int io_class;       // IOPRIO_CLASS_IDLE or IOPRIO_CLASS_BE
+        int io_level;       // 0 (highest) - 7 (lowest), for IOPRIO_CLASS_BE
+        int cgroup_weight;  // 1 - 10000; the kernel default is 100
+    };
+    static Settings settings(Level level);
+
+    static constexpr int IOPRIO_CLASS_BE {2};
+    static constexpr int IOPRIO_CLASS_IDLE {3};
+
+    struct Result
+    {
+        int n_threads {};
+        int n_failed {};   // threads where at least one setting failed
+        bool reniced {};   // whether the nice values were set
+        bool cgroup {};    // whether the cgroup weights were set
+    };
+    static Result apply(std::vector<pid_t> const& pids, Level level);
+
+    // true if RLIMIT_NICE lets us set nice values down to 0
+    static bool can_renice();
+
+    // the processes that make up the helper that `pid` belongs to:
+    // its process group, unless that's also ours
+    static std::vector<pid_t> helper_processes(pid_t pid);
+    static std::vector<pid_t> processes_in_group(pid_t pgid);
+
+    static bool get_io_priority(pid_t tid, int& setme_class, int& setme_level);
+
+    static char const* to_string(Level level);
+};
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "util/qiodevice-source.h"
+
+#include <algorithm> // std::min()
+
+QIODeviceSource::QIODeviceSource(QIODevice* device, qint64 n_bytes)
+    : device_{device}
+    , n_bytes_{n_bytes}
+{
+}
+
+ssize_t
+QIODeviceSource::read(char* buf, size_t max_bytes)
+{
+    if (!device_)
+        return -1;
+
+    auto n_wanted = qint64(max_bytes);
+    if (n_bytes_ >= 0)
+        n_wanted = std::min(n_wanted, n_bytes_ - n_read_);
+    if ((n_wanted <= 0) || (device_->bytesAvailable() <= 0))
+        return 0;
+
+    auto const n = device_->read(buf, n_wanted);
+    if (n > 0)
+        n_read_ += n;
+    return ssize_t(n);
+}
+
+bool
+QIODeviceSource::eof() const
+{
+    if (n_bytes_ >= 0)
+        return n_read_ >= n_bytes_;
+
+    return !device_ || !device_->isOpen() || (!device_->isSequential() && device_->atEnd());
+}
+
+std::string
+QIODeviceSource::error_string() const
+{
+    return device_
+        ? device_->errorString().toStdString()
+        : std::string("device was destroyed");
+}
+
+qint64
+QIODeviceSource::n_read() const
+{
+    return n_read_;
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#pragma once
+
+#include "util/pipeline.h"
+
+#include <QIODevice>
+#include <QPointer>
+
+#include <string>
+
+/**
+ * A Pipeline::Source that reads from a QIODevice,
+ * eg a storage framework downloader's socket.
+ *
+ * If n_bytes is given, the stream ends after that many bytes
+ * instead of when the device is closed.
+ */
+class QIODeviceSource final: public Pipeline::Source
+{
+public:
+    explicit QIODeviceSource(QIODevice* device, qint64 n_bytes = -1);
+
+    ssize_t read(char* buf, size_t max_bytes) override;
+    bool eof() const override;
+    std::string error_string() const override;
+
+    qint64 n_read() const;
+
+private:
+    QPointer<QIODevice> device_;
+    qint64 const n_bytes_;
+    qint64 n_read_ {};
+};
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+
+#include "util/retry-policy.h"
+
+#include <algorithm> // std::max(), std::min()
+
+constexpr int RetryPolicy::DEFAULT_MAX_ATTEMPTS;
+constexpr uint64_t RetryPolicy::DEFAULT_BASE_MSEC;
+constexpr uint64_t RetryPolicy::DEFAULT_MAX_MSEC;
+constexpr int RetryPolicy::DEFAULT_BUDGET;
+constexpr int RetryPolicy::TOKEN;
+
+RetryPolicy::RetryPolicy(int max_attempts, uint64_t base_msec, uint64_t max_msec, int budget)
+    : max_attempts_{std::max(max_attempts, 1)}
+    , base_msec_{std::max(base_msec, uint64_t(1))}
+    , max_msec_{std::max(max_msec, base_msec_)}
+    , max_tokens_{std::max(budget, 1) * TOKEN}
+    , tokens_{max_tokens_}
+{
+}
+
+bool
+RetryPolicy::should_retry(int n_failures) const
+{
+    return (n_failures < max_attempts_) && (tokens_ > max_tokens_ / 2);
+}
+
+uint64_t
+RetryPolicy::next_delay_msec(int n_failures)
+{
+    tokens_ = std::max(tokens_ - TOKEN, 0);
+
+    // base, 2*base, 4*base, ... without overflowing
+    auto ceiling = base_msec_;
+    for (int i=1; i<n_failures && ceiling<max_msec_; ++i)
+        ceiling *= 2;
+    ceiling = std::min(ceiling, max_msec_);
+
+    std::uniform_int_distribution<uint64_t> dist(ceiling / 2, ceiling);
+    return dist(engine_);
+}
+
+void
+RetryPolicy::on_success()
+{
+    tokens_ = std::min(tokens_ + 1, max_tokens_);
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+
+#pragma once
+
+#include <cstdint> // uint32_t, uint64_t
+#include <random>
+
+/**
+ * Decides whether, and when, to try a failed operation again.
+ *
+ * The wait before each retry grows exponentially from `base_msec` up to
+ * `max_msec`, and is jittered to somewhere between half and all of that
+ * so that operations which failed together don't all retry together.
+ * An operation is tried at most `max_attempts` times.
+ *
+ * The retry budget keeps retries from piling onto an outage: each retry
+ * spends a token, and each success earns back a tenth of one. Once half
+ * of the `budget` tokens are gone, failures aren't retried until enough
+ * operations have succeeded again.
+ */
+class RetryPolicy
+{
+public:
+
+    // how often an operation was retried, and how long it took because of that
+    struct Stats
+    {
+        uint32_t n_retries {};
+        uint64_t msec {};
+
+        Stats& operator+=(Stats const& that)
+        {
+            n_retries += that.n_retries;
+            msec += that.msec;
+            return *this;
+        }
+    };
+
+    static constexpr int DEFAULT_MAX_ATTEMPTS {4};
+    static constexpr uint64_t DEFAULT_BASE_MSEC {1000};
+    static constexpr uint64_t DEFAULT_MAX_MSEC {30000};
+    static constexpr int DEFAULT_BUDGET {10};
+
+    explicit RetryPolicy(int max_attempts = DEFAULT_MAX_ATTEMPTS,
+                         uint64_t base_msec = DEFAULT_BASE_MSEC,
+                         uint64_t max_msec = DEFAULT_MAX_MSEC,
+                         int budget = DEFAULT_BUDGET);
+
+    // whether an operation that has failed `n_failures` times may be tried again
+    bool should_retry(int n_failures) const;
+
+    // spends a token, and returns how long to wait before trying again
+    uint64_t next_delay_msec(int n_failures);
+
+    void on_success();
+
+private:
+    static constexpr int TOKEN {10}; // tokens are counted in tenths
+
+    int const max_attempts_;
+    uint64_t const base_msec_;
+    uint64_t const max_msec_;
+    int const max_tokens_;
+    int tokens_;
+    std::mt19937 engine_ {std::random_device{}()};
+};
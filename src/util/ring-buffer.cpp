@@ -0,0 +1,161 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "util/ring-buffer.h"
+
+#include <algorithm> // std::min()
+#include <cstring> // memcpy()
+
+RingBuffer::RingBuffer(size_t capacity)
+    : buf_(std::max(capacity, size_t(1)))
+{
+}
+
+size_t
+RingBuffer::capacity() const
+{
+    return buf_.size();
+}
+
+size_t
+RingBuffer::size() const
+{
+    return size_;
+}
+
+size_t
+RingBuffer::space() const
+{
+    return capacity() - size_;
+}
+
+bool
+RingBuffer::empty() const
+{
+    return size_ == 0;
+}
+
+bool
+RingBuffer::full() const
+{
+    return size_ == capacity();
+}
+
+void
+RingBuffer::clear()
+{
+    head_ = 0;
+    size_ = 0;
+}
+
+int
+RingBuffer::writable(struct iovec* iov)
+{
+    if (full())
+        return 0;
+
+    auto const tail = (head_ + size_) % capacity();
+    auto const base = buf_.data();
+
+    // free space is [tail, end) then [0, head) if it wraps
+    if (tail >= head_)
+    {
+        iov[0].iov_base = base + tail;
+        iov[0].iov_len = capacity() - tail;
+        if (head_ == 0)
+            return 1;
+        iov[1].iov_base = base;
+        iov[1].iov_len = head_;
+        return 2;
+    }
+
+    iov[0].iov_base = base + tail;
+    iov[0].iov_len = head_ - tail;
+    return 1;
+}
+
+void
+RingBuffer::commit(size_t n)
+{
+    size_ += std::min(n, space());
+}
+
+int
+RingBuffer::readable(struct iovec* iov) const
+{
+    if (empty())
+        return 0;
+
+    auto const base = const_cast<char*>(buf_.data());
+    auto const first = std::min(size_, capacity() - head_);
+    iov[0].iov_base = base + head_;
+    iov[0].iov_len = first;
+    if (first == size_)
+        return 1;
+
+    iov[1].iov_base = base;
+    iov[1].iov_len = size_ - first;
+    return 2;
+}
+
+void
+RingBuffer::consume(size_t n)
+{
+    n = std::min(n, size_);
+    head_ = (head_ + n) % capacity();
+    size_ -= n;
+    if (!size_)
+        head_ = 0; // keep the next write contiguous
+}
+
+size_t
+RingBuffer::write(char const* data, size_t len)
+{
+    struct iovec iov[2];
+    auto const n_iov = writable(iov);
+
+    size_t n {};
+    for (int i=0; i<n_iov && n<len; ++i)
+    {
+        auto const n_this = std::min(len - n, iov[i].iov_len);
+        memcpy(iov[i].iov_base, data + n, n_this);
+        n += n_this;
+    }
+
+    commit(n);
+    return n;
+}
+
+size_t
+RingBuffer::read(char* data, size_t len)
+{
+    struct iovec iov[2];
+    auto const n_iov = readable(iov);
+
+    size_t n {};
+    for (int i=0; i<n_iov && n<len; ++i)
+    {
+        auto const n_this = std::min(len - n, iov[i].iov_len);
+        memcpy(data + n, iov[i].iov_base, n_this);
+        n += n_this;
+    }
+
+    consume(n);
+    return n;
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#pragma once
+
+#include <sys/uio.h> // struct iovec
+
+#include <cstddef> // size_t
+#include <vector>
+
+/**
+ * A fixed-capacity byte FIFO for relaying data between sockets.
+ *
+ * The storage is allocated once, and data is never moved inside it:
+ * readers and writers work on the free or filled regions in place,
+ * which wrap around the end of the storage as at most two iovecs.
+ */
+class RingBuffer
+{
+public:
+    explicit RingBuffer(size_t capacity);
+
+    size_t capacity() const;
+    size_t size() const;
+    size_t space() const;
+    bool empty() const;
+    bool full() const;
+    void clear();
+
+    // fills `iov` with the free regions and returns how many there are (0-2).
+    // after writing into them, call commit() with the number of bytes written.
+    int writable(struct iovec* iov);
+    void commit(size_t n);
+
+    // fills `iov` with the filled regions and returns how many there are (0-2).
+    // after reading from them, call consume() with the number of bytes read.
+    int readable(struct iovec* iov) const;
+    void consume(size_t n);
+
+    // convenience wrappers that copy in and out. They return the number of
+    // bytes copied, which may be less than `len`.
+    size_t write(char const* data, size_t len);
+    size_t read(char* data, size_t len);
+
+private:
+    std::vector<char> buf_;
+    size_t head_ {}; // where the next read starts
+    size_t size_ {};
+};
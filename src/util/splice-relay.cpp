@@ -0,0 +1,248 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // splice(), tee()
+#endif
+
+#include "util/splice-relay.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm> // std::min()
+#include <cerrno>
+
+namespace
+{
+
+// large enough to move a good-sized chunk per syscall,
+// and still below the default /proc/sys/fs/pipe-max-size
+constexpr int PIPE_SIZE {256*1024};
+
+void close_pipe(int (&fds)[2])
+{
+    for (auto& fd : fds)
+    {
+        if (fd != -1)
+            ::close(fd);
+        fd = -1;
+    }
+}
+
+} // anonymous namespace
+
+SpliceRelay::SpliceRelay(Observer const& observer)
+    : observer_{observer}
+{
+    if ((pipe2(pipe_, O_NONBLOCK|O_CLOEXEC) == -1) ||
+        (observer_ && (pipe2(tap_, O_NONBLOCK|O_CLOEXEC) == -1)))
+    {
+        close_pipe(pipe_);
+        close_pipe(tap_);
+        return;
+    }
+
+    // best effort; if it fails, we just use the default size
+    fcntl(pipe_[1], F_SETPIPE_SZ, PIPE_SIZE);
+    if (observer_)
+        fcntl(tap_[1], F_SETPIPE_SZ, PIPE_SIZE);
+
+    auto const size = fcntl(pipe_[1], F_GETPIPE_SZ);
+    capacity_ = size > 0 ? size_t(size) : size_t(4096);
+    if (observer_)
+        buf_.resize(capacity_);
+}
+
+SpliceRelay::~SpliceRelay()
+{
+    close_pipe(pipe_);
+    close_pipe(tap_);
+}
+
+bool
+SpliceRelay::is_valid() const
+{
+    return pipe_[0] != -1;
+}
+
+int64_t
+SpliceRelay::n_pending() const
+{
+    return int64_t(n_in_pipe_);
+}
+
+bool
+SpliceRelay::set_pipe_size(size_t n_bytes)
+{
+    if (!is_valid() || (n_in_pipe_ > 0))
+        return false;
+
+    auto const size = fcntl(pipe_[1], F_SETPIPE_SZ, int(n_bytes));
+    if (size <= 0)
+        return false;
+    if (observer_)
+        fcntl(tap_[1], F_SETPIPE_SZ, size);
+
+    capacity_ = size_t(size);
+    if (observer_)
+        buf_.resize(capacity_);
+    return true;
+}
+
+size_t
+SpliceRelay::pipe_size() const
+{
+    return capacity_;
+}
+
+SpliceRelay::Result
+SpliceRelay::relay(int in_fd, int out_fd, size_t max_write)
+{
+    Result result;
+
+    if (!is_valid())
+    {
+        result.read_errno = EBADF;
+        return result;
+    }
+
+    for (;;)
+    {
+        // tee() always copies from the front of the pipe, so data is only
+        // observed once everything in front of it has been sent along
+        if (n_observed_ > 0)
+        {
+            auto const max_bytes = std::min(n_observed_, max_write - size_t(result.n_written));
+            if (max_bytes == 0)
+            {
+                result.throttled = true;
+                break;
+            }
+            auto const n = splice(pipe_[0], nullptr, out_fd, nullptr, max_bytes, SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+            if (n > 0)
+            {
+                n_observed_ -= size_t(n);
+                n_in_pipe_ -= size_t(n);
+                result.n_written += n;
+            }
+            else if ((n == -1) && (errno == EINTR))
+            {
+                continue;
+            }
+            else if ((n == -1) && (errno == EAGAIN))
+            {
+                result.want_write = true;
+                break;
+            }
+            else
+            {
+                result.write_errno = n == 0 ? EPIPE : errno;
+                break;
+            }
+        }
+        else if (n_in_pipe_ > 0)
+        {
+            if (!observer_)
+            {
+                n_observed_ = n_in_pipe_;
+            }
+            else
+            {
+                auto const n = tee(pipe_[0], tap_[1], n_in_pipe_, SPLICE_F_NONBLOCK);
+                if (n > 0)
+                {
+                    if (!observe(size_t(n), result.read_errno))
+                        break;
+                    n_observed_ = size_t(n);
+                }
+                else if ((n == -1) && (errno == EINTR))
+                {
+                    continue;
+                }
+                else
+                {
+                    result.read_errno = n == 0 ? EIO : errno;
+                    break;
+                }
+            }
+        }
+        else if (eof_)
+        {
+            result.eof = true;
+            break;
+        }
+        else if (in_fd == -1)
+        {
+            result.want_read = true;
+            break;
+        }
+        else
+        {
+            auto const n = splice(in_fd, nullptr, pipe_[1], nullptr, capacity_, SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+            if (n > 0)
+            {
+                n_in_pipe_ = size_t(n);
+                result.n_read += n;
+            }
+            else if (n == 0)
+            {
+                eof_ = true;
+            }
+            else if (errno == EAGAIN)
+            {
+                result.want_read = true;
+                break;
+            }
+            else if (errno != EINTR)
+            {
+                result.read_errno = errno;
+                break;
+            }
+        }
+    }
+
+    return result;
+}
+
+// drain the tee()d copy from the tap and hand it to the observer
+bool
+SpliceRelay::observe(size_t len, int& setme_errno)
+{
+    while (len > 0)
+    {
+        auto const n = ::read(tap_[0], buf_.data(), std::min(len, buf_.size()));
+        if (n > 0)
+        {
+            observer_(buf_.data(), size_t(n));
+            len -= size_t(n);
+        }
+        else if ((n == -1) && (errno == EINTR))
+        {
+            continue;
+        }
+        else
+        {
+            setme_errno = n == 0 ? EIO : errno;
+            return false;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#pragma once
+
+#include <cstddef> // size_t
+#include <cstdint> // int64_t, SIZE_MAX
+#include <functional>
+#include <vector>
+
+/**
+ * Moves data between two nonblocking fds with splice(), so that the
+ * bytes never pass through a userspace buffer on their way.
+ *
+ * If an observer is given, a copy of the data is tee()d to it before
+ * it's sent, eg so that a TarIndexer can see the stream go by.
+ */
+class SpliceRelay
+{
+public:
+    using Observer = std::function<void(char const* data, size_t len)>;
+
+    explicit SpliceRelay(Observer const& observer = nullptr);
+    ~SpliceRelay();
+
+    SpliceRelay(SpliceRelay const&) =delete;
+    SpliceRelay& operator=(SpliceRelay const&) =delete;
+
+    // false if the pipes couldn't be created
+    bool is_valid() const;
+
+    struct Result
+    {
+        int64_t n_read {};     // bytes taken from in_fd
+        int64_t n_written {};  // bytes delivered to out_fd
+        bool eof {};           // in_fd has been closed by its writer
+        bool want_read {};     // stopped because in_fd had nothing to read
+        bool want_write {};    // stopped because out_fd was full
+        bool throttled {};     // stopped because max_write was reached
+        int read_errno {};
+        int write_errno {};
+    };
+
+    // relays as much as possible without blocking, up to max_write bytes.
+    // If in_fd is -1, only the data that's already been read is relayed.
+    Result relay(int in_fd, int out_fd, size_t max_write = SIZE_MAX);
+
+    // bytes that have been read but not yet written
+    int64_t n_pending() const;
+
+    // resizes the pipes. This can only be done while they're empty.
+    // Returns false if the size couldn't be changed.
+    bool set_pipe_size(size_t n_bytes);
+    size_t pipe_size() const;
+
+private:
+    bool observe(size_t len, int& setme_errno);
+
+    Observer observer_;
+    int pipe_[2] {-1, -1};
+    int tap_[2] {-1, -1};
+    size_t capacity_ {};
+    size_t n_in_pipe_ {};  // bytes in pipe_
+    size_t n_observed_ {}; // bytes at the front of pipe_ that the observer has seen
+    bool eof_ {};
+    std::vector<char> buf_;
+};
@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "util/token-bucket.h"
+
+#include <algorithm> // std::max(), std::min()
+
+constexpr int TokenBucket::DEFAULT_BURST_MSEC;
+constexpr uint64_t TokenBucket::MIN_BURST;
+constexpr uint64_t TokenBucket::UNLIMITED;
+
+TokenBucket::TokenBucket(uint64_t bytes_per_second, int burst_msec)
+    : rate_{bytes_per_second}
+    , burst_msec_{std::max(burst_msec, 1)}
+{
+    tokens_ = burst();
+}
+
+void
+TokenBucket::set_rate(uint64_t bytes_per_second, uint64_t now_msec)
+{
+    if (rate_ == bytes_per_second)
+        return;
+
+    refill(now_msec);
+    auto const was_limited = is_limited();
+    rate_ = bytes_per_second;
+    remainder_ = 0;
+    last_refill_ = now_msec;
+
+    // a newly-limited stream starts with a full bucket
+    tokens_ = was_limited ? std::min(tokens_, burst()) : burst();
+}
+
+uint64_t
+TokenBucket::rate() const
+{
+    return rate_;
+}
+
+bool
+TokenBucket::is_limited() const
+{
+    return rate_ != 0;
+}
+
+uint64_t
+TokenBucket::available(uint64_t now_msec)
+{
+    if (!is_limited())
+        return UNLIMITED;
+
+    refill(now_msec);
+    return tokens_;
+}
+
+void
+TokenBucket::consume(uint64_t n_bytes)
+{
+    if (is_limited())
+        tokens_ -= std::min(tokens_, n_bytes);
+}
+
+uint64_t
+TokenBucket::msec_until_available(uint64_t n_bytes, uint64_t now_msec)
+{
+    if (!is_limited())
+        return 0;
+
+    refill(now_msec);
+    n_bytes = std::min(n_bytes, burst());
+    if (tokens_ >= n_bytes)
+        return 0;
+
+    // round up so that waking up on time always finds enough
+    auto const needed = (n_bytes - tokens_) * 1000u;
+    auto const have = remainder_;
+    return needed > have ? (needed - have + rate_ - 1) / rate_ : 0;
+}
+
+void
+TokenBucket::refill(uint64_t now_msec)
+{
+    if (now_msec <= last_refill_)
+    {
+        // the clock went backwards; start counting from here
+        last_refill_ = now_msec;
+        return;
+    }
+
+    // anything longer than this fills the bucket anyway
+    static constexpr uint64_t MAX_ELAPSED_MSEC {60*1000};
+    remainder_ += rate_ * std::min(now_msec - last_refill_, MAX_ELAPSED_MSEC);
+    last_refill_ = now_msec;
+    tokens_ = std::min(tokens_ + remainder_ / 1000u, burst());
+    remainder_ %= 1000u;
+}
+
+uint64_t
+TokenBucket::burst() const
+{
+    return std::max(rate_ * uint64_t(burst_msec_) / 1000u, MIN_BURST);
+}
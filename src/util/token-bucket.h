@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#pragma once
+
+#include <cstdint> // uint64_t
+
+/**
+ * Rate-limits a stream of bytes.
+ *
+ * Tokens accrue at `bytes_per_second`, up to a burst of `burst_msec`
+ * worth, and each byte sent spends one. A rate of zero means unlimited.
+ * Timestamps are in msec and come from the caller, eg Helper's clock.
+ */
+class TokenBucket
+{
+public:
+    static constexpr int DEFAULT_BURST_MSEC {100};
+    static constexpr uint64_t MIN_BURST {4096};
+    static constexpr uint64_t UNLIMITED {UINT64_MAX};
+
+    explicit TokenBucket(uint64_t bytes_per_second = 0, int burst_msec = DEFAULT_BURST_MSEC);
+
+    void set_rate(uint64_t bytes_per_second, uint64_t now_msec);
+    uint64_t rate() const;
+    bool is_limited() const;
+
+    // how many bytes may be sent now, or UNLIMITED
+    uint64_t available(uint64_t now_msec);
+
+    void consume(uint64_t n_bytes);
+
+    // how long until `n_bytes` may be sent
+    uint64_t msec_until_available(uint64_t n_bytes, uint64_t now_msec);
+
+private:
+    void refill(uint64_t now_msec);
+    uint64_t burst() const;
+
+    uint64_t rate_ {};
+    int burst_msec_ {};
+    uint64_t tokens_ {};
+    uint64_t remainder_ {}; // fractional tokens, in thousandths
+    uint64_t last_refill_ {};
+};
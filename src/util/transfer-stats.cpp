@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "util/transfer-stats.h"
+
+#include <algorithm> // std::max()
+#include <cmath> // std::exp()
+
+constexpr uint64_t TransferStats::DEFAULT_WINDOW_MSEC;
+constexpr uint64_t TransferStats::SAMPLE_MSEC;
+
+TransferStats::TransferStats(uint64_t window_msec)
+    : alpha_{1.0 - std::exp(-double(SAMPLE_MSEC) / double(std::max(window_msec, SAMPLE_MSEC)))}
+    , window_msec_{std::max(window_msec, SAMPLE_MSEC)}
+{
+}
+
+void
+TransferStats::reset(uint64_t now, uint64_t n_total)
+{
+    *this = TransferStats(window_msec_);
+    start_ = now;
+    n_total_ = n_total;
+}
+
+void
+TransferStats::add(uint64_t now, uint64_t n_bytes)
+{
+    if (!first_byte_)
+    {
+        first_byte_ = now;
+        sample_start_ = now;
+    }
+
+    roll(now);
+    sample_bytes_ += n_bytes;
+    n_bytes_ += n_bytes;
+    last_byte_ = now;
+}
+
+// folds each finished sample into the moving average
+void
+TransferStats::roll(uint64_t now) const
+{
+    if (!first_byte_)
+        return;
+
+    while (now >= sample_start_ + SAMPLE_MSEC)
+    {
+        auto const sample = double(sample_bytes_) * 1000.0 / double(SAMPLE_MSEC);
+        smoothed_ = primed_ ? smoothed_ + alpha_ * (sample - smoothed_) : sample;
+        primed_ = true;
+        sample_bytes_ = 0;
+        sample_start_ += SAMPLE_MSEC;
+
+        // after a long stall there's nothing left to decay,
+        // so skip ahead instead of counting out every sample
+        if (now > sample_start_ + window_msec_ * 8)
+        {
+            smoothed_ = 0;
+            sample_start_ = now - (now - sample_start_) % SAMPLE_MSEC;
+        }
+    }
+}
+
+TransferStats::Snapshot
+TransferStats::snapshot(uint64_t now) const
+{
+    roll(now);
+
+    Snapshot ret;
+    ret.n_bytes = n_bytes_;
+    if (n_total_ > n_bytes_)
+        ret.n_remaining = n_total_ - n_bytes_;
+
+    if (first_byte_)
+    {
+        auto const elapsed = std::max(now - first_byte_, SAMPLE_MSEC);
+        ret.average_bps = n_bytes_ * 1000u / elapsed;
+    }
+
+    // until the first sample is in, the average is the best guess
+    ret.smoothed_bps = primed_ ? uint64_t(smoothed_ + 0.5) : ret.average_bps;
+
+    auto const last = first_byte_ ? last_byte_ : start_;
+    ret.stalled_msec = now > last ? now - last : 0;
+
+    if (n_total_ && !ret.n_remaining)
+        ret.eta_msec = 0;
+    else if (ret.n_remaining && ret.smoothed_bps)
+        ret.eta_msec = int64_t(ret.n_remaining * 1000u / ret.smoothed_bps);
+
+    return ret;
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#pragma once
+
+#include <cstdint> // uint64_t, int64_t
+
+/**
+ * Tracks a transfer's throughput over time: its average and smoothed
+ * rates, how long it's been since data last moved, and when it should
+ * be done.
+ *
+ * The smoothed rate is an exponentially weighted moving average of
+ * one-second samples over a window much longer than the instantaneous
+ * speed's, so that ETAs don't swing with every hiccup. It decays
+ * toward zero while the transfer is stalled.
+ */
+class TransferStats
+{
+public:
+    static constexpr uint64_t DEFAULT_WINDOW_MSEC {20000};
+    static constexpr uint64_t SAMPLE_MSEC {1000};
+
+    explicit TransferStats(uint64_t window_msec = DEFAULT_WINDOW_MSEC);
+
+    // starts over with a transfer of n_total bytes, or of unknown size if 0
+    void reset(uint64_t now, uint64_t n_total);
+    void add(uint64_t now, uint64_t n_bytes);
+
+    struct Snapshot
+    {
+        uint64_t n_bytes {};
+        uint64_t n_remaining {};  // 0 if the size is unknown
+        uint64_t average_bps {};  // since the first byte moved
+        uint64_t smoothed_bps {};
+        uint64_t stalled_msec {}; // since data last moved
+        int64_t eta_msec {-1};    // -1 if unknown
+    };
+    Snapshot snapshot(uint64_t now) const;
+
+private:
+    void roll(uint64_t now) const;
+
+    double alpha_ {};
+    uint64_t window_msec_ {};
+    uint64_t start_ {};
+    uint64_t first_byte_ {};
+    uint64_t last_byte_ {};
+    uint64_t n_total_ {};
+    uint64_t n_bytes_ {};
+
+    mutable uint64_t sample_start_ {};
+    mutable uint64_t sample_bytes_ {};
+    mutable double smoothed_ {};
+    mutable bool primed_ {};
+};
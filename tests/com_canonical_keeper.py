@@ -358,11 +358,37 @@ def user_build_state(user):
     )
 
 
+def user_build_state_delta(old_state, new_state):
+    """Returns the (changes, removed) arguments of a StateChanged signal."""
+
+    changes = {}
+    removed = [uuid for uuid in old_state if uuid not in new_state]
+    for uuid, task_state in new_state.items():
+        old = old_state.get(uuid, {})
+        changed = {k: v for k, v in task_state.items() if old.get(k) != v}
+        lost_keys = any(k not in task_state for k in old)
+        if lost_keys:
+            removed.append(uuid)
+            changed = dict(task_state)
+        if lost_keys or changed:
+            changes[uuid] = dbus.Dictionary(changed, signature='sv')
+    return (
+        dbus.Dictionary(changes, signature='sa{sv}'),
+        dbus.Array(removed, signature='s')
+    )
+
+
 def user_update_state_property(user):
     old_state = user.Get(USER_IFACE, 'State')
     new_state = user.build_state(user)
     if old_state != new_state:
         user.Set(USER_IFACE, 'State', new_state)
+        user.EmitSignal(
+            USER_IFACE,
+            'StateChanged',
+            'a{sa{sv}}as',
+            list(user_build_state_delta(old_state, new_state))
+        )
 
 
 #
@@ -497,6 +523,16 @@ def load(main, parameters):
          'self.start_restore(self, args[0])'),
         ('Cancel', '', '',
          'self.cancel(self)'),
+        ('SetBandwidthLimits', 'tt', '',
+         'self.log("bandwidth limits: up %s down %s" % (args[0], args[1]))'),
+        ('SetBandwidthProfiles', 'a{sa{sv}}', '',
+         'self.log("bandwidth profiles: %s" % (args[0]))'),
+        ('SetForeground', 'b', '',
+         'self.log("foreground: %s" % (args[0]))'),
+        ('SetMaxConcurrentTasks', 'u', '',
+         'self.log("max concurrent tasks: %s" % (args[0]))'),
+        ('SetMultipartUpload', 'tu', '',
+         'self.log("multipart upload: %s %s" % (args[0], args[1]))'),
     ])
     o.AddProperty(USER_IFACE, "State", o.build_state(o))
 
@@ -509,6 +545,13 @@ def load(main, parameters):
     o.AddMethods(HELPER_IFACE, [
         ('StartBackup', 't', 'h',
          'ret = self.start_backup(self, args[0])'),
+        # the mock's socket already plays the part of the storage backend
+        ('StartBackupDirect', 't', 'h',
+         'ret = self.start_backup(self, args[0])'),
+        ('UpdateBackupProgress', 't', '',
+         'self.log("backup progress: %s bytes" % (args[0]))'),
+        ('SetBackupCatalog', 'ay', '',
+         'self.log("got a %s byte catalog" % (len(args[0])))'),
         ('StartRestore', '', 'h',
          'ret = self.start_restore(self)')
     ])
@@ -0,0 +1,96 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include <QElapsedTimer>
+#include <QUuid>
+
+#include "tests/utils/keeper-dbusmock-fixture.h"
+
+#include <client/client.h>
+
+#include <QDBusInterface>
+#include <QSignalSpy>
+#include <QString>
+#include <QVariant>
+
+class KeeperClientTest: public KeeperDBusMockFixture
+{
+protected:
+
+    // makes the mock service emit a StateChanged signal
+    void emit_state_changed(QVariantDictMap const& changes, QStringList const& removed)
+    {
+        QDBusInterface mock(
+            DBusTypes::KEEPER_SERVICE,
+            DBusTypes::KEEPER_USER_PATH,
+            QStringLiteral("org.freedesktop.DBus.Mock"),
+            connection()
+        );
+        auto msg = mock.call(
+            QStringLiteral("EmitSignal"),
+            QString::fromUtf8(DBusTypes::KEEPER_USER_INTERFACE),
+            QStringLiteral("StateChanged"),
+            QStringLiteral("a{sa{sv}}as"),
+            QVariantList{ QVariant::fromValue(changes), QVariant::fromValue(removed) }
+        );
+        EXPECT_NE(QDBusMessage::ErrorMessage, msg.type()) << qPrintable(msg.errorMessage());
+    }
+
+    static QVariantMap task_state(QString const& action, double percent_done)
+    {
+        return QVariantMap{
+            { KEY_NAME, QStringLiteral("some-name") },
+            { KEY_ACTION, action },
+            { KEY_PERCENT, percent_done }
+        };
+    }
+};
+
+// KeeperClient keeps its own copy of the state, built up from StateChanged deltas
+TEST_F(KeeperClientTest, AppliesStateDeltas)
+{
+    KeeperClient client;
+    QSignalSpy spy(&client, &KeeperClient::progressChanged);
+
+    // new tasks are sent whole
+    emit_state_changed({
+        { "a", task_state(ACTION_SAVING, 0.5) },
+        { "b", task_state(ACTION_QUEUED, 0.0) }
+    }, {});
+    ASSERT_TRUE(spy.wait());
+    EXPECT_DOUBLE_EQ(0.25, client.progress());
+    spy.clear();
+
+    // after that, only what changed
+    emit_state_changed({ { "b", QVariantMap{ { KEY_PERCENT, 0.5 } } } }, {});
+    ASSERT_TRUE(spy.wait());
+    EXPECT_DOUBLE_EQ(0.5, client.progress());
+    spy.clear();
+
+    // removed tasks stop counting
+    emit_state_changed({ { "a", QVariantMap{ { KEY_PERCENT, 1.0 } } } }, { "b" });
+    ASSERT_TRUE(spy.wait());
+    EXPECT_DOUBLE_EQ(1.0, client.progress());
+    spy.clear();
+
+    // a task that lost properties is removed and sent again whole
+    emit_state_changed({ { "a", task_state(ACTION_QUEUED, 0.0) } }, { "a" });
+    ASSERT_TRUE(spy.wait());
+    EXPECT_DOUBLE_EQ(0.0, client.progress());
+}
@@ -88,6 +88,24 @@ QString get_app_id(QStringList const &env)
     }
     return QString();
 }
+
+// set when several helpers for the same app can run at once
+QString get_instance_id(QStringList const &env)
+{
+    for (auto item : env)
+    {
+        if (item.startsWith("INSTANCE_ID="))
+        {
+            return item.remove(QString("INSTANCE_ID="));
+        }
+    }
+    return QString();
+}
+
+QString get_process_key(QString const & app_id, QString const & instance_id)
+{
+    return QStringLiteral("%1:%2").arg(instance_id).arg(app_id);
+}
 } // namespace
 
 QDBusObjectPath UpstartJobMock::Start(QStringList const &env, bool wait)
@@ -96,17 +114,19 @@ QDBusObjectPath UpstartJobMock::Start(QStringList const &env, bool wait)
     auto params = get_process_args(env);
 
     auto app_id = get_app_id(env);
+    auto instance_id = get_instance_id(env);
 
     if (app_id.isEmpty())
     {
         sendErrorReply(QDBusError::InvalidArgs, QString("Failed starting job. Please check that the APP_ID env is valid: [%s]").arg(env.join(':')));
     }
-    // arg[0] is the process, arg[1] is the directory where to execute the process
-    if (params.size() != 2)
+    // arg[0] is the process, arg[1] is the directory where to execute the process,
+    // and the optional arg[2] is the bus path that the helper reports on
+    if (params.size() < 2)
     {
         sendErrorReply(QDBusError::InvalidArgs, QString("Failed starting job. Please check that the APP_URIS env is valid: [%s]").arg(env.join(':')));
     }
-    if (!start_process(app_id, params.at(0), params.at(1)))
+    if (!start_process(app_id, instance_id, params.at(0), params.at(1), params.value(2)))
     {
         sendErrorReply(QDBusError::InvalidArgs, QString("Failed starting job. Please check that the APP_URIS env is valid: [%s]").arg(env.join(':')));
     }
@@ -123,7 +143,7 @@ void UpstartJobMock::Stop(QStringList const &env, bool wait)
          sendErrorReply(QDBusError::InvalidArgs, QString("Failed stopping job. Please check that the APP_ID env is valid: [%s]").arg(env.join(':')));
          return;
      }
-     auto iter = processes_.find(app_id);
+     auto iter = processes_.find(get_process_key(app_id, get_instance_id(env)));
      if (iter == processes_.end())
      {
          sendErrorReply(QDBusError::InvalidArgs, QString("Failed stopping job. Process for app_id was not found [%s]").arg(app_id));
@@ -142,13 +162,25 @@ QList<QDBusObjectPath> UpstartJobMock::GetAllInstances() const
     return ret;
 }
 
-bool UpstartJobMock::start_process(QString const & app_id, QString const & path, QString const & cwd)
+bool UpstartJobMock::start_process(QString const & app_id,
+                                   QString const & instance_id,
+                                   QString const & path,
+                                   QString const & cwd,
+                                   QString const & helper_path)
 {
     auto new_process = QSharedPointer<QProcess>(new QProcess(this));
 
     // set the cwd
     new_process->setWorkingDirectory(cwd);
 
+    // like exec-tool, tell the helper which bus path to report on
+    if (!helper_path.isEmpty())
+    {
+        auto process_env = QProcessEnvironment::systemEnvironment();
+        process_env.insert(QStringLiteral("KEEPER_HELPER_PATH"), helper_path);
+        new_process->setProcessEnvironment(process_env);
+    }
+
     /* uncomment this line to see keeper-service stdout/stderr in test logs
        NB: this is useful for manual debugging but not for automated tests
        because connecting stdout/stderr between processes keeps keeper-service
@@ -168,15 +200,16 @@ bool UpstartJobMock::start_process(QString const & app_id, QString const & path,
         return false;
     }
 
-    QString instance_name = QStringLiteral("INSTANCE=backup-helper::%1").arg(app_id);
+    QString instance_name = QStringLiteral("INSTANCE=backup-helper:%1:%2").arg(instance_id).arg(app_id);
     qDebug() << "Sending signal " << QStringList{"JOB=untrusted-helper", instance_name};
     Q_EMIT(upstart_adaptor_->EventEmitted("started", {"JOB=untrusted-helper", instance_name}));
 
-    processes_[app_id] = new_process;
-    auto on_finished = [this, new_process, instance_name, app_id](int exit_code, QProcess::ExitStatus /*exit_status*/)
+    auto const key = get_process_key(app_id, instance_id);
+    processes_[key] = new_process;
+    auto on_finished = [this, new_process, instance_name, key](int exit_code, QProcess::ExitStatus /*exit_status*/)
     {
         qDebug() << "Process finished: " << new_process->pid() << " Exit code: " << exit_code;
-        auto iter = processes_.find(app_id);
+        auto iter = processes_.find(key);
         if (iter != processes_.end())
         {
             processes_.erase(iter);
@@ -46,9 +46,13 @@ public:
 Q_SIGNALS:
     void EventEmitted(QString const &name, QStringList const &env);
 private:
-    bool start_process(QString const & app_id, QString const & path, QString const & cwd);
+    bool start_process(QString const & app_id,
+                       QString const & instance_id,
+                       QString const & path,
+                       QString const & cwd,
+                       QString const & helper_path);
 
-    QMap<QString, QSharedPointer<QProcess>> processes_;
+    QMap<QString, QSharedPointer<QProcess>> processes_; // keyed by instance and app id
     QMap<QString, QString> job_paths_;
     QSharedPointer<UpstartMockAdaptor> upstart_adaptor_;
 };
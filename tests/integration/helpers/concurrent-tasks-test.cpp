@@ -0,0 +1,182 @@
+/*
+ * Copyright 2013-2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *     Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "test-helpers-base.h"
+
+#include <QElapsedTimer>
+
+#include <algorithm>
+
+namespace
+{
+    bool has_manifest()
+    {
+        for (auto const& file : StorageFrameworkLocalUtils::get_storage_framework_files())
+            if (file.fileName() == QStringLiteral("manifest.json"))
+                return true;
+        return false;
+    }
+}
+
+// runs two backups and two restores at once
+class ConcurrentTasksBase: public TestHelpersBase
+{
+protected:
+
+    void run_concurrently()
+    {
+        XdgUserDirsSandbox tmp_dir;
+
+        // starts the services, including keeper-service
+        start_tasks();
+
+        QSharedPointer<DBusInterfaceKeeperUser> user_iface(new DBusInterfaceKeeperUser(
+                                                                DBusTypes::KEEPER_SERVICE,
+                                                                DBusTypes::KEEPER_USER_PATH,
+                                                                dbus_test_runner.sessionConnection()
+                                                            ) );
+        ASSERT_TRUE(user_iface->isValid()) << qPrintable(dbus_test_runner.sessionConnection().lastError().message());
+
+        QDBusReply<void> max_reply = user_iface->call("SetMaxConcurrentTasks", 2u);
+        ASSERT_TRUE(max_reply.isValid()) << qPrintable(max_reply.error().message());
+
+        QDBusReply<keeper::Items> choices = user_iface->call("GetBackupChoices");
+        ASSERT_TRUE(choices.isValid()) << qPrintable(choices.error().message());
+
+        // fill two folders with different contents
+        QStringList user_dirs;
+        QStringList uuids;
+        QVector<BackupItem> backup_items;
+        for (auto const& user_option : { "XDG_MUSIC_DIR", "XDG_VIDEOS_DIR" })
+        {
+            auto const user_dir = QString::fromUtf8(qgetenv(user_option));
+            ASSERT_FALSE(user_dir.isEmpty());
+            FileUtils::fillTemporaryDirectory(user_dir, 1 + qrand() % 100);
+
+            auto const uuid = get_uuid_for_xdg_folder_path(user_dir, choices.value());
+            ASSERT_FALSE(uuid.isEmpty());
+
+            user_dirs << user_dir;
+            uuids << uuid;
+            backup_items.push_back(BackupItem{get_display_name_for_xdg_folder_path(user_dir, choices.value()),
+                                              get_type_for_xdg_folder_path(user_dir, choices.value()),
+                                              uuid});
+        }
+
+        QSharedPointer<DBusPropertiesInterface> properties_interface(new DBusPropertiesInterface(
+                                                                DBusTypes::KEEPER_SERVICE,
+                                                                DBusTypes::KEEPER_USER_PATH,
+                                                                dbus_test_runner.sessionConnection()
+                                                            ) );
+        ASSERT_TRUE(properties_interface->isValid()) << qPrintable(QDBusConnection::sessionBus().lastError().message());
+        QSignalSpy spy(properties_interface.data(), &DBusPropertiesInterface::PropertiesChanged);
+
+        QDBusReply<void> backup_reply = user_iface->call("StartBackup", uuids, "");
+        ASSERT_TRUE(backup_reply.isValid()) << qPrintable(dbus_test_runner.sessionConnection().lastError().message());
+
+        // the manifest lists every task, so it mustn't be written
+        // while one of them is still running
+        QElapsedTimer timer;
+        timer.start();
+        for (;;)
+        {
+            auto const state = user_iface->state();
+            auto const n_complete = std::count_if(uuids.begin(), uuids.end(), [this, &state](QString const& uuid){
+                return check_task_has_action_state(state, uuid, "complete");
+            });
+            if (n_complete == uuids.size())
+                break;
+            if (n_complete > 0)
+                EXPECT_FALSE(has_manifest());
+            ASSERT_FALSE(timer.hasExpired(15000));
+            spy.wait(100);
+        }
+
+        // each helper's socket went to its own task, so each
+        // archive is named for the folder whose files it holds
+        auto const files = StorageFrameworkLocalUtils::get_storage_framework_files();
+        for (int i=0, n=user_dirs.size(); i<n; ++i)
+        {
+            auto const& display_name = backup_items[i].display_name;
+            auto const it = std::find_if(files.begin(), files.end(), [&display_name](QFileInfo const& file){
+                return file.fileName().startsWith(display_name);
+            });
+            ASSERT_NE(files.end(), it) << qPrintable(display_name);
+            EXPECT_TRUE(StorageFrameworkLocalUtils::compare_tar_content(it->absoluteFilePath(), user_dirs[i], false));
+        }
+        EXPECT_TRUE(check_manifest_file(backup_items));
+
+        // restore both at once into emptied folders
+        QList<QSharedPointer<QTemporaryDir>> copies;
+        for (auto const& user_dir : user_dirs)
+        {
+            copies << QSharedPointer<QTemporaryDir>(new QTemporaryDir());
+            ASSERT_TRUE(FileUtils::copyDirsRecursively(user_dir, copies.last()->path()));
+            EXPECT_TRUE(FileUtils::clearDir(user_dir));
+        }
+
+        QDBusPendingReply<keeper::Items> restore_choices_reply = user_iface->call("GetRestoreChoices", "");
+        restore_choices_reply.waitForFinished();
+        ASSERT_TRUE(restore_choices_reply.isValid()) << qPrintable(restore_choices_reply.error().message());
+        EXPECT_EQ(uuids.size(), restore_choices_reply.value().size());
+
+        QDBusPendingReply<void> restore_reply = user_iface->call("StartRestore", uuids, "");
+        restore_reply.waitForFinished();
+        ASSERT_TRUE(restore_reply.isValid()) << qPrintable(dbus_test_runner.sessionConnection().lastError().message());
+        EXPECT_TRUE(wait_for_all_tasks_have_action_state(uuids, "complete", user_iface));
+
+        // each folder got its own files back
+        for (int i=0, n=user_dirs.size(); i<n; ++i)
+            EXPECT_TRUE(FileUtils::compareDirectories(copies[i]->path(), user_dirs[i]));
+    }
+};
+
+// helpers that call in on the bus path of their own task
+class ConcurrentTasks: public ConcurrentTasksBase
+{
+    using super = ConcurrentTasksBase;
+
+    void SetUp() override
+    {
+        super::SetUp();
+        init_helper_registry(HELPER_REGISTRY);
+    }
+};
+
+TEST_F(ConcurrentTasks, UseTheirOwnHelperPaths)
+{
+    run_concurrently();
+}
+
+// older helpers that all call in on the shared path
+class ConcurrentLegacyTasks: public ConcurrentTasksBase
+{
+    using super = ConcurrentTasksBase;
+
+    void SetUp() override
+    {
+        super::SetUp();
+        init_helper_registry(LEGACY_HELPER_REGISTRY);
+    }
+};
+
+TEST_F(ConcurrentLegacyTasks, ShareTheHelperPath)
+{
+    run_concurrently();
+}
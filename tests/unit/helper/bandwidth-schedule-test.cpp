@@ -0,0 +1,137 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "service/bandwidth-schedule.h"
+
+#include <gtest/gtest.h>
+
+#include <QTemporaryDir>
+
+namespace
+{
+    BandwidthSchedule::Limits limits(quint64 upload, quint64 download)
+    {
+        BandwidthSchedule::Limits ret;
+        ret.upload = upload;
+        ret.download = download;
+        return ret;
+    }
+
+    QVariantMap profile(QString const& start, QString const& end, quint64 upload, quint64 download)
+    {
+        QVariantMap ret;
+        ret[BandwidthSchedule::START_KEY] = start;
+        ret[BandwidthSchedule::END_KEY] = end;
+        ret[BandwidthSchedule::UPLOAD_LIMIT_KEY] = upload;
+        ret[BandwidthSchedule::DOWNLOAD_LIMIT_KEY] = download;
+        return ret;
+    }
+}
+
+TEST(BandwidthSchedule, UnlimitedByDefault)
+{
+    BandwidthSchedule schedule;
+    EXPECT_EQ(limits(0, 0), schedule.limits_at(QTime(12, 0)));
+    EXPECT_EQ(-1, schedule.msec_until_change(QTime(12, 0)));
+    EXPECT_FALSE(schedule.limits_uploads());
+}
+
+TEST(BandwidthSchedule, Profiles)
+{
+    QVariantDictMap map;
+    map["a-work"] = profile("09:00", "17:00", 1000, 2000);
+    map["b-night"] = profile("23:00", "06:00", 0, 0);
+
+    QVector<BandwidthSchedule::Profile> profiles;
+    QString error;
+    ASSERT_TRUE(BandwidthSchedule::parse_profiles(map, profiles, error));
+    ASSERT_EQ(2, profiles.size());
+
+    BandwidthSchedule schedule;
+    schedule.set_default_limits(limits(5000, 0));
+    schedule.set_profiles(profiles);
+    EXPECT_TRUE(schedule.limits_uploads());
+
+    EXPECT_EQ(limits(1000, 2000), schedule.limits_at(QTime(9, 0)));
+    EXPECT_EQ(limits(1000, 2000), schedule.limits_at(QTime(16, 59)));
+    EXPECT_EQ(limits(5000, 0), schedule.limits_at(QTime(17, 0)));
+
+    // the night profile wraps past midnight
+    EXPECT_EQ(limits(0, 0), schedule.limits_at(QTime(23, 30)));
+    EXPECT_EQ(limits(0, 0), schedule.limits_at(QTime(3, 0)));
+    EXPECT_EQ(limits(5000, 0), schedule.limits_at(QTime(6, 0)));
+
+    // the next change is the nearest profile boundary
+    EXPECT_EQ(60*60*1000, schedule.msec_until_change(QTime(8, 0)));
+    EXPECT_EQ(6*60*60*1000, schedule.msec_until_change(QTime(17, 0)));
+    EXPECT_EQ(30*60*1000, schedule.msec_until_change(QTime(5, 30)));
+}
+
+TEST(BandwidthSchedule, RejectsBadProfiles)
+{
+    QVector<BandwidthSchedule::Profile> profiles;
+    QString error;
+
+    QVariantDictMap map;
+    map["bad-time"] = profile("9am", "17:00", 0, 0);
+    EXPECT_FALSE(BandwidthSchedule::parse_profiles(map, profiles, error));
+    EXPECT_FALSE(error.isEmpty());
+
+    map.clear();
+    map["empty"] = profile("09:00", "09:00", 0, 0);
+    EXPECT_FALSE(BandwidthSchedule::parse_profiles(map, profiles, error));
+
+    map.clear();
+    auto props = profile("09:00", "17:00", 0, 0);
+    props[BandwidthSchedule::UPLOAD_LIMIT_KEY] = QStringLiteral("fast");
+    map["bad-limit"] = props;
+    EXPECT_FALSE(BandwidthSchedule::parse_profiles(map, profiles, error));
+
+    EXPECT_TRUE(profiles.isEmpty());
+}
+
+TEST(BandwidthSchedule, SavesAndLoads)
+{
+    QVariantDictMap map;
+    map["work"] = profile("09:00", "17:30", 1000, 2000);
+    QVector<BandwidthSchedule::Profile> profiles;
+    QString error;
+    ASSERT_TRUE(BandwidthSchedule::parse_profiles(map, profiles, error));
+
+    BandwidthSchedule schedule;
+    schedule.set_default_limits(limits(300, 400));
+    schedule.set_profiles(profiles);
+
+    QTemporaryDir dir;
+    auto const path = dir.path() + "/keeper/bandwidth.json";
+    ASSERT_TRUE(schedule.save(path));
+
+    auto const loaded = BandwidthSchedule::load(path);
+    EXPECT_EQ(limits(300, 400), loaded.default_limits());
+    auto const loaded_profiles = loaded.profiles();
+    ASSERT_EQ(1, loaded_profiles.size());
+    auto const& p = loaded_profiles.front();
+    EXPECT_EQ(QStringLiteral("work"), p.name);
+    EXPECT_EQ(QTime(9, 0), p.start);
+    EXPECT_EQ(QTime(17, 30), p.end);
+    EXPECT_EQ(limits(1000, 2000), p.limits);
+
+    // a missing file means no limits
+    EXPECT_EQ(limits(0, 0), BandwidthSchedule::load(dir.path() + "/nope.json").default_limits());
+}
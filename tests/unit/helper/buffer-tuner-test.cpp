@@ -0,0 +1,108 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "util/buffer-tuner.h"
+
+#include <gtest/gtest.h>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace
+{
+    // simulate `n_wakeups` wakeups that each move `n_bytes`
+    bool run(BufferTuner& tuner, int n_wakeups, size_t n_bytes, uint64_t bytes_per_second)
+    {
+        bool changed {};
+        for (int i=0; i<n_wakeups; ++i)
+            changed |= tuner.update(n_bytes, bytes_per_second);
+        return changed;
+    }
+}
+
+TEST(BufferTuner, StartsSmall)
+{
+    BufferTuner tuner(16*1024, 1024*1024);
+    EXPECT_EQ(16*1024, int(tuner.size()));
+
+    // a trickle of data doesn't need a bigger buffer
+    EXPECT_FALSE(run(tuner, 1000, 100, 10*1024));
+    EXPECT_EQ(16*1024, int(tuner.size()));
+}
+
+TEST(BufferTuner, FollowsThroughput)
+{
+    BufferTuner tuner(16*1024, 1024*1024, 250);
+
+    // at 1 MiB/s, 250 msec is 256 KiB
+    run(tuner, 100, 4*1024, 1024*1024);
+    EXPECT_EQ(256*1024, int(tuner.size()));
+
+    // a small dip shouldn't make it flap
+    run(tuner, 1000, 4*1024, 600*1024);
+    EXPECT_EQ(256*1024, int(tuner.size()));
+
+    // but a big one should shrink it
+    run(tuner, 1000, 4*1024, 64*1024);
+    EXPECT_EQ(16*1024, int(tuner.size()));
+}
+
+TEST(BufferTuner, GrowsWhenFull)
+{
+    BufferTuner tuner(16*1024, 1024*1024);
+
+    // even if the speed isn't known yet, a buffer that's filled on every
+    // wakeup is too small
+    for (int i=0; i<100; ++i)
+        tuner.update(tuner.size(), 0);
+    EXPECT_EQ(1024*1024, int(tuner.size()));
+
+    auto const& stats = tuner.stats();
+    EXPECT_EQ(100, int(stats.n_wakeups));
+    EXPECT_EQ(6, int(stats.n_resizes));
+    EXPECT_EQ(1024*1024, int(stats.largest_size));
+}
+
+TEST(BufferTuner, StaysWithinBudget)
+{
+    BufferTuner tuner(16*1024, 100*1000);
+    run(tuner, 1000, 64*1024, 1024*1024*1024);
+    EXPECT_EQ(100*1000, int(tuner.size()));
+
+    BufferTuner fixed(32*1024, 32*1024);
+    EXPECT_FALSE(run(fixed, 1000, 64*1024, 1024*1024*1024));
+    EXPECT_EQ(32*1024, int(fixed.size()));
+}
+
+TEST(BufferTuner, AppliesToSocket)
+{
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+
+    // the kernel rounds and doubles it, so just check that it took
+    auto const small = BufferTuner::apply_to_socket(fds[0], 8*1024);
+    auto const big = BufferTuner::apply_to_socket(fds[0], 128*1024);
+    EXPECT_LT(0, int(small));
+    EXPECT_LT(small, big);
+
+    EXPECT_EQ(0, int(BufferTuner::apply_to_socket(-1, 8*1024)));
+
+    close(fds[0]);
+    close(fds[1]);
+}
@@ -0,0 +1,415 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "util/pipeline.h"
+#include "util/qiodevice-source.h"
+
+#include <gtest/gtest.h>
+
+#include <QBuffer>
+#include <QByteArray>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+
+namespace
+{
+    void wait_for(int fd, short events)
+    {
+        pollfd pfd {fd, events, 0};
+        poll(&pfd, 1, 100);
+    }
+
+    class Upcase final: public Pipeline::Transform
+    {
+    public:
+        void process(char const* data, size_t len, std::string& out) override
+        {
+            for (size_t i=0; i<len; ++i)
+                out += char(toupper(data[i]));
+        }
+    };
+
+    // emits more than it's given, eg like a TarFilter that passes through headers
+    class Triple final: public Pipeline::Transform
+    {
+    public:
+        void process(char const* data, size_t len, std::string& out) override
+        {
+            for (size_t i=0; i<len; ++i)
+                out.append(3, data[i]);
+        }
+    };
+
+    // holds everything back until the end, then emits it reversed
+    class Reverse final: public Pipeline::Transform
+    {
+    public:
+        void process(char const* data, size_t len, std::string&) override
+        {
+            held_.append(data, len);
+        }
+        void finish(std::string& out) override
+        {
+            out.assign(held_.rbegin(), held_.rend());
+        }
+    private:
+        std::string held_;
+    };
+
+    class Recorder final: public Pipeline::Tap
+    {
+    public:
+        void observe(char const* data, size_t len) override
+        {
+            seen.append(data, len);
+        }
+        std::string seen;
+    };
+}
+
+class PipelineFixture: public ::testing::Test
+{
+protected:
+
+    void SetUp() override
+    {
+        ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK, 0, in_));
+        ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK, 0, out_));
+
+        src_.resize(2*1024*1024 + 123);
+        std::mt19937 engine {std::random_device{}()};
+        std::uniform_int_distribution<int> dist('a', 'z');
+        for (auto& ch : src_)
+            ch = char(dist(engine));
+    }
+
+    void TearDown() override
+    {
+        for (auto fd : { in_[0], in_[1], out_[0], out_[1] })
+            if (fd != -1)
+                close(fd);
+    }
+
+    void connect(Pipeline& pipeline)
+    {
+        pipeline.set_source(std::make_shared<FdSource>(in_[0]));
+        pipeline.set_sink(std::make_shared<FdSink>(out_[0]));
+    }
+
+    // pump src_ through the pipeline, with threads playing the helper & uploader
+    std::string run(Pipeline& pipeline, bool& setme_spliced)
+    {
+        std::thread writer([this]{
+            size_t pos {};
+            while (pos < src_.size()) {
+                auto const n = write(in_[1], src_.data()+pos, src_.size()-pos);
+                if (n > 0)
+                    pos += size_t(n);
+                else
+                    wait_for(in_[1], POLLOUT);
+            }
+            close(in_[1]);
+            in_[1] = -1;
+        });
+
+        std::string received;
+        std::thread reader([this, &received]{
+            char buf[64*1024];
+            for (;;) {
+                auto const n = read(out_[1], buf, sizeof(buf));
+                if (n > 0)
+                    received.append(buf, size_t(n));
+                else if (n == 0)
+                    break;
+                else
+                    wait_for(out_[1], POLLIN);
+            }
+        });
+
+        int64_t n_read {};
+        setme_spliced = false;
+        for (;;)
+        {
+            auto const result = pipeline.pump();
+            EXPECT_FALSE(result.read_error) << result.error;
+            EXPECT_FALSE(result.write_error) << result.error;
+            if (result.read_error || result.write_error)
+                break;
+            n_read += result.n_read;
+            setme_spliced |= result.spliced;
+            if (result.eof)
+                break;
+            if (result.want_write)
+                wait_for(out_[0], POLLOUT);
+            else
+                wait_for(in_[0], POLLIN);
+        }
+        shutdown(out_[0], SHUT_WR);
+
+        writer.join();
+        reader.join();
+        EXPECT_EQ(int64_t(src_.size()), n_read);
+        EXPECT_EQ(0, int(pipeline.n_pending()));
+        return received;
+    }
+
+    static Pipeline::Counters const& counters(std::vector<Pipeline::Counters> const& all, std::string const& name)
+    {
+        return *std::find_if(all.begin(), all.end(), [&name](Pipeline::Counters const& c){return c.name == name;});
+    }
+
+    int in_[2] {-1, -1};
+    int out_[2] {-1, -1};
+    std::string src_;
+};
+
+TEST_F(PipelineFixture, Transforms)
+{
+    Pipeline pipeline(64*1024);
+    connect(pipeline);
+    auto recorder = std::make_shared<Recorder>();
+    pipeline.add_transform("upcase", std::make_shared<Upcase>());
+    pipeline.add_transform("recorder", recorder);
+
+    bool spliced {};
+    auto expected = src_;
+    std::transform(expected.begin(), expected.end(), expected.begin(), ::toupper);
+    EXPECT_EQ(expected, run(pipeline, spliced));
+    EXPECT_EQ(expected, recorder->seen);
+    EXPECT_FALSE(spliced);
+
+    auto const all = pipeline.counters();
+    ASSERT_EQ(4, int(all.size()));
+    EXPECT_EQ("source", all.front().name);
+    EXPECT_EQ("sink", all.back().name);
+    EXPECT_EQ(uint64_t(src_.size()), counters(all, "source").n_bytes_out);
+    EXPECT_EQ(uint64_t(src_.size()), counters(all, "upcase").n_bytes_in);
+    EXPECT_EQ(uint64_t(src_.size()), counters(all, "recorder").n_bytes_out);
+    EXPECT_EQ(uint64_t(src_.size()), counters(all, "sink").n_bytes_in);
+    EXPECT_LE(pipeline.max_pending(), size_t(64*1024));
+}
+
+TEST_F(PipelineFixture, SplicesTaps)
+{
+    Pipeline pipeline(64*1024);
+    connect(pipeline);
+    auto recorder = std::make_shared<Recorder>();
+    pipeline.add_transform("recorder", recorder);
+
+    bool spliced {};
+    EXPECT_EQ(src_, run(pipeline, spliced));
+    EXPECT_EQ(src_, recorder->seen);
+    EXPECT_TRUE(spliced);
+
+    auto const all = pipeline.counters();
+    EXPECT_EQ(uint64_t(src_.size()), counters(all, "recorder").n_bytes_in);
+    EXPECT_EQ(uint64_t(src_.size()), counters(all, "sink").n_bytes_in);
+}
+
+TEST_F(PipelineFixture, CopiesTaps)
+{
+    Pipeline pipeline(64*1024);
+    pipeline.set_splice_enabled(false);
+    connect(pipeline);
+    auto recorder = std::make_shared<Recorder>();
+    pipeline.add_transform("recorder", recorder);
+
+    bool spliced {};
+    EXPECT_EQ(src_, run(pipeline, spliced));
+    EXPECT_EQ(src_, recorder->seen);
+    EXPECT_FALSE(spliced);
+}
+
+TEST_F(PipelineFixture, Finishes)
+{
+    // smaller than what Reverse emits at the end
+    Pipeline pipeline(4096);
+    connect(pipeline);
+    pipeline.add_transform("reverse", std::make_shared<Reverse>());
+    pipeline.add_transform("upcase", std::make_shared<Upcase>());
+
+    bool spliced {};
+    std::string expected(src_.rbegin(), src_.rend());
+    std::transform(expected.begin(), expected.end(), expected.begin(), ::toupper);
+    EXPECT_EQ(expected, run(pipeline, spliced));
+}
+
+TEST_F(PipelineFixture, PushesBack)
+{
+    for (auto const splice : {false, true})
+    {
+        int in[2], out[2];
+        ASSERT_EQ(0, pipe2(in, O_NONBLOCK));
+        ASSERT_EQ(0, pipe2(out, O_NONBLOCK));
+        ASSERT_LT(0, fcntl(out[1], F_SETPIPE_SZ, 4096));
+        auto const sink_size = size_t(fcntl(out[1], F_GETPIPE_SZ));
+
+        Pipeline pipeline(4096);
+        pipeline.set_splice_enabled(splice);
+        pipeline.set_source(std::make_shared<FdSource>(in[0]));
+        pipeline.set_sink(std::make_shared<FdSink>(out[1]));
+
+        // nobody's reading from the sink, so the pipeline should stop
+        // reading once its buffer is full
+        ASSERT_EQ(ssize_t(64*1024), write(in[1], src_.data(), 64*1024));
+        auto const result = pipeline.pump();
+        EXPECT_FALSE(result.read_error);
+        EXPECT_FALSE(result.write_error);
+        EXPECT_TRUE(result.want_write);
+        EXPECT_EQ(int64_t(sink_size), result.n_written);
+        EXPECT_LE(pipeline.n_pending(), pipeline.buffer_size());
+        EXPECT_EQ(int64_t(pipeline.n_pending()) + result.n_written, result.n_read);
+        EXPECT_LT(result.n_read, 64*1024);
+
+        for (auto fd : { in[0], in[1], out[0], out[1] })
+            close(fd);
+    }
+}
+
+TEST_F(PipelineFixture, StopsAtMaxWrite)
+{
+    for (auto const splice : {false, true})
+    {
+        Pipeline pipeline(64*1024);
+        pipeline.set_splice_enabled(splice);
+        connect(pipeline);
+
+        ASSERT_EQ(ssize_t(64*1024), write(in_[1], src_.data(), 64*1024));
+        auto result = pipeline.pump(1000);
+        EXPECT_EQ(1000, result.n_written);
+        EXPECT_TRUE(result.throttled);
+        EXPECT_EQ(splice, result.spliced);
+
+        result = pipeline.pump(64*1024);
+        EXPECT_EQ(64*1024 - 1000, result.n_written);
+        EXPECT_FALSE(result.throttled);
+        EXPECT_EQ(0, int(pipeline.n_pending()));
+
+        char buf[64*1024];
+        ASSERT_EQ(ssize_t(sizeof(buf)), read(out_[1], buf, sizeof(buf)));
+        EXPECT_EQ(src_.substr(0, sizeof(buf)), std::string(buf, sizeof(buf)));
+    }
+}
+
+TEST_F(PipelineFixture, ChangesSource)
+{
+    Pipeline pipeline(64*1024);
+    pipeline.set_sink(std::make_shared<FdSink>(out_[0]));
+
+    // two streams, one after the other, as the restore helper does with archives
+    std::string expected;
+    for (auto const upcase : {false, true})
+    {
+        int in[2];
+        ASSERT_EQ(0, pipe2(in, O_NONBLOCK));
+        ASSERT_EQ(ssize_t(1000), write(in[1], src_.data(), 1000));
+        close(in[1]);
+
+        pipeline.clear_transforms();
+        if (upcase)
+            pipeline.add_transform("upcase", std::make_shared<Upcase>());
+        pipeline.set_source(std::make_shared<FdSource>(in[0]));
+        auto const result = pipeline.pump();
+        EXPECT_TRUE(result.eof);
+        EXPECT_EQ(1000, result.n_written);
+        close(in[0]);
+
+        auto chunk = src_.substr(0, 1000);
+        if (upcase)
+            std::transform(chunk.begin(), chunk.end(), chunk.begin(), ::toupper);
+        expected += chunk;
+    }
+
+    char buf[4096];
+    ASSERT_EQ(ssize_t(expected.size()), read(out_[1], buf, sizeof(buf)));
+    EXPECT_EQ(expected, std::string(buf, expected.size()));
+}
+
+// a transform's output can be bigger than the room that was left in the ring
+// when its input was read; what doesn't fit has to wait, not get dropped
+TEST_F(PipelineFixture, KeepsWhatDoesNotFit)
+{
+    Pipeline pipeline(4*1024);
+    connect(pipeline);
+    pipeline.add_transform("triple", std::make_shared<Triple>());
+
+    bool spliced {};
+    std::string expected;
+    for (auto const ch : src_)
+        expected.append(3, ch);
+    EXPECT_EQ(expected, run(pipeline, spliced));
+    EXPECT_FALSE(spliced);
+
+    auto const all = pipeline.counters();
+    EXPECT_EQ(uint64_t(expected.size()), counters(all, "triple").n_bytes_out);
+    EXPECT_EQ(uint64_t(expected.size()), counters(all, "sink").n_bytes_in);
+}
+
+TEST_F(PipelineFixture, ResizesWhenEmpty)
+{
+    Pipeline pipeline(64*1024);
+    pipeline.set_splice_enabled(false);
+    connect(pipeline);
+
+    ASSERT_EQ(ssize_t(1000), write(in_[1], src_.data(), 1000));
+    auto result = pipeline.pump(0);
+    EXPECT_EQ(1000, int(pipeline.n_pending()));
+
+    // can't shrink while holding data, but should do it once drained
+    pipeline.set_buffer_size(100);
+    EXPECT_EQ(100, int(pipeline.buffer_size()));
+    result = pipeline.pump();
+    EXPECT_EQ(1000, result.n_written);
+
+    ASSERT_EQ(ssize_t(1000), write(in_[1], src_.data(), 1000));
+    result = pipeline.pump(0);
+    EXPECT_EQ(100, int(pipeline.n_pending()));
+}
+
+TEST_F(PipelineFixture, ReadsQIODevice)
+{
+    QByteArray bytes(src_.data(), 5000);
+    QBuffer buffer(&bytes);
+    ASSERT_TRUE(buffer.open(QIODevice::ReadOnly));
+
+    // stop at n_bytes, as when reading one archive from a downloader
+    auto source = std::make_shared<QIODeviceSource>(&buffer, 4000);
+    Pipeline pipeline(64*1024);
+    pipeline.set_source(source);
+    pipeline.set_sink(std::make_shared<FdSink>(out_[0]));
+    auto const result = pipeline.pump();
+    EXPECT_FALSE(result.read_error);
+    EXPECT_TRUE(result.eof);
+    EXPECT_EQ(4000, result.n_written);
+    EXPECT_EQ(4000, source->n_read());
+
+    char buf[8192];
+    ASSERT_EQ(ssize_t(4000), read(out_[1], buf, sizeof(buf)));
+    EXPECT_EQ(src_.substr(0, 4000), std::string(buf, 4000));
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "util/process-priority.h"
+
+#include <gtest/gtest.h>
+
+#include <sched.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+class ProcessPriorityFixture: public ::testing::Test
+{
+protected:
+
+    void SetUp() override
+    {
+        // a child in its own process group, like a helper launched for us
+        child_ = fork();
+        ASSERT_NE(-1, child_);
+        if (child_ == 0)
+        {
+            setpgid(0, 0);
+            for (;;)
+                pause();
+        }
+        setpgid(child_, child_);
+    }
+
+    void TearDown() override
+    {
+        kill(child_, SIGKILL);
+        waitpid(child_, nullptr, 0);
+    }
+
+    pid_t child_ {-1};
+};
+
+TEST_F(ProcessPriorityFixture, FindsHelperProcesses)
+{
+    EXPECT_EQ(std::vector<pid_t>{child_}, ProcessPriority::processes_in_group(child_));
+    EXPECT_EQ(std::vector<pid_t>{child_}, ProcessPriority::helper_processes(child_));
+
+    // never the whole of our own process group
+    EXPECT_EQ(std::vector<pid_t>{getpid()}, ProcessPriority::helper_processes(getpid()));
+}
+
+TEST_F(ProcessPriorityFixture, LowersPriority)
+{
+    auto const pids = ProcessPriority::helper_processes(child_);
+    auto const nice_before = getpriority(PRIO_PROCESS, id_t(child_));
+    auto const expected_nice = ProcessPriority::can_renice() ? 10 : nice_before;
+
+    auto result = ProcessPriority::apply(pids, ProcessPriority::Level::BACKGROUND);
+    EXPECT_EQ(1, result.n_threads);
+    EXPECT_EQ(0, result.n_failed);
+    EXPECT_EQ(ProcessPriority::can_renice(), result.reniced);
+    EXPECT_EQ(SCHED_BATCH, sched_getscheduler(child_));
+    EXPECT_EQ(expected_nice, getpriority(PRIO_PROCESS, id_t(child_)));
+    int io_class {}, io_level {};
+    ASSERT_TRUE(ProcessPriority::get_io_priority(child_, io_class, io_level));
+    EXPECT_EQ(ProcessPriority::IOPRIO_CLASS_BE, io_class);
+    EXPECT_EQ(7, io_level);
+
+    result = ProcessPriority::apply(pids, ProcessPriority::Level::IDLE);
+    EXPECT_EQ(0, result.n_failed);
+    EXPECT_EQ(SCHED_BATCH, sched_getscheduler(child_));
+    EXPECT_EQ(expected_nice, getpriority(PRIO_PROCESS, id_t(child_)));
+    ASSERT_TRUE(ProcessPriority::get_io_priority(child_, io_class, io_level));
+    EXPECT_EQ(ProcessPriority::IOPRIO_CLASS_IDLE, io_class);
+}
+
+TEST_F(ProcessPriorityFixture, RaisesPriority)
+{
+    auto const pids = ProcessPriority::helper_processes(child_);
+    auto const nice_before = getpriority(PRIO_PROCESS, id_t(child_));
+    ProcessPriority::apply(pids, ProcessPriority::Level::IDLE);
+
+    // every level can be undone, whatever our privileges
+    auto const result = ProcessPriority::apply(pids, ProcessPriority::Level::NORMAL);
+    EXPECT_EQ(0, result.n_failed);
+    EXPECT_EQ(SCHED_OTHER, sched_getscheduler(child_));
+    EXPECT_EQ(ProcessPriority::can_renice() ? 0 : nice_before, getpriority(PRIO_PROCESS, id_t(child_)));
+    int io_class {}, io_level {};
+    ASSERT_TRUE(ProcessPriority::get_io_priority(child_, io_class, io_level));
+    EXPECT_EQ(ProcessPriority::IOPRIO_CLASS_BE, io_class);
+    EXPECT_EQ(4, io_level);
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "util/retry-policy.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm> // std::min()
+
+TEST(RetryPolicy, LimitsAttempts)
+{
+    RetryPolicy policy(3, 100, 1000, 100);
+    EXPECT_TRUE(policy.should_retry(1));
+    EXPECT_TRUE(policy.should_retry(2));
+    EXPECT_FALSE(policy.should_retry(3));
+}
+
+TEST(RetryPolicy, BacksOffWithJitter)
+{
+    RetryPolicy policy(100, 100, 1000, 100);
+
+    // each delay is between half and all of base * 2^(n-1), up to the max
+    for (int i=0; i<100; ++i)
+    {
+        for (int n_failures=1; n_failures<=6; ++n_failures)
+        {
+            auto const ceiling = std::min(uint64_t(100) << (n_failures-1), uint64_t(1000));
+            auto const delay = policy.next_delay_msec(n_failures);
+            EXPECT_LE(ceiling/2, delay);
+            EXPECT_GE(ceiling, delay);
+            policy.on_success();
+        }
+    }
+
+    // huge failure counts don't overflow
+    auto const delay = policy.next_delay_msec(1000);
+    EXPECT_LE(500, int(delay));
+    EXPECT_GE(1000, int(delay));
+}
+
+TEST(RetryPolicy, BudgetStopsRetryStorms)
+{
+    RetryPolicy policy(100, 1, 1, 4);
+
+    // half the budget can be spent on retries...
+    EXPECT_TRUE(policy.should_retry(1));
+    policy.next_delay_msec(1);
+    EXPECT_TRUE(policy.should_retry(1));
+    policy.next_delay_msec(1);
+    EXPECT_FALSE(policy.should_retry(1));
+
+    // ...then it takes ten successes to earn another retry
+    policy.on_success();
+    EXPECT_TRUE(policy.should_retry(1));
+    policy.next_delay_msec(1);
+    for (int i=0; i<9; ++i)
+        policy.on_success();
+    EXPECT_FALSE(policy.should_retry(1));
+    policy.on_success();
+    EXPECT_TRUE(policy.should_retry(1));
+}
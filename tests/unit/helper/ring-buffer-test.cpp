@@ -0,0 +1,129 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "util/ring-buffer.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <random>
+#include <vector>
+
+TEST(RingBuffer, Basics)
+{
+    RingBuffer ring(8);
+    EXPECT_EQ(8, int(ring.capacity()));
+    EXPECT_TRUE(ring.empty());
+    EXPECT_EQ(8, int(ring.space()));
+
+    EXPECT_EQ(5, int(ring.write("hello", 5)));
+    EXPECT_EQ(3, int(ring.write(" world", 6)));
+    EXPECT_TRUE(ring.full());
+
+    char buf[8];
+    EXPECT_EQ(4, int(ring.read(buf, 4)));
+    EXPECT_EQ(0, memcmp(buf, "hell", 4));
+
+    // this write wraps around the end
+    EXPECT_EQ(4, int(ring.write("abcd", 4)));
+    struct iovec iov[2];
+    ASSERT_EQ(2, ring.readable(iov));
+    EXPECT_EQ(4, int(iov[0].iov_len));
+    EXPECT_EQ(4, int(iov[1].iov_len));
+
+    EXPECT_EQ(8, int(ring.read(buf, sizeof(buf))));
+    EXPECT_EQ(0, memcmp(buf, "o woabcd", 8));
+    EXPECT_TRUE(ring.empty());
+    EXPECT_EQ(0, ring.readable(iov));
+}
+
+TEST(RingBuffer, MatchesModel)
+{
+    std::mt19937 engine {std::random_device{}()};
+    std::uniform_int_distribution<size_t> len_dist(0, 300);
+
+    RingBuffer ring(257);
+    std::deque<char> model;
+    char next {};
+    std::vector<char> buf(400);
+
+    for (int i=0; i<100000; ++i)
+    {
+        auto const len = len_dist(engine);
+        if (engine() % 2)
+        {
+            // write through the iovecs, as a readv() would
+            struct iovec iov[2];
+            auto const n_iov = ring.writable(iov);
+            size_t n {};
+            for (int j=0; j<n_iov && n<len; ++j)
+                for (size_t k=0; k<iov[j].iov_len && n<len; ++k, ++n)
+                    model.push_back(static_cast<char*>(iov[j].iov_base)[k] = next++);
+            ring.commit(n);
+            EXPECT_EQ(std::min(len, ring.capacity() - (model.size() - n)), n);
+        }
+        else
+        {
+            auto const n = ring.read(buf.data(), len);
+            ASSERT_EQ(std::min(len, model.size()), n);
+            for (size_t k=0; k<n; ++k)
+            {
+                ASSERT_EQ(model.front(), buf[k]);
+                model.pop_front();
+            }
+        }
+        ASSERT_EQ(model.size(), ring.size());
+    }
+}
+
+// relays data with random-sized reads and partial writes, the way the
+// helpers do, and checks that it comes out the other side intact
+TEST(RingBuffer, Relays)
+{
+    static constexpr size_t capacity {64*1024};
+    static constexpr size_t n_bytes {4*1024*1024};
+    std::mt19937 engine {42};
+    std::uniform_int_distribution<int> byte_dist(0, 255);
+    std::uniform_int_distribution<size_t> chunk_dist(1, capacity);
+
+    std::vector<char> src(n_bytes);
+    for (auto& ch : src)
+        ch = char(byte_dist(engine));
+
+    RingBuffer ring(capacity);
+    std::vector<char> dst;
+    std::vector<char> buf(capacity);
+    size_t n_in {};
+    while (dst.size() < n_bytes)
+    {
+        auto const n_wanted = std::min(chunk_dist(engine), n_bytes - n_in);
+        auto const n_written = ring.write(src.data() + n_in, n_wanted);
+        ASSERT_EQ(std::min(n_wanted, capacity - (n_in - dst.size())), n_written);
+        n_in += n_written;
+
+        auto const n_read = ring.read(buf.data(), chunk_dist(engine));
+        dst.insert(dst.end(), buf.begin(), buf.begin() + long(n_read));
+        ASSERT_EQ(n_in - dst.size(), ring.size());
+    }
+
+    EXPECT_TRUE(ring.empty());
+    EXPECT_TRUE(src == dst);
+}
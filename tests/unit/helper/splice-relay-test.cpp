@@ -0,0 +1,169 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "util/splice-relay.h"
+
+#include <gtest/gtest.h>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <random>
+#include <string>
+#include <thread>
+
+namespace
+{
+    void wait_for(int fd, short events)
+    {
+        pollfd pfd {fd, events, 0};
+        poll(&pfd, 1, 100);
+    }
+}
+
+class SpliceRelayFixture: public ::testing::Test
+{
+protected:
+
+    void SetUp() override
+    {
+        ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK, 0, in_));
+        ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK, 0, out_));
+
+        src_.resize(8*1024*1024 + 123);
+        std::mt19937 engine {std::random_device{}()};
+        for (auto& ch : src_)
+            ch = char(engine());
+    }
+
+    void TearDown() override
+    {
+        for (auto fd : { in_[0], out_[0], out_[1] })
+            close(fd);
+    }
+
+    // relay src_ from in_ to out_, with threads playing the helper & uploader
+    std::string relay(SpliceRelay& relay)
+    {
+        std::thread writer([this]{
+            size_t pos {};
+            while (pos < src_.size()) {
+                auto const n = write(in_[1], src_.data()+pos, src_.size()-pos);
+                if (n > 0)
+                    pos += size_t(n);
+                else
+                    wait_for(in_[1], POLLOUT);
+            }
+            close(in_[1]);
+        });
+
+        std::string received;
+        std::thread reader([this, &received]{
+            char buf[64*1024];
+            for (;;) {
+                auto const n = read(out_[1], buf, sizeof(buf));
+                if (n > 0)
+                    received.append(buf, size_t(n));
+                else if (n == 0)
+                    break;
+                else
+                    wait_for(out_[1], POLLIN);
+            }
+        });
+
+        int64_t n_read {};
+        int64_t n_written {};
+        for (;;)
+        {
+            auto const result = relay.relay(in_[0], out_[0]);
+            EXPECT_EQ(0, result.read_errno);
+            EXPECT_EQ(0, result.write_errno);
+            if (result.read_errno || result.write_errno)
+                break;
+            n_read += result.n_read;
+            n_written += result.n_written;
+            if (result.eof && !relay.n_pending())
+                break;
+            if (result.want_write)
+                wait_for(out_[0], POLLOUT);
+            else
+                wait_for(in_[0], POLLIN);
+        }
+        shutdown(out_[0], SHUT_WR);
+
+        writer.join();
+        reader.join();
+        EXPECT_EQ(int64_t(src_.size()), n_read);
+        EXPECT_EQ(int64_t(src_.size()), n_written);
+        return received;
+    }
+
+    int in_[2] {-1, -1};
+    int out_[2] {-1, -1};
+    std::string src_;
+};
+
+TEST_F(SpliceRelayFixture, Relays)
+{
+    SpliceRelay splice_relay;
+    ASSERT_TRUE(splice_relay.is_valid());
+    EXPECT_EQ(src_, relay(splice_relay));
+}
+
+TEST_F(SpliceRelayFixture, Observes)
+{
+    std::string observed;
+    SpliceRelay splice_relay([&observed](char const* data, size_t len){observed.append(data, len);});
+    ASSERT_TRUE(splice_relay.is_valid());
+    EXPECT_EQ(src_, relay(splice_relay));
+    EXPECT_EQ(src_, observed);
+}
+
+TEST_F(SpliceRelayFixture, ResizesPipe)
+{
+    std::string observed;
+    SpliceRelay splice_relay([&observed](char const* data, size_t len){observed.append(data, len);});
+    ASSERT_TRUE(splice_relay.is_valid());
+
+    ASSERT_TRUE(splice_relay.set_pipe_size(64*1024));
+    EXPECT_EQ(64*1024, int(splice_relay.pipe_size()));
+    EXPECT_EQ(src_, relay(splice_relay));
+    EXPECT_EQ(src_, observed);
+}
+
+TEST_F(SpliceRelayFixture, StopsAtMaxWrite)
+{
+    SpliceRelay splice_relay;
+    ASSERT_TRUE(splice_relay.is_valid());
+
+    ASSERT_EQ(ssize_t(64*1024), write(in_[1], src_.data(), 64*1024));
+    auto result = splice_relay.relay(in_[0], out_[0], 1000);
+    EXPECT_EQ(0, result.read_errno);
+    EXPECT_EQ(0, result.write_errno);
+    EXPECT_EQ(1000, result.n_written);
+    EXPECT_TRUE(result.throttled);
+
+    result = splice_relay.relay(in_[0], out_[0], 64*1024);
+    EXPECT_EQ(64*1024 - 1000, result.n_written);
+    EXPECT_FALSE(result.throttled);
+    EXPECT_EQ(0, splice_relay.n_pending());
+
+    close(in_[1]);
+}
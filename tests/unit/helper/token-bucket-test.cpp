@@ -0,0 +1,100 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "util/token-bucket.h"
+
+#include <gtest/gtest.h>
+
+TEST(TokenBucket, UnlimitedByDefault)
+{
+    TokenBucket bucket;
+    EXPECT_FALSE(bucket.is_limited());
+    EXPECT_EQ(TokenBucket::UNLIMITED, bucket.available(1000));
+    bucket.consume(1024*1024);
+    EXPECT_EQ(TokenBucket::UNLIMITED, bucket.available(1000));
+    EXPECT_EQ(0, int(bucket.msec_until_available(1024*1024, 1000)));
+}
+
+TEST(TokenBucket, Refills)
+{
+    // 100 KB/s with a 100 msec burst
+    uint64_t now {5000};
+    TokenBucket bucket(100*1000, 100);
+    bucket.set_rate(100*1000, now);
+    EXPECT_EQ(10*1000, int(bucket.available(now)));
+
+    // spend it all, then wait for more
+    bucket.consume(10*1000);
+    EXPECT_EQ(0, int(bucket.available(now)));
+    EXPECT_EQ(20, int(bucket.msec_until_available(2000, now)));
+    now += 20;
+    EXPECT_EQ(2000, int(bucket.available(now)));
+
+    // fractions of a byte aren't lost between refills
+    bucket.consume(2000);
+    for (int i=0; i<1000; ++i)
+        bucket.available(++now);
+    EXPECT_EQ(10*1000, int(bucket.available(now)));
+
+    // and it never holds more than a burst
+    now += 60*60*1000;
+    EXPECT_EQ(10*1000, int(bucket.available(now)));
+}
+
+TEST(TokenBucket, EnforcesRate)
+{
+    // send as fast as the bucket allows for ten simulated seconds
+    constexpr uint64_t rate {256*1024};
+    TokenBucket bucket;
+    uint64_t now {1000};
+    bucket.set_rate(rate, now);
+
+    uint64_t n_sent {};
+    auto const end = now + 10*1000;
+    while (now < end)
+    {
+        auto const n = std::min(bucket.available(now), uint64_t(64*1024));
+        bucket.consume(n);
+        n_sent += n;
+        now += std::max(bucket.msec_until_available(TokenBucket::MIN_BURST, now), uint64_t(1));
+    }
+
+    // the initial burst is the only allowed excess
+    EXPECT_LE(n_sent, rate*10 + rate/10);
+    EXPECT_GE(n_sent, rate*10 - TokenBucket::MIN_BURST);
+}
+
+TEST(TokenBucket, ChangesRate)
+{
+    uint64_t now {1000};
+    TokenBucket bucket;
+
+    // becoming limited starts with a full burst
+    bucket.set_rate(1000*1000, now);
+    EXPECT_EQ(100*1000, int(bucket.available(now)));
+
+    // lowering the limit drops what's over the new burst
+    bucket.set_rate(50*1000, now);
+    EXPECT_EQ(5*1000, int(bucket.available(now)));
+
+    // and lifting it stops the limiting
+    bucket.set_rate(0, now);
+    EXPECT_FALSE(bucket.is_limited());
+    EXPECT_EQ(TokenBucket::UNLIMITED, bucket.available(now));
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "service/transfer-settings.h"
+
+#include <gtest/gtest.h>
+
+#include <QTemporaryDir>
+
+TEST(TransferSettings, Defaults)
+{
+    TransferSettings settings;
+    EXPECT_FALSE(settings.direct_uploads());
+    EXPECT_EQ(1, settings.max_concurrent_tasks());
+    EXPECT_EQ(0, settings.part_size());
+    EXPECT_EQ(PartedUploader::DEFAULT_MAX_PARALLEL, settings.max_parallel_parts());
+}
+
+TEST(TransferSettings, SavesAndLoads)
+{
+    TransferSettings settings;
+    settings.set_direct_uploads(true);
+    settings.set_max_concurrent_tasks(3);
+    settings.set_multipart_upload(qint64(64)*1024*1024, 6);
+
+    QTemporaryDir dir;
+    auto const path = dir.path() + "/keeper/transfers.json";
+    ASSERT_TRUE(settings.save(path));
+
+    auto const loaded = TransferSettings::load(path);
+    EXPECT_TRUE(loaded.direct_uploads());
+    EXPECT_EQ(3, loaded.max_concurrent_tasks());
+    EXPECT_EQ(qint64(64)*1024*1024, loaded.part_size());
+    EXPECT_EQ(6, loaded.max_parallel_parts());
+
+    // a missing file means the defaults
+    auto const missing = TransferSettings::load(dir.path() + "/nope.json");
+    EXPECT_FALSE(missing.direct_uploads());
+    EXPECT_EQ(1, missing.max_concurrent_tasks());
+    EXPECT_EQ(0, missing.part_size());
+}
@@ -0,0 +1,129 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "util/transfer-stats.h"
+
+#include <gtest/gtest.h>
+
+TEST(TransferStats, Empty)
+{
+    TransferStats stats;
+    stats.reset(1000, 0);
+
+    auto const snap = stats.snapshot(3000);
+    EXPECT_EQ(0, int(snap.n_bytes));
+    EXPECT_EQ(0, int(snap.n_remaining));
+    EXPECT_EQ(0, int(snap.average_bps));
+    EXPECT_EQ(0, int(snap.smoothed_bps));
+    EXPECT_EQ(2000, int(snap.stalled_msec));
+    EXPECT_EQ(-1, snap.eta_msec);
+}
+
+TEST(TransferStats, SteadyRate)
+{
+    TransferStats stats;
+    uint64_t now {1000};
+    stats.reset(now, 10*1000*1000);
+
+    // 100 KB/s, in 100 msec pieces
+    for (int i=0; i<300; ++i)
+    {
+        now += 100;
+        stats.add(now, 10*1000);
+    }
+
+    auto const snap = stats.snapshot(now);
+    EXPECT_EQ(3*1000*1000, int(snap.n_bytes));
+    EXPECT_EQ(7*1000*1000, int(snap.n_remaining));
+    EXPECT_NEAR(100*1000, double(snap.average_bps), 4000);
+    EXPECT_NEAR(100*1000, double(snap.smoothed_bps), 1000);
+    EXPECT_EQ(0, int(snap.stalled_msec));
+    EXPECT_NEAR(70*1000, double(snap.eta_msec), 1000);
+}
+
+TEST(TransferStats, SmoothsBursts)
+{
+    TransferStats stats;
+    uint64_t now {1000};
+    stats.reset(now, 0);
+
+    // 30 seconds at 100 KB/s, then a one-second burst at 1 MB/s
+    for (int i=0; i<30; ++i)
+    {
+        now += 1000;
+        stats.add(now, 100*1000);
+    }
+    now += 1000;
+    stats.add(now, 1000*1000);
+    now += 1000;
+
+    auto const snap = stats.snapshot(now);
+    EXPECT_GT(snap.smoothed_bps, uint64_t(100*1000));
+    EXPECT_LT(snap.smoothed_bps, uint64_t(200*1000));
+}
+
+TEST(TransferStats, DecaysWhileStalled)
+{
+    TransferStats stats;
+    uint64_t now {1000};
+    stats.reset(now, 10*1000*1000);
+
+    for (int i=0; i<30; ++i)
+    {
+        now += 1000;
+        stats.add(now, 100*1000);
+    }
+    auto const before = stats.snapshot(now);
+
+    // nothing moves for ten seconds
+    now += 10*1000;
+    auto const after = stats.snapshot(now);
+    EXPECT_EQ(10*1000, int(after.stalled_msec));
+    EXPECT_LT(after.smoothed_bps, before.smoothed_bps * 3 / 4);
+    EXPECT_GT(after.eta_msec, before.eta_msec);
+
+    // a long stall forgets the old rate entirely
+    now += 10*60*1000;
+    EXPECT_EQ(0, int(stats.snapshot(now).smoothed_bps));
+    EXPECT_EQ(-1, stats.snapshot(now).eta_msec);
+}
+
+TEST(TransferStats, Finished)
+{
+    TransferStats stats;
+    stats.reset(1000, 5000);
+    stats.add(2000, 5000);
+
+    auto const snap = stats.snapshot(2500);
+    EXPECT_EQ(0, int(snap.n_remaining));
+    EXPECT_EQ(0, snap.eta_msec);
+}
+
+TEST(TransferStats, Resets)
+{
+    TransferStats stats;
+    stats.reset(1000, 5000);
+    stats.add(2000, 4000);
+
+    stats.reset(3000, 8000);
+    auto const snap = stats.snapshot(3000);
+    EXPECT_EQ(0, int(snap.n_bytes));
+    EXPECT_EQ(8000, int(snap.n_remaining));
+    EXPECT_EQ(0, int(snap.smoothed_bps));
+}
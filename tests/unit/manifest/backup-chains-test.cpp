@@ -0,0 +1,112 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "service/backup-chains.h"
+
+#include <gtest/gtest.h>
+
+#include <QUuid>
+
+namespace
+{
+    Metadata create_entry(QString const& subtype, QString const& dir_name, bool incremental)
+    {
+        Metadata entry(QUuid::createUuid().toString(), subtype);
+        entry.set_property_value(keeper::Item::TYPE_KEY, keeper::Item::FOLDER_VALUE);
+        entry.set_property_value(keeper::Item::SUBTYPE_KEY, subtype);
+        entry.set_property_value(keeper::Item::DIR_NAME_KEY, dir_name);
+        entry.set_property_value(keeper::Item::FILE_NAME_KEY, subtype + QStringLiteral(".keeper"));
+        entry.set_property_value(keeper::Item::INCREMENTAL_KEY, incremental);
+        return entry;
+    }
+
+    QStringList dir_names(QVector<Metadata> const& entries)
+    {
+        QStringList ret;
+        for (auto const& entry : entries)
+            ret << entry.get_dir_name();
+        return ret;
+    }
+}
+
+TEST(BackupChains, GroupsAndSorts)
+{
+    // add them out of order, as if read from manifests in any order
+    QVector<Metadata> entries {
+        create_entry("/home/a/Music", "2016-10-03T00-00-00", true),
+        create_entry("/home/a/Pictures", "2016-10-02T00-00-00", false),
+        create_entry("/home/a/Music", "2016-10-01T00-00-00", false),
+        create_entry("/home/a/Music", "2016-10-02T00-00-00", true)
+    };
+
+    BackupChains chains(entries);
+    ASSERT_EQ(2, chains.keys().size());
+
+    auto const music = BackupChains::chain_key(entries[0]);
+    EXPECT_EQ(
+        QStringList({"2016-10-01T00-00-00", "2016-10-02T00-00-00", "2016-10-03T00-00-00"}),
+        dir_names(chains.chain(music))
+    );
+    EXPECT_EQ(2, chains.incrementals_since_full(music));
+
+    auto const pictures = BackupChains::chain_key(entries[1]);
+    EXPECT_EQ(1, chains.chain(pictures).size());
+    EXPECT_EQ(0, chains.incrementals_since_full(pictures));
+}
+
+TEST(BackupChains, RestoreChain)
+{
+    QVector<Metadata> entries {
+        create_entry("/home/a/Music", "2016-10-01T00-00-00", false),
+        create_entry("/home/a/Music", "2016-10-02T00-00-00", true),
+        create_entry("/home/a/Music", "2016-10-03T00-00-00", false),
+        create_entry("/home/a/Music", "2016-10-04T00-00-00", true),
+        create_entry("/home/a/Music", "2016-10-05T00-00-00", true)
+    };
+
+    BackupChains chains(entries);
+
+    // a full backup is its own chain
+    EXPECT_EQ(QStringList({"2016-10-01T00-00-00"}), dir_names(chains.restore_chain(entries[0])));
+    EXPECT_EQ(QStringList({"2016-10-03T00-00-00"}), dir_names(chains.restore_chain(entries[2])));
+
+    // incrementals go back to the newest full backup before them
+    EXPECT_EQ(
+        QStringList({"2016-10-01T00-00-00", "2016-10-02T00-00-00"}),
+        dir_names(chains.restore_chain(entries[1]))
+    );
+    EXPECT_EQ(
+        QStringList({"2016-10-03T00-00-00", "2016-10-04T00-00-00", "2016-10-05T00-00-00"}),
+        dir_names(chains.restore_chain(entries[4]))
+    );
+    EXPECT_EQ(2, chains.incrementals_since_full(BackupChains::chain_key(entries[0])));
+}
+
+TEST(BackupChains, LegacyEntriesAreFull)
+{
+    // entries written before incrementals existed have no incremental key
+    Metadata entry(QUuid::createUuid().toString(), "Music");
+    entry.set_property_value(keeper::Item::TYPE_KEY, keeper::Item::FOLDER_VALUE);
+    entry.set_property_value(keeper::Item::DIR_NAME_KEY, "2016-10-01T00-00-00");
+    EXPECT_FALSE(entry.is_incremental());
+
+    BackupChains chains(QVector<Metadata>{entry});
+    EXPECT_EQ(1, chains.restore_chain(entry).size());
+    EXPECT_EQ(0, chains.incrementals_since_full(BackupChains::chain_key(entry)));
+}
@@ -0,0 +1,115 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+
+#include "service/backup-checkpoints.h"
+
+#include <gtest/gtest.h>
+
+#include <QDir>
+#include <QTemporaryDir>
+#include <QUuid>
+
+namespace
+{
+    Metadata create_entry(QString const& subtype)
+    {
+        Metadata entry(QUuid::createUuid().toString(), subtype);
+        entry.set_property_value(keeper::Item::TYPE_KEY, keeper::Item::FOLDER_VALUE);
+        entry.set_property_value(keeper::Item::SUBTYPE_KEY, subtype);
+        return entry;
+    }
+
+    BackupCheckpoints::Part create_part(QString const& name, QByteArray const& digest)
+    {
+        BackupCheckpoints::Part part;
+        part.name = name;
+        part.digest = digest;
+        return part;
+    }
+}
+
+TEST(BackupCheckpoints, KeyedByStorageAndItem)
+{
+    auto const music = create_entry("/home/a/Music");
+
+    // the same item gets a new uuid each time the choices are listed
+    EXPECT_EQ(BackupCheckpoints::key("sf:1", music), BackupCheckpoints::key("sf:1", create_entry("/home/a/Music")));
+    EXPECT_NE(BackupCheckpoints::key("sf:1", music), BackupCheckpoints::key("sf:2", music));
+    EXPECT_NE(BackupCheckpoints::key("sf:1", music), BackupCheckpoints::key("sf:1", create_entry("/home/a/Pictures")));
+}
+
+TEST(BackupCheckpoints, ResumesUpToTheFirstGap)
+{
+    BackupCheckpoints::Checkpoint checkpoint;
+    checkpoint.dir_name = "2016-10-01T00-00-00";
+    checkpoint.n_bytes = 1000;
+    checkpoint.part_size = 100;
+    EXPECT_FALSE(checkpoint.matches(1000, 100));
+
+    checkpoint.parts[0] = create_part("a.part000", "digest0");
+    checkpoint.parts[1] = create_part("a.part001", "digest1");
+    checkpoint.parts[3] = create_part("a.part003", "digest3");
+    EXPECT_TRUE(checkpoint.matches(1000, 100));
+    EXPECT_FALSE(checkpoint.matches(1001, 100));
+    EXPECT_FALSE(checkpoint.matches(1000, 200));
+
+    auto const resume = checkpoint.resume();
+    EXPECT_EQ(100, resume.part_size);
+    EXPECT_EQ(QStringList({"a.part000", "a.part001"}), resume.parts);
+    EXPECT_EQ(QList<QByteArray>({"digest0", "digest1"}), resume.digests);
+}
+
+TEST(BackupCheckpoints, SavesAndLoads)
+{
+    QTemporaryDir tmp;
+    auto const path = QDir(tmp.path()).filePath("keeper/checkpoints.json");
+    auto const key = BackupCheckpoints::key("sf:1", create_entry("/home/a/Music"));
+
+    BackupCheckpoints::Checkpoint checkpoint;
+    checkpoint.dir_name = "2016-10-01T00-00-00";
+    checkpoint.n_bytes = 5000000000;
+    checkpoint.part_size = 64*1024*1024;
+    checkpoint.parts[0] = create_part("Music.keeper.part000", QByteArray("\x00\xff\x10", 3));
+    checkpoint.parts[2] = create_part("Music.keeper.part002", QByteArray("\x01\x02\x03", 3));
+
+    {
+        BackupCheckpoints checkpoints(path);
+        EXPECT_TRUE(checkpoints.get(key).parts.isEmpty());
+        checkpoints.set(key, checkpoint);
+    }
+    {
+        BackupCheckpoints checkpoints(path);
+        auto const loaded = checkpoints.get(key);
+        EXPECT_EQ(checkpoint.dir_name, loaded.dir_name);
+        EXPECT_EQ(checkpoint.n_bytes, loaded.n_bytes);
+        EXPECT_EQ(checkpoint.part_size, loaded.part_size);
+        ASSERT_EQ(checkpoint.parts.keys(), loaded.parts.keys());
+        for (auto const i : checkpoint.parts.keys())
+        {
+            EXPECT_EQ(checkpoint.parts[i].name, loaded.parts[i].name);
+            EXPECT_EQ(checkpoint.parts[i].digest, loaded.parts[i].digest);
+        }
+        checkpoints.remove(key);
+    }
+    {
+        BackupCheckpoints checkpoints(path);
+        EXPECT_TRUE(checkpoints.get(key).parts.isEmpty());
+    }
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+
+#include "service/backup-index.h"
+
+#include <gtest/gtest.h>
+
+#include <QUuid>
+
+namespace
+{
+    Metadata create_entry(QString const& subtype, QString const& dir_name)
+    {
+        Metadata entry(QUuid::createUuid().toString(), subtype);
+        entry.set_property_value(keeper::Item::TYPE_KEY, keeper::Item::FOLDER_VALUE);
+        entry.set_property_value(keeper::Item::SUBTYPE_KEY, subtype);
+        entry.set_property_value(keeper::Item::DIR_NAME_KEY, dir_name);
+        entry.set_property_value(keeper::Item::FILE_NAME_KEY, subtype + QStringLiteral(".keeper"));
+        return entry;
+    }
+}
+
+TEST(BackupIndex, JsonRoundTrip)
+{
+    BackupIndex::Backups backups;
+    backups["2016-10-01T00-00-00"] = QVector<Metadata>{
+        create_entry("/home/a/Music", "2016-10-01T00-00-00"),
+        create_entry("/home/a/Pictures", "2016-10-01T00-00-00")
+    };
+    // a resumed archive lives in an older backup's dir
+    backups["2016-10-02T00-00-00"] = QVector<Metadata>{
+        create_entry("/home/a/Music", "2016-10-01T00-00-00")
+    };
+
+    BackupIndex::Backups got;
+    ASSERT_TRUE(BackupIndex::from_json(BackupIndex::to_json(backups), got));
+    ASSERT_EQ(backups.keys(), got.keys());
+    for (auto const& dir : backups.keys())
+    {
+        ASSERT_EQ(backups[dir].size(), got[dir].size());
+        for (int i=0; i<backups[dir].size(); ++i)
+            EXPECT_EQ(backups[dir][i].json(), got[dir][i].json());
+    }
+}
+
+TEST(BackupIndex, RejectsGarbage)
+{
+    BackupIndex::Backups got;
+    EXPECT_FALSE(BackupIndex::from_json(QByteArray(), got));
+    EXPECT_FALSE(BackupIndex::from_json("{\"backups\":{\"2016-10-01T00-00-", got));
+    EXPECT_FALSE(BackupIndex::from_json("{\"entries\":[]}", got));
+
+    // an index that covers nothing is still an index
+    EXPECT_TRUE(BackupIndex::from_json(BackupIndex::to_json(BackupIndex::Backups()), got));
+    EXPECT_TRUE(got.isEmpty());
+}
+
+TEST(BackupIndex, CandidatesAreNewestFirst)
+{
+    QVector<QString> const dirs {
+        "2016-10-02T00-00-00",
+        "2016-10-04T00-00-00",
+        "2016-10-01T00-00-00",
+        "2016-10-03T00-00-00",
+        "2016-10-05T00-00-00"
+    };
+    QVector<QString> const expected {
+        "2016-10-05T00-00-00",
+        "2016-10-04T00-00-00",
+        "2016-10-03T00-00-00"
+    };
+    ASSERT_EQ(BackupIndex::MAX_CANDIDATES, expected.size());
+    EXPECT_EQ(expected, BackupIndex::candidates(dirs));
+    EXPECT_TRUE(BackupIndex::candidates(QVector<QString>()).isEmpty());
+}
@@ -0,0 +1,191 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+
+#include "service/consolidator.h"
+#include "service/manifest.h"
+#include "storage-framework/download-reader.h"
+#include "storage-framework/storage_framework_client.h"
+#include "tar/tar-creator.h"
+#include "tar/untar.h"
+
+#include <gtest/gtest.h>
+
+#include <QDir>
+#include <QFile>
+#include <QFutureWatcher>
+#include <QSignalSpy>
+#include <QTemporaryDir>
+#include <QUrl>
+#include <QUuid>
+
+#include <algorithm>
+#include <vector>
+
+class ConsolidatorFixture: public ::testing::Test
+{
+protected:
+
+    void SetUp() override
+    {
+        storage_.reset(new StorageFrameworkClient);
+        storage_->set_storage(QUrl::fromLocalFile(root_.path()).toString());
+    }
+
+    template<typename T>
+    T wait_for(QFuture<T> future)
+    {
+        QFutureWatcher<T> w;
+        QSignalSpy spy(&w, &QFutureWatcher<T>::finished);
+        w.setFuture(future);
+        if (!future.isFinished())
+            EXPECT_TRUE(spy.wait());
+        return future.result();
+    }
+
+    void write_file(QString const& filename, QByteArray const& contents)
+    {
+        QFile file(QDir(in_.path()).filePath(filename));
+        ASSERT_TRUE(file.open(QIODevice::WriteOnly|QIODevice::Truncate));
+        ASSERT_EQ(qint64(contents.size()), file.write(contents));
+    }
+
+    QByteArray random_bytes(int n)
+    {
+        QByteArray bytes(n, Qt::Uninitialized);
+        for (auto& ch : bytes)
+            ch = char(qrand());
+        return bytes;
+    }
+
+    // stores a backup of `files` in `dir_name`, as TaskManager would
+    void backup(QString const& dir_name, QStringList const& files, bool incremental)
+    {
+        TarCreator tar_creator(files, false);
+        tar_creator.set_base_dir(in_.path());
+        tar_creator.enable_delta(signatures_.path(), 1024);
+        auto const n_bytes = tar_creator.calculate_size();
+        QByteArray tar;
+        std::vector<char> step;
+        while (tar_creator.step(step))
+            tar.append(step.data(), int(step.size()));
+        ASSERT_EQ(qint64(n_bytes), qint64(tar.size()));
+
+        auto const file_name = QStringLiteral("Music.keeper");
+        auto uploader = wait_for(storage_->get_new_uploader(tar.size(), dir_name, file_name));
+        ASSERT_NE(nullptr, uploader);
+        uploader->socket()->write(tar);
+        QSignalSpy commit_spy(uploader.get(), &Uploader::commit_finished);
+        uploader->commit();
+        ASSERT_TRUE(commit_spy.count() || commit_spy.wait());
+        ASSERT_TRUE(commit_spy.at(0).at(0).toBool());
+
+        Metadata entry(QUuid::createUuid().toString(), "Music");
+        entry.set_property_value(keeper::Item::TYPE_KEY, keeper::Item::FOLDER_VALUE);
+        entry.set_property_value(keeper::Item::SUBTYPE_KEY, in_.path());
+        entry.set_property_value(keeper::Item::DIR_NAME_KEY, dir_name);
+        entry.set_property_value(keeper::Item::FILE_NAME_KEY, uploader->file_name());
+        entry.set_property_value(keeper::Item::INCREMENTAL_KEY, incremental);
+
+        Manifest manifest(storage_, dir_name);
+        manifest.add_entry(entry);
+        QSignalSpy manifest_spy(&manifest, &Manifest::finished);
+        manifest.store();
+        ASSERT_TRUE(manifest_spy.count() || manifest_spy.wait());
+        ASSERT_TRUE(manifest_spy.at(0).at(0).toBool());
+
+        TarCreator::commit_signatures(signatures_.path(), in_.path());
+    }
+
+    QVector<Metadata> read_manifest(QString const& dir_name)
+    {
+        Manifest manifest(storage_, dir_name);
+        QSignalSpy spy(&manifest, &Manifest::finished);
+        manifest.read();
+        EXPECT_TRUE(spy.count() || spy.wait());
+        return manifest.get_entries();
+    }
+
+    // untars the archive that `entry` describes into `dir`
+    bool restore(Metadata const& entry, QString const& dir)
+    {
+        auto downloader = wait_for(Manifest::open_archive(storage_, entry));
+        if (!downloader)
+            return false;
+
+        DownloadReader reader(downloader);
+        QSignalSpy spy(&reader, &DownloadReader::finished);
+        reader.start();
+        if (!spy.wait() || !spy.at(0).at(0).toBool())
+            return false;
+        downloader->finish();
+
+        Untar untar(dir.toStdString());
+        return untar.step(reader.bytes().constData(), size_t(reader.bytes().size())) && untar.finish();
+    }
+
+    QTemporaryDir root_;
+    QTemporaryDir in_;
+    QTemporaryDir signatures_;
+    QSharedPointer<StorageFrameworkClient> storage_;
+};
+
+TEST_F(ConsolidatorFixture, DropsFilesDeletedMidChain)
+{
+    auto const v1 = random_bytes(64*1024);
+    auto v2 = v1;
+    v2.replace(1000, 100, random_bytes(100));
+
+    // a full backup of a and b, then b is deleted, then c is added
+    write_file("a", v1);
+    write_file("b", random_bytes(2000));
+    backup("2016-10-01T00-00-00", QStringList{"./a", "./b"}, false);
+    write_file("a", v2);
+    QFile::remove(QDir(in_.path()).filePath("b"));
+    backup("2016-10-02T00-00-00", QStringList{"./a"}, true);
+    auto const c = random_bytes(3000);
+    write_file("c", c);
+    backup("2016-10-03T00-00-00", QStringList{"./a", "./c"}, true);
+
+    Consolidator consolidator(storage_);
+    QSignalSpy spy(&consolidator, &Consolidator::finished);
+    consolidator.start(1);
+    ASSERT_TRUE(spy.wait(30000));
+    ASSERT_TRUE(spy.at(0).at(0).toBool());
+
+    // the synthetic full is in a new dir that sorts after the chain
+    auto dirs = wait_for(storage_->get_keeper_dirs());
+    ASSERT_EQ(4, dirs.size());
+    auto const newest = *std::max_element(dirs.begin(), dirs.end());
+    auto const entries = read_manifest(newest);
+    ASSERT_EQ(1, entries.size());
+    EXPECT_FALSE(entries[0].get_property_value(keeper::Item::INCREMENTAL_KEY).toBool());
+
+    // it should hold what the newest backup held, and no more
+    QTemporaryDir out;
+    ASSERT_TRUE(restore(entries[0], out.path()));
+    QDir const outdir(out.path());
+    EXPECT_EQ(QStringList({"a", "c"}), outdir.entryList(QDir::Files|QDir::Hidden, QDir::Name));
+    QFile a(outdir.filePath("a"));
+    ASSERT_TRUE(a.open(QIODevice::ReadOnly));
+    EXPECT_EQ(v2, a.readAll());
+    QFile restored_c(outdir.filePath("c"));
+    ASSERT_TRUE(restored_c.open(QIODevice::ReadOnly));
+    EXPECT_EQ(c, restored_c.readAll());
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "service/manifest-cache.h"
+
+#include <gtest/gtest.h>
+
+#include <QDir>
+#include <QTemporaryDir>
+#include <QUuid>
+
+namespace
+{
+    Metadata create_entry(QString const& subtype, QString const& dir_name)
+    {
+        Metadata entry(QUuid::createUuid().toString(), subtype);
+        entry.set_property_value(keeper::Item::TYPE_KEY, keeper::Item::FOLDER_VALUE);
+        entry.set_property_value(keeper::Item::SUBTYPE_KEY, subtype);
+        entry.set_property_value(keeper::Item::DIR_NAME_KEY, dir_name);
+        entry.set_property_value(keeper::Item::FILE_NAME_KEY, subtype + QStringLiteral(".keeper"));
+        return entry;
+    }
+}
+
+TEST(ManifestCache, SavesAndLoads)
+{
+    QTemporaryDir tmp;
+    auto const path = QDir(tmp.path()).filePath("keeper/manifests.json");
+    QVector<Metadata> const entries {
+        create_entry("/home/a/Music", "2016-10-01T00-00-00"),
+        create_entry("/home/a/Pictures", "2016-10-01T00-00-00")
+    };
+
+    {
+        ManifestCache cache(path);
+        QVector<Metadata> got;
+        EXPECT_FALSE(cache.get("sf:1", "2016-10-01T00-00-00", got));
+        cache.set("sf:1", "2016-10-01T00-00-00", entries);
+        cache.save();
+    }
+    {
+        ManifestCache cache(path);
+        QVector<Metadata> got;
+        ASSERT_TRUE(cache.get("sf:1", "2016-10-01T00-00-00", got));
+        ASSERT_EQ(entries.size(), got.size());
+        for (int i=0; i<entries.size(); ++i)
+            EXPECT_EQ(entries[i].json(), got[i].json());
+
+        // each storage has its own
+        EXPECT_FALSE(cache.get("sf:2", "2016-10-01T00-00-00", got));
+    }
+}
+
+TEST(ManifestCache, PrunesDeletedBackups)
+{
+    QTemporaryDir tmp;
+    auto const path = QDir(tmp.path()).filePath("manifests.json");
+    QVector<Metadata> got;
+
+    ManifestCache cache(path);
+    cache.set("sf:1", "2016-10-01T00-00-00", QVector<Metadata>{create_entry("/home/a/Music", "2016-10-01T00-00-00")});
+    cache.set("sf:1", "2016-10-02T00-00-00", QVector<Metadata>{create_entry("/home/a/Music", "2016-10-02T00-00-00")});
+    cache.set("sf:2", "2016-10-01T00-00-00", QVector<Metadata>{create_entry("/home/a/Music", "2016-10-01T00-00-00")});
+
+    cache.prune("sf:1", QVector<QString>{"2016-10-02T00-00-00", "2016-10-03T00-00-00"});
+    EXPECT_FALSE(cache.get("sf:1", "2016-10-01T00-00-00", got));
+    EXPECT_TRUE(cache.get("sf:1", "2016-10-02T00-00-00", got));
+    EXPECT_TRUE(cache.get("sf:2", "2016-10-01T00-00-00", got));
+}
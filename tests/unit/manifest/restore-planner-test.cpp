@@ -0,0 +1,143 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "service/restore-planner.h"
+#include "tar/delta.h"
+#include "tar/tar-filter.h"
+
+#include <gtest/gtest.h>
+
+#include <QUuid>
+
+#include <set>
+#include <string>
+#include <vector>
+
+namespace
+{
+    Metadata create_backup(QString const& dir_name, bool incremental)
+    {
+        Metadata entry(QUuid::createUuid().toString(), "Music");
+        entry.set_property_value(keeper::Item::TYPE_KEY, keeper::Item::FOLDER_VALUE);
+        entry.set_property_value(keeper::Item::DIR_NAME_KEY, dir_name);
+        entry.set_property_value(keeper::Item::FILE_NAME_KEY, QStringLiteral("Music.keeper"));
+        entry.set_property_value(keeper::Item::INCREMENTAL_KEY, incremental);
+        return entry;
+    }
+
+    // builds a catalog with one 1 KiB member per path
+    std::vector<TarIndexer::Entry> create_catalog(std::vector<std::string> const& paths)
+    {
+        std::vector<TarIndexer::Entry> catalog;
+        uint64_t offset {};
+        for (auto const& path : paths)
+        {
+            TarIndexer::Entry entry;
+            entry.path = path;
+            entry.type = '0';
+            entry.size = 1024;
+            entry.start_offset = offset;
+            entry.data_offset = offset + TarIndexer::BLOCK_SIZE;
+            entry.end_offset = entry.data_offset + entry.size;
+            offset = entry.end_offset;
+            catalog.push_back(entry);
+        }
+        return catalog;
+    }
+
+    std::set<std::string> kept_paths(RestorePlanner::Step const& step)
+    {
+        std::set<std::string> paths;
+        for (auto const& entry : step.kept)
+            paths.insert(entry.path);
+        return paths;
+    }
+
+    std::string delta(std::string const& path)
+    {
+        return path + Delta::SUFFIX;
+    }
+}
+
+TEST(RestorePlanner, ReadsEachFileFromItsNewestFullCopy)
+{
+    QVector<Metadata> const chain {
+        create_backup("2016-10-01T00-00-00", false),
+        create_backup("2016-10-02T00-00-00", true),
+        create_backup("2016-10-03T00-00-00", true)
+    };
+    std::vector<std::vector<TarIndexer::Entry>> const catalogs {
+        create_catalog({ "./a", "./b", "./c", "./deleted" }),
+        create_catalog({ "./a", delta("./b"), "./c" }),
+        create_catalog({ "./a", delta("./b"), delta("./c"), "./new" })
+    };
+
+    RestorePlanner planner(chain, catalogs);
+    auto const& steps = planner.steps();
+    ASSERT_EQ(3, int(steps.size()));
+
+    // "a" comes from the newest backup, and "deleted" isn't restored.
+    // "b" is rebuilt from its full copy and both deltas; "c" from the middle one.
+    EXPECT_EQ(std::set<std::string>({ "./b" }), kept_paths(steps[0]));
+    EXPECT_EQ(std::set<std::string>({ delta("./b"), "./c" }), kept_paths(steps[1]));
+    EXPECT_EQ(std::set<std::string>({ "./a", delta("./b"), delta("./c"), "./new" }), kept_paths(steps[2]));
+
+    // the steps are oldest first
+    EXPECT_EQ(chain[0].get_dir_name(), steps[0].backup.get_dir_name());
+    EXPECT_EQ(chain[2].get_dir_name(), steps[2].backup.get_dir_name());
+
+    qint64 n_bytes {};
+    for (auto const& step : steps)
+        n_bytes += qint64(TarFilter::filtered_size(step.kept));
+    EXPECT_EQ(n_bytes, planner.n_bytes());
+}
+
+TEST(RestorePlanner, SkipsArchivesThatContributeNothing)
+{
+    QVector<Metadata> const chain {
+        create_backup("2016-10-01T00-00-00", false),
+        create_backup("2016-10-02T00-00-00", true)
+    };
+    std::vector<std::vector<TarIndexer::Entry>> const catalogs {
+        create_catalog({ "./a", "./b" }),
+        create_catalog({ "./a", "./b" })
+    };
+
+    RestorePlanner planner(chain, catalogs);
+    ASSERT_EQ(1, int(planner.steps().size()));
+    EXPECT_EQ(chain[1].get_dir_name(), planner.steps()[0].backup.get_dir_name());
+    EXPECT_EQ(qint64(TarFilter::filtered_size(catalogs[1])), planner.n_bytes());
+}
+
+TEST(RestorePlanner, Filter)
+{
+    QVector<Metadata> const chain {
+        create_backup("2016-10-01T00-00-00", false),
+        create_backup("2016-10-02T00-00-00", true)
+    };
+    std::vector<std::vector<TarIndexer::Entry>> const catalogs {
+        create_catalog({ "./a", "./b" }),
+        create_catalog({ delta("./a"), "./b" })
+    };
+
+    RestorePlanner planner(chain, catalogs);
+    ASSERT_EQ(2, int(planner.steps().size()));
+    EXPECT_EQ(std::set<std::string>({ "./a" }), kept_paths(planner.steps()[0]));
+    EXPECT_TRUE(bool(planner.create_filter(0)));
+}
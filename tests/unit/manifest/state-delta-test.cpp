@@ -0,0 +1,125 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+
+#include "service/task-manager.h"
+
+#include <gtest/gtest.h>
+
+namespace
+{
+    QVariantMap task_state(QString const& action, double percent_done)
+    {
+        return QVariantMap{
+            { keeper::Item::DISPLAY_NAME_KEY, QStringLiteral("Music") },
+            { QStringLiteral("action"), action },
+            { QStringLiteral("percent-done"), percent_done }
+        };
+    }
+}
+
+TEST(StateDelta, NothingChanged)
+{
+    QVariantDictMap const state { { "a", task_state("saving", 0.5) } };
+
+    keeper::Items changes;
+    QStringList removed;
+    TaskManager::diff_state(state, state, changes, removed);
+    EXPECT_TRUE(changes.isEmpty());
+    EXPECT_TRUE(removed.isEmpty());
+}
+
+TEST(StateDelta, NewTasksAreSentWhole)
+{
+    QVariantDictMap const after { { "a", task_state("queued", 0.0) } };
+
+    keeper::Items changes;
+    QStringList removed;
+    TaskManager::diff_state(QVariantDictMap(), after, changes, removed);
+    EXPECT_TRUE(removed.isEmpty());
+    ASSERT_EQ(1, changes.size());
+    EXPECT_EQ(after["a"], QVariantMap(changes["a"]));
+}
+
+TEST(StateDelta, OnlyChangedPropertiesAreSent)
+{
+    QVariantDictMap const before {
+        { "a", task_state("saving", 0.5) },
+        { "b", task_state("queued", 0.0) }
+    };
+    auto after = before;
+    after["a"]["percent-done"] = 0.75;
+
+    keeper::Items changes;
+    QStringList removed;
+    TaskManager::diff_state(before, after, changes, removed);
+    EXPECT_TRUE(removed.isEmpty());
+    ASSERT_EQ(1, changes.size());
+    EXPECT_EQ((QVariantMap{ { "percent-done", 0.75 } }), QVariantMap(changes["a"]));
+
+    // a property that's new to a task is a change too
+    after = before;
+    after["b"]["speed"] = 100;
+    changes.clear();
+    TaskManager::diff_state(before, after, changes, removed);
+    EXPECT_TRUE(removed.isEmpty());
+    ASSERT_EQ(1, changes.size());
+    EXPECT_EQ((QVariantMap{ { "speed", 100 } }), QVariantMap(changes["b"]));
+}
+
+TEST(StateDelta, GoneTasksAreRemoved)
+{
+    QVariantDictMap const before {
+        { "a", task_state("complete", 1.0) },
+        { "b", task_state("saving", 0.5) }
+    };
+    QVariantDictMap const after { { "b", task_state("saving", 0.5) } };
+
+    keeper::Items changes;
+    QStringList removed;
+    TaskManager::diff_state(before, after, changes, removed);
+    EXPECT_TRUE(changes.isEmpty());
+    EXPECT_EQ(QStringList{ "a" }, removed);
+}
+
+// clients can't unset one property, so a task that lost
+// some is removed and then sent again in full
+TEST(StateDelta, LostKeysResendTheTask)
+{
+    auto with_error = task_state("failed", 0.5);
+    with_error["error"] = 3;
+    QVariantDictMap const before { { "a", with_error } };
+    QVariantDictMap const after { { "a", task_state("queued", 0.0) } };
+
+    keeper::Items changes;
+    QStringList removed;
+    TaskManager::diff_state(before, after, changes, removed);
+    EXPECT_EQ(QStringList{ "a" }, removed);
+    ASSERT_EQ(1, changes.size());
+    EXPECT_EQ(after["a"], QVariantMap(changes["a"]));
+
+    // applying it the way a client does gets back to `after`
+    QVariantDictMap applied = before;
+    for (auto const& uuid : removed)
+        applied.remove(uuid);
+    for (auto it = changes.cbegin(); it != changes.cend(); ++it)
+        for (auto kit = it->cbegin(); kit != it->cend(); ++kit)
+            applied[it.key()].insert(kit.key(), kit.value());
+    EXPECT_EQ(after, applied);
+}
@@ -0,0 +1,177 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include <storage-framework/storage_framework_client.h>
+
+#include "tests/utils/storage-framework-local.h"
+
+#include <QDir>
+#include <QSignalSpy>
+#include <QTemporaryDir>
+#include <QUrl>
+
+#include <gtest/gtest.h>
+#include <glib.h>
+
+class HandleCacheFixture: public ::testing::Test
+{
+protected:
+
+    void SetUp() override
+    {
+        g_setenv("XDG_DATA_HOME", tmp_dir_.path().toLatin1().data(), true);
+    }
+
+    void TearDown() override
+    {
+        g_unsetenv("XDG_DATA_HOME");
+    }
+
+    template<typename T>
+    T wait_for(QFuture<T> future)
+    {
+        QFutureWatcher<T> w;
+        QSignalSpy spy(&w, &QFutureWatcher<T>::finished);
+        w.setFuture(future);
+        if (!future.isFinished())
+            EXPECT_TRUE(spy.wait());
+        return future.result();
+    }
+
+    bool upload(StorageFrameworkClient& client, QString const& dir_name, QString const& file_name, QByteArray const& contents)
+    {
+        auto uploader = wait_for(client.get_new_uploader(contents.size(), dir_name, file_name));
+        if (!uploader)
+            return false;
+
+        uploader->socket()->write(contents);
+        QSignalSpy spy(uploader.get(), &Uploader::commit_finished);
+        uploader->commit();
+        if (!spy.count() && !spy.wait(15000))
+            return false;
+        return spy.at(0).at(0).toBool();
+    }
+
+    // the keeper folder on disk, or an invalid QDir if it's not there
+    QDir keeper_dir()
+    {
+        QDir dir;
+        return StorageFrameworkLocalUtils::find_storage_framework_root_dir(dir) ? dir : QDir();
+    }
+
+    QTemporaryDir tmp_dir_;
+};
+
+TEST_F(HandleCacheFixture, LookupsAreCached)
+{
+    QString const dir_name {QStringLiteral("cached_dir")};
+
+    StorageFrameworkClient sf_client;
+    ASSERT_TRUE(wait_for(sf_client.prepare_folder(dir_name, true)));
+    ASSERT_TRUE(keeper_dir().exists(dir_name));
+
+    // removing the folder behind the client's back doesn't show
+    // because the handle that was looked up before is reused...
+    ASSERT_TRUE(QDir(keeper_dir().filePath(dir_name)).removeRecursively());
+    EXPECT_TRUE(wait_for(sf_client.prepare_folder(dir_name, false)));
+
+    // ...until the cache is invalidated
+    sf_client.invalidate_cache();
+    EXPECT_FALSE(wait_for(sf_client.prepare_folder(dir_name, false)));
+    EXPECT_FALSE(keeper_dir().exists(dir_name));
+}
+
+TEST_F(HandleCacheFixture, ChangingStorageInvalidatesCache)
+{
+    QString const dir_name {QStringLiteral("cached_dir")};
+
+    StorageFrameworkClient sf_client;
+    ASSERT_TRUE(wait_for(sf_client.prepare_folder(dir_name, true)));
+    ASSERT_TRUE(QDir(keeper_dir().filePath(dir_name)).removeRecursively());
+
+    // setting the same storage again keeps the cache
+    sf_client.set_storage(QString());
+    EXPECT_TRUE(wait_for(sf_client.prepare_folder(dir_name, false)));
+
+    // switching to another one and back doesn't
+    QTemporaryDir local_dir;
+    sf_client.set_storage(QUrl::fromLocalFile(local_dir.path()).toString());
+    sf_client.set_storage(QString());
+    EXPECT_FALSE(wait_for(sf_client.prepare_folder(dir_name, false)));
+}
+
+TEST_F(HandleCacheFixture, StaleFolderIsRetriedOnce)
+{
+    QString const dir_name {QStringLiteral("stale_dir")};
+    QByteArray const contents {"hello world"};
+
+    StorageFrameworkClient sf_client;
+    ASSERT_TRUE(upload(sf_client, dir_name, QStringLiteral("first"), contents));
+
+    // the cached handle now points at a folder that isn't there anymore,
+    // so creating the next file fails once and is retried with fresh handles
+    ASSERT_TRUE(QDir(keeper_dir().filePath(dir_name)).removeRecursively());
+    EXPECT_TRUE(upload(sf_client, dir_name, QStringLiteral("second"), contents));
+    EXPECT_EQ(keeper::Error::OK, sf_client.get_last_error());
+
+    QDir const dir(keeper_dir().filePath(dir_name));
+    ASSERT_TRUE(dir.exists());
+    EXPECT_EQ(QStringList{QStringLiteral("second")}, dir.entryList(QDir::Files));
+}
+
+TEST_F(HandleCacheFixture, StaleKeeperFolderIsRetriedOnce)
+{
+    QString const dir_name {QStringLiteral("stale_dir")};
+    QByteArray const contents {"hello world"};
+
+    StorageFrameworkClient sf_client;
+    ASSERT_TRUE(upload(sf_client, dir_name, QStringLiteral("first"), contents));
+
+    // same, but with everything under the keeper folder gone
+    ASSERT_TRUE(keeper_dir().removeRecursively());
+    EXPECT_TRUE(upload(sf_client, dir_name, QStringLiteral("second"), contents));
+
+    QDir const dir(keeper_dir().filePath(dir_name));
+    ASSERT_TRUE(dir.exists());
+    EXPECT_EQ(QStringList{QStringLiteral("second")}, dir.entryList(QDir::Files));
+}
+
+TEST_F(HandleCacheFixture, ConcurrentLookupsAreShared)
+{
+    QString const dir_name {QStringLiteral("shared_dir")};
+
+    // neither lookup has finished when the other starts,
+    // so the second has to wait on the first instead of creating its own
+    StorageFrameworkClient sf_client;
+    auto first = sf_client.prepare_folder(dir_name, true);
+    auto second = sf_client.prepare_folder(dir_name, true);
+    EXPECT_TRUE(wait_for(first));
+    EXPECT_TRUE(wait_for(second));
+
+    auto const entries = keeper_dir().entryList(QDir::Dirs | QDir::NoDotAndDotDot);
+    EXPECT_EQ(QStringList{dir_name}, entries);
+
+    // uploaders that start together share the folder as well
+    QString const other_name {QStringLiteral("other_dir")};
+    auto uploader_a = sf_client.get_new_uploader(0, other_name, QStringLiteral("a"));
+    auto uploader_b = sf_client.get_new_uploader(0, other_name, QStringLiteral("b"));
+    EXPECT_NE(nullptr, wait_for(uploader_a));
+    EXPECT_NE(nullptr, wait_for(uploader_b));
+    EXPECT_EQ(2, keeper_dir().entryList(QDir::Dirs | QDir::NoDotAndDotDot).size());
+}
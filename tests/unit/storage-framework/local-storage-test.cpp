@@ -0,0 +1,279 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+
+#include <storage-framework/download-reader.h>
+#include <storage-framework/storage_framework_client.h>
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QSignalSpy>
+#include <QTemporaryDir>
+#include <QUrl>
+
+#include <gtest/gtest.h>
+
+class LocalStorageFixture: public ::testing::Test
+{
+protected:
+
+    template<typename T>
+    T wait_for(QFuture<T> future)
+    {
+        QFutureWatcher<T> w;
+        QSignalSpy spy(&w, &QFutureWatcher<T>::finished);
+        w.setFuture(future);
+        if (!future.isFinished())
+            EXPECT_TRUE(spy.wait());
+        return future.result();
+    }
+
+    bool upload(StorageFrameworkClient& client, QString const& dir_name, QString const& file_name, QByteArray const& contents)
+    {
+        auto uploader = wait_for(client.get_new_uploader(contents.size(), dir_name, file_name));
+        if (!uploader)
+            return false;
+
+        uploader->socket()->write(contents);
+        QSignalSpy spy(uploader.get(), &Uploader::commit_finished);
+        uploader->commit();
+        if (!spy.count() && !spy.wait())
+            return false;
+        return spy.at(0).at(0).toBool();
+    }
+
+    QByteArray download(StorageFrameworkClient& client, QString const& dir_name, QString const& file_name)
+    {
+        QByteArray bytes;
+        auto downloader = wait_for(client.get_new_downloader(dir_name, file_name));
+        if (!downloader)
+            return bytes;
+
+        auto socket = downloader->socket();
+        while (bytes.size() < downloader->file_size())
+        {
+            if (!socket->bytesAvailable() && !socket->waitForReadyRead(5000))
+                break;
+            bytes += socket->readAll();
+        }
+        downloader->finish();
+        return bytes;
+    }
+
+    QByteArray random_bytes(int n)
+    {
+        QByteArray bytes(n, Qt::Uninitialized);
+        for (auto& ch : bytes)
+            ch = char(qrand());
+        return bytes;
+    }
+};
+
+TEST_F(LocalStorageFixture, StorageId)
+{
+    EXPECT_EQ(QStringLiteral("/media/nas/backups"), StorageFrameworkClient::local_storage_dir(QStringLiteral("file:///media/nas/backups/")));
+    EXPECT_TRUE(StorageFrameworkClient::local_storage_dir(QStringLiteral("12345:Ubuntu One")).isEmpty());
+    EXPECT_TRUE(StorageFrameworkClient::local_storage_dir(QString()).isEmpty());
+}
+
+TEST_F(LocalStorageFixture, UploadAndDownload)
+{
+    QTemporaryDir root;
+    StorageFrameworkClient client;
+    client.set_storage(QUrl::fromLocalFile(root.path()).toString());
+
+    auto const dir_name = QStringLiteral("2016-10-18T12-00-00");
+    auto const file_name = QStringLiteral("test_file");
+    auto const contents = random_bytes(5*1024*1024 + 123);
+    ASSERT_TRUE(upload(client, dir_name, file_name, contents));
+
+    // it should be laid out like a storage-framework root,
+    // with no temporary files left behind
+    QDir const dir(QDir(root.path()).filePath(StorageFrameworkClient::KEEPER_FOLDER + QStringLiteral("/") + dir_name));
+    EXPECT_EQ(QStringList{file_name}, dir.entryList(QDir::Files | QDir::Hidden));
+    QFile file(dir.filePath(file_name));
+    ASSERT_TRUE(file.open(QIODevice::ReadOnly));
+    EXPECT_EQ(contents, file.readAll());
+
+    EXPECT_EQ(QVector<QString>{dir_name}, wait_for(client.get_keeper_dirs()));
+    EXPECT_EQ(contents, download(client, dir_name, file_name));
+
+    // missing files can't be downloaded
+    EXPECT_EQ(nullptr, wait_for(client.get_new_downloader(dir_name, QStringLiteral("nope"))));
+    EXPECT_EQ(keeper::Error::READING_REMOTE_FILE, client.get_last_error());
+    EXPECT_EQ(nullptr, wait_for(client.get_new_downloader(QStringLiteral("nope"), file_name)));
+    EXPECT_EQ(keeper::Error::REMOTE_DIR_NOT_EXISTS, client.get_last_error());
+}
+
+TEST_F(LocalStorageFixture, UncommittedUploadsAreDiscarded)
+{
+    QTemporaryDir root;
+    StorageFrameworkClient client;
+    client.set_storage(QUrl::fromLocalFile(root.path()).toString());
+
+    auto const dir_name = QStringLiteral("dir");
+    auto const contents = random_bytes(1000);
+    {
+        auto uploader = wait_for(client.get_new_uploader(contents.size(), dir_name, QStringLiteral("file")));
+        ASSERT_NE(nullptr, uploader);
+        uploader->socket()->write(contents);
+        uploader->socket()->waitForBytesWritten(1000);
+    }
+    QCoreApplication::sendPostedEvents(nullptr, QEvent::DeferredDelete);
+
+    QDir const dir(QDir(root.path()).filePath(StorageFrameworkClient::KEEPER_FOLDER + QStringLiteral("/") + dir_name));
+    EXPECT_TRUE(dir.entryList(QDir::Files | QDir::Hidden).isEmpty());
+}
+
+TEST_F(LocalStorageFixture, ExistingFilesAreNotReplaced)
+{
+    QTemporaryDir root;
+    StorageFrameworkClient client;
+    client.set_storage(QUrl::fromLocalFile(root.path()).toString());
+
+    // two uploads of the same file that are both underway at once
+    auto const dir_name = QStringLiteral("dir");
+    auto const file_name = QStringLiteral("file");
+    QVector<QByteArray> contents;
+    QVector<std::shared_ptr<Uploader>> uploaders;
+    for (int i=0; i<2; ++i)
+    {
+        contents << random_bytes(1000);
+        uploaders << wait_for(client.get_new_uploader(contents[i].size(), dir_name, file_name));
+        ASSERT_NE(nullptr, uploaders[i]);
+        uploaders[i]->socket()->write(contents[i]);
+    }
+
+    QVector<std::shared_ptr<QSignalSpy>> spies;
+    for (auto& uploader : uploaders)
+    {
+        spies << std::make_shared<QSignalSpy>(uploader.get(), &Uploader::commit_finished);
+        uploader->commit();
+    }
+    for (auto& spy : spies)
+    {
+        if (!spy->count())
+            ASSERT_TRUE(spy->wait());
+    }
+
+    // only the first to finish gets the name
+    int n_committed {};
+    int winner {-1};
+    for (int i=0; i<spies.size(); ++i)
+    {
+        if (spies[i]->at(0).at(0).toBool())
+        {
+            ++n_committed;
+            winner = i;
+        }
+    }
+    ASSERT_EQ(1, n_committed);
+
+    QDir const dir(QDir(root.path()).filePath(StorageFrameworkClient::KEEPER_FOLDER + QStringLiteral("/") + dir_name));
+    EXPECT_EQ(QStringList{file_name}, dir.entryList(QDir::Files | QDir::Hidden));
+    QFile file(dir.filePath(file_name));
+    ASSERT_TRUE(file.open(QIODevice::ReadOnly));
+    EXPECT_EQ(contents[winner], file.readAll());
+}
+
+TEST_F(LocalStorageFixture, ShortUploadsFail)
+{
+    QTemporaryDir root;
+    StorageFrameworkClient client;
+    client.set_storage(QUrl::fromLocalFile(root.path()).toString());
+
+    auto uploader = wait_for(client.get_new_uploader(1000, QStringLiteral("dir"), QStringLiteral("file")));
+    ASSERT_NE(nullptr, uploader);
+    uploader->socket()->write(random_bytes(500));
+    uploader->socket()->waitForBytesWritten(1000);
+    uploader->socket()->close();
+
+    QSignalSpy spy(uploader.get(), &Uploader::commit_finished);
+    uploader->commit();
+    ASSERT_TRUE(spy.wait());
+    EXPECT_FALSE(spy.at(0).at(0).toBool());
+    EXPECT_TRUE(uploader->file_name().isEmpty());
+}
+
+TEST_F(LocalStorageFixture, ReadsDownloadsConcurrently)
+{
+    QTemporaryDir root;
+    StorageFrameworkClient client;
+    client.set_storage(QUrl::fromLocalFile(root.path()).toString());
+
+    // bigger than a socket's buffer, so each one arrives in pieces
+    auto const dir_name = QStringLiteral("dir");
+    QVector<QByteArray> contents;
+    for (int i=0; i<4; ++i)
+    {
+        contents << random_bytes(2*1024*1024 + i);
+        ASSERT_TRUE(upload(client, dir_name, QString::number(i), contents.back()));
+    }
+
+    QVector<std::shared_ptr<Downloader>> downloaders;
+    QVector<std::shared_ptr<DownloadReader>> readers;
+    QVector<std::shared_ptr<QSignalSpy>> spies;
+    for (int i=0; i<contents.size(); ++i)
+    {
+        downloaders << wait_for(client.get_new_downloader(dir_name, QString::number(i)));
+        ASSERT_NE(nullptr, downloaders.back());
+        readers << std::make_shared<DownloadReader>(downloaders.back());
+        spies << std::make_shared<QSignalSpy>(readers.back().get(), &DownloadReader::finished);
+        readers.back()->start();
+    }
+
+    // they're all read from the one event loop
+    for (auto const& spy : spies)
+        if (!spy->count())
+            ASSERT_TRUE(spy->wait());
+    for (int i=0; i<contents.size(); ++i)
+    {
+        ASSERT_EQ(1, spies[i]->count());
+        EXPECT_TRUE(spies[i]->at(0).at(0).toBool());
+        EXPECT_EQ(contents[i], readers[i]->bytes());
+        downloaders[i]->finish();
+    }
+}
+
+TEST_F(LocalStorageFixture, ShortDownloadsFail)
+{
+    QTemporaryDir root;
+    StorageFrameworkClient client;
+    client.set_storage(QUrl::fromLocalFile(root.path()).toString());
+
+    auto const dir_name = QStringLiteral("dir");
+    auto const file_name = QStringLiteral("file");
+    ASSERT_TRUE(upload(client, dir_name, file_name, random_bytes(5*1024*1024)));
+
+    auto downloader = wait_for(client.get_new_downloader(dir_name, file_name));
+    ASSERT_NE(nullptr, downloader);
+
+    // it shrinks after the downloader has promised its full size
+    QDir const dir(QDir(root.path()).filePath(StorageFrameworkClient::KEEPER_FOLDER + QStringLiteral("/") + dir_name));
+    ASSERT_TRUE(QFile::resize(dir.filePath(file_name), 1000));
+
+    DownloadReader reader(downloader);
+    QSignalSpy spy(&reader, &DownloadReader::finished);
+    reader.start();
+    ASSERT_TRUE(spy.wait());
+    EXPECT_FALSE(spy.at(0).at(0).toBool());
+    EXPECT_LT(reader.bytes().size(), downloader->file_size());
+    downloader->finish();
+}
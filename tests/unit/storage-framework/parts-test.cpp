@@ -0,0 +1,280 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+
+#include <storage-framework/storage_framework_client.h>
+#include <storage-framework/parted-uploader.h>
+
+#include "tests/utils/storage-framework-local.h"
+
+#include <QSignalSpy>
+#include <QTemporaryDir>
+
+#include <gtest/gtest.h>
+#include <glib.h>
+
+#include <algorithm>
+
+TEST(SF, UploadAndDownloadInParts)
+{
+    QByteArray test_content;
+    for (int i=0; i<10000; ++i)
+        test_content.append(char('a' + i % 26));
+
+    constexpr qint64 part_size {3000};
+    constexpr int n_parts {4};
+
+    QTemporaryDir tmp_dir;
+    QString test_dir = QStringLiteral("test_dir");
+    QString test_file_name = QStringLiteral("test_file");
+
+    g_setenv("XDG_DATA_HOME", tmp_dir.path().toLatin1().data(), true);
+
+    StorageFrameworkClient sf_client;
+    sf_client.set_multipart_upload(part_size, 2);
+    auto uploader_fut = sf_client.get_new_archive_uploader(test_content.size(), test_dir, test_file_name);
+    {
+        QFutureWatcher<std::shared_ptr<Uploader>> w;
+        QSignalSpy spy(&w, &decltype(w)::finished);
+        w.setFuture(uploader_fut);
+        if (!spy.count())
+            ASSERT_TRUE(spy.wait());
+    }
+    auto uploader = uploader_fut.result();
+    ASSERT_NE(uploader, nullptr);
+
+    auto socket = uploader->socket();
+    ASSERT_NE(socket, nullptr);
+    socket->write(test_content);
+
+    QSignalSpy spy_commit(uploader.get(), &Uploader::commit_finished);
+    uploader->commit();
+    if (!spy_commit.count())
+        ASSERT_TRUE(spy_commit.wait(15000));
+    ASSERT_EQ(1, spy_commit.count());
+    EXPECT_TRUE(spy_commit.at(0).at(0).toBool());
+
+    // the archive should have been stored as numbered parts
+    EXPECT_EQ(test_file_name, uploader->file_name());
+    EXPECT_EQ(part_size, uploader->part_size());
+    auto const part_names = uploader->part_names();
+    ASSERT_EQ(n_parts, part_names.size());
+    EXPECT_EQ(n_parts, StorageFrameworkLocalUtils::check_storage_framework_nb_files());
+
+    QByteArray joined;
+    for (int i=0; i<n_parts; ++i)
+    {
+        EXPECT_EQ(PartedUploader::part_name(test_file_name, i), part_names[i]);
+        auto const files = StorageFrameworkLocalUtils::get_storage_framework_files();
+        auto const it = std::find_if(files.begin(), files.end(), [&part_names, i](QFileInfo const& fi){return fi.fileName() == part_names[i];});
+        ASSERT_NE(files.end(), it);
+        QFile file(it->absoluteFilePath());
+        ASSERT_TRUE(file.open(QIODevice::ReadOnly)) << qPrintable(file.errorString());
+        auto const bytes = file.readAll();
+        EXPECT_EQ(i < n_parts-1 ? part_size : test_content.size() % part_size, bytes.size());
+        joined += bytes;
+    }
+    EXPECT_EQ(test_content, joined);
+
+    // reading the parts back should give the original archive
+    auto downloader_fut = sf_client.get_new_parted_downloader(test_dir, part_names, part_size, test_content.size());
+    {
+        QFutureWatcher<std::shared_ptr<Downloader>> w;
+        QSignalSpy spy(&w, &decltype(w)::finished);
+        w.setFuture(downloader_fut);
+        if (!spy.count())
+            ASSERT_TRUE(spy.wait());
+    }
+    auto downloader = downloader_fut.result();
+    ASSERT_NE(downloader, nullptr);
+    EXPECT_EQ(test_content.size(), downloader->file_size());
+
+    auto socket_downloader = downloader->socket();
+    ASSERT_NE(socket_downloader, nullptr);
+    QByteArray downloaded;
+    while (downloaded.size() < test_content.size())
+    {
+        if (!socket_downloader->bytesAvailable() && !socket_downloader->waitForReadyRead(5000))
+            break;
+        downloaded += socket_downloader->readAll();
+    }
+    EXPECT_EQ(test_content, downloaded);
+
+    QSignalSpy spy_downloader(downloader.get(), &Downloader::download_finished);
+    downloader->finish();
+    if (!spy_downloader.count())
+        spy_downloader.wait();
+    EXPECT_EQ(1, spy_downloader.count());
+
+    g_unsetenv("XDG_DATA_HOME");
+}
+
+TEST(SF, SmallArchivesAreNotParted)
+{
+    QTemporaryDir tmp_dir;
+    g_setenv("XDG_DATA_HOME", tmp_dir.path().toLatin1().data(), true);
+
+    QByteArray const test_content {"hello world"};
+
+    StorageFrameworkClient sf_client;
+    sf_client.set_multipart_upload(1000, 2);
+    auto uploader_fut = sf_client.get_new_archive_uploader(test_content.size(), QStringLiteral("test_dir"), QStringLiteral("test_file"));
+    {
+        QFutureWatcher<std::shared_ptr<Uploader>> w;
+        QSignalSpy spy(&w, &decltype(w)::finished);
+        w.setFuture(uploader_fut);
+        if (!spy.count())
+            ASSERT_TRUE(spy.wait());
+    }
+    auto uploader = uploader_fut.result();
+    ASSERT_NE(uploader, nullptr);
+    uploader->socket()->write(test_content);
+
+    QSignalSpy spy_commit(uploader.get(), &Uploader::commit_finished);
+    uploader->commit();
+    if (!spy_commit.count())
+        ASSERT_TRUE(spy_commit.wait());
+    EXPECT_TRUE(uploader->part_names().isEmpty());
+    EXPECT_EQ(1, StorageFrameworkLocalUtils::check_storage_framework_nb_files());
+
+    g_unsetenv("XDG_DATA_HOME");
+}
+
+TEST(SF, TruncatedStreamFails)
+{
+    QTemporaryDir tmp_dir;
+    g_setenv("XDG_DATA_HOME", tmp_dir.path().toLatin1().data(), true);
+
+    QByteArray test_content;
+    for (int i=0; i<10000; ++i)
+        test_content.append(char('a' + i % 26));
+
+    StorageFrameworkClient sf_client;
+    sf_client.set_multipart_upload(3000, 2);
+
+    auto uploader_fut = sf_client.get_new_archive_uploader(test_content.size(), QStringLiteral("test_dir"), QStringLiteral("test_file"));
+    {
+        QFutureWatcher<std::shared_ptr<Uploader>> w;
+        QSignalSpy spy(&w, &decltype(w)::finished);
+        w.setFuture(uploader_fut);
+        if (!spy.count())
+            ASSERT_TRUE(spy.wait());
+    }
+    auto uploader = uploader_fut.result();
+    ASSERT_NE(nullptr, std::dynamic_pointer_cast<PartedUploader>(uploader));
+
+    // hang up partway through the second part
+    QSignalSpy spy_commit(uploader.get(), &Uploader::commit_finished);
+    uploader->socket()->write(test_content.left(4500));
+    uploader->commit();
+    uploader->socket()->disconnectFromServer();
+    if (!spy_commit.count())
+        ASSERT_TRUE(spy_commit.wait(15000));
+    ASSERT_EQ(1, spy_commit.count());
+    EXPECT_FALSE(spy_commit.takeFirst().at(0).toBool());
+    EXPECT_TRUE(uploader->file_name().isEmpty());
+    EXPECT_TRUE(uploader->part_names().isEmpty());
+
+    g_unsetenv("XDG_DATA_HOME");
+}
+
+namespace
+{
+    std::shared_ptr<Uploader> upload(StorageFrameworkClient& sf_client, QByteArray const& content, PartedUploader::Resume const& resume, QList<QVariantList>* committed, int* n_invalid = nullptr)
+    {
+        auto uploader_fut = sf_client.get_new_archive_uploader(content.size(), QStringLiteral("test_dir"), QStringLiteral("test_file"), resume);
+        {
+            QFutureWatcher<std::shared_ptr<Uploader>> w;
+            QSignalSpy spy(&w, &decltype(w)::finished);
+            w.setFuture(uploader_fut);
+            if (!spy.count())
+                spy.wait();
+        }
+        auto uploader = uploader_fut.result();
+        auto parted = std::dynamic_pointer_cast<PartedUploader>(uploader);
+        if (!parted)
+            return uploader;
+
+        QSignalSpy spy_part(parted.get(), &PartedUploader::part_committed);
+        QSignalSpy spy_invalid(parted.get(), &PartedUploader::resume_invalid);
+        QSignalSpy spy_commit(uploader.get(), &Uploader::commit_finished);
+        uploader->socket()->write(content);
+        uploader->commit();
+        if (!spy_commit.count())
+            spy_commit.wait(15000);
+        for (auto const& args : spy_part)
+            committed->append(args);
+        if (n_invalid)
+            *n_invalid = spy_invalid.count();
+        return uploader;
+    }
+}
+
+TEST(SF, ResumeSkipsCommittedParts)
+{
+    QTemporaryDir tmp_dir;
+    g_setenv("XDG_DATA_HOME", tmp_dir.path().toLatin1().data(), true);
+
+    QByteArray test_content;
+    for (int i=0; i<10000; ++i)
+        test_content.append(char('a' + i % 26));
+
+    constexpr qint64 part_size {3000};
+    constexpr int n_parts {4};
+    StorageFrameworkClient sf_client;
+    sf_client.set_multipart_upload(part_size, 2);
+
+    // upload it once to learn the parts' digests
+    QList<QVariantList> committed;
+    auto uploader = upload(sf_client, test_content, PartedUploader::Resume(), &committed);
+    ASSERT_NE(nullptr, std::dynamic_pointer_cast<PartedUploader>(uploader));
+    ASSERT_EQ(n_parts, committed.size());
+    std::sort(committed.begin(), committed.end(), [](QVariantList const& a, QVariantList const& b){return a[0].toInt() < b[0].toInt();});
+    EXPECT_EQ(n_parts, StorageFrameworkLocalUtils::check_storage_framework_nb_files());
+
+    // pretend the first upload only got through two parts
+    PartedUploader::Resume resume;
+    resume.part_size = part_size;
+    for (int i=0; i<2; ++i)
+    {
+        resume.parts << committed[i][1].toString();
+        resume.digests << committed[i][2].toByteArray();
+    }
+
+    // resuming it should only upload the other two
+    QList<QVariantList> resumed;
+    int n_invalid {};
+    uploader = upload(sf_client, test_content, resume, &resumed, &n_invalid);
+    EXPECT_EQ(2, resumed.size());
+    EXPECT_EQ(0, n_invalid);
+    ASSERT_EQ(n_parts, uploader->part_names().size());
+    EXPECT_EQ(resume.parts, uploader->part_names().mid(0, 2));
+    EXPECT_EQ(n_parts + 2, StorageFrameworkLocalUtils::check_storage_framework_nb_files());
+
+    // but not if the data has changed since then
+    auto changed = test_content;
+    changed[10] = '!';
+    resumed.clear();
+    uploader = upload(sf_client, changed, resume, &resumed, &n_invalid);
+    EXPECT_TRUE(uploader->file_name().isEmpty());
+    EXPECT_TRUE(uploader->part_names().isEmpty());
+    EXPECT_EQ(1, n_invalid);
+
+    g_unsetenv("XDG_DATA_HOME");
+}
@@ -0,0 +1,323 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "tar/delta.h"
+#include "tar/digest.h"
+#include "tar/tar-creator.h"
+#include "tar/untar.h"
+
+#include <gtest/gtest.h>
+
+#include <QDir>
+#include <QFile>
+#include <QString>
+#include <QTemporaryDir>
+
+#include <algorithm>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+class DeltaFixture: public ::testing::Test
+{
+protected:
+
+    std::string random_string(size_t len)
+    {
+        std::string str(len, '\0');
+        for (auto& ch : str)
+            ch = char(engine_());
+        return str;
+    }
+
+    std::string modify(std::string str)
+    {
+        // overwrite a few bytes, insert some, and remove some
+        for (size_t i=str.size()/4, n=std::min(str.size(), i+100); i<n; ++i)
+            str[i] = char(engine_());
+        str.insert(str.size()/2, random_string(333));
+        str.erase(str.size()*3/4, 777);
+        return str;
+    }
+
+    std::string round_trip(std::string const& basis, std::string const& target, uint32_t block_size, int64_t& n_literal)
+    {
+        std::istringstream basis_in(basis);
+        auto const sig = Delta::make_signature(basis_in, block_size);
+
+        std::istringstream target_in(target);
+        std::stringstream patch;
+        n_literal = Delta::encode(sig, target_in, patch);
+
+        basis_in.clear();
+        std::ostringstream out;
+        std::string error;
+        EXPECT_TRUE(Delta::apply(basis_in, patch, out, error)) << error;
+        return out.str();
+    }
+
+    std::string read_file(QString const& path)
+    {
+        QFile file(path);
+        EXPECT_TRUE(file.open(QIODevice::ReadOnly));
+        return file.readAll().toStdString();
+    }
+
+    void write_file(QString const& path, std::string const& contents)
+    {
+        QFile file(path);
+        EXPECT_TRUE(file.open(QIODevice::WriteOnly|QIODevice::Truncate));
+        EXPECT_EQ(qint64(contents.size()), file.write(contents.data(), qint64(contents.size())));
+    }
+
+    std::vector<char> create_tar(QStringList const& files, QString const& signatures_dir, ssize_t& calculated_size)
+    {
+        TarCreator tar_creator(files, false);
+        tar_creator.enable_delta(signatures_dir, 1024);
+        calculated_size = tar_creator.calculate_size();
+
+        std::vector<char> contents;
+        std::vector<char> step;
+        while (tar_creator.step(step))
+            contents.insert(contents.end(), step.begin(), step.end());
+        return contents;
+    }
+
+    std::mt19937 engine_ {std::random_device{}()};
+};
+
+/***
+****
+***/
+
+TEST_F(DeltaFixture, Digest)
+{
+    EXPECT_EQ(0xef46db3751d8e999ULL, Digest::of("", 0));
+    EXPECT_EQ(0x44bc2cf5ad770999ULL, Digest::of("abc", 3));
+
+    // feeding it piecemeal should give the same result
+    auto const str = random_string(10000);
+    Digest digest;
+    for (size_t i=0; i<str.size(); i+=7)
+        digest.update(str.data()+i, std::min(size_t(7), str.size()-i));
+    EXPECT_EQ(Digest::of(str.data(), str.size()), digest.value());
+    EXPECT_EQ("44bc2cf5ad770999", Digest::to_hex(Digest::of("abc", 3)));
+}
+
+TEST_F(DeltaFixture, SignatureSerialization)
+{
+    auto const str = random_string(100000);
+    std::istringstream in(str);
+    auto const sig = Delta::make_signature(in, 4096);
+    EXPECT_EQ(25, int(sig.blocks.size()));
+
+    std::stringstream buf;
+    EXPECT_TRUE(sig.serialize(buf));
+    Delta::Signature parsed;
+    EXPECT_TRUE(parsed.parse(buf));
+    EXPECT_EQ(sig.block_size, parsed.block_size);
+    EXPECT_EQ(sig.file_size, parsed.file_size);
+    ASSERT_EQ(sig.blocks.size(), parsed.blocks.size());
+    for (size_t i=0; i<sig.blocks.size(); ++i)
+    {
+        EXPECT_EQ(sig.blocks[i].weak, parsed.blocks[i].weak);
+        EXPECT_EQ(sig.blocks[i].strong, parsed.blocks[i].strong);
+    }
+
+    std::istringstream garbage("not a signature");
+    EXPECT_FALSE(parsed.parse(garbage));
+}
+
+TEST_F(DeltaFixture, RoundTrip)
+{
+    for (auto const size : { 0, 1, 1000, 4096, 100000, 1000000 })
+    {
+        auto const basis = random_string(size_t(size));
+        auto const target = modify(basis);
+        auto const block_size = Delta::choose_block_size(basis.size());
+
+        int64_t n_literal {};
+        EXPECT_EQ(target, round_trip(basis, target, block_size, n_literal));
+        EXPECT_LE(0, n_literal);
+
+        // unchanged files shouldn't need any literal data
+        EXPECT_EQ(basis, round_trip(basis, basis, block_size, n_literal));
+        EXPECT_EQ(0, n_literal);
+    }
+
+    // small edits to a big file should give a small patch
+    auto const basis = random_string(4*1024*1024);
+    auto const target = modify(basis);
+    int64_t n_literal {};
+    EXPECT_EQ(target, round_trip(basis, target, Delta::choose_block_size(basis.size()), n_literal));
+    EXPECT_GT(int64_t(basis.size()/50), n_literal);
+}
+
+TEST_F(DeltaFixture, WrongBasisFails)
+{
+    auto const basis = random_string(100000);
+    auto const target = modify(basis);
+
+    std::istringstream basis_in(basis);
+    auto const sig = Delta::make_signature(basis_in, 2048);
+    std::istringstream target_in(target);
+    std::stringstream patch;
+    EXPECT_LE(0, Delta::encode(sig, target_in, patch));
+
+    // same size, different contents
+    auto const wrong = random_string(basis.size());
+    std::istringstream wrong_in(wrong);
+    std::ostringstream out;
+    std::string error;
+    EXPECT_FALSE(Delta::apply(wrong_in, patch, out, error));
+    EXPECT_FALSE(error.empty());
+}
+
+TEST_F(DeltaFixture, TarAndUntar)
+{
+    QTemporaryDir in;
+    QTemporaryDir signatures;
+    QTemporaryDir out;
+    ASSERT_TRUE(QDir::setCurrent(in.path()));
+
+    auto const filename = QStringLiteral("mailbox");
+    auto const small_filename = QStringLiteral("small");
+    auto const files = QStringList{ filename, small_filename };
+    auto const v1 = random_string(512*1024);
+    auto const v2 = modify(v1);
+    write_file(small_filename, random_string(100));
+
+    // first backup: no signatures yet, so it's archived in full
+    write_file(filename, v1);
+    ssize_t calculated_size {};
+    auto const full = create_tar(files, signatures.path(), calculated_size);
+    EXPECT_EQ(calculated_size, ssize_t(full.size()));
+    EXPECT_GT(full.size(), v1.size());
+
+    // its signature is only used once the backup has been stored
+    EXPECT_EQ(0, int(QDir(signatures.path()).entryList(QDir::Files).size()));
+    EXPECT_TRUE(TarCreator::commit_signatures(signatures.path(), in.path()));
+    EXPECT_EQ(1, int(QDir(signatures.path()).entryList(QDir::Files).size()));
+
+    // second backup: only the changes should be archived
+    write_file(filename, v2);
+    auto const delta = create_tar(files, signatures.path(), calculated_size);
+    EXPECT_EQ(calculated_size, ssize_t(delta.size()));
+    EXPECT_LT(delta.size(), v2.size()/10);
+
+    // restore the first version, then apply the delta on top of it
+    QDir outdir(out.path());
+    write_file(outdir.filePath(filename), v1);
+    Untar untar(out.path().toStdString());
+    EXPECT_TRUE(untar.step(delta.data(), delta.size()));
+    EXPECT_TRUE(untar.finish());
+    EXPECT_EQ(v2, read_file(outdir.filePath(filename)));
+    EXPECT_FALSE(outdir.exists(filename + QString::fromUtf8(Delta::SUFFIX)));
+}
+
+TEST_F(DeltaFixture, UnstoredBackupsAreNotABasis)
+{
+    QTemporaryDir in;
+    QTemporaryDir signatures;
+    QTemporaryDir out;
+    ASSERT_TRUE(QDir::setCurrent(in.path()));
+
+    auto const filename = QStringLiteral("mailbox");
+    auto const files = QStringList{ filename };
+    auto const v1 = random_string(512*1024);
+    auto const v2 = modify(v1);
+    auto const v3 = modify(v2);
+    ssize_t calculated_size {};
+
+    // a stored full backup
+    write_file(filename, v1);
+    auto const full = create_tar(files, signatures.path(), calculated_size);
+    EXPECT_TRUE(TarCreator::commit_signatures(signatures.path(), in.path()));
+
+    // a backup whose upload failed, so it's never committed
+    write_file(filename, v2);
+    create_tar(files, signatures.path(), calculated_size);
+
+    // the next delta should still be against the stored backup
+    write_file(filename, v3);
+    auto const delta = create_tar(files, signatures.path(), calculated_size);
+    EXPECT_LT(delta.size(), v3.size()/10);
+    EXPECT_TRUE(TarCreator::commit_signatures(signatures.path(), in.path()));
+
+    Untar untar(out.path().toStdString());
+    EXPECT_TRUE(untar.step(full.data(), full.size()));
+    EXPECT_TRUE(untar.step(delta.data(), delta.size()));
+    EXPECT_TRUE(untar.finish());
+    EXPECT_EQ(v3, read_file(QDir(out.path()).filePath(filename)));
+
+    // a discarded set can't be committed afterwards
+    write_file(filename, v1);
+    create_tar(files, signatures.path(), calculated_size);
+    TarCreator::discard_signatures(signatures.path(), in.path());
+    EXPECT_TRUE(TarCreator::commit_signatures(signatures.path(), in.path()));
+
+    // so this delta still applies on top of v3
+    write_file(filename, v2);
+    auto const delta2 = create_tar(files, signatures.path(), calculated_size);
+    Untar untar2(out.path().toStdString());
+    EXPECT_TRUE(untar2.step(delta2.data(), delta2.size()));
+    EXPECT_TRUE(untar2.finish());
+    EXPECT_EQ(v2, read_file(QDir(out.path()).filePath(filename)));
+}
+
+TEST_F(DeltaFixture, ManyFilesAndUnusualNames)
+{
+    QTemporaryDir in;
+    QTemporaryDir signatures;
+    QTemporaryDir out;
+    ASSERT_TRUE(QDir::setCurrent(in.path()));
+
+    // enough members that tar's listing wouldn't fit in a pipe,
+    // and a name that tar would escape if it listed it
+    QStringList files;
+    for (int i=0; i<3000; ++i)
+    {
+        auto const name = QStringLiteral("file-with-a-fairly-long-name-%1").arg(i);
+        write_file(name, random_string(16));
+        files << name;
+    }
+    auto const filename = QString::fromUtf8("mail\tb\xc3\xb6x");
+    files << filename;
+    auto const v1 = random_string(512*1024);
+    auto const v2 = modify(v1);
+
+    write_file(filename, v1);
+    ssize_t calculated_size {};
+    auto const full = create_tar(files, signatures.path(), calculated_size);
+    EXPECT_TRUE(TarCreator::commit_signatures(signatures.path(), in.path()));
+
+    write_file(filename, v2);
+    auto const delta = create_tar(files, signatures.path(), calculated_size);
+
+    Untar untar(out.path().toStdString());
+    EXPECT_TRUE(untar.step(full.data(), full.size()));
+    EXPECT_TRUE(untar.step(delta.data(), delta.size()));
+    EXPECT_TRUE(untar.finish());
+
+    QDir const outdir(out.path());
+    EXPECT_EQ(v2, read_file(outdir.filePath(filename)));
+    EXPECT_FALSE(outdir.exists(filename + QString::fromUtf8(Delta::SUFFIX)));
+    EXPECT_EQ(files.size(), int(outdir.entryList(QDir::Files).size()));
+}
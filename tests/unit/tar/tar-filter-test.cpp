@@ -0,0 +1,164 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "tar/tar-creator.h"
+#include "tar/tar-filter.h"
+#include "tar/tar-index.h"
+#include "tar/untar.h"
+
+#include <gtest/gtest.h>
+
+#include <QDir>
+#include <QFile>
+#include <QString>
+#include <QTemporaryDir>
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+class TarFilterFixture: public ::testing::Test
+{
+protected:
+
+    std::string random_string(size_t len)
+    {
+        std::string str(len, '\0');
+        for (auto& ch : str)
+            ch = char(engine_());
+        return str;
+    }
+
+    void write_file(QString const& path, std::string const& contents)
+    {
+        QFile file(path);
+        EXPECT_TRUE(file.open(QIODevice::WriteOnly|QIODevice::Truncate));
+        EXPECT_EQ(qint64(contents.size()), file.write(contents.data(), qint64(contents.size())));
+    }
+
+    std::string read_file(QString const& path)
+    {
+        QFile file(path);
+        EXPECT_TRUE(file.open(QIODevice::ReadOnly));
+        return file.readAll().toStdString();
+    }
+
+    std::string create_tar(QString const& base_dir, QStringList const& files, QString const& signatures_dir = QString())
+    {
+        TarCreator tar_creator(files, false);
+        tar_creator.set_base_dir(base_dir);
+        if (!signatures_dir.isEmpty())
+            tar_creator.enable_delta(signatures_dir, 1024);
+
+        std::string contents;
+        std::vector<char> step;
+        while (tar_creator.step(step))
+            contents.append(step.data(), step.size());
+
+        // as if it had been stored
+        if (!signatures_dir.isEmpty())
+            TarCreator::commit_signatures(signatures_dir, base_dir);
+        return contents;
+    }
+
+    // feed the filter in random-sized pieces, like a socket would
+    std::string filter(std::string const& tar, TarFilter::Predicate const& keep)
+    {
+        TarFilter filter(keep);
+        std::string out;
+        std::uniform_int_distribution<size_t> dist(1, 4096);
+        for (size_t pos=0; pos<tar.size(); )
+        {
+            auto const n = std::min(dist(engine_), tar.size()-pos);
+            filter.feed(tar.data()+pos, n, out);
+            pos += n;
+        }
+        return out;
+    }
+
+    std::mt19937 engine_ {std::random_device{}()};
+};
+
+TEST_F(TarFilterFixture, DropsMembers)
+{
+    QTemporaryDir in;
+    QDir dir(in.path());
+    QStringList const files { "./a", "./b", "./c", "./" + QString(150, 'd') };
+    for (auto const& file : files)
+        write_file(dir.filePath(file), random_string(size_t(std::uniform_int_distribution<int>(0, 50000)(engine_))));
+    auto const tar = create_tar(in.path(), files);
+
+    auto const keep = [](TarIndexer::Entry const& entry){ return entry.path != "./b"; };
+    auto const filtered = filter(tar, keep);
+
+    // the size should match what the catalog predicts
+    TarIndexer indexer;
+    indexer.feed(tar.data(), tar.size());
+    std::vector<TarIndexer::Entry> kept;
+    for (auto const& entry : indexer.entries())
+        if (keep(entry))
+            kept.push_back(entry);
+    EXPECT_EQ(TarFilter::filtered_size(kept), uint64_t(filtered.size()));
+
+    // the result should be a valid tar with everything but "b"
+    QTemporaryDir out;
+    Untar untar(out.path().toStdString());
+    EXPECT_TRUE(untar.step(filtered.data(), filtered.size()));
+    EXPECT_TRUE(untar.finish());
+    QDir outdir(out.path());
+    for (auto const& file : files)
+    {
+        if (file == "./b")
+            EXPECT_FALSE(outdir.exists(file));
+        else
+            EXPECT_EQ(read_file(dir.filePath(file)), read_file(outdir.filePath(file)));
+    }
+}
+
+TEST_F(TarFilterFixture, UntarsConcatenatedArchives)
+{
+    QTemporaryDir in;
+    QTemporaryDir signatures;
+    QDir dir(in.path());
+    auto const filename = QStringLiteral("./mailbox");
+    auto const v1 = random_string(256*1024);
+
+    // a full backup followed by two incrementals
+    std::string stream;
+    write_file(dir.filePath(filename), v1);
+    stream += create_tar(in.path(), QStringList{filename}, signatures.path());
+    write_file(dir.filePath(filename), v1 + "hello");
+    stream += create_tar(in.path(), QStringList{filename}, signatures.path());
+    write_file(dir.filePath(filename), v1 + "hello world");
+    stream += filter(create_tar(in.path(), QStringList{filename}, signatures.path()), [](TarIndexer::Entry const&){return true;});
+
+    // untarring them as one stream should apply each delta in turn
+    QTemporaryDir out;
+    Untar untar(out.path().toStdString());
+    EXPECT_TRUE(untar.step(stream.data(), stream.size()));
+    EXPECT_TRUE(untar.finish());
+    EXPECT_EQ(v1 + "hello world", read_file(QDir(out.path()).filePath(filename)));
+}
+
+TEST_F(TarFilterFixture, PassesThroughNonTar)
+{
+    auto const garbage = random_string(100000);
+    EXPECT_EQ(garbage, filter(garbage, [](TarIndexer::Entry const&){return false;}));
+}
@@ -0,0 +1,235 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "tar/delta.h"
+#include "tar/digest.h"
+#include "tar/tar-creator.h"
+#include "tar/tar-index.h"
+
+#include <gtest/gtest.h>
+
+#include <QDir>
+#include <QFile>
+#include <QString>
+#include <QTemporaryDir>
+
+#include <algorithm>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+class TarIndexFixture: public ::testing::Test
+{
+protected:
+
+    std::string write_file(QString const& path, size_t len)
+    {
+        std::string contents(len, '\0');
+        for (auto& ch : contents)
+            ch = char(engine_());
+
+        QFile file(path);
+        EXPECT_TRUE(file.open(QIODevice::WriteOnly|QIODevice::Truncate));
+        EXPECT_EQ(qint64(len), file.write(contents.data(), qint64(len)));
+        return contents;
+    }
+
+    std::vector<char> create_tar(TarCreator& tar_creator)
+    {
+        std::vector<char> contents;
+        std::vector<char> step;
+        while (tar_creator.step(step))
+            contents.insert(contents.end(), step.begin(), step.end());
+        return contents;
+    }
+
+    // feed the indexer in random-sized pieces, like a socket would
+    void feed(TarIndexer& indexer, std::vector<char> const& tar)
+    {
+        std::uniform_int_distribution<size_t> dist(1, 4096);
+        for (size_t pos=0; pos<tar.size(); )
+        {
+            auto const n = std::min(dist(engine_), tar.size()-pos);
+            indexer.feed(tar.data()+pos, n);
+            pos += n;
+        }
+    }
+
+    std::mt19937 engine_ {std::random_device{}()};
+};
+
+TEST_F(TarIndexFixture, IndexesEntries)
+{
+    QTemporaryDir in;
+    QDir dir(in.path());
+
+    // include a name too long for a plain ustar header
+    auto const long_name = QString(150, 'x');
+    std::map<std::string,size_t> sizes {
+        { "./empty", 0 },
+        { "./one-block", TarIndexer::BLOCK_SIZE },
+        { "./odd", 1234 },
+        { "./" + long_name.toStdString(), 100000 }
+    };
+    QStringList files;
+    std::map<std::string,uint64_t> digests;
+    for (auto const& it : sizes)
+    {
+        auto const filename = QString::fromStdString(it.first);
+        auto const contents = write_file(dir.filePath(filename), it.second);
+        digests[it.first] = Digest::of(contents.data(), contents.size());
+        files << filename;
+    }
+
+    TarCreator tar_creator(files, false);
+    tar_creator.set_base_dir(in.path());
+    auto const tar = create_tar(tar_creator);
+
+    TarIndexer indexer;
+    feed(indexer, tar);
+    EXPECT_TRUE(indexer.is_tar());
+    EXPECT_TRUE(indexer.finished());
+    EXPECT_EQ(uint64_t(tar.size()), indexer.n_bytes());
+
+    auto const& entries = indexer.entries();
+    ASSERT_EQ(sizes.size(), entries.size());
+    uint64_t prev_end {};
+    for (auto const& entry : entries)
+    {
+        ASSERT_EQ(1, int(sizes.count(entry.path))) << entry.path;
+        EXPECT_EQ(sizes[entry.path], entry.size);
+        EXPECT_EQ('0', entry.type);
+
+        // the offsets should point at the file's contents
+        EXPECT_LE(prev_end, entry.start_offset);
+        EXPECT_LT(entry.start_offset, entry.data_offset);
+        EXPECT_EQ(entry.data_offset + TarIndexer::padded(entry.size), entry.end_offset);
+        prev_end = entry.end_offset;
+
+        // the digest should match the file's contents
+        EXPECT_TRUE(entry.has_digest);
+        EXPECT_EQ(digests[entry.path], entry.digest) << entry.path;
+    }
+}
+
+TEST_F(TarIndexFixture, Catalog)
+{
+    QTemporaryDir in;
+    QDir dir(in.path());
+    QStringList const files { "./a", "./b", "./" + QString(150, 'c') };
+    for (auto const& file : files)
+        write_file(dir.filePath(file), 5000);
+
+    TarCreator tar_creator(files, false);
+    tar_creator.set_base_dir(in.path());
+    TarIndexer indexer;
+    feed(indexer, create_tar(tar_creator));
+    ASSERT_TRUE(indexer.finished());
+
+    std::stringstream catalog;
+    EXPECT_TRUE(TarIndexer::write_catalog(catalog, indexer.entries()));
+
+    std::vector<TarIndexer::Entry> entries;
+    EXPECT_TRUE(TarIndexer::read_catalog(catalog, entries));
+    ASSERT_EQ(indexer.entries().size(), entries.size());
+    for (size_t i=0; i<entries.size(); ++i)
+    {
+        auto const& a = indexer.entries()[i];
+        auto const& b = entries[i];
+        EXPECT_EQ(a.path, b.path);
+        EXPECT_EQ(a.type, b.type);
+        EXPECT_EQ(a.mode, b.mode);
+        EXPECT_EQ(a.mtime, b.mtime);
+        EXPECT_EQ(a.size, b.size);
+        EXPECT_EQ(a.start_offset, b.start_offset);
+        EXPECT_EQ(a.data_offset, b.data_offset);
+        EXPECT_EQ(a.end_offset, b.end_offset);
+        EXPECT_EQ(a.has_digest, b.has_digest);
+        EXPECT_EQ(a.digest, b.digest);
+    }
+
+    // a truncated catalog should be rejected
+    auto const str = catalog.str();
+    std::stringstream truncated(str.substr(0, str.size()-1));
+    EXPECT_FALSE(TarIndexer::read_catalog(truncated, entries));
+}
+
+TEST_F(TarIndexFixture, RecognizesDeltas)
+{
+    QTemporaryDir in;
+    QTemporaryDir signatures;
+    QDir dir(in.path());
+    auto const filename = QStringLiteral("./mailbox");
+    auto const path = dir.filePath(filename);
+
+    auto const has_delta = [](TarIndexer const& indexer){
+        auto const suffix = std::string(Delta::SUFFIX);
+        for (auto const& entry : indexer.entries())
+            if ((entry.path.size() > suffix.size()) && !entry.path.compare(entry.path.size()-suffix.size(), suffix.size(), suffix))
+                return true;
+        return false;
+    };
+
+    // first backup is a full one
+    write_file(path, 64*1024);
+    {
+        TarCreator tar_creator(QStringList{filename}, false);
+        tar_creator.set_base_dir(in.path());
+        tar_creator.enable_delta(signatures.path(), 1024);
+        TarIndexer indexer;
+        feed(indexer, create_tar(tar_creator));
+        EXPECT_FALSE(has_delta(indexer));
+    }
+    EXPECT_TRUE(TarCreator::commit_signatures(signatures.path(), in.path()));
+
+    // append to the file so that the next backup is incremental
+    {
+        QFile file(path);
+        ASSERT_TRUE(file.open(QIODevice::Append));
+        file.write("hello world");
+    }
+    {
+        TarCreator tar_creator(QStringList{filename}, false);
+        tar_creator.set_base_dir(in.path());
+        tar_creator.enable_delta(signatures.path(), 1024);
+        TarIndexer indexer;
+        feed(indexer, create_tar(tar_creator));
+        EXPECT_TRUE(has_delta(indexer));
+    }
+}
+
+TEST_F(TarIndexFixture, IgnoresCompressedStreams)
+{
+    QTemporaryDir in;
+    QDir dir(in.path());
+    auto const filename = QStringLiteral("./file");
+    write_file(dir.filePath(filename), 10000);
+
+    TarCreator tar_creator(QStringList{filename}, true);
+    tar_creator.set_base_dir(in.path());
+    auto const tar = create_tar(tar_creator);
+
+    TarIndexer indexer;
+    feed(indexer, tar);
+    EXPECT_FALSE(indexer.is_tar());
+    EXPECT_TRUE(indexer.entries().empty());
+    EXPECT_EQ(uint64_t(tar.size()), indexer.n_bytes());
+}
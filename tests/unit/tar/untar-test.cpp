@@ -20,15 +20,19 @@
 #include "tests/utils/file-utils.h"
 
 #include "tar/tar-creator.h"
+#include "tar/tar-index.h"
 #include "tar/untar.h"
+#include "tar/untar-thread.h"
 
 #include <gtest/gtest.h>
 
+#include <QDateTime>
 #include <QDebug>
 #include <QDir>
 #include <QFile>
 #include <QFileInfo>
 #include <QProcess>
+#include <QSignalSpy>
 #include <QString>
 #include <QTemporaryDir>
 
@@ -118,3 +122,106 @@ TEST_F(UntarFixture, Untar)
         in.setAutoRemove(passed);
     }
 }
+
+TEST_F(UntarFixture, SkipIdentical)
+{
+    auto const write_file = [](QString const& path, QByteArray const& contents) {
+        QFile file(path);
+        EXPECT_TRUE(file.open(QIODevice::WriteOnly|QIODevice::Truncate));
+        EXPECT_EQ(qint64(contents.size()), file.write(contents));
+    };
+    auto const read_file = [](QString const& path) {
+        QFile file(path);
+        EXPECT_TRUE(file.open(QIODevice::ReadOnly));
+        return file.readAll();
+    };
+    auto const set_mtime = [](QString const& path, QDateTime const& mtime) {
+        QFile file(path);
+        EXPECT_TRUE(file.open(QIODevice::ReadWrite));
+        EXPECT_TRUE(file.setFileTime(mtime, QFileDevice::FileModificationTime));
+    };
+    auto const untar = [](QString const& path, std::vector<char> const& tar, std::vector<TarIndexer::Entry> const* catalog) {
+        Untar untar(path.toStdString());
+        untar.set_skip_identical(true);
+        if (catalog)
+            untar.set_catalog(*catalog);
+        EXPECT_TRUE(untar.step(tar.data(), tar.size()));
+        EXPECT_TRUE(untar.finish());
+    };
+
+    // build an archive
+    QTemporaryDir in;
+    QDir indir(in.path());
+    QStringList const files { "./same", "./changed", "./corrupt", "./missing" };
+    for (auto const& file : files)
+        write_file(indir.filePath(file), file.toUtf8().repeated(1000));
+    TarCreator tar_creator(files, false);
+    tar_creator.set_base_dir(in.path());
+    std::vector<char> tar;
+    std::vector<char> step;
+    while (tar_creator.step(step))
+        tar.insert(tar.end(), step.begin(), step.end());
+    TarIndexer indexer;
+    indexer.feed(tar.data(), tar.size());
+
+    // restore it, then damage some of the restored files
+    QTemporaryDir out;
+    QDir outdir(out.path());
+    untar(out.path(), tar, nullptr);
+    EXPECT_TRUE(FileUtils::compareDirectories(in.path(), out.path()));
+    auto const mtime = QFileInfo(outdir.filePath("./corrupt")).lastModified();
+    write_file(outdir.filePath("./changed"), "hello");
+    write_file(outdir.filePath("./corrupt"), QByteArray("./corrupt").repeated(999) + "xxxxxxxxx");
+    set_mtime(outdir.filePath("./corrupt"), mtime);
+    EXPECT_TRUE(QFile::remove(outdir.filePath("./missing")));
+
+    // files whose size & mtime match are left alone...
+    untar(out.path(), tar, nullptr);
+    EXPECT_EQ(QByteArray("./changed").repeated(1000), read_file(outdir.filePath("./changed")));
+    EXPECT_EQ(QByteArray("./missing").repeated(1000), read_file(outdir.filePath("./missing")));
+    EXPECT_NE(QByteArray("./corrupt").repeated(1000), read_file(outdir.filePath("./corrupt")));
+
+    // ...unless their contents don't match the catalog
+    untar(out.path(), tar, &indexer.entries());
+    EXPECT_TRUE(FileUtils::compareDirectories(in.path(), out.path()));
+}
+
+TEST_F(UntarFixture, InAThread)
+{
+    // build an archive that's bigger than what UntarThread will queue
+    QTemporaryDir in;
+    QDir indir(in.path());
+    FileUtils::fillTemporaryDirectory(in.path(), 3, 3, 4*1024*1024, 1);
+    std::vector<char> contents;
+    {
+        EXPECT_TRUE(QDir::setCurrent(in.path()));
+        QStringList files;
+        for (auto file : FileUtils::getFilesRecursively(in.path()))
+            files += indir.relativeFilePath(file);
+        TarCreator tar_creator(files, false);
+        std::vector<char> step;
+        while (tar_creator.step(step))
+            contents.insert(contents.end(), step.begin(), step.end());
+    }
+
+    QTemporaryDir out;
+    UntarThread untar(out.path().toStdString());
+    QSignalSpy ready_spy(&untar, &UntarThread::ready_for_more);
+    QSignalSpy finished_spy(&untar, &UntarThread::finished);
+
+    // feed it the way Consolidator does, waiting whenever it says it's full
+    static constexpr size_t step_size {64*1024};
+    for (size_t pos=0; pos<contents.size(); pos+=step_size)
+    {
+        auto const n = std::min(step_size, contents.size()-pos);
+        if (!untar.step(QByteArray(&contents[pos], int(n))))
+            ASSERT_TRUE(ready_spy.wait());
+    }
+    untar.finish();
+    if (!finished_spy.count())
+        ASSERT_TRUE(finished_spy.wait(30*1000));
+    ASSERT_EQ(1, finished_spy.count());
+    EXPECT_TRUE(finished_spy.at(0).at(0).toBool());
+
+    EXPECT_TRUE(FileUtils::compareDirectories(in.path(), out.path()));
+}